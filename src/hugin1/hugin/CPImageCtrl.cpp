@@ -220,8 +220,9 @@ void DisplayedControlPoint::Draw(wxDC& dc, bool selected, bool newPoint)
         box.setUpperLeft(vigra::Point2D(hugin_utils::roundi(pointInput.x - l), hugin_utils::roundi(pointInput.y - l)));
         box.setSize(2*l, 2*l);
     };                
+    const HuginBase::ImageCache::ImageCacheRGB8Ptr img = m_control->GetImg();
     // only use part inside.
-    box &= vigra::Rect2D(m_control->GetImg()->size());
+    box &= vigra::Rect2D(img->size());
     if(box.width()<=0 || box.height()<=0)
     {
         return;
@@ -229,8 +230,8 @@ void DisplayedControlPoint::Draw(wxDC& dc, bool selected, bool newPoint)
     // calculate mean "luminance value"
     vigra::FindAverage<vigra::UInt8> average;   // init functor
     vigra::RGBToGrayAccessor<vigra::RGBValue<vigra::UInt8> > lumac;
-    vigra::inspectImage(m_control->GetImg()->upperLeft()+ box.upperLeft(),
-                        m_control->GetImg()->upperLeft()+ box.lowerRight(),
+    vigra::inspectImage(img->upperLeft()+ box.upperLeft(),
+                        img->upperLeft()+ box.lowerRight(),
                         lumac, average);
     if (average() < 150)
     {
@@ -839,7 +840,7 @@ wxBitmap CPImageCtrl::generateMagBitmap(hugin_utils::FDiff2D point, wxPoint canv
 
     // apply the transform
     AppBase::DummyProgressDisplay progDisp;
-    vigra_ext::transformImageIntern(vigra::srcImageRange(*(m_img->image8)),
+    vigra_ext::transformImageIntern(vigra::srcImageRange(*m_img8),
                          vigra::destImageRange(magImg),
                          vigra::destImage(maskImg),
                          transform,
@@ -916,10 +917,12 @@ void CPImageCtrl::setImage(const std::string & file, ImageRotation imgRot)
         m_img = ImageCache::getInstance().getImageIfAvailable(imageFilename);
         editState = NO_SELECTION;
         if (m_img.get()) {
+            m_img8 = m_img->get8BitImage();
             rescaleImage();
         } else {
+            m_img8.reset();
             // load the image in the background.
-            m_imgRequest = ImageCache::getInstance().requestAsyncImage(imageFilename);
+            m_imgRequest = ImageCache::getInstance().requestAsyncImage(imageFilename, ImageCache::PRIORITY_HIGH);
             m_imgRequest->ready.push_back(
                 std::bind(&CPImageCtrl::OnImageLoaded, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3)
                 );
@@ -931,6 +934,7 @@ void CPImageCtrl::setImage(const std::string & file, ImageRotation imgRot)
         // delete the image (release shared_ptr)
         // create an empty image.
         m_img = ImageCache::EntryPtr(new ImageCache::Entry);
+        m_img8.reset();
     }
 }
 
@@ -952,6 +956,7 @@ void CPImageCtrl::OnImageLoaded(ImageCache::EntryPtr entry, std::string filename
     if (imageFilename == filename)
     {
         m_img = entry;
+        m_img8 = m_img->get8BitImage();
         rescaleImage();
     }
 }
@@ -427,7 +427,7 @@ public:
     const bool GetMouseInWindow() const { return m_mouseInWindow; };
     const bool GetForceMagnifier() const { return m_forceMagnifier; };
     /** get pointer to image, for DisplayedControlPoint */
-    const HuginBase::ImageCache::ImageCacheRGB8Ptr GetImg() const { return m_img->image8; };
+    const HuginBase::ImageCache::ImageCacheRGB8Ptr GetImg() const { return m_img8; };
     /** draw the magnified view of a selected control point */
     wxBitmap generateMagBitmap(hugin_utils::FDiff2D point, wxPoint canvasPos) const;
     /** return the real size of the image in the control */
@@ -516,6 +516,9 @@ private:
     ImageRotation m_imgRotation;
 
     ImageCache::EntryPtr m_img;
+    /** 8 bit version of m_img, held for drawing the control points and the magnifier,
+     *  so that the cache does not release and convert it again on each redraw */
+    HuginBase::ImageCache::ImageCacheRGB8Ptr m_img8;
     ImageCache::RequestPtr m_imgRequest;
 
     bool m_mouseInWindow;
@@ -43,12 +43,12 @@ ChoosyRemapper::~ChoosyRemapper()
     if (selected_remapper) delete selected_remapper;
 }
 
-void ChoosyRemapper::UpdateAndResetIndex()
+void ChoosyRemapper::UpdateAndResetIndex(ViewPtr new_view)
 {
-    MeshRemapper::UpdateAndResetIndex();
+    MeshRemapper::UpdateAndResetIndex(new_view);
     // have a look at the output mode, find those where the poles cause problems
     // with the vetex remapper.
-    HuginBase::PanoramaOptions *opts = visualization_state->GetOptions();
+    const HuginBase::PanoramaOptions *opts = &view->options;
     switch (opts->getProjection())
     {
         // the 'stretchy poles' cases.
@@ -81,10 +81,9 @@ void ChoosyRemapper::UpdateAndResetIndex()
             // check for pole crossing
         {
             bool pole = false;
-            OutputProjectionInfo *info = visualization_state->GetProjectionInfo();
+            const OutputProjectionInfo *info = &view->projection_info;
             // get the pole in image coordinates
-            transform.createTransform(*image,
-                                      *(visualization_state->GetOptions()));
+            transform.createTransform(*image, view->options);
             double img_x, img_y;
             transform.transformImgCoord(img_x, img_y,
                                         info->GetNorthPoleX(),
@@ -156,7 +155,7 @@ void ChoosyRemapper::UpdateAndResetIndex()
             break;
     }
     // now we get the selected remapper to actually do the work.
-    selected_remapper->UpdateAndResetIndex();
+    selected_remapper->UpdateAndResetIndex(view);
 }
 
 bool ChoosyRemapper::GetNextFaceCoordinates(Coords *result)
@@ -34,7 +34,7 @@ public:
     ChoosyRemapper(HuginBase::Panorama *m_pano, HuginBase::SrcPanoImage * image,
                    VisualizationState *visualization_state);
     ~ChoosyRemapper();
-    void UpdateAndResetIndex();
+    void UpdateAndResetIndex(ViewPtr new_view);
     bool GetNextFaceCoordinates(Coords *result);
 private:
     enum RemapperSelection {REMAP_NONE, REMAP_VERTEX, REMAP_TEX};
@@ -61,6 +61,7 @@ BEGIN_EVENT_TABLE(GLViewer, wxGLCanvas)
     // keyboard events
     EVT_KEY_DOWN(GLViewer::KeyDown)
     EVT_KEY_UP(GLViewer::KeyUp)
+    EVT_TIMER(wxID_ANY, GLViewer::OnUploadTimer)
 END_EVENT_TABLE()
 
 
@@ -101,6 +102,7 @@ GLViewer::GLViewer(
     m_toolsInitialized = false;
 
     active = true;
+    m_uploadTimer.SetOwner(this);
 }
 
 GLViewer::~GLViewer()
@@ -405,9 +407,22 @@ void GLViewer::Redraw()
     SwapBuffers();
     // tell the view state we did all the updates and redrew.
     m_visualization_state->FinishedDraw();
+    // draw again soon, if not all textures are uploaded or not all meshes
+    // are calculated yet
+    if ((m_view_state->GetTextureManager()->HasPendingUploads()
+         || m_visualization_state->GetMeshManager()->HasPendingMeshes())
+        && !m_uploadTimer.IsRunning())
+    {
+        m_uploadTimer.Start(40, wxTIMER_ONE_SHOT);
+    }
     DEBUG_INFO("Finished Rendering.");
 }
 
+void GLViewer::OnUploadTimer(wxTimerEvent & e)
+{
+    Refresh();
+}
+
 void GLViewer::OnEraseBackground(wxEraseEvent& e)
 {
     // Do nothing, to avoid flashing on MSW
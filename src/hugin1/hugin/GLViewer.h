@@ -26,6 +26,7 @@
 #include "ViewState.h"
 #include "base_wx/platform.h"
 #include <wx/glcanvas.h>
+#include <wx/timer.h>
 #include <utility>
 #include <vigra/diff2d.hxx>
 
@@ -90,6 +91,7 @@ protected:
     void MouseWheel(wxMouseEvent& e);
     void KeyDown(wxKeyEvent & e);
     void KeyUp(wxKeyEvent & e);
+    void OnUploadTimer(wxTimerEvent & e);
 
     DECLARE_EVENT_TABLE()
 
@@ -110,6 +112,8 @@ protected:
     bool active;
 
     wxColour m_background_color;
+    /// redraws while textures are uploaded or meshes are calculated in the background
+    wxTimer m_uploadTimer;
 };
 
 class GLPreview : public GLViewer
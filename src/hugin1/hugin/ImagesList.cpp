@@ -150,7 +150,6 @@ void ImagesList::panoramaImagesChanged(HuginBase::Panorama &pano, const HuginBas
             if (*it >= nrItems) {
                 // create new item.
                 DEBUG_DEBUG("creating " << *it);
-                wxBitmap small0(m_iconHeight, m_iconHeight);
                 //createIcon(small0, *it, m_iconHeight);
                 //m_smallIcons->Add(small0);
 
@@ -159,13 +158,11 @@ void ImagesList::panoramaImagesChanged(HuginBase::Panorama &pano, const HuginBas
             } else {
                 // update existing item
                 DEBUG_DEBUG("updating item" << *it);
-                wxBitmap small0(m_iconHeight, m_iconHeight);
                 //createIcon(small0, *it, m_iconHeight);
                 //m_smallIcons->Replace(*it, small0);
 
                 UpdateItem(*it);
             }
-            ImageCache::getInstance().softFlush();
         }
 //    }
     
@@ -250,6 +250,20 @@ void ImagesTreeCtrl::panoramaImagesChanged(HuginBase::Panorama &pano, const Hugi
     size_t oldLensCount=m_variable_groups->getLenses().getNumberOfParts();
     size_t oldStackCount=m_variable_groups->getStacks().getNumberOfParts();
     m_variable_groups->update();
+    // count the control points of all images in a single pass
+    m_cpCounts.assign(pano.getNrOfImages(), 0);
+    const HuginBase::CPVector & cps = pano.getCtrlPoints();
+    for (HuginBase::CPVector::const_iterator it = cps.begin(); it != cps.end(); ++it)
+    {
+        if (it->image1Nr < m_cpCounts.size())
+        {
+            ++m_cpCounts[it->image1Nr];
+        };
+        if (it->image2Nr != it->image1Nr && it->image2Nr < m_cpCounts.size())
+        {
+            ++m_cpCounts[it->image2Nr];
+        };
+    };
     //if the number of lenses or stacks have changed we need to update all images
     //because the changed images set contains only the list of the changed imagges
     //but not these images where the stack or lens number has changed because
@@ -377,8 +391,14 @@ void ImagesTreeCtrl::UpdateImageText(wxTreeItemId item)
         flags[1]='C';
     }
     SetItemText(item, m_columnMap["anchor"], wxString(flags, wxConvLocal));
-    std::vector<unsigned int> cps = m_pano->getCtrlPointsForImage(imgNr);
-    s << cps.size();
+    if (imgNr < m_cpCounts.size())
+    {
+        s << m_cpCounts[imgNr];
+    }
+    else
+    {
+        s << m_pano->getCtrlPointsForImage(imgNr).size();
+    };
     SetItemText(item, m_columnMap["cps"], s);
     s.Clear();
     const unsigned int stackNumber = m_variable_groups->getStacks().getPartNumber(imgNr);
@@ -829,10 +849,12 @@ void ImagesTreeCtrl::UpdateGroupText(wxTreeItemId item)
 void ImagesTreeCtrl::UpdateGroup(wxTreeItemId parent, const HuginBase::UIntSet imgs, HuginBase::UIntSet& changed)
 {
     size_t nrItems=GetChildrenCount(parent,false);
-    bool forceUpdate=false;
+    // the rows of a group with a single image are shown differently (see
+    // UpdateImageText), only then all rows need an update. Otherwise only
+    // the rows of changed images or of other images than before are updated
+    const bool forceUpdate = (nrItems == 1) != (imgs.size() == 1);
     if(nrItems!=imgs.size())
     {
-        forceUpdate=true;
         if(nrItems<imgs.size())
         {
             for(size_t i=nrItems;i<imgs.size();i++)
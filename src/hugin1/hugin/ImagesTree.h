@@ -160,6 +160,9 @@ private:
     
     // image variable group information
     HuginBase::StandardImageVariableGroups * m_variable_groups;
+    /** number of control points of each image, counted once for each
+     *  update instead of searching all control points for each row */
+    std::vector<unsigned int> m_cpCounts;
 
     // number of digits for display
     int m_degDigits;
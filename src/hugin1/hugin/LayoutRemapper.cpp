@@ -49,8 +49,9 @@ LayoutRemapper::LayoutRemapper(HuginBase::Panorama *m_pano,
     face.tex_c[1][1][1] = 1.0;
 }
 
-void LayoutRemapper::UpdateAndResetIndex()
+void LayoutRemapper::UpdateAndResetIndex(ViewPtr new_view)
 {
+    MeshRemapper::UpdateAndResetIndex(new_view);
 //    HuginBase::SrcPanoImage *src_img = visualization_state->GetSrcImage(image_number);
     
     // find the image size.
@@ -60,7 +61,7 @@ void LayoutRemapper::UpdateAndResetIndex()
     // remap the middle of the image to find centre coordinates.
     double centre_x, centre_y;
     // create a transformation from source image to destination.
-    transform.createInvTransform(*image, *(visualization_state->GetOptions()));
+    transform.createInvTransform(*image, view->options);
     transform.transformImgCoord(centre_x, centre_y,
                                 image_width / 2.0, image_height / 2.0);
     /** @todo Offset the centre position for images in brackets, when showing
@@ -34,7 +34,7 @@ class LayoutRemapper: public MeshRemapper
 public:
     LayoutRemapper(HuginBase::Panorama *m_pano, HuginBase::SrcPanoImage * image,
                      VisualizationState *visualization_state);
-    virtual void UpdateAndResetIndex();
+    virtual void UpdateAndResetIndex(ViewPtr new_view);
     virtual bool GetNextFaceCoordinates(Coords *result);
     /** Set the size to draw the images.
      * 
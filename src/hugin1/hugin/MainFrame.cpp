@@ -263,6 +263,22 @@ END_EVENT_TABLE()
 //wxBitmap *p_img = (wxBitmap *) NULL;
 //WX_DEFINE_ARRAY()
 
+/** sets directory and size of the disk cache for the small images from the preferences */
+static void SetImageDiskCache(wxConfigBase* cfg)
+{
+    std::string directory = hugin_utils::GetUserAppDataDir();
+    if (!directory.empty())
+    {
+#if _WIN32
+        directory.append("\\thumbnails");
+#else
+        directory.append("/thumbnails");
+#endif
+    };
+    const unsigned long long size = cfg->Read(wxT("/ImageCache/DiskCacheSize"), HUGIN_IMGCACHE_DISK_UPPERBOUND);
+    ImageCache::getInstance().SetDiskCache(directory, size << 20);
+}
+
 MainFrame::MainFrame(wxWindow* parent, HuginBase::Panorama & pano)
     : cp_frame(0), pano(pano)
 {
@@ -536,6 +552,7 @@ MainFrame::MainFrame(wxWindow* parent, HuginBase::Panorama & pano)
 #else
     ImageCache::getInstance().SetUpperLimit(wxConfigBase::Get()->Read(wxT("/ImageCache/UpperBound"), HUGIN_IMGCACHE_UPPERBOUND));
 #endif
+    SetImageDiskCache(wxConfigBase::Get());
 
     if(splash) {
         splash->Close();
@@ -1311,6 +1328,7 @@ void MainFrame::OnShowPrefs(wxCommandEvent & e)
 #else
     ImageCache::getInstance().SetUpperLimit(cfg->Read(wxT("/ImageCache/UpperBound"), HUGIN_IMGCACHE_UPPERBOUND));
 #endif
+    SetImageDiskCache(cfg);
     images_panel->ReloadCPDetectorSettings();
     if(gl_preview_frame)
     {
@@ -40,6 +40,11 @@
 #include "ChoosyRemapper.h"
 #include "LayoutRemapper.h"
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <functional>
+#include <thread>
+#include <mutex>
 
 
 // If we want to draw the outline of each face instead of shading it normally,
@@ -48,6 +53,87 @@
 
 const double MeshManager::PanosphereOverviewMeshInfo::scale_diff=1.5;
 
+hugin_utils::ThreadPool & MeshManager::GetMeshThreads()
+{
+    // leave one core for the user interface
+    static hugin_utils::ThreadPool threads(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return threads;
+}
+
+class MeshManager::MeshInfo::Remapping
+{
+public:
+    Remapping(HuginBase::Panorama *pano, const HuginBase::SrcPanoImage &src,
+              VisualizationState *visualization_state, bool layout_mode_on_in)
+        :   image(src),
+            remap(layout_mode_on_in ? (MeshRemapper *) new LayoutRemapper(pano, &image, visualization_state)
+                                    : (MeshRemapper *) new ChoosyRemapper(pano, &image, visualization_state)),
+            layout_mode_on(layout_mode_on_in),
+            layout_scale(0.0),
+            running(false),
+            finished(false)
+    {
+    }
+
+    ~Remapping()
+    {
+        delete remap;
+    }
+
+    /// get the faces from the remapper. This runs in a worker thread.
+    void Calculate()
+    {
+        if (layout_mode_on)
+        {
+            static_cast<LayoutRemapper*>(remap)->setScale(layout_scale);
+        }
+        std::vector<MeshRemapper::ArrayCoords> new_faces;
+        remap->UpdateAndResetIndex(view);
+        MeshRemapper::Coords coords;
+        while (remap->GetNextFaceCoordinates(&coords))
+        {
+            MeshRemapper::ArrayCoords face;
+            for (int x = 0 ; x < 2 ; x++)
+            {
+                for (int y = 0 ; y < 2 ; y++)
+                {
+                    for (int c = 0 ; c < 2 ; c++)
+                    {
+                        face.tex_c[x][y][c] = coords.tex_c[x][y][c];
+                        face.vertex_c[x][y][c] = coords.vertex_c[x][y][c];
+                    }
+                }
+            }
+            new_faces.push_back(face);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        faces.swap(new_faces);
+        finished = true;
+    }
+
+    bool IsRunning()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return running;
+    }
+
+    /// the image the remapper uses, as it was for the last mesh.
+    HuginBase::SrcPanoImage image;
+    MeshRemapper * remap;
+    bool layout_mode_on;
+    double layout_scale;
+    /// the view used for the last mesh.
+    MeshRemapper::ViewPtr view;
+    /// the faces of the last mesh.
+    std::vector<MeshRemapper::ArrayCoords> faces;
+    std::mutex mutex;
+    /// a worker thread was given this object, until the main thread sees
+    /// that it has finished.
+    bool running;
+    /// set by the worker thread, when the faces are ready.
+    bool finished;
+};
+
 MeshManager::MeshManager(HuginBase::Panorama *pano, VisualizationState *visualization_state)
     :   m_pano(pano),
         visualization_state(visualization_state),
@@ -65,6 +151,8 @@ MeshManager::~MeshManager()
 
 void MeshManager::CheckUpdate()
 {
+    // all meshes made now use the same copy of the view.
+    m_view = std::make_shared<MeshRemapper::View>(visualization_state);
     unsigned int old_size = meshes.size();    
     // Resize to fit if images were removed
     while (meshes.size() > m_pano->getNrOfImages())
@@ -75,6 +163,8 @@ void MeshManager::CheckUpdate()
     // check each existing image individualy.
     for (unsigned int i = 0; i < meshes.size(); i++)
     {
+        // swap in the meshes the worker threads have finished.
+        meshes[i]->CheckFinished();
         if (visualization_state->RequireRecalculateMesh(i))
         {
             DEBUG_DEBUG("Update mesh for " << i);
@@ -89,6 +179,28 @@ void MeshManager::CheckUpdate()
         //use the virtual method to get the right subclass for the MeshInfo
         meshes.push_back(this->ObtainMeshInfo(visualization_state->GetSrcImage(i), layout_mode_on));
     }
+    m_view.reset();
+}
+
+bool MeshManager::HasPendingMeshes() const
+{
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        if (meshes[i]->IsCalculating())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+MeshRemapper::ViewPtr MeshManager::GetView()
+{
+    if (m_view)
+    {
+        return m_view;
+    }
+    return std::make_shared<MeshRemapper::View>(visualization_state);
 }
 
 void MeshManager::RenderMesh(unsigned int image_number) const
@@ -101,6 +213,16 @@ unsigned int MeshManager::GetDisplayList(unsigned int image_number) const
     return meshes[image_number]->display_list_number;
 }
 
+bool MeshManager::GetBoundingBox(unsigned int image_number, vigra::Rect2D &box) const
+{
+    if (image_number >= meshes.size() || !meshes[image_number]->has_mesh)
+    {
+        return false;
+    }
+    box = meshes[image_number]->bounding_box;
+    return true;
+}
+
 void MeshManager::SetLayoutMode(bool state)
 {
     if (layout_mode_on == state) return;
@@ -126,26 +248,28 @@ MeshManager::MeshInfo::MeshInfo(HuginBase::Panorama * m_pano_in,
                                 VisualizationState * visualization_state_in,
                                 bool layout_mode_on_in)
     :   display_list_number(glGenLists(1)), // Find a free display list.
+        has_mesh(false),
         image(*image),
         m_pano(m_pano_in),
         scale_factor(3.0),
         m_visualization_state(visualization_state_in),
-        remap(layout_mode_on_in ? (MeshRemapper *) new LayoutRemapper(m_pano, &(this->image), m_visualization_state)
-                                : (MeshRemapper *) new ChoosyRemapper(m_pano, &(this->image), m_visualization_state)),
-        layout_mode_on(layout_mode_on_in)
+        remapping(std::make_shared<Remapping>(m_pano, *image, m_visualization_state, layout_mode_on_in)),
+        layout_mode_on(layout_mode_on_in),
+        update_pending(false)
 {
 }
 
 MeshManager::MeshInfo::MeshInfo(const MeshInfo & source)
     // copy remap object and display list, instead of references.
     :   display_list_number(glGenLists(1)),
+    has_mesh(false),
     image(source.image),
     m_pano(source.m_pano),
     scale_factor(3.0),
     m_visualization_state(source.m_visualization_state),
-    remap(source.layout_mode_on ? (MeshRemapper *) new LayoutRemapper(source.m_pano, (HuginBase::SrcPanoImage*) &(source.image), source.m_visualization_state)
-                                : (MeshRemapper *) new ChoosyRemapper(source.m_pano, (HuginBase::SrcPanoImage*) &(source.image), source.m_visualization_state)),
-    layout_mode_on(source.layout_mode_on)
+    remapping(std::make_shared<Remapping>(source.m_pano, source.image, source.m_visualization_state, source.layout_mode_on)),
+    layout_mode_on(source.layout_mode_on),
+    update_pending(false)
 {
 }
 
@@ -153,24 +277,85 @@ MeshManager::MeshInfo::MeshInfo(const MeshInfo & source)
 
 MeshManager::MeshInfo::~MeshInfo()
 {
+    // a running worker thread keeps its own reference to the remapping.
     glDeleteLists(display_list_number, 1);
-    delete remap;
 }
 
 void MeshManager::MeshInfo::Update()
 {
+    if (remapping->IsRunning())
+    {
+        // the remapper is busy, start again when it has finished.
+        update_pending = true;
+        return;
+    }
+    update_pending = false;
+    double scale = 0.0;
     if (layout_mode_on)
     {
         /** @todo Maybe we should find the scale once, instead of for each
          * image, and find a more asthetic way to calculate it.
          */
-        double scale = m_visualization_state->GetVisibleArea().width() /
+        scale = m_visualization_state->GetVisibleArea().width() /
                        sqrt((double) m_pano->getNrOfImages()) / scale_factor;
-        MeshRemapper & remapper_ref = *remap;
-        LayoutRemapper &r = dynamic_cast<LayoutRemapper &>(remapper_ref);
-        r.setScale(scale);
     }
+    MeshRemapper::ViewPtr view = m_visualization_state->GetMeshManager()->GetView();
+    // the remapper works on a copy of the image, the overviews may change it
+    // for the remapping.
+    this->BeforeCompile();
+    const bool same_mesh = has_mesh && remapping->view
+                        && remapping->view->SameMesh(*view)
+                        && remapping->image == image
+                        && remapping->layout_scale == scale;
+    remapping->image = image;
+    this->AfterCompile();
+    if (same_mesh)
+    {
+        // only the placement of the mesh changed, e.g. the position of the
+        // image in the panosphere overview, so reuse the faces.
+        this->CompileList();
+        return;
+    }
+    remapping->view = view;
+    remapping->layout_scale = scale;
+    {
+        std::lock_guard<std::mutex> lock(remapping->mutex);
+        remapping->running = true;
+    }
+    std::shared_ptr<Remapping> job = remapping;
+    GetMeshThreads().push([job]()
+    {
+        job->Calculate();
+    });
+}
+
+bool MeshManager::MeshInfo::IsCalculating() const
+{
+    return remapping->IsRunning();
+}
+
+bool MeshManager::MeshInfo::CheckFinished()
+{
+    {
+        std::lock_guard<std::mutex> lock(remapping->mutex);
+        if (!remapping->running)
+        {
+            return false;
+        }
+        if (!remapping->finished)
+        {
+            return true;
+        }
+        remapping->running = false;
+        remapping->finished = false;
+    }
+    // the worker thread is done with the remapping now.
     this->CompileList();
+    if (update_pending)
+    {
+        Update();
+    }
+    return remapping->IsRunning();
 }
 
 MeshManager::MeshInfo::MeshCoords3D::MeshCoords3D(const MeshRemapper::Coords & coords)
@@ -202,17 +387,17 @@ void MeshManager::MeshInfo::CompileList()
     // build the display list from the coordinates generated by the remapper
 //    DEBUG_INFO("Preparing to compile a display list for overview for " << image_number
 //              << ".");
-    DEBUG_ASSERT(remap);
+    DEBUG_ASSERT(remapping);
+    std::vector<MeshRemapper::ArrayCoords> &faces = remapping->faces;
     bool multiTexture=m_visualization_state->getViewState()->GetSupportMultiTexture();
     unsigned int number_of_faces = 0;
+    // the outline of the remapped image, used to find which images are visible
+    double min_x = DBL_MAX, min_y = DBL_MAX, max_x = -DBL_MAX, max_y = -DBL_MAX;
 
     DEBUG_DEBUG("mesh update compile pano");
 
-    this->BeforeCompile();
-
     glNewList(display_list_number, GL_COMPILE);
 
-        remap->UpdateAndResetIndex();
         DEBUG_INFO("Specifying faces in display list.");
 
         glPushMatrix();
@@ -222,10 +407,22 @@ void MeshManager::MeshInfo::CompileList()
         #ifndef WIREFRAME
         glBegin(GL_QUADS);
         #endif
-            // get each face's coordinates from the remapper
+            // get each face's coordinates made by the remapper
             MeshRemapper::Coords coords;
-            while (remap->GetNextFaceCoordinates(&coords))
+            for (size_t face = 0; face < faces.size(); face++)
             {
+                coords.tex_c = faces[face].tex_c;
+                coords.vertex_c = faces[face].vertex_c;
+                for (int x = 0 ; x < 2 ; x++)
+                {
+                    for (int y = 0 ; y < 2 ; y++)
+                    {
+                        min_x = std::min(min_x, coords.vertex_c[x][y][0]);
+                        max_x = std::max(max_x, coords.vertex_c[x][y][0]);
+                        min_y = std::min(min_y, coords.vertex_c[x][y][1]);
+                        max_y = std::max(max_y, coords.vertex_c[x][y][1]);
+                    }
+                }
                 MeshCoords3D coords3d = m_visualization_state->GetMeshManager()->GetMeshCoords3D(coords);
 //                DEBUG_DEBUG("mesh update " << coords3d.vertex_coords[0][0][0] << " " << coords3d.vertex_coords[0][0][1] << " " << coords3d.vertex_coords[0][0][2]);
                 number_of_faces++;
@@ -277,8 +474,16 @@ void MeshManager::MeshInfo::CompileList()
 
     glEndList();
 
-
-    this->AfterCompile();
+    if (number_of_faces > 0)
+    {
+        bounding_box = vigra::Rect2D(int(floor(min_x)), int(floor(min_y)),
+                                     int(ceil(max_x)), int(ceil(max_y)));
+    }
+    else
+    {
+        bounding_box = vigra::Rect2D();
+    }
+    has_mesh = true;
 //    DEBUG_INFO("Prepared a display list for " << image_number << ", using "
 //              << number_of_faces << " face(s).");
     DEBUG_DEBUG("after compile mesh");
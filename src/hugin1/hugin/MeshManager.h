@@ -25,7 +25,9 @@
 
 #include "panodata/Panorama.h"
 
+#include <memory>
 #include "MeshRemapper.h"
+#include <hugin_utils/thread_pool.h>
 
 class MeshRemapper;
 class VisualizationState;
@@ -33,6 +35,8 @@ class VisualizationState;
 /** A MeshManager handles the graphics system representation of a remapping,
  * by creating OpenGL display lists that draw a remapped image.
  * The coordinates used in the display list are calculated by a MeshRemapper
+ * in a pool of worker threads, one job per image. The old display list is
+ * drawn until the new one is ready.
  */
 class MeshManager
 {
@@ -41,11 +45,23 @@ public:
     virtual ~MeshManager();
 
     void CheckUpdate();
+    /// Return true if some meshes are still calculated.
+    bool HasPendingMeshes() const;
+    /** Get the view used to make the meshes.
+     * During CheckUpdate all meshes share one copy of the view.
+     */
+    MeshRemapper::ViewPtr GetView();
     
     /// Remove meshes for images that have been deleted.
     void CleanMeshes();
     void RenderMesh(unsigned int image_number) const;
     unsigned int GetDisplayList(unsigned int image_number) const;
+    /** Get the bounding box of the remapped image in panorama pixels.
+     *
+     * The box is empty if the image has no faces in the output.
+     * @return false if the mesh for this image was not made yet.
+     */
+    bool GetBoundingBox(unsigned int image_number, vigra::Rect2D &box) const;
     
     /** Turn layout mode on or off.
      * 
@@ -79,9 +95,21 @@ public:
         virtual ~MeshInfo();
         /// Draw the mesh
         void CallList() const;
-        /// Recreate the mesh when the image or panorama it represents changes.
+        /** Recreate the mesh when the image or panorama it represents changes.
+         * The mesh is made in a worker thread, if the remapping has changed.
+         */
         void Update();
+        /** Make the display list when the worker thread has finished.
+         * @return true if the mesh is still calculated.
+         */
+        bool CheckFinished();
+        /// Return true while a worker thread calculates the mesh.
+        bool IsCalculating() const;
         unsigned int display_list_number;
+        /// true once a display list was made.
+        bool has_mesh;
+        /// The area covered by the faces of the mesh, in panorama pixels.
+        vigra::Rect2D bounding_box;
         void SetScaleFactor(double scale);
         void SetSrcImage(HuginBase::SrcPanoImage * image) {this->image = *image;}
 
@@ -118,11 +146,16 @@ public:
         HuginBase::Panorama *m_pano;
         double scale_factor;
         VisualizationState *m_visualization_state;
-        /// The ramapper we should use
-        MeshRemapper * remap;
-        /// Use the remapper to create the display list.
+        /** The remapper we should use and the faces it made. While a mesh
+         * is calculated, only the worker thread uses it.
+         */
+        class Remapping;
+        std::shared_ptr<Remapping> remapping;
+        /// Use the faces made by the remapper to create the display list.
         void CompileList();
         bool layout_mode_on;
+        /// Update was called while the mesh was calculated.
+        bool update_pending;
     };
 
     /**
@@ -219,6 +252,10 @@ protected:
 
     HuginBase::Panorama  * m_pano;
     VisualizationState * visualization_state;
+    /// the view shared by the meshes made in CheckUpdate.
+    MeshRemapper::ViewPtr m_view;
+    /// The worker threads, shared by all views.
+    static hugin_utils::ThreadPool & GetMeshThreads();
 
     
     std::vector<MeshInfo*> meshes;
@@ -42,8 +42,28 @@ MeshRemapper::~MeshRemapper()
 {
 }
 
-void MeshRemapper::UpdateAndResetIndex()
+MeshRemapper::View::View(VisualizationState *visualization_state)
+    :   options(*(visualization_state->GetOptions())),
+        projection_info(&options),
+        visible_area(visualization_state->GetVisibleArea()),
+        scale(visualization_state->GetScale())
 {
+}
+
+bool MeshRemapper::View::SameMesh(const View &other) const
+{
+    return options.getSize() == other.options.getSize()
+        && options.getProjection() == other.options.getProjection()
+        && options.getProjectionParameters() == other.options.getProjectionParameters()
+        && options.getHFOV() == other.options.getHFOV()
+        && options.getVFOV() == other.options.getVFOV()
+        && visible_area == other.visible_area
+        && scale == other.scale;
+}
+
+void MeshRemapper::UpdateAndResetIndex(ViewPtr new_view)
+{
+    view = new_view;
     // we want to make a remapped mesh, get some generic information:
 //    const HuginBase::SrcPanoImage *src = visualization_state->GetSrcImage(image_number);
     // get the size of the image.
@@ -52,7 +72,7 @@ void MeshRemapper::UpdateAndResetIndex()
   
     // use the scale to determine edge lengths in pixels for any
     // resolution selection.
-    scale = visualization_state->GetScale();
+    scale = view->scale;
     // It is up to the child classes to determine what to do here. They should
     // probably use set up transform and use it to fill some data structure that
     // stores coordinates.
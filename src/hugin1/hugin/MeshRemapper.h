@@ -24,8 +24,11 @@
 #define _MESHREMAPPER_H
 
 #include <vector>
+#include <memory>
+#include <vigra/diff2d.hxx>
 #include <panodata/Panorama.h>
 #include <panotools/PanoToolsInterface.h>
+#include "OutputProjectionInfo.h"
 
 class VisualizationState;
 
@@ -46,7 +49,29 @@ public:
     MeshRemapper(HuginBase::Panorama *m_pano, HuginBase::SrcPanoImage * image,
                          VisualizationState *visualization_state);
     virtual ~MeshRemapper();
-    virtual void UpdateAndResetIndex();
+    /** A copy of the parts of a VisualizationState used to make a mesh.
+     * The meshes are made in worker threads, while the view can change.
+     */
+    class View
+    {
+    public:
+        explicit View(VisualizationState *visualization_state);
+        /// true if a mesh made for other is also valid for this view.
+        bool SameMesh(const View &other) const;
+        HuginBase::PanoramaOptions options;
+        OutputProjectionInfo projection_info;
+        vigra::Rect2D visible_area;
+        float scale;
+    private:
+        // the projection info points to options, so don't copy this class
+        View(const View &other);
+        View & operator=(const View &other);
+    };
+    typedef std::shared_ptr<const View> ViewPtr;
+    /** Make the faces for the image in the given view. This can be called in
+     * a worker thread, the remapper doesn't use the VisualizationState.
+     */
+    virtual void UpdateAndResetIndex(ViewPtr new_view);
     /**  A class for exchanging pointers to coordinates.
      * @warning These are pointers to arrays, and GetNextFaceCoordinates
      * is expected to set the pointers, they won't be pointing at an array
@@ -81,6 +106,8 @@ public:
     virtual bool GetNextFaceCoordinates(Coords *result) = 0;
 protected:
     VisualizationState *visualization_state;
+    /// The view the faces are made for.
+    ViewPtr view;
     HuginBase::Panorama *m_pano;
     HuginBase::SrcPanoImage * image;
     /** The number number of units between vertex coorinates that
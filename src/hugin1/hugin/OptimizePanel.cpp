@@ -56,7 +56,7 @@ BEGIN_EVENT_TABLE(OptimizePanel, wxPanel)
 END_EVENT_TABLE()
 
 
-OptimizePanel::OptimizePanel()
+OptimizePanel::OptimizePanel() : m_lastOptimizedNrImages(0)
 {
     DEBUG_TRACE("");
 }
@@ -92,6 +92,10 @@ bool OptimizePanel::Create(wxWindow* parent, wxWindowID id , const wxPoint& pos,
     m_edit_cb = XRCCTRL(*this, "optimizer_panel_edit_script", wxCheckBox);
     DEBUG_ASSERT(m_edit_cb);
 
+    m_incremental_cb = XRCCTRL(*this, "optimizer_panel_incremental", wxCheckBox);
+    DEBUG_ASSERT(m_incremental_cb);
+    m_incremental_cb->SetValue(wxConfigBase::Get()->Read(wxT("/OptimizePanel/Incremental"), 0l) != 0);
+
     XRCCTRL(*this, "optimizer_panel_splitter", wxSplitterWindow)->SetSashGravity(0.66);
 
     wxString text(_("Any variables below which are bold and underlined will be optimized."));
@@ -135,6 +139,7 @@ OptimizePanel::~OptimizePanel()
 {
     DEBUG_TRACE("dtor, writing config");
     wxConfigBase::Get()->Write(wxT("/OptimizePanel/OnlyActiveImages"),m_only_active_images_cb->IsChecked() ? 1l : 0l);
+    wxConfigBase::Get()->Write(wxT("/OptimizePanel/Incremental"), m_incremental_cb->IsChecked() ? 1l : 0l);
 
     m_pano->removeObserver(this);
     DEBUG_TRACE("dtor end");
@@ -146,6 +151,7 @@ void OptimizePanel::panoramaChanged(HuginBase::Panorama & pano)
     m_images_tree_list->Enable(m_pano->getOptimizerSwitch()==0);
     m_lens_tree_list->Enable(m_pano->getOptimizerSwitch()==0);
     m_edit_cb->Enable(m_pano->getOptimizerSwitch()==0);
+    m_incremental_cb->Enable(m_pano->getOptimizerSwitch()==0);
 }
 
 void OptimizePanel::panoramaImagesChanged(HuginBase::Panorama &pano,
@@ -270,7 +276,30 @@ void OptimizePanel::runOptimizer(const HuginBase::UIntSet & imgs)
         }
         else
         {
-            HuginBase::PTools::optimize(optPano);
+            // find images with added or removed control points since last optimization
+            HuginBase::UIntSet changedImgs;
+            if (m_incremental_cb->IsChecked() && mode == 0 && m_lastOptimizedNrImages == m_pano->getNrOfImages())
+            {
+                const HuginBase::UIntSet changedPanoImgs = HuginBase::IncrementalOptimise::getImagesWithChangedCPs(m_lastOptimizedCPs, m_pano->getCtrlPoints());
+                // translate image numbers into numbers of the subset
+                unsigned int i = 0;
+                for (HuginBase::UIntSet::const_iterator it = imgs.begin(); it != imgs.end(); ++it, ++i)
+                {
+                    if (set_contains(changedPanoImgs, *it))
+                    {
+                        changedImgs.insert(i);
+                    };
+                };
+            };
+            if (changedImgs.empty())
+            {
+                HuginBase::PTools::optimize(optPano);
+            }
+            else
+            {
+                const long hops = wxConfigBase::Get()->Read(wxT("/OptimizePanel/IncrementalHops"), HUGIN_OPTIMIZER_INCREMENTAL_HOPS);
+                HuginBase::IncrementalOptimise(optPano, changedImgs, static_cast<unsigned int>(std::max(0l, hops))).run();
+            };
         }
 #ifdef DEBUG
         // print optimized script to cout
@@ -293,6 +322,9 @@ void OptimizePanel::runOptimizer(const HuginBase::UIntSet & imgs)
         PanoCommand::GlobalCmdHist::getInstance().addCommand(
             new PanoCommand::UpdateVariablesCPSetCmd(*m_pano, imgs, optPano.getVariables(), optPano.getCtrlPoints())
         );
+        // remember state for next incremental optimization
+        m_lastOptimizedCPs = m_pano->getCtrlPoints();
+        m_lastOptimizedNrImages = m_pano->getNrOfImages();
     }
 }
 
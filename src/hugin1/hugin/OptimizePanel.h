@@ -76,6 +76,11 @@ protected:
 
     wxCheckBox * m_only_active_images_cb;
     wxCheckBox * m_edit_cb;
+    wxCheckBox * m_incremental_cb;
+
+    /** control points at the time of the last applied optimization, used for incremental optimization */
+    HuginBase::CPVector m_lastOptimizedCPs;
+    size_t m_lastOptimizedNrImages;
 
     HuginBase::Panorama * m_pano;
 private:
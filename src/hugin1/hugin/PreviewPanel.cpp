@@ -32,6 +32,7 @@
 #include <vigra/basicimageview.hxx>
 #include "nona/Stitcher.h"
 
+#include "base_wx/platform.h"
 #include "base_wx/wxImageCache.h"
 #include "hugin/PreviewPanel.h"
 #include "hugin/PreviewFrame.h"
@@ -43,23 +44,33 @@
 #include "hugin/huginApp.h"
 
 #include <math.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 typedef vigra::RGBValue<unsigned char> BRGBValue;
 
+/** the low resolution pass renders the preview with the panel size divided
+ *  by this factor */
+static const unsigned int lowResolutionDivisor = 4;
+
 BEGIN_EVENT_TABLE(PreviewPanel, wxPanel)
     EVT_SIZE(PreviewPanel::OnResize)
     EVT_LEFT_DOWN(PreviewPanel::mousePressLMBEvent)
     EVT_RIGHT_DOWN(PreviewPanel::mousePressRMBEvent)
     EVT_MOUSE_EVENTS ( PreviewPanel::OnMouse )
     EVT_PAINT ( PreviewPanel::OnDraw )
+    EVT_TIMER(wxID_ANY, PreviewPanel::OnRenderTimer)
 END_EVENT_TABLE()
 
 PreviewPanel::PreviewPanel()
     : pano(0), m_autoPreview(false),m_panoImgSize(1,1),
     m_panoBitmap(0), 
     m_pano2erect(0), m_blendMode(BLEND_COPY), 
-    m_state_rendering(false), m_rerender(false), m_imgsDirty(true)
+    m_imgsDirty(true)
 {
+    m_renderTimer.SetOwner(this);
 }
 
 bool PreviewPanel::Create(wxWindow* parent, wxWindowID id,
@@ -73,7 +84,6 @@ bool PreviewPanel::Create(wxWindow* parent, wxWindowID id,
         return false;
     }
     DEBUG_TRACE("");
-    DEBUG_DEBUG("m_state_rendering = " << m_state_rendering);
 
 #if defined(__WXMSW__) 
     wxString cursorPath = huginApp::Get()->GetXRCPath() + wxT("/data/cursor_cp_pick.cur");
@@ -97,6 +107,9 @@ void PreviewPanel::Init(PreviewFrame *parent, HuginBase::Panorama * panorama )
 PreviewPanel::~PreviewPanel()
 {
     DEBUG_TRACE("dtor");
+    m_renderTimer.Stop();
+    // cancels and waits for the rendering
+    m_renderThread.reset();
     delete m_cursor;
     pano->removeObserver(this);
     if (m_panoBitmap) {
@@ -140,11 +153,9 @@ void PreviewPanel::panoramaChanged(HuginBase::Panorama &pano)
         dirty = true;
     };
 
+    // the remapped images are not invalidated here, the render thread
+    // only remaps the images whose remapping has changed
     opts = newOpts;
-    if (dirty) {
-        // have to remap all images
-        m_remapCache.invalidate();
-    }
 
     if (m_autoPreview && dirty) {
         DEBUG_DEBUG("forcing preview update");
@@ -203,21 +214,348 @@ struct ExposureResponseFunctor2
 };
 
 
-void PreviewPanel::updatePreview()
+/** a progress display, which cancels the remapping when the rendering
+ *  thread got a newer job. The SmallRemappedImageCache checks it before
+ *  remapping each image. */
+class CancelProgressDisplay : public AppBase::ProgressDisplay
 {
-    DEBUG_TRACE("");
+public:
+    explicit CancelProgressDisplay(const std::atomic<bool> & cancel)
+        : ProgressDisplay(), m_cancel(cancel)
+    {
+    };
+protected:
+    virtual void updateProgressDisplay()
+    {
+        m_canceled = m_cancel;
+    };
+private:
+    const std::atomic<bool> & m_cancel;
+};
 
-    // we can accidentally end up here recursively, because wxWidgets
-    // allows user input during redraw of the progress in the bottom
-    if (m_state_rendering) {
-        DEBUG_DEBUG("m_state_rendering == true, aborting rendering");
-        m_rerender = true;
-        return;
-    }
+/** the background thread, which remaps and blends the images. Only the
+ *  newest job is rendered, a new job cancels the running one. The thread
+ *  owns the caches of the remapped images, so they are only used in this
+ *  thread. */
+class PreviewPanel::RenderThread
+{
+public:
+    /** everything needed for rendering, set in the main thread */
+    struct Job
+    {
+        explicit Job(const HuginBase::Panorama & panorama) : pano(panorama.duplicate()) {};
+        HuginBase::Panorama pano;
+        HuginBase::PanoramaOptions opts;
+        HuginBase::UIntSet images;
+        BlendMode blendMode;
+        // mapping of HDR output to 8 bit
+        int mapping;
+        // the small images of all images and flatfields
+        HuginBase::SmallRemappedImageCache::SourceImages sourceImages;
+    };
+    /** a rendered preview, or the error message if the rendering failed */
+    struct Result
+    {
+        vigra::BRGBImage image;
+        vigra::ImageImportInfo::ICCProfile iccProfile;
+        // options of the panel resolution
+        HuginBase::PanoramaOptions opts;
+        // false for the low resolution pass
+        bool isFinal;
+        bool isHDR;
+        std::string error;
+    };
+
+    RenderThread() : m_cancel(false), m_stop(false), m_busy(false)
+    {
+        m_thread = std::thread(&RenderThread::run, this);
+    };
+
+    ~RenderThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_cancel = true;
+        }
+        m_condition.notify_all();
+        m_thread.join();
+    };
+
+    /** renders job, a running older job is cancelled */
+    void Render(std::shared_ptr<Job> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = job;
+            m_cancel = m_busy;
+            m_results.clear();
+        }
+        m_condition.notify_one();
+    };
+
+    /** returns the newest result which was not shown yet, or a 0 pointer */
+    std::shared_ptr<Result> GetResult()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::shared_ptr<Result> result;
+        if (!m_results.empty())
+        {
+            result = m_results.back();
+            m_results.clear();
+        };
+        return result;
+    };
+
+    /** returns true, if there is a job or a result waiting */
+    bool IsBusy()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_busy || m_job || !m_results.empty();
+    };
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_busy = false;
+                m_condition.wait(lock, [this] { return m_stop || m_job; });
+                if (m_stop)
+                {
+                    return;
+                };
+                job.swap(m_job);
+                m_cancel = false;
+                m_busy = true;
+            }
+            RenderJob(*job);
+        };
+    };
+
+    /** renders a low resolution preview first, if images need remapping,
+     *  then the preview in the panel resolution */
+    void RenderJob(const Job & job)
+    {
+        CancelProgressDisplay progress(m_cancel);
+        m_remapCache.invalidateFrom(job.pano.getNrOfImages());
+        m_lowResCache.invalidateFrom(job.pano.getNrOfImages());
+        // the ImageCache is not thread safe, so the caches must only use
+        // the images of the job
+        m_remapCache.setSourceImages(job.sourceImages);
+        m_lowResCache.setSourceImages(job.sourceImages);
+        try
+        {
+            bool needsRemapping = false;
+            for (HuginBase::UIntSet::const_iterator it = job.images.begin(); it != job.images.end(); ++it)
+            {
+                if (!m_remapCache.isValid(job.pano, job.opts, *it))
+                {
+                    needsRemapping = true;
+                    break;
+                };
+            };
+            if (needsRemapping && job.opts.getWidth() >= 2 * lowResolutionDivisor
+                && job.opts.getHeight() >= 2 * lowResolutionDivisor)
+            {
+                HuginBase::PanoramaOptions opts(job.opts);
+                opts.setWidth(job.opts.getWidth() / lowResolutionDivisor, false);
+                opts.setHeight(job.opts.getHeight() / lowResolutionDivisor);
+                opts.setROI(vigra::Rect2D(opts.getSize()));
+                std::shared_ptr<Result> result = Stitch(job, opts, m_lowResCache, progress);
+                result->isFinal = false;
+                Publish(result);
+            };
+            std::shared_ptr<Result> result = Stitch(job, job.opts, m_remapCache, progress);
+            result->isFinal = true;
+            Publish(result);
+        }
+        catch (std::exception & e)
+        {
+            if (!m_cancel)
+            {
+                DEBUG_ERROR("error during stitching: " << e.what());
+                std::shared_ptr<Result> result = std::make_shared<Result>();
+                result->opts = job.opts;
+                result->isFinal = true;
+                result->isHDR = false;
+                result->error = e.what();
+                Publish(result);
+            };
+        };
+        // don't keep the small images, so the ImageCache can release them
+        m_remapCache.setSourceImages(HuginBase::SmallRemappedImageCache::SourceImages());
+        m_lowResCache.setSourceImages(HuginBase::SmallRemappedImageCache::SourceImages());
+    };
 
-    DEBUG_DEBUG("m_state_rendering = true");
-    m_state_rendering = true;
-    m_rerender = false;
+    /** remaps and blends the images of job into an 8 bit image */
+    std::shared_ptr<Result> Stitch(const Job & job, const HuginBase::PanoramaOptions & opts,
+                                   HuginBase::SmallRemappedImageCache & remapCache,
+                                   AppBase::ProgressDisplay & progress)
+    {
+        std::shared_ptr<Result> result = std::make_shared<Result>();
+        result->opts = job.opts;
+        result->isHDR = opts.outputMode == HuginBase::PanoramaOptions::OUTPUT_HDR;
+        result->image.resize(opts.getSize());
+        vigra::FRGBImage panoImg(opts.getSize());
+        vigra::BImage alpha(opts.getSize());
+
+        DEBUG_DEBUG("about to stitch images, pano size: " << opts.getSize());
+        HuginBase::UIntSet displayedImages = job.images;
+        if (displayedImages.empty())
+        {
+            return result;
+        };
+        if (result->isHDR) {
+            DEBUG_DEBUG("HDR output merge");
+
+            vigra_ext::ReduceToHDRFunctor<vigra::RGBValue<float> > hdrmerge;
+            HuginBase::Nona::ReduceStitcher<vigra::FRGBImage, vigra::BImage> stitcher(job.pano, &progress);
+            stitcher.stitch(opts, displayedImages,
+                            destImageRange(panoImg), destImage(alpha),
+                            remapCache,
+                            hdrmerge);
+#ifdef DEBUG_REMAP
+{
+    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin04_preview_HDR_Reduce.tif"); \
+            vigra::exportImage(vigra::srcImageRange(panoImg), exi); \
+}
+{
+    vigra::ImageExportInfo exi(DEBUG_FILE_PREFIX "hugin04_preview_HDR_Reduce_Alpha.tif"); \
+            vigra::exportImage(vigra::srcImageRange(alpha), exi); \
+}
+#endif
+
+            // find min and max
+            vigra::FindMinMax<float> minmax;   // init functor
+            vigra::inspectImageIf(vigra::srcImageRange(panoImg), vigra::srcImage(alpha),
+                                minmax);
+            double min = std::max(minmax.min, 1e-6f);
+            double max = minmax.max;
+
+            vigra_ext::applyMapping(vigra::srcImageRange(panoImg), vigra::destImage(result->image), min, max, job.mapping);
+
+        } else {
+                // LDR output
+            switch (job.blendMode) {
+            case BLEND_COPY:
+            {
+                HuginBase::Nona::StackingBlender blender;
+                HuginBase::Nona::SimpleStitcher<vigra::FRGBImage, vigra::BImage> stitcher(job.pano, &progress);
+                stitcher.stitch(opts, displayedImages,
+                                destImageRange(panoImg), destImage(alpha),
+                                remapCache,
+                                blender);
+                result->iccProfile = stitcher.iccProfile;
+                break;
+            }
+            case BLEND_DIFFERENCE:
+            {
+                HuginBase::Nona::ReduceToDifferenceFunctor<vigra::RGBValue<float> > func;
+                HuginBase::Nona::ReduceStitcher<vigra::FRGBImage, vigra::BImage> stitcher(job.pano, &progress);
+                stitcher.stitch(opts, displayedImages,
+                                destImageRange(panoImg), destImage(alpha),
+                                remapCache,
+                                func);
+                result->iccProfile = stitcher.iccProfile;
+                break;
+            }
+            }
+
+#ifdef DEBUG_REMAP
+{
+    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin04_preview_AfterRemap.tif"); \
+            vigra::exportImage(vigra::srcImageRange(panoImg), exi); \
+}
+{
+    vigra::ImageExportInfo exi(DEBUG_FILE_PREFIX "hugin04_preview_AfterRemapAlpha.tif"); \
+            vigra::exportImage(vigra::srcImageRange(alpha), exi); \
+}
+#endif
+
+            // apply default exposure and convert to 8 bit
+            HuginBase::SrcPanoImage src = job.pano.getSrcImage(0);
+
+            // apply the exposure
+            double scale = 1.0/pow(2.0,opts.outputExposureValue);
+
+            vigra::transformImage(srcImageRange(panoImg), destImage(panoImg),
+                                  vigra::functor::Arg1()*vigra::functor::Param(scale));
+
+            DEBUG_DEBUG("LDR output, with response: " << src.getResponseType());
+            if (src.getResponseType() == HuginBase::SrcPanoImage::RESPONSE_LINEAR) {
+                vigra::transformImage(srcImageRange(panoImg), destImage(result->image),
+                                      vigra::functor::Arg1()*vigra::functor::Param(255));
+            } else {
+            // create suitable lut for response
+                typedef  std::vector<double> LUT;
+                LUT lut;
+                switch(src.getResponseType())
+                {
+                    case HuginBase::SrcPanoImage::RESPONSE_EMOR:
+                        vigra_ext::EMoR::createEMoRLUT(src.getEMoRParams(), lut);
+                        break;
+                    case HuginBase::SrcPanoImage::RESPONSE_GAMMA:
+                        lut.resize(256);
+                        vigra_ext::createGammaLUT(1/src.getGamma(), lut);
+                        break;
+                    default:
+                        vigra_fail("Unknown or unsupported response function type");
+                        break;
+                }
+                // scale lut
+                for (size_t i=0; i < lut.size(); i++) 
+                    lut[i] = lut[i]*255;
+                typedef vigra::RGBValue<float> FRGB;
+                vigra_ext::LUTFunctor<FRGB, LUT> lutf(lut);
+
+                vigra::transformImage(srcImageRange(panoImg), destImage(result->image),
+                                      lutf);
+            }
+        }
+
+#ifdef DEBUG_REMAP
+{
+    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin05_preview_final.tif"); \
+            vigra::exportImage(vigra::srcImageRange(result->image), exi); \
+}
+#endif
+        return result;
+    };
+
+    /** passes result to the main thread, if no newer job is waiting */
+    void Publish(std::shared_ptr<Result> result)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_job)
+        {
+            m_results.push_back(result);
+        };
+    };
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    // the next job, guarded by m_mutex
+    std::shared_ptr<Job> m_job;
+    // rendered previews, guarded by m_mutex
+    std::vector<std::shared_ptr<Result> > m_results;
+    // set by the main thread, when the running job is outdated
+    std::atomic<bool> m_cancel;
+    bool m_stop;
+    bool m_busy;
+    // the remapped images for the preview and the low resolution pass,
+    // only used by the thread
+    HuginBase::SmallRemappedImageCache m_remapCache;
+    HuginBase::SmallRemappedImageCache m_lowResCache;
+};
+
+void PreviewPanel::updatePreview()
+{
+    DEBUG_TRACE("");
 
 	{
 	  // Even though the frame is hidden, the panel is not
@@ -227,183 +565,180 @@ void PreviewPanel::updatePreview()
 		  DEBUG_INFO("Parent window shown - updating");
 		} else {
 		  DEBUG_INFO("Parent window hidden - not updating");
-                  m_state_rendering = false;
 		  return;
 		}
 	  }
 	}
-    wxBusyCursor wait;
     double finalWidth = pano->getOptions().getWidth();
     double finalHeight = pano->getOptions().getHeight();
 
-    m_panoImgSize = vigra::Diff2D(GetClientSize().GetWidth(), GetClientSize().GetHeight());
+    vigra::Diff2D panoImgSize(GetClientSize().GetWidth(), GetClientSize().GetHeight());
 
     double ratioPano = finalWidth / finalHeight;
-    double ratioPanel = (double)m_panoImgSize.x / (double)m_panoImgSize.y;
+    double ratioPanel = (double)panoImgSize.x / (double)panoImgSize.y;
 
     DEBUG_DEBUG("panorama ratio: " << ratioPano << "  panel ratio: " << ratioPanel);
 
     if (ratioPano < ratioPanel) {
         // panel is wider than pano
-        m_panoImgSize.x = hugin_utils::round(m_panoImgSize.y * ratioPano);
-        DEBUG_DEBUG("portrait: " << m_panoImgSize);
+        panoImgSize.x = hugin_utils::round(panoImgSize.y * ratioPano);
+        DEBUG_DEBUG("portrait: " << panoImgSize);
     } else {
         // panel is taller than pano
-        m_panoImgSize.y = hugin_utils::round(m_panoImgSize.x / ratioPano);
-        DEBUG_DEBUG("landscape: " << m_panoImgSize);
+        panoImgSize.y = hugin_utils::round(panoImgSize.x / ratioPano);
+        DEBUG_DEBUG("landscape: " << panoImgSize);
     }
+    panoImgSize.x = std::max(panoImgSize.x, 1);
+    panoImgSize.y = std::max(panoImgSize.y, 1);
 
-    HuginBase::PanoramaOptions opts = pano->getOptions();
+    std::shared_ptr<RenderThread::Job> job = std::make_shared<RenderThread::Job>(*pano);
+    HuginBase::PanoramaOptions & opts = job->opts;
+    opts = pano->getOptions();
     //don't use GPU for preview
     opts.remapUsingGPU = false;
-    opts.setWidth(m_panoImgSize.x, false);
-    opts.setHeight(m_panoImgSize.y);
+    opts.setWidth(panoImgSize.x, false);
+    opts.setHeight(panoImgSize.y);
     // always use bilinear for preview.
 
     // reset ROI. The preview needs to draw the parts outside the ROI, too!
     opts.setROI(vigra::Rect2D(opts.getSize()));
     opts.interpolator = vigra_ext::INTERP_BILINEAR;
 
-    // create images
-    wxImage panoImage(m_panoImgSize.x, m_panoImgSize.y);
-    try {
-        vigra::BasicImageView<vigra::RGBValue<unsigned char> > panoImg8((vigra::RGBValue<unsigned char> *)panoImage.GetData(), panoImage.GetWidth(), panoImage.GetHeight());
-        vigra::FRGBImage panoImg(m_panoImgSize);
-        vigra::BImage alpha(m_panoImgSize);
-
-        DEBUG_DEBUG("about to stitch images, pano size: " << m_panoImgSize);
-        HuginBase::UIntSet displayedImages = pano->getActiveImages();
-        if (displayedImages.size() > 0) {
-            if (opts.outputMode == HuginBase::PanoramaOptions::OUTPUT_HDR) {
-                DEBUG_DEBUG("HDR output merge");
-
-                vigra_ext::ReduceToHDRFunctor<vigra::RGBValue<float> > hdrmerge;
-                HuginBase::Nona::ReduceStitcher<vigra::FRGBImage, vigra::BImage> stitcher(*pano, parentWindow);
-                stitcher.stitch(opts, displayedImages,
-                                destImageRange(panoImg), destImage(alpha),
-                                m_remapCache,
-                                hdrmerge);
-#ifdef DEBUG_REMAP
-{
-    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin04_preview_HDR_Reduce.tif"); \
-            vigra::exportImage(vigra::srcImageRange(panoImg), exi); \
-}
-{
-    vigra::ImageExportInfo exi(DEBUG_FILE_PREFIX "hugin04_preview_HDR_Reduce_Alpha.tif"); \
-            vigra::exportImage(vigra::srcImageRange(alpha), exi); \
-}
-#endif
+    job->images = pano->getActiveImages();
+    job->blendMode = m_blendMode;
+    job->mapping = wxConfigBase::Get()->Read(wxT("/ImageCache/MappingFloat"), HUGIN_IMGCACHE_MAPPING_FLOAT);
 
-                // find min and max
-                vigra::FindMinMax<float> minmax;   // init functor
-                vigra::inspectImageIf(vigra::srcImageRange(panoImg), vigra::srcImage(alpha),
-                                    minmax);
-                double min = std::max(minmax.min, 1e-6f);
-                double max = minmax.max;
+    // the render thread can't use the ImageCache, so collect the small
+    // images here. The missing images are loaded in the background, the
+    // preview is rendered when all are loaded.
+    m_imageRequests.clear();
+    m_loadError.clear();
+    for (HuginBase::UIntSet::const_iterator it = job->images.begin(); it != job->images.end(); ++it)
+    {
+        const HuginBase::SrcPanoImage & img = pano->getImage(*it);
+        std::vector<std::string> filenames(1, img.getFilename());
+        if (img.getVigCorrMode() & HuginBase::SrcPanoImage::VIGCORR_FLATFIELD)
+        {
+            filenames.push_back(img.getFlatfieldFilename());
+        };
+        for (size_t i = 0; i < filenames.size(); ++i)
+        {
+            if (set_contains(job->sourceImages, filenames[i]))
+            {
+                continue;
+            };
+            ImageCache::EntryPtr entry = ImageCache::getInstance().getSmallImageIfAvailable(filenames[i]);
+            if (entry)
+            {
+                job->sourceImages[filenames[i]] = entry;
+            }
+            else
+            {
+                ImageCache::RequestPtr request = ImageCache::getInstance().requestAsyncSmallImage(filenames[i], ImageCache::PRIORITY_NORMAL);
+                request->ready.push_back(std::bind(&PreviewPanel::OnSmallImageLoaded, this));
+                request->failed.push_back(std::bind(&PreviewPanel::OnSmallImageFailed, this, std::placeholders::_1));
+                m_imageRequests.push_back(request);
+            };
+        };
+    };
 
-                int mapping = wxConfigBase::Get()->Read(wxT("/ImageCache/MappingFloat"), HUGIN_IMGCACHE_MAPPING_FLOAT);
-                vigra_ext::applyMapping(vigra::srcImageRange(panoImg), vigra::destImage(panoImg8), min, max, mapping);
+    parentWindow->setMessage("Stitching");
+    if (!m_imageRequests.empty())
+    {
+        DEBUG_DEBUG("waiting for " << m_imageRequests.size() << " small images");
+        return;
+    };
 
-            } else {
-                    // LDR output
-                vigra::ImageImportInfo::ICCProfile iccProfile;
-                switch (m_blendMode) {
-                case BLEND_COPY:
-                {
-                    HuginBase::Nona::StackingBlender blender;
-                    HuginBase::Nona::SimpleStitcher<vigra::FRGBImage, vigra::BImage> stitcher(*pano, parentWindow);
-                    stitcher.stitch(opts, displayedImages,
-                                    destImageRange(panoImg), destImage(alpha),
-                                    m_remapCache,
-                                    blender);
-                    iccProfile = stitcher.iccProfile;
-                    break;
-                }
-                case BLEND_DIFFERENCE:
-                {
-                    HuginBase::Nona::ReduceToDifferenceFunctor<vigra::RGBValue<float> > func;
-                    HuginBase::Nona::ReduceStitcher<vigra::FRGBImage, vigra::BImage> stitcher(*pano, parentWindow);
-                    stitcher.stitch(opts, displayedImages,
-                                    destImageRange(panoImg), destImage(alpha),
-                                    m_remapCache,
-                                    func);
-                    iccProfile = stitcher.iccProfile;
-                    break;
-                }
-                }
-                
-#ifdef DEBUG_REMAP
-{
-    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin04_preview_AfterRemap.tif"); \
-            vigra::exportImage(vigra::srcImageRange(panoImg), exi); \
+    if (!m_renderThread)
+    {
+        m_renderThread = std::make_shared<RenderThread>();
+    };
+    m_renderThread->Render(job);
+    if (!m_renderTimer.IsRunning())
+    {
+        m_renderTimer.Start(40);
+    };
 }
+
+void PreviewPanel::OnSmallImageLoaded()
 {
-    vigra::ImageExportInfo exi(DEBUG_FILE_PREFIX "hugin04_preview_AfterRemapAlpha.tif"); \
-            vigra::exportImage(vigra::srcImageRange(alpha), exi); \
+    if (m_imageRequests.empty())
+    {
+        return;
+    };
+    for (size_t i = 0; i < m_imageRequests.size(); ++i)
+    {
+        if (!ImageCache::getInstance().getSmallImageIfAvailable(m_imageRequests[i]->getFilename()))
+        {
+            return;
+        };
+    };
+    m_imageRequests.clear();
+    updatePreview();
 }
-#endif
 
-                // apply default exposure and convert to 8 bit
-                HuginBase::SrcPanoImage src = pano->getSrcImage(0);
-
-                // apply the exposure
-                double scale = 1.0/pow(2.0,opts.outputExposureValue);
-
-                vigra::transformImage(srcImageRange(panoImg), destImage(panoImg),
-                                      vigra::functor::Arg1()*vigra::functor::Param(scale));
-
-                DEBUG_DEBUG("LDR output, with response: " << src.getResponseType());
-                if (src.getResponseType() == HuginBase::SrcPanoImage::RESPONSE_LINEAR) {
-                    vigra::transformImage(srcImageRange(panoImg), destImage(panoImg8),
-                                          vigra::functor::Arg1()*vigra::functor::Param(255));
-                } else {
-                // create suitable lut for response
-                    typedef  std::vector<double> LUT;
-                    LUT lut;
-                    switch(src.getResponseType())
-                    {
-                        case HuginBase::SrcPanoImage::RESPONSE_EMOR:
-                            vigra_ext::EMoR::createEMoRLUT(src.getEMoRParams(), lut);
-                            break;
-                        case HuginBase::SrcPanoImage::RESPONSE_GAMMA:
-                            lut.resize(256);
-                            vigra_ext::createGammaLUT(1/src.getGamma(), lut);
-                            break;
-                        default:
-                            vigra_fail("Unknown or unsupported response function type");
-                            break;
-                    }
-                    // scale lut
-                    for (size_t i=0; i < lut.size(); i++) 
-                        lut[i] = lut[i]*255;
-                    typedef vigra::RGBValue<float> FRGB;
-                    vigra_ext::LUTFunctor<FRGB, LUT> lutf(lut);
-
-                    vigra::transformImage(srcImageRange(panoImg), destImage(panoImg8),
-                                          lutf);
-                }
-                // apply color profiles
-                if (!iccProfile.empty() || huginApp::Get()->HasMonitorProfile())
-                {
-                    HuginBase::Color::CorrectImage(panoImage, iccProfile, huginApp::Get()->GetMonitorProfile());
-                };
-            }
-        }
-
-#ifdef DEBUG_REMAP
+void PreviewPanel::OnSmallImageFailed(const std::string & filename)
 {
-    vigra::ImageExportInfo exi( DEBUG_FILE_PREFIX "hugin05_preview_final.tif"); \
-            vigra::exportImage(vigra::srcImageRange(panoImg8), exi); \
+    if (m_imageRequests.empty())
+    {
+        return;
+    };
+    // the preview can't be rendered without the image, forget the other
+    // requests and report the error with the next timer event, like the
+    // errors of the render thread. The next update tries to load it again.
+    m_imageRequests.clear();
+    m_loadError = "could not retrieve small source image for preview generation: " + filename;
+    if (!m_renderTimer.IsRunning())
+    {
+        m_renderTimer.Start(40);
+    };
 }
-#endif
 
+void PreviewPanel::OnRenderTimer(wxTimerEvent & e)
+{
+    std::shared_ptr<RenderThread::Result> result;
+    if (m_renderThread)
+    {
+        result = m_renderThread->GetResult();
+    };
+    if (!m_renderThread || !m_renderThread->IsBusy())
+    {
+        m_renderTimer.Stop();
+    };
+    if (!m_loadError.empty())
+    {
+        const std::string error = m_loadError;
+        m_loadError.clear();
+        parentWindow->taskFinished();
+        wxMessageBox(wxString(error.c_str(), HUGIN_CONV_FILENAME), _("Error during Stitching"));
+        return;
+    };
+    if (!result)
+    {
+        return;
+    };
+    if (!result->error.empty())
+    {
+        parentWindow->taskFinished();
+        wxMessageBox(wxString(result->error.c_str(), wxConvLocal), _("Error during Stitching"));
+        return;
+    };
 
-    } catch (std::exception & e) {
-        m_state_rendering = false;
-        DEBUG_ERROR("error during stitching: " << e.what());
-        wxMessageBox(wxString(e.what(), wxConvLocal), _("Error during Stitching"));
-    }
-
+    // convert to wxImage, the low resolution pass is scaled up to the panel size
+    wxImage panoImage(result->image.width(), result->image.height(), false);
+    vigra::BasicImageView<BRGBValue> panoImg8((BRGBValue *)panoImage.GetData(), panoImage.GetWidth(), panoImage.GetHeight());
+    vigra::copyImage(vigra::srcImageRange(result->image), vigra::destImage(panoImg8));
+    // apply color profiles
+    if (!result->isHDR && (!result->iccProfile.empty() || huginApp::Get()->HasMonitorProfile()))
+    {
+        HuginBase::Color::CorrectImage(panoImage, result->iccProfile, huginApp::Get()->GetMonitorProfile());
+    };
+    const HuginBase::PanoramaOptions & opts = result->opts;
+    if (!result->isFinal)
+    {
+        panoImage.Rescale(opts.getWidth(), opts.getHeight());
+    };
+    m_panoImgSize = vigra::Diff2D(opts.getWidth(), opts.getHeight());
 
     // update the transform for pano -> erect coordinates
     if (m_pano2erect) delete m_pano2erect;
@@ -419,17 +754,16 @@ void PreviewPanel::updatePreview()
     }
     m_panoBitmap = new wxBitmap(panoImage);
 
+    if (result->isFinal)
+    {
+        parentWindow->taskFinished();
+    };
 
     // always redraw
     wxClientDC dc(this);
     DrawPreview(dc);
-
-    m_state_rendering = false;
-    DEBUG_DEBUG("m_state_rendering = false");
-    m_rerender = false;
 }
 
-
 void PreviewPanel::DrawPreview(wxDC & dc)
 {
     if (!IsShown()){
@@ -599,7 +933,6 @@ void PreviewPanel::OnResize(wxSizeEvent & e)
     DEBUG_TRACE("");
     wxSize sz = GetClientSize();
     if (sz.GetWidth() != m_panoImgSize.x && sz.GetHeight() != m_panoImgSize.y) {
-        m_remapCache.invalidate();
         if (m_autoPreview) {
             ForceUpdate();
         }
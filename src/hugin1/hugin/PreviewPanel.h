@@ -25,8 +25,10 @@
 #define _PREVIEWPANEL_H
 
 #include <vector>
+#include <memory>
 
 #include <base_wx/wxImageCache.h>
+#include <wx/timer.h>
 
 #include <vigra_ext/ROIImage.h>
 
@@ -35,7 +37,9 @@ class PreviewFrame;
 
 /** A preview panel that renders the pictures using the panotools library
  *
- *  Lets hope this works out fine..
+ *  The preview is rendered in a background thread, first in a lower
+ *  resolution and then in the full resolution of the panel. A newer
+ *  update cancels the rendering of the older one.
  */
 class PreviewPanel : public wxPanel, public HuginBase::PanoramaObserver
 {
@@ -76,10 +80,22 @@ private:
     void DrawPreview(wxDC & dc);
 
     // remaps the images, called automatically if autopreview is enabled.
+    // The images are remapped in the background, the result is shown
+    // when it is ready.
     void updatePreview();
 
     void mapPreviewImage(unsigned int imgNr);
 
+    /** renders the preview, when all small images requested by
+     *  updatePreview are loaded */
+    void OnSmallImageLoaded();
+    /** cancels the waiting for the small images, when one could not be
+     *  loaded, the error is shown by OnRenderTimer */
+    void OnSmallImageFailed(const std::string & filename);
+
+    /** shows the rendered previews and errors of the render thread */
+    void OnRenderTimer(wxTimerEvent & e);
+
     /** recalculate panorama to fit the panel */
     void OnResize(wxSizeEvent & e);
     void OnDraw(wxPaintEvent & event);
@@ -110,16 +126,22 @@ private:
     // transformation for current preview coordinates into equirect coordinates
     HuginBase::PTools::Transform * m_pano2erect;
 
-    // cache for remapped images
-    SmallRemappedImageCache m_remapCache;
+    /** the thread which remaps and blends the images, it also holds
+     *  the caches for the remapped images */
+    class RenderThread;
+    std::shared_ptr<RenderThread> m_renderThread;
+    // polls the render thread for results while it is busy
+    wxTimer m_renderTimer;
+    // requests for the small images which are not loaded yet
+    std::vector<HuginBase::ImageCache::RequestPtr> m_imageRequests;
+    // error message, if a small image could not be loaded
+    std::string m_loadError;
 
     BlendMode m_blendMode;
 
     PreviewFrame * parentWindow;
     wxCursor * m_cursor;
 
-    bool m_state_rendering;
-    bool m_rerender;
     bool m_imgsDirty;
 
     DECLARE_EVENT_TABLE()
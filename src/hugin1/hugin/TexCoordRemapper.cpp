@@ -42,13 +42,14 @@ TexCoordRemapper::TexCoordRemapper(HuginBase::Panorama *m_pano,
     
 }
 
-void TexCoordRemapper::UpdateAndResetIndex()
+void TexCoordRemapper::UpdateAndResetIndex(ViewPtr new_view)
 {
+    MeshRemapper::UpdateAndResetIndex(new_view);
     // work what area we should cover in what detail.
     SetSize();
     // we want to make a remapped mesh, get the transformation we need:
 //    HuginBase::SrcPanoImage *src_img = visualization_state->GetSrcImage(image_number);
-    transform.createTransform(*image, *(visualization_state->GetOptions()));
+    transform.createTransform(*image, view->options);
 //    DEBUG_INFO("updating mesh for image " << image_number
 //              << ", using faces spaced about " << scale << " units apart.\n");
     // fill the map with transformed points.
@@ -161,7 +162,7 @@ void TexCoordRemapper::SetSize()
     //            (I had a look at ComputeImageROI but seemed a bit brute force)
     // 2. With zooming, we could clip the stuff off the edge of the screen.
     // For now we stick with everything that is visible.
-    vigra::Rect2D visible_area = visualization_state->GetVisibleArea();
+    vigra::Rect2D visible_area = view->visible_area;
     start_x = (double) visible_area.left() - 0.5;
     start_y = (double) visible_area.top() - 0.5;
     end_x = (double) visible_area.right() - 0.5;
@@ -169,7 +170,7 @@ void TexCoordRemapper::SetSize()
     o_width = end_x - start_x;
     o_height = end_y - start_y;
     // use the scale to determine edge lengths in pixels for subdivision
-    scale = visualization_state->GetScale() * mesh_frequency;
+    scale = view->scale * mesh_frequency;
     // round the number of divisions we need to get a whole number of faces
     divisions_x = (int) ((end_x - start_x) * scale + 0.5);
     if (divisions_x < 2) divisions_x = 2;
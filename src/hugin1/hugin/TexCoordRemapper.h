@@ -40,7 +40,7 @@ class TexCoordRemapper: public MeshRemapper
 public:
     TexCoordRemapper(HuginBase::Panorama *m_pano, HuginBase::SrcPanoImage * image,
                      VisualizationState *visualization_state);
-    virtual void UpdateAndResetIndex();
+    virtual void UpdateAndResetIndex(ViewPtr new_view);
     virtual bool GetNextFaceCoordinates(Coords *result);
 private:
     void SetSize();
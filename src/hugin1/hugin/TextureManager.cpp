@@ -22,6 +22,10 @@
 
 #include <math.h>
 #include <iostream>
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <iomanip>
 
 #include <config.h>
 
@@ -61,10 +65,271 @@
 #include "exiv2/exiv2.hpp"
 #include "exiv2/preview.hpp"
 
+/** input and result of the preparation of some mip levels in the background */
+struct TextureManager::PrepareJob
+{
+    PrepareJob() : transform(NULL), cancelled(false), ready(false) {};
+    ~PrepareJob()
+    {
+        if (transform != NULL)
+        {
+            cmsDeleteTransform(transform);
+        };
+    };
+    // set in the main thread, before the job is started
+    ImageCache::EntryPtr entry;
+    std::shared_ptr<vigra::BRGBImage> image;
+    std::shared_ptr<vigra::BImage> mask;
+    bool has_mask;
+    unsigned int width_p, height_p;
+    int first_level, last_level;
+    bool photometric_correct;
+    HuginBase::SrcPanoImage src_img;
+    double dest_exposure;
+    std::vector<float> dest_EMoR_params;
+    cmsHTRANSFORM transform;
+    // guards the following members
+    std::mutex mutex;
+    bool cancelled;
+    bool ready;
+    std::vector<MipLevel> levels;
+};
+
+/** creates the transform from the color profile of the image to the monitor
+ *  profile, returns NULL if no color correction is needed */
+static cmsHTRANSFORM CreateMonitorTransform(const vigra::ImageImportInfo::ICCProfile& iccProfile)
+{
+    cmsHPROFILE inputICC = NULL;
+    if (!iccProfile.empty())
+    {
+        inputICC = cmsOpenProfileFromMem(iccProfile.data(), iccProfile.size());
+    };
+    cmsHTRANSFORM transform = NULL;
+    // do color correction only if input image has icc profile or if we found a monitor profile
+    if (inputICC != NULL || huginApp::Get()->HasMonitorProfile())
+    {
+        // check input profile
+        if (inputICC != NULL)
+        {
+            if (cmsGetColorSpace(inputICC) != cmsSigRgbData)
+            {
+                cmsCloseProfile(inputICC);
+                inputICC = NULL;
+            };
+        };
+        // if there is no icc profile in file fall back to sRGB
+        if (inputICC == NULL)
+        {
+            inputICC = cmsCreate_sRGBProfile();
+        };
+        // now build transform
+        transform = cmsCreateTransform(inputICC, TYPE_RGB_8,
+            huginApp::Get()->GetMonitorProfile(), TYPE_RGB_8,
+            INTENT_PERCEPTUAL, cmsFLAGS_BLACKPOINTCOMPENSATION);
+    };
+    if (inputICC != NULL)
+    {
+        cmsCloseProfile(inputICC);
+    };
+    return transform;
+}
+
+/** halves the size of an 8 bit image with a box filter, a side with a
+ *  size of 1 is kept */
+static void ReduceLevel(const unsigned char* src, unsigned int src_width, unsigned int src_height,
+                        unsigned char* dest, unsigned int channels)
+{
+    const unsigned int dest_width = std::max(1u, src_width / 2);
+    const unsigned int dest_height = std::max(1u, src_height / 2);
+    const size_t dx = (src_width > 1) ? channels : 0;
+    const size_t dy = (src_height > 1) ? src_width * channels : 0;
+#pragma omp parallel for
+    for (int y = 0; y < static_cast<int>(dest_height); ++y)
+    {
+        const unsigned char* row = src + (src_height > 1 ? 2 * y : 0) * src_width * channels;
+        unsigned char* out = dest + y * dest_width * channels;
+        for (unsigned int x = 0; x < dest_width; ++x)
+        {
+            const unsigned char* p = row + (src_width > 1 ? 2 * x : 0) * channels;
+            for (unsigned int c = 0; c < channels; ++c)
+            {
+                *out++ = (p[c] + p[c + dx] + p[c + dy] + p[c + dx + dy] + 2) / 4;
+            };
+        };
+    };
+}
+
+/** uploads a lookup table for the code of InvResponseTransform::emitGLSL to the
+ *  currently bound rectangle texture, each texel contains the entry and the next
+ *  one for the linear interpolation in the shader */
+static void DefineLUTTexture(const std::vector<double>& lut)
+{
+    std::vector<float> data(2 * lut.size());
+    for (size_t i = 0; i < lut.size(); ++i)
+    {
+        data[2 * i] = lut[i];
+        data[2 * i + 1] = (i + 1 < lut.size()) ? lut[i + 1] : lut[i];
+    }
+    glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_LUMINANCE_ALPHA32F_ARB, lut.size(), 1, 0,
+                 GL_LUMINANCE_ALPHA, GL_FLOAT, data.data());
+}
+
+/** textures up to this number of texels are made from the small image of the
+ *  ImageCache with about 800*800 pixels. The texture sizes are rounded up to
+ *  powers of two, so it has about the same detail. */
+static const unsigned int maxSmallImageTexels = 1024 * 1024;
+
+/** fragment shader for the photometric correction of one image. The correction
+ *  is generated by InvResponseTransform::emitGLSL, the same code as used by the
+ *  GPU remapping, so the preview matches the stitched panorama. */
+class TextureManager::PhotometricProgram
+{
+public:
+    PhotometricProgram() : m_program(0), m_invLutTexture(0), m_destLutTexture(0) {};
+    ~PhotometricProgram()
+    {
+        if (m_program)
+        {
+            glDeleteProgram(m_program);
+        }
+        if (m_invLutTexture)
+        {
+            glDeleteTextures(1, (GLuint*) &m_invLutTexture);
+        }
+        if (m_destLutTexture)
+        {
+            glDeleteTextures(1, (GLuint*) &m_destLutTexture);
+        }
+    };
+    /** creates the program for img, the output exposure and the output response */
+    bool Create(const HuginBase::SrcPanoImage &img, double exposure, const std::vector<double> &destResponse)
+    {
+        HuginBase::Photometric::InvResponseTransform<unsigned char, double> invResponse(img);
+        invResponse.setOutput(exposure, destResponse, 1.0);
+        // the texture coordinates are scaled to 0..1
+        std::ostringstream srcPos;
+        srcPos << std::showpoint << "gl_TexCoord[0].st * vec2(" << static_cast<double>(img.getSize().width())
+               << ", " << static_cast<double>(img.getSize().height()) << ")";
+        std::ostringstream photometric;
+        photometric << std::setprecision(20) << std::showpoint;
+        std::vector<double> invLut;
+        std::vector<double> destLut;
+        invResponse.emitGLSL(photometric, invLut, destLut, srcPos.str());
+
+        std::ostringstream oss;
+        oss << "#version 120" << std::endl
+            << "#extension GL_ARB_texture_rectangle : enable" << std::endl
+            << "uniform sampler2D imageTexture;" << std::endl
+            << "uniform sampler2D maskTexture;" << std::endl
+            << "uniform bool useMask;" << std::endl;
+        if (!invLut.empty())
+        {
+            oss << "uniform sampler2DRect InvLutTexture;" << std::endl;
+        }
+        if (!destLut.empty())
+        {
+            oss << "uniform sampler2DRect DestLutTexture;" << std::endl;
+        }
+        oss << "void main()" << std::endl
+            << "{" << std::endl
+            << "    vec4 p = texture2D(imageTexture, gl_TexCoord[0].st);" << std::endl
+            << photometric.str()
+            << "    if (useMask)" << std::endl
+            << "    {" << std::endl
+            << "        p.a *= texture2D(maskTexture, gl_TexCoord[1].st).a;" << std::endl
+            << "    }" << std::endl
+            << "    gl_FragColor = p * gl_Color;" << std::endl
+            << "}" << std::endl;
+        const std::string source = oss.str();
+        const char* sourcePtr = source.c_str();
+
+        GLuint shader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(shader, 1, &sourcePtr, NULL);
+        glCompileShader(shader);
+        GLint success;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+            DEBUG_ERROR("Could not compile photometric correction shader: " << log);
+            glDeleteShader(shader);
+            return false;
+        }
+        m_program = glCreateProgram();
+        glAttachShader(m_program, shader);
+        glLinkProgram(m_program);
+        // the program keeps the shader
+        glDeleteShader(shader);
+        glGetProgramiv(m_program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            char log[1024];
+            glGetProgramInfoLog(m_program, sizeof(log), NULL, log);
+            DEBUG_ERROR("Could not link photometric correction shader: " << log);
+            return false;
+        }
+        // the texture units used by the shader
+        glUseProgram(m_program);
+        glUniform1i(glGetUniformLocation(m_program, "imageTexture"), 0);
+        glUniform1i(glGetUniformLocation(m_program, "maskTexture"), 1);
+        if (!invLut.empty())
+        {
+            glUniform1i(glGetUniformLocation(m_program, "InvLutTexture"), 2);
+            glGenTextures(1, (GLuint*) &m_invLutTexture);
+            glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_invLutTexture);
+            DefineLUTTexture(invLut);
+        }
+        if (!destLut.empty())
+        {
+            glUniform1i(glGetUniformLocation(m_program, "DestLutTexture"), 3);
+            glGenTextures(1, (GLuint*) &m_destLutTexture);
+            glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_destLutTexture);
+            DefineLUTTexture(destLut);
+        }
+        glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+        glUseProgram(0);
+        return true;
+    };
+    /** binds the lookup tables and uses the program */
+    void Use(bool useMask)
+    {
+        if (m_invLutTexture)
+        {
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_invLutTexture);
+        }
+        if (m_destLutTexture)
+        {
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_destLutTexture);
+        }
+        glActiveTexture(GL_TEXTURE0);
+        glUseProgram(m_program);
+        glUniform1i(glGetUniformLocation(m_program, "useMask"), useMask ? 1 : 0);
+    };
+private:
+    PhotometricProgram(const PhotometricProgram&);
+    PhotometricProgram& operator=(const PhotometricProgram&);
+    unsigned int m_program;
+    unsigned int m_invLutTexture;
+    unsigned int m_destLutTexture;
+};
+
 TextureManager::TextureManager(HuginBase::Panorama *pano, ViewState *view_state_in)
 {
     m_pano = pano;
     photometric_correct = false;
+    photometric_in_texture = false;
+    shader_checked = false;
+    photometric_shader = false;
+    programs_exposure = 0.0;
+    viewer_exposure = 1.0;
+    update_counter = 0;
     view_state = view_state_in;
 }
 
@@ -72,6 +337,16 @@ TextureManager::~TextureManager()
 {
     // free up the textures
     textures.clear();
+    photometric_programs.clear();
+}
+
+hugin_utils::ThreadPool * TextureManager::GetPrepareThread()
+{
+    if (!m_prepareThread)
+    {
+        m_prepareThread = std::make_shared<hugin_utils::ThreadPool>(1);
+    }
+    return m_prepareThread.get();
 }
 
 void TextureManager::DrawImage(unsigned int image_number,
@@ -80,7 +355,7 @@ void TextureManager::DrawImage(unsigned int image_number,
     // bind the texture that represents the given image number.
     TexturesMap::iterator it;
     HuginBase::SrcPanoImage *img_p = view_state->GetSrcImage(image_number);
-    TextureKey key(img_p, &photometric_correct);
+    TextureKey key(img_p, &photometric_in_texture);
     it = textures.find(key);
     DEBUG_ASSERT(it != textures.end());
     it->second->Bind();
@@ -147,6 +422,24 @@ void TextureManager::DrawImage(unsigned int image_number,
             glDisable(GL_BLEND);
             glColor3f(1.0, 1.0, 1.0);
         }
+    } else if (!photometric_in_texture) {
+        // the textures are not corrected, the fragment shader does the
+        // photometric correction while drawing.
+        PhotometricProgram *program = GetPhotometricProgram(*view_state->GetSrcImage(image_number));
+        if (program)
+        {
+            program->Use(it->second->GetHasActiveMasks());
+            glCallList(display_list);
+            glUseProgram(0);
+        }
+        else
+        {
+            glCallList(display_list);
+        }
+        if (it->second->GetUseAlpha() || it->second->GetHasActiveMasks())
+        {
+            glDisable(GL_BLEND);
+        }
     } else {
         // we've already corrected all the photometrics, just draw once normally
         glCallList(display_list);
@@ -162,7 +455,7 @@ unsigned int TextureManager::GetTextureName(unsigned int image_number)
     // bind the texture that represents the given image number.
     TexturesMap::iterator it;
     HuginBase::SrcPanoImage *img_p = view_state->GetSrcImage(image_number);
-    TextureKey key(img_p, &photometric_correct);
+    TextureKey key(img_p, &photometric_in_texture);
     it = textures.find(key);
     DEBUG_ASSERT(it != textures.end());
     return it->second->GetNumber();
@@ -173,7 +466,7 @@ void TextureManager::BindTexture(unsigned int image_number)
     // bind the texture that represents the given image number.
     TexturesMap::iterator it;
     HuginBase::SrcPanoImage *img_p = view_state->GetSrcImage(image_number);
-    TextureKey key(img_p, &photometric_correct);
+    TextureKey key(img_p, &photometric_in_texture);
     it = textures.find(key);
     DEBUG_ASSERT(it != textures.end());
     it->second->Bind();
@@ -198,12 +491,32 @@ void TextureManager::DisableTexture(bool maskOnly)
 
 void TextureManager::Begin()
 {
-    if (!photometric_correct)
+    // find the exposure factor to scale by.
+    viewer_exposure = 1.0 / pow(2.0,
+                                m_pano->getOptions().outputExposureValue);
+    if (photometric_correct && photometric_shader && m_pano->getNrOfImages() > 0)
     {
-        // find the exposure factor to scale by.
-        viewer_exposure = 1.0 / pow(2.0,
-                                    m_pano->getOptions().outputExposureValue);
-    };
+        // the stitcher uses the response of the first image as output
+        // response, the programs need to be recreated if it or the output
+        // exposure has changed.
+        const std::vector<float> EMoR_params = view_state->GetSrcImage(0)->getEMoRParams();
+        if (EMoR_params != programs_EMoR_params || viewer_exposure != programs_exposure)
+        {
+            photometric_programs.clear();
+            programs_exposure = viewer_exposure;
+            if (EMoR_params != programs_EMoR_params)
+            {
+                programs_EMoR_params = EMoR_params;
+                vigra_ext::EMoR::createEMoRLUT(EMoR_params, programs_dest_lut);
+                vigra_ext::enforceMonotonicity(programs_dest_lut);
+            }
+        }
+        // drop the programs of old image states
+        if (photometric_programs.size() > 2 * m_pano->getNrOfImages())
+        {
+            photometric_programs.clear();
+        }
+    }
 };
 
 void TextureManager::End()
@@ -222,28 +535,59 @@ void TextureManager::CheckUpdate()
         textures.clear();
         return;
     }
-    // if we are doing photometric correction, and someone changed the output
-    // exposure, all of our images are at the wrong exposure.
-    if (photometric_correct && view_state->RequireRecalculatePhotometric())
+    // we need a rendering context to find out if we can use shaders.
+    if (!shader_checked)
+    {
+        InitShader();
+    }
+    // the flat-field correction of an image may have changed
+    UpdatePhotometricInTexture();
+    // if we are correcting the textures, and someone changed the output
+    // exposure, all of our images are at the wrong exposure. The shader
+    // doesn't need new textures for this.
+    if (photometric_in_texture && view_state->RequireRecalculatePhotometric())
     {
         textures.clear();
     }
-    HuginBase::PanoramaOptions *dest_img = view_state->GetOptions();
     // Recalculuate the ideal image density if required
     // TODO tidy up once it works.
     DEBUG_INFO("Updating texture sizes.");
+    update_counter++;
+    // Only the images on screen share the texture memory. The images just
+    // off screen get a smaller share, so they are there when they are moved
+    // into the view. The others keep a tiny texture.
+    std::vector<double> weights(num_images, 0.0);
+    std::vector<bool> on_screen(num_images, false);
     // find the total of fields of view of the images, in degrees squared
     // we assume each image has the same density across all it's pixels
     double total_fov = 0.0;
     for (unsigned int image_index = 0; image_index < num_images; image_index++)
     {
+        if (!m_pano->getImage(image_index).getActive())
+        {
+            continue;
+        }
+        if (view_state->GetVisibleFraction(image_index) > 0.0)
+        {
+            on_screen[image_index] = true;
+            weights[image_index] = 1.0;
+        }
+        else if (view_state->GetVisibleFraction(image_index, GetPrefetchMargin()) > 0.0)
+        {
+            weights[image_index] = GetPrefetchWeight();
+        }
         HuginBase::SrcPanoImage *src = view_state->GetSrcImage(image_index);
         double aspect = double(src->getSize().height())
                                                / double(src->getSize().width());
-        total_fov += src->getHFOV() * aspect;
+        total_fov += src->getHFOV() * aspect * weights[image_index];
     };
     // now find the ideal density
-    texel_density = double(GetMaxTotalTexels()) / total_fov;
+    texel_density = total_fov > 0.0 ? double(GetMaxTotalTexels()) / total_fov : 0.0;
+    // textures bigger than needed are kept until the memory is needed, so we
+    // don't upload them again when they are needed again.
+    std::vector<unsigned int> shrinkable;
+    std::vector<std::pair<unsigned int, unsigned int> > wanted_sizes(num_images);
+    unsigned int texels_resident = 0;
 
     // now recalculate the best image sizes
     // The actual texture size is the biggest one possible withouth scaling the
@@ -257,7 +601,7 @@ void TextureManager::CheckUpdate()
         // if it has not been created before, it will be created now.
         TexturesMap::iterator it;
         HuginBase::SrcPanoImage *img_p = view_state->GetSrcImage(image_index);
-        TextureKey key(img_p, &photometric_correct);
+        TextureKey key(img_p, &photometric_in_texture);
         it = textures.find(key);
         /* This section would allow us to reuse textures generated when we want
          * to change the size. It is not used as it causes segmentation faults
@@ -287,7 +631,7 @@ void TextureManager::CheckUpdate()
                       << ".\n";
             std::pair<std::map<TextureKey, TextureInfo>::iterator, bool> ins;
             ins = textures.insert(std::pair<TextureKey, TextureInfo>
-                                 (TextureKey(img_p, &photometric_correct),
+                                 (TextureKey(img_p, &photometric_in_texture),
                 // the key is used to identify the image with (or without)
                 // photometric correction parameters.
                               TextureInfo(max_tex_width_p, max_tex_height_p)
@@ -366,7 +710,8 @@ void TextureManager::CheckUpdate()
         double hfov = img_p->getHFOV(),
            aspect = double (img_p->getSize().height())
                                             / double (img_p->getSize().width()),
-           ideal_texels = texel_density * hfov * aspect,
+           ideal_texels = std::max(texel_density * hfov * aspect * weights[image_index],
+                                   GetMinTexels()),
            // we would like a texture this size:
            ideal_tex_width = sqrt(ideal_texels / aspect),
            ideal_tex_height = aspect * ideal_tex_width;
@@ -404,43 +749,65 @@ void TextureManager::CheckUpdate()
         }
         // we have a nice size
         texels_used += 1 << (tex_width_p + tex_height_p);
+        wanted_sizes[image_index] = std::make_pair(tex_width_p, tex_height_p);
         if (   it == textures.end()
-            || (it->second)->width_p != tex_width_p
-            || (it->second)->height_p != tex_height_p)
+            || (it->second)->width_p < tex_width_p
+            || (it->second)->height_p < tex_height_p)
         {
             // Either: 1. We haven't seen this image before
-            //     or: 2. Our texture for this is image is the wrong size
+            //     or: 2. Our texture for this is image is too small
             // ...therefore we make a new one the right size:
-            //
-            // remove duplicate key if exists
-            TextureKey checkKey (img_p, &photometric_correct);
-            textures.erase(checkKey);
-
-            std::pair<TexturesMap::iterator, bool> ins;
-            ins = textures.insert(std::pair<TextureKey, std::shared_ptr<TextureInfo> >
-                                 (TextureKey(img_p, &photometric_correct),
-                // the key is used to identify the image with (or without)
-                // photometric correction parameters.
-                              std::make_shared<TextureInfo>(view_state, tex_width_p, tex_height_p)
-                            ));
-           // create and upload the texture image
-           TextureInfo* texinfo = (ins.first)->second.get();
-           texinfo->DefineLevels(0, // minimum mip level
-                                 // maximum mip level
-                        tex_width_p > tex_height_p ? tex_width_p : tex_height_p,
-                                photometric_correct,
-                                *dest_img,
-                                *view_state->GetSrcImage(image_index));
-           texinfo->DefineMaskTexture(*view_state->GetSrcImage(image_index));
+            MakeTexture(image_index, tex_width_p, tex_height_p, !on_screen[image_index]);
+            texels_resident += 1 << (tex_width_p + tex_height_p);
         }
         else
         {
+            if ((it->second)->width_p != tex_width_p
+                || (it->second)->height_p != tex_height_p)
+            {
+                // the texture is bigger than needed, shrink it later if we
+                // run out of memory.
+                shrinkable.push_back(image_index);
+            }
+            texels_resident += 1 << ((it->second)->width_p + (it->second)->height_p);
             if(view_state->RequireRecalculateMasks(image_index))
             {
                 //mask for this image has changed, also update only mask
                 it->second->UpdateMask(*view_state->GetSrcImage(image_index));
             };
         }
+        it = textures.find(key);
+        if (weights[image_index] > 0.0)
+        {
+            it->second->last_visible = update_counter;
+        }
+        it->second->prefetch = !on_screen[image_index];
+    }
+    // when the textures use too much memory, shrink the ones which were not
+    // visible for the longest time first.
+    const unsigned int max_resident = GetMaxTotalTexels() + GetMaxTotalTexels() / 2;
+    if (texels_resident > max_resident)
+    {
+        std::vector<std::pair<unsigned long, unsigned int> > lru;
+        for (size_t i = 0; i < shrinkable.size(); i++)
+        {
+            TexturesMap::iterator it = textures.find(
+                    TextureKey(view_state->GetSrcImage(shrinkable[i]), &photometric_in_texture));
+            lru.push_back(std::make_pair(it->second->last_visible, shrinkable[i]));
+        }
+        std::sort(lru.begin(), lru.end());
+        for (size_t i = 0; i < lru.size() && texels_resident > max_resident; i++)
+        {
+            const unsigned int image_index = lru[i].second;
+            TexturesMap::iterator it = textures.find(
+                    TextureKey(view_state->GetSrcImage(image_index), &photometric_in_texture));
+            texels_resident -= 1 << (it->second->width_p + it->second->height_p);
+            texels_resident += 1 << (wanted_sizes[image_index].first + wanted_sizes[image_index].second);
+            MakeTexture(image_index, wanted_sizes[image_index].first,
+                        wanted_sizes[image_index].second, !on_screen[image_index]);
+            textures.find(TextureKey(view_state->GetSrcImage(image_index),
+                          &photometric_in_texture))->second->last_visible = lru[i].first;
+        }
     }
     // We should remove any images' texture when it is no longer in the panorama
     // with the ati bug work around, we might make unneassry textures whenever 
@@ -448,18 +815,71 @@ void TextureManager::CheckUpdate()
     {
         CleanTextures();
     }
+    // continue with the upload of the levels prepared in the background
+    UploadPendingLevels();
 //    std::map<TextureKey, TextureInfo>::iterator it;
 //    for (it = textures.begin() ; it != textures.end() ; it++) {
 //        DEBUG_DEBUG("textures num " << it->second.GetNumber());
 //    }
 }
 
+void TextureManager::MakeTexture(unsigned int image_index, unsigned int width_p,
+                                 unsigned int height_p, bool prefetch)
+{
+    HuginBase::SrcPanoImage *img_p = view_state->GetSrcImage(image_index);
+    // remove duplicate key if exists
+    TextureKey checkKey (img_p, &photometric_in_texture);
+    textures.erase(checkKey);
+
+    std::pair<TexturesMap::iterator, bool> ins;
+    ins = textures.insert(std::pair<TextureKey, std::shared_ptr<TextureInfo> >
+                         (TextureKey(img_p, &photometric_in_texture),
+        // the key is used to identify the image with (or without)
+        // photometric correction parameters.
+                      std::make_shared<TextureInfo>(view_state, width_p, height_p)
+                    ));
+    // create and upload the texture image
+    TextureInfo* texinfo = (ins.first)->second.get();
+    texinfo->prefetch = prefetch;
+    texinfo->DefineLevels(0, // minimum mip level
+                          // maximum mip level
+                          width_p > height_p ? width_p : height_p,
+                          photometric_in_texture,
+                          *view_state->GetOptions(),
+                          *img_p);
+    texinfo->DefineMaskTexture(*img_p);
+}
+
 void TextureManager::SetPhotometricCorrect(bool state)
 {
     // change the photometric correction state.
-    if (state != photometric_correct)
+    photometric_correct = state;
+    // the keys of the programs compare the photometric parameters only
+    // while the correction is on
+    photometric_programs.clear();
+    UpdatePhotometricInTexture();
+}
+
+void TextureManager::UpdatePhotometricInTexture()
+{
+    // with the shader the textures are the same with and without photometric
+    // correction, so switching is instant. The shader can't do the flat-field
+    // correction, so use the textures if any image needs it.
+    bool in_texture = photometric_correct && !photometric_shader;
+    if (photometric_correct && !in_texture)
+    {
+        for (size_t i = 0; i < m_pano->getNrOfImages(); ++i)
+        {
+            if (m_pano->getImage(i).getVigCorrMode() & HuginBase::SrcPanoImage::VIGCORR_FLATFIELD)
+            {
+                in_texture = true;
+                break;
+            }
+        }
+    }
+    if (in_texture != photometric_in_texture)
     {
-        photometric_correct = state;
+        photometric_in_texture = in_texture;
         // We will need to recalculate all the images.
         /* TODO It may be possible to keep textures that have some identity
          * photometric transformation.
@@ -470,6 +890,111 @@ void TextureManager::SetPhotometricCorrect(bool state)
     }
 }
 
+void TextureManager::InitShader()
+{
+    shader_checked = true;
+    photometric_shader = false;
+    if (!GLEW_VERSION_2_0 || !view_state->GetSupportMultiTexture())
+    {
+        DEBUG_INFO("GLSL is not available, photometric correction is done on the textures.");
+        return;
+    }
+    // the shader can't apply the monitor profile after the correction
+    if (huginApp::Get()->HasMonitorProfile())
+    {
+        DEBUG_INFO("Using monitor profile, photometric correction is done on the textures.");
+        return;
+    }
+    GLint units;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+    if (units < 4)
+    {
+        DEBUG_INFO("Not enough texture units for the photometric correction shader.");
+        return;
+    }
+    // the lookup tables are stored in float rectangle textures
+    if (!GLEW_ARB_texture_rectangle || !GLEW_ARB_texture_float)
+    {
+        DEBUG_INFO("No float rectangle textures for the photometric correction shader.");
+        return;
+    }
+    photometric_shader = true;
+    DEBUG_INFO("Using GLSL for the photometric correction.");
+}
+
+TextureManager::PhotometricProgram * TextureManager::GetPhotometricProgram(const HuginBase::SrcPanoImage &img)
+{
+    const TextureKey key(&img, &photometric_correct);
+    PhotometricProgramsMap::iterator it = photometric_programs.find(key);
+    if (it == photometric_programs.end())
+    {
+        std::shared_ptr<PhotometricProgram> program = std::make_shared<PhotometricProgram>();
+        if (!program->Create(img, programs_exposure, programs_dest_lut))
+        {
+            // don't try again for this image state
+            program.reset();
+        }
+        it = photometric_programs.insert(std::make_pair(key, program)).first;
+    }
+    return it->second.get();
+}
+
+bool TextureManager::HasPendingUploads()
+{
+    for (TexturesMap::iterator it = textures.begin(); it != textures.end(); ++it)
+    {
+        if (it->second->HasPendingLevels())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TextureManager::UploadPendingLevels()
+{
+    unsigned int budget = GetMaxUploadTexels();
+    while (budget > 0)
+    {
+        // refine coarse to fine over all images, so always continue with the
+        // smallest waiting level. The images on screen go first.
+        TextureInfo *next = NULL;
+        unsigned int next_size = 0;
+        for (TexturesMap::iterator it = textures.begin(); it != textures.end(); ++it)
+        {
+            const unsigned int size = it->second->NextUploadSize();
+            if (size > 0 && (next == NULL
+                || (next->prefetch && !it->second->prefetch)
+                || (next->prefetch == it->second->prefetch && size < next_size)))
+            {
+                next = it->second.get();
+                next_size = size;
+            }
+        }
+        if (next == NULL)
+        {
+            break;
+        }
+        budget -= std::min(budget, next->UploadLevel(budget));
+    }
+}
+
+double TextureManager::GetMinTexels()
+{
+    // 64 by 64 pixels, enough to see where the image is.
+    return 4096.0;
+}
+
+double TextureManager::GetPrefetchMargin()
+{
+    return 0.25;
+}
+
+double TextureManager::GetPrefetchWeight()
+{
+    return 0.25;
+}
+
 unsigned int TextureManager::GetMaxTotalTexels()
 {
     // TODO: cut off at a sensible value for available hardware, otherwise set
@@ -484,6 +1009,13 @@ unsigned int TextureManager::GetMaxTotalTexels()
     // buffers, and the meshes, so we should do fine with ~24MB of video memory.
 }
 
+unsigned int TextureManager::GetMaxUploadTexels()
+{
+    // about 2MB per frame, which should take only a few milliseconds even on
+    // slow hardware. The prepared levels are uploaded over several frames.
+    return 524288;
+}
+
 unsigned int TextureManager::GetMaxTextureSizePower()
 {
     // get the maximum texture size supported by the hardware
@@ -523,7 +1055,7 @@ void TextureManager::CleanTextures()
           // try and find an image with this key
           for (unsigned int img = 0; img < num_images; img++)
           {
-              TextureKey ik(view_state->GetSrcImage(img), &photometric_correct);
+              TextureKey ik(view_state->GetSrcImage(img), &photometric_in_texture);
               if (ik == tex->first)
               {
                   found = true;
@@ -567,6 +1099,9 @@ TextureManager::TextureInfo::TextureInfo(ViewState *new_view_state)
     m_viewState=new_view_state;
     has_active_masks=false;
     has_mask=false;
+    m_uploadRow = 0;
+    last_visible = 0;
+    prefetch = false;
     CreateTexture();
 }
 
@@ -576,6 +1111,9 @@ TextureManager::TextureInfo::TextureInfo(ViewState *new_view_state, unsigned int
     m_viewState=new_view_state;
     has_active_masks=false;
     has_mask=false;
+    m_uploadRow = 0;
+    last_visible = 0;
+    prefetch = false;
     width_p = width_p_in;
     height_p = height_p_in;
     width = 1 << width_p;
@@ -652,6 +1190,7 @@ TextureManager::TextureInfo::~TextureInfo()
 {
     // free up the graphics system's memory for this texture
     DEBUG_DEBUG("textures num deleting " <<  num);
+    CancelPrepareJob();
     glDeleteTextures(1, (GLuint*) &num);
     glDeleteTextures(1, (GLuint*) &numMask);
 }
@@ -710,7 +1249,6 @@ void TextureManager::TextureInfo::DefineLevels(int min,
     // add more detail textures. We need to get the biggest one first.
     // find the original image to scale down.
     // TODO cache full texture to disk after scaling?
-    // TODO use small image if don't need bigger?
     // It is also possible to use HDR textures, but I can't see the point using
     // them as the only difference on an LDR display would be spending extra 
     // time reading the texture and converting the numbers. (float and uint16)
@@ -719,10 +1257,26 @@ void TextureManager::TextureInfo::DefineLevels(int min,
     DEBUG_INFO("Loading image");
     const std::string img_name = src_img.getFilename();
     ImageCache::EntryPtr entry = ImageCache::getInstance().getImageIfAvailable(img_name);
+    // small textures are made from the small image, it loads much faster.
+    const bool use_small_image = width * height <= maxSmallImageTexels;
+    if (!entry.get() && use_small_image)
+    {
+        entry = ImageCache::getInstance().getSmallImageIfAvailable(img_name);
+    }
     if (!entry.get())
     {
-        // Image isn't loaded yet. Request it for later.
-        m_imageRequest = ImageCache::getInstance().requestAsyncImage(img_name);
+        // Image isn't loaded yet. Request it for later. The images which
+        // are not on screen wait for the others.
+        const ImageCache::RequestPriority priority =
+            prefetch ? ImageCache::PRIORITY_LOW : ImageCache::PRIORITY_NORMAL;
+        if (use_small_image)
+        {
+            m_imageRequest = ImageCache::getInstance().requestAsyncSmallImage(img_name, priority);
+        }
+        else
+        {
+            m_imageRequest = ImageCache::getInstance().requestAsyncImage(img_name, priority);
+        }
         // call this function with the same parameters after the image loads
         // it would be easier to call DefineLevels directly
         // but this fails if the TextureInfo object is destroyed during loading of the image
@@ -812,173 +1366,227 @@ void TextureManager::TextureInfo::DefineLevels(int min,
                 }
             }
         };
+        CancelPrepareJob();
         gluBuild2DMipmaps(GL_TEXTURE_2D, GL_RGBA8, placeholderWidth, placeholderHeight,
                                GL_RGBA, GL_UNSIGNED_BYTE,
                                placeholder_image);
+        // gluBuild2DMipmaps defines all levels from 0
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
         SetParameters();
         delete[] placeholder_image;
         return;
     }
     // forget the request if we made one before.
     m_imageRequest = ImageCache::RequestPtr();
+    // levels from an earlier call are not needed anymore
+    CancelPrepareJob();
     DEBUG_INFO("Converting to 8 bits");
-    std::shared_ptr<vigra::BRGBImage> img = entry->get8BitImage();
-    std::shared_ptr<vigra::BImage> mask = entry->mask;
+    std::shared_ptr<PrepareJob> job = std::make_shared<PrepareJob>();
+    job->entry = entry;
+    job->image = entry->get8BitImage();
+    job->mask = entry->mask;
+    // OpenGL requires that the mask is in the same array as the colour data,
+    // but the ImageCache doesn't work in this way.
+    has_mask = job->mask->width() && job->mask->height();
+    job->has_mask = has_mask;
+    job->width_p = width_p;
+    job->height_p = height_p;
+    job->photometric_correct = photometric_correct;
+    job->src_img = src_img;
+    job->dest_exposure = 1.0 / pow(2.0, dest_img.outputExposureValue);
+    // @TODO better handling of output EMoR parameters
+    // Hugin's stitcher is currently using the EMoR parameters of the first image
+    // as so called output EMoR parameter, so enforce this also for the fast
+    // preview window
+    job->dest_EMoR_params = m_viewState->GetSrcImage(0)->getEMoRParams();
+    job->transform = CreateMonitorTransform(*(entry->iccProfile));
+
+    // The levels up to 64 pixels are made at once, so the image is shown
+    // immediately. The more detailed ones are made in the background and
+    // uploaded during the next frames.
+    const int coarse = std::min(max, std::max(min, max_mip_level - 6));
+    DEBUG_INFO("Defining mipmap levels " <<  coarse << " to " << max
+          << " of texture " << num << ", levels " << min << " to "
+          << coarse - 1 << " follow later.");
+    std::vector<MipLevel> levels;
+    try
+    {
+        TextureManager::PrepareLevels(*job, coarse, max, levels);
+    }
+    catch (std::exception& e)
+    {
+        DEBUG_ERROR("Could not prepare texture for " << img_name << ": " << e.what());
+        return;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        glTexImage2D(GL_TEXTURE_2D, levels[i].level, has_mask ? GL_RGBA8 : GL_RGB8,
+                     levels[i].width, levels[i].height, 0,
+                     has_mask ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE,
+                     levels[i].data.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // only use the defined levels. The base level is lowered when the more
+    // detailed levels are uploaded.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, coarse);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max);
+    GLint error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        DEBUG_ERROR("GL Error when bulding mipmap levels: "
+                  << gluErrorString(error) << ".");
+    }
+    SetParameters();
+    if (coarse > min)
+    {
+        // prepare the other levels in the background. The job is only
+        // shared with the thread, so it doesn't matter if this TextureInfo
+        // is destroyed in the meantime.
+        job->first_level = min;
+        job->last_level = coarse - 1;
+        m_prepareJob = job;
+        m_viewState->GetTextureManager()->GetPrepareThread()->push([job]()
+        {
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                if (job->cancelled)
+                {
+                    return;
+                };
+            }
+            std::vector<MipLevel> levels;
+            try
+            {
+                TextureManager::PrepareLevels(*job, job->first_level, job->last_level, levels);
+            }
+            catch (std::exception& e)
+            {
+                DEBUG_ERROR("Could not prepare texture: " << e.what());
+                levels.clear();
+            };
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->levels.swap(levels);
+            job->ready = true;
+        });
+    }
+    DEBUG_INFO("Finsihed loading texture.");
+}
+
+void TextureManager::PrepareLevels(const PrepareJob &job, int first_level,
+                                   int last_level, std::vector<MipLevel> &levels)
+{
+    const vigra::BRGBImage &img = *(job.image);
+    const vigra::BImage &mask = *(job.mask);
     // first make the biggest mip level.
-    int wo = 1 << (width_p - min), ho = 1 << (height_p - min);
-    if (wo < 1) wo = 1; if (ho < 1) ho = 1;
-    // use Vigra to resize image
-    DEBUG_INFO("Scaling image");
+    const int wo = std::max(1, (1 << job.width_p) >> first_level),
+              ho = std::max(1, (1 << job.height_p) >> first_level);
     vigra::BRGBImage out_img(wo, ho);
-    // also read in the mask. OpenGL requires that the mask is in the same array
-    // as the colour data, but the ImageCache doesn't work in this way.
-    has_mask = mask->width()  && mask->height();
-    vigra::UInt8Image *out_alpha;
-    if (has_mask) out_alpha = new vigra::UInt8Image(wo, ho);
+    vigra::BImage out_alpha;
+    if (job.has_mask) out_alpha.resize(wo, ho);
     if (wo < 2 || ho < 2)
     {
-        // too small for vigra to scale
-        // we still need to define some mipmap levels though, so use only (0, 0)
+        // too small for vigra to scale, pick the pixels ourselves
         for (int h = 0; h < ho; h++)
         {
+            const int sy = h * img.height() / ho;
             for (int w = 0; w < wo; w++)
             {
-                out_img[h][w] = (*img)[0][0];
-                if (has_mask) (*out_alpha)[h][w] = (*mask)[0][0];
+                const int sx = w * img.width() / wo;
+                out_img[h][w] = img[sy][sx];
+                if (job.has_mask) out_alpha[h][w] = mask[sy][sx];
             }
         }
     } else {
         // I think this takes to long, although it should be prettier.
-        /*vigra::resizeImageLinearInterpolation(srcImageRange(*img),
+        /*vigra::resizeImageLinearInterpolation(srcImageRange(img),
                                                destImageRange(out_img));
-        if (has_mask)
+        if (job.has_mask)
         {
-            vigra::resizeImageLinearInterpolation(srcImageRange(*(entry->mask)),
+            vigra::resizeImageLinearInterpolation(srcImageRange(mask),
                                           destImageRange(out_alpha));
         }*/
         
         // much faster. It shouldn't be so bad after it
-        vigra::resizeImageNoInterpolation(srcImageRange(*img),
+        vigra::resizeImageNoInterpolation(srcImageRange(img),
                                           destImageRange(out_img));
-        if (has_mask)
+        if (job.has_mask)
         {
-            vigra::resizeImageNoInterpolation(srcImageRange(*(mask)),
-                                              destImageRange(*out_alpha));
+            vigra::resizeImageNoInterpolation(srcImageRange(mask),
+                                              destImageRange(out_alpha));
         }/**/
-        // prepare color management
-        cmsHPROFILE inputICC = NULL;
-        if (!entry->iccProfile->empty())
-        {
-            inputICC = cmsOpenProfileFromMem(entry->iccProfile->data(), entry->iccProfile->size());
-        };
-        cmsHTRANSFORM transform = NULL;
-        // do color correction only if input image has icc profile or if we found a monitor profile
-        if (inputICC != NULL || huginApp::Get()->HasMonitorProfile())
+    }
+    const cmsHTRANSFORM transform = job.transform;
+    // now perform photometric correction
+    if (job.photometric_correct)
+    {
+        DEBUG_INFO("Performing photometric correction");
+        // setup photometric transform for this image type
+        // this corrects for response curve, white balance, exposure and
+        // radial vignetting
+        HuginBase::Photometric::InvResponseTransform < unsigned char, double >
+            invResponse(job.src_img);
+        // Assume LDR for now.
+        // if (m_destImg.outputMode == PanoramaOptions::OUTPUT_LDR) {
+        // select exposure and response curve for LDR output
+        std::vector<double> outLut;
+        // vigra_ext::EMoR::createEMoRLUT(dest_img.outputEMoRParams, outLut);
+        vigra_ext::EMoR::createEMoRLUT(job.dest_EMoR_params, outLut);
+        vigra_ext::enforceMonotonicity(outLut);
+        invResponse.setOutput(job.dest_exposure, outLut, 255.0);
+        /*} else {
+           // HDR output. not sure how that would be handled by the opengl
+           // preview, though. It might be possible to apply a logarithmic
+           // lookup table here, and average the overlapping pixels
+           // in the OpenGL renderer?
+           // TODO
+           invResponse.setHDROutput();
+           }*/
+        // now perform the corrections
+        double scale_x = (double)job.src_img.getSize().width() / (double)wo,
+            scale_y = (double)job.src_img.getSize().height() / (double)ho;
+#pragma omp parallel for
+        for (int y = 0; y < ho; y++)
         {
-            // check input profile
-            if (inputICC != NULL)
+            for (int x = 0; x < wo; x++)
             {
-                if (cmsGetColorSpace(inputICC) != cmsSigRgbData)
-                {
-                    cmsCloseProfile(inputICC);
-                    inputICC = NULL;
-                };
-            };
-            // if there is no icc profile in file fall back to sRGB
-            if (inputICC == NULL)
+                double sx = (double)x * scale_x,
+                    sy = (double)y * scale_y;
+                out_img[y][x] = invResponse(out_img[y][x],
+                    hugin_utils::FDiff2D(sx, sy));
+            }
+            // now take color profiles in file and of monitor into account
+            if (transform != NULL)
             {
-                inputICC = cmsCreate_sRGBProfile();
+                cmsDoTransform(transform, out_img[y], out_img[y], out_img.width());
             };
-            // now build transform
-            transform = cmsCreateTransform(inputICC, TYPE_RGB_8,
-                huginApp::Get()->GetMonitorProfile(), TYPE_RGB_8,
-                INTENT_PERCEPTUAL, cmsFLAGS_BLACKPOINTCOMPENSATION);
-        };
-        // now perform photometric correction
-        if (photometric_correct)
+        }
+    }
+    else
+    {
+        // no photometric correction
+        if (transform != NULL)
         {
-            DEBUG_INFO("Performing photometric correction");
-            // setup photometric transform for this image type
-            // this corrects for response curve, white balance, exposure and
-            // radial vignetting
-            HuginBase::Photometric::InvResponseTransform < unsigned char, double >
-                invResponse(src_img);
-            // Assume LDR for now.
-            // if (m_destImg.outputMode == PanoramaOptions::OUTPUT_LDR) {
-            // select exposure and response curve for LDR output
-            std::vector<double> outLut;
-            // @TODO better handling of output EMoR parameters
-            // Hugin's stitcher is currently using the EMoR parameters of the first image
-            // as so called output EMoR parameter, so enforce this also for the fast
-            // preview window
-            // vigra_ext::EMoR::createEMoRLUT(dest_img.outputEMoRParams, outLut);
-            vigra_ext::EMoR::createEMoRLUT(m_viewState->GetSrcImage(0)->getEMoRParams(), outLut);
-            vigra_ext::enforceMonotonicity(outLut);
-            invResponse.setOutput(1.0 / pow(2.0, dest_img.outputExposureValue),
-                outLut, 255.0);
-            /*} else {
-               // HDR output. not sure how that would be handled by the opengl
-               // preview, though. It might be possible to apply a logarithmic
-               // lookup table here, and average the overlapping pixels
-               // in the OpenGL renderer?
-               // TODO
-               invResponse.setHDROutput();
-               }*/
-            // now perform the corrections
-            double scale_x = (double)src_img.getSize().width() / (double)wo,
-                scale_y = (double)src_img.getSize().height() / (double)ho;
 #pragma omp parallel for
             for (int y = 0; y < ho; y++)
             {
-                for (int x = 0; x < wo; x++)
-                {
-                    double sx = (double)x * scale_x,
-                        sy = (double)y * scale_y;
-                    out_img[y][x] = invResponse(out_img[y][x],
-                        hugin_utils::FDiff2D(sx, sy));
-                }
-                // now take color profiles in file and of monitor into account
-                if (transform != NULL)
-                {
-                    cmsDoTransform(transform, out_img[y], out_img[y], out_img.width());
-                };
-            }
-        }
-        else
-        {
-            // no photometric correction
-            if (transform != NULL)
-            {
-#pragma omp parallel for
-                for (int y = 0; y < ho; y++)
-                {
-                    cmsDoTransform(transform, out_img[y], out_img[y], out_img.width());
-                };
+                cmsDoTransform(transform, out_img[y], out_img[y], out_img.width());
             };
         };
-        if (transform != NULL)
-        {
-            cmsDeleteTransform(transform);
-        };
-        if (inputICC != NULL)
-        {
-            cmsCloseProfile(inputICC);
-        };
-    }
-    
-    //  make all of the smaller ones until we are done.
-    // this will use a box filter.
-    // dependent on OpenGL 1.3. Might need an alternative for 1.2.
-    // TODO use texture compresion?
-    DEBUG_INFO("Defining mipmap levels " <<  min << " to " << max
-          << " of texture " << num << ", starting with a size of "
-          << wo << " by " << ho << ".");
-    GLint error;
-    if (has_mask)
+    };
+
+    const unsigned int channels = job.has_mask ? 4 : 3;
+    levels.resize(last_level - first_level + 1);
+    MipLevel &first = levels[0];
+    first.level = first_level;
+    first.width = wo;
+    first.height = ho;
+    first.data.resize(wo * ho * channels);
+    if (job.has_mask)
     {
         // combine the alpha bitmap with the red green and blue one.
-        unsigned char *image = new unsigned char[ho * wo * 4];
-        unsigned char *pix_start = image;
+        unsigned char *pix_start = first.data.data();
         for (int h = 0; h < ho; h++)
         {
             for (int w = 0; w < wo; w++)
@@ -986,39 +1594,107 @@ void TextureManager::TextureInfo::DefineLevels(int min,
                 pix_start[0] = out_img[h][w].red();
                 pix_start[1] = out_img[h][w].green();
                 pix_start[2] = out_img[h][w].blue();
-                pix_start[3] = (*out_alpha)[h][w];
+                pix_start[3] = out_alpha[h][w];
                 pix_start += 4;
             }
         }
-        // We don't need to worry about levels with the ATI bug work around,
-        // and Windows doesn't like it as gluBuild2DMipmapLevels is in OpenGL
-        // version 1.3 and above only (Microsoft's SDK only uses 1.1)
-        error = gluBuild2DMipmaps/*Levels*/(GL_TEXTURE_2D, GL_RGBA8, wo, ho,
-                               GL_RGBA, GL_UNSIGNED_BYTE, /*min, min, max,*/
-                               image);
-        delete [] image;
-        delete out_alpha;
     } else {
         // we don't need to rearange the data in memory if there is no mask.
-        error = gluBuild2DMipmaps/*Levels*/(GL_TEXTURE_2D, GL_RGB8, wo, ho,
-                               GL_RGB, GL_UNSIGNED_BYTE, /*min, min, max,*/
-                               (unsigned char *) out_img.data());
+        const unsigned char *data = (const unsigned char *) out_img.data();
+        std::copy(data, data + first.data.size(), first.data.begin());
     }
-    if (error)
+    //  make all of the smaller ones until we are done.
+    // this will use a box filter.
+    for (size_t i = 1; i < levels.size(); i++)
     {
-        DEBUG_ERROR("GLU Error when building mipmap levels: "
-                  << gluErrorString(error) << ".");
+        const MipLevel &src = levels[i - 1];
+        MipLevel &dest = levels[i];
+        dest.level = src.level + 1;
+        dest.width = std::max(1u, src.width / 2);
+        dest.height = std::max(1u, src.height / 2);
+        dest.data.resize(dest.width * dest.height * channels);
+        ReduceLevel(src.data.data(), src.width, src.height, dest.data.data(), channels);
     }
-    error = glGetError();
-    if (error != GL_NO_ERROR)
+}
+
+void TextureManager::TextureInfo::CancelPrepareJob()
+{
+    if (m_prepareJob)
     {
-        DEBUG_ERROR("GL Error when bulding mipmap levels: "
-                  << gluErrorString(error) << ".");
+        std::lock_guard<std::mutex> lock(m_prepareJob->mutex);
+        m_prepareJob->cancelled = true;
     }
-    SetParameters();
-    DEBUG_INFO("Finsihed loading texture.");
+    m_prepareJob.reset();
+    m_uploadLevels.clear();
+    m_uploadRow = 0;
+}
 
+unsigned int TextureManager::TextureInfo::NextUploadSize()
+{
+    if (m_uploadLevels.empty())
+    {
+        if (!m_prepareJob)
+        {
+            return 0;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_prepareJob->mutex);
+            if (!m_prepareJob->ready)
+            {
+                return 0;
+            }
+            m_uploadLevels.swap(m_prepareJob->levels);
+        }
+        m_prepareJob.reset();
+        m_uploadRow = 0;
+        if (m_uploadLevels.empty())
+        {
+            return 0;
+        }
+    }
+    // the least detailed level is uploaded first.
+    return m_uploadLevels.back().width * m_uploadLevels.back().height;
+}
 
+unsigned int TextureManager::TextureInfo::UploadLevel(unsigned int budget)
+{
+    if (m_uploadLevels.empty())
+    {
+        return 0;
+    }
+    const MipLevel &level = m_uploadLevels.back();
+    const GLenum format = has_mask ? GL_RGBA : GL_RGB;
+    const unsigned int channels = has_mask ? 4 : 3;
+    BindImageTexture();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (m_uploadRow == 0)
+    {
+        // allocate the level, it is filled in parts
+        glTexImage2D(GL_TEXTURE_2D, level.level, has_mask ? GL_RGBA8 : GL_RGB8,
+                     level.width, level.height, 0, format, GL_UNSIGNED_BYTE, NULL);
+    }
+    const unsigned int rows = std::min(level.height - m_uploadRow,
+                                       std::max(1u, budget / level.width));
+    glTexSubImage2D(GL_TEXTURE_2D, level.level, 0, m_uploadRow, level.width, rows,
+                    format, GL_UNSIGNED_BYTE,
+                    level.data.data() + m_uploadRow * level.width * channels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    m_uploadRow += rows;
+    const unsigned int uploaded = rows * level.width;
+    if (m_uploadRow == level.height)
+    {
+        // the level is complete, so we can draw with it.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level.level);
+        m_uploadLevels.pop_back();
+        m_uploadRow = 0;
+    }
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        DEBUG_ERROR("GL Error when uploading mipmap level: "
+                  << gluErrorString(error) << ".");
+    }
+    return uploaded;
 }
 
 void TextureManager::TextureInfo::DefineMaskTexture(const HuginBase::SrcPanoImage &srcImg)
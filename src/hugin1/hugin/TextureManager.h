@@ -35,13 +35,23 @@
  * to be the smallest 1 by 1 pixel image. We use this convention too.
  */
 
+/* The mip levels are prepared in a background thread. Only the coarse levels
+ * are made at once, so the image can be shown immediately. The finer levels
+ * are uploaded in parts in the following frames, with a limited number of
+ * texels per frame, so the preview stays responsive while it gets sharper.
+ * If the hardware supports GLSL, the photometric correction is done in a
+ * fragment shader, otherwise it is applied to the textures when they are made.
+ */
+
 #ifndef _TextureManager_h
 #define _TextureManager_h
 
 #include <string>
 #include <map>
 #include <memory>
+#include <vector>
 #include <huginapp/ImageCache.h>
+#include <hugin_utils/thread_pool.h>
 #include "panodata/Panorama.h"
 
 //class GLViewer;
@@ -64,6 +74,9 @@ public:
     void SetPhotometricCorrect(bool state);
     // return true if we are doing photometric correction.
     bool GetPhotometricCorrect() {return photometric_correct;}
+    // return true if some textures are still prepared or uploaded. The
+    // preview should be redrawn until this is false.
+    bool HasPendingUploads();
     // get the OpneGL texture name for a given image
     unsigned int GetTextureName(unsigned int image_number);
     // binds the texture for a given image
@@ -82,6 +95,30 @@ protected:
     float viewer_exposure;
     // remove textures for deleted images.
     void CleanTextures();
+    // pixel data of one mip level, 8 bit RGB, or RGBA if the image has a mask.
+    struct MipLevel
+    {
+        int level;
+        unsigned int width, height;
+        std::vector<unsigned char> data;
+    };
+    // the preparation of mip levels in the background, see TextureManager.cpp
+    struct PrepareJob;
+    // a single background thread runs the jobs, they use OpenMP themselves
+    std::shared_ptr<hugin_utils::ThreadPool> m_prepareThread;
+    hugin_utils::ThreadPool * GetPrepareThread();
+    // scales, corrects and filters the levels first_level to last_level of
+    // the texture described by job. The levels are returned in levels, the
+    // most detailed first. This is thread safe.
+    static void PrepareLevels(const PrepareJob &job, int first_level,
+                              int last_level, std::vector<MipLevel> &levels);
+    // upload the levels prepared in the background, limited by
+    // GetMaxUploadTexels. The smallest levels of the images on screen are
+    // done first, then the ones of the images just off screen.
+    void UploadPendingLevels();
+    // replace the texture of an image by a new one with the given size.
+    void MakeTexture(unsigned int image_index, unsigned int width_p,
+                     unsigned int height_p, bool prefetch);
     class TextureInfo
     {
     public:
@@ -100,6 +137,12 @@ protected:
         unsigned int width_p, height_p;
         // min_lod is the most detailed mipmap level defined
         int min_lod;
+        // the value of the update counter when the image was last visible
+        // or close to the visible area, to shrink the oldest textures first.
+        unsigned long last_visible;
+        // true if the image is not on screen but may be soon. The image is
+        // loaded and uploaded after the ones on screen.
+        bool prefetch;
         
         void DefineLevels(int min, int max,
                           bool photometric_correct,
@@ -108,6 +151,14 @@ protected:
         void DefineMaskTexture(const HuginBase::SrcPanoImage &srcImg);
         void UpdateMask(const HuginBase::SrcPanoImage &srcImg);
         void SetMaxLevel(int level);
+        // returns the number of texels in the next level, which is waiting
+        // for the upload, or 0 if there is none.
+        unsigned int NextUploadSize();
+        // upload rows of the next waiting level, about budget texels but at
+        // least one row. Returns the number of texels uploaded.
+        unsigned int UploadLevel(unsigned int budget);
+        // returns true if levels are prepared or waiting for the upload
+        bool HasPendingLevels() {return m_prepareJob || !m_uploadLevels.empty();};
         void Bind();
         void BindImageTexture();
         void BindMaskTexture();
@@ -123,6 +174,14 @@ protected:
         ViewState *m_viewState;
         /// a request for an image, if it was not loaded before.
         HuginBase::ImageCache::RequestPtr m_imageRequest;
+        /// the finer levels, which are prepared in the background.
+        std::shared_ptr<PrepareJob> m_prepareJob;
+        /// prepared levels waiting for the upload, the most detailed first.
+        std::vector<MipLevel> m_uploadLevels;
+        /// number of rows of the last level in m_uploadLevels already uploaded.
+        unsigned int m_uploadRow;
+        // stop preparing and uploading levels
+        void CancelPrepareJob();
         // this binds a new texture in openGL and sets the various parameters
         // we need for it.
         void CreateTexture();
@@ -170,8 +229,43 @@ protected:
     unsigned int GetMaxTotalTexels();
     // this is the maximum size a single texture is supported on the hardware.
     unsigned int GetMaxTextureSizePower(); 
+    // number of texels uploaded to the graphics card in each frame.
+    unsigned int GetMaxUploadTexels();
+    // size of the textures of images which are not visible.
+    double GetMinTexels();
+    // the images in this fraction of the view size around the visible area
+    // are prefetched.
+    double GetPrefetchMargin();
+    // share of the texture memory for prefetched images, relative to the
+    // images on screen.
+    double GetPrefetchWeight();
+    // counts the calls of CheckUpdate, used to find the least recently
+    // visible textures.
+    unsigned long update_counter;
     float texel_density;          // multiply by angles to get optimal size.
     bool photometric_correct;
+    // true if the photometric correction is applied to the textures. The
+    // texture keys point to this, as the textures only depend on the
+    // photometric parameters in this case.
+    bool photometric_in_texture;
+    void UpdatePhotometricInTexture();
+    // checks if GLSL can be used for the photometric correction.
+    void InitShader();
+    bool shader_checked;
+    bool photometric_shader;
+    // GLSL program for the photometric correction of one image, generated
+    // by InvResponseTransform::emitGLSL like for the GPU remapping.
+    class PhotometricProgram;
+    // returns the program for img and the current output exposure and
+    // response, it is created if necessary. Returns NULL on errors.
+    PhotometricProgram * GetPhotometricProgram(const HuginBase::SrcPanoImage &img);
+    typedef std::map<TextureKey, std::shared_ptr<PhotometricProgram> > PhotometricProgramsMap;
+    PhotometricProgramsMap photometric_programs;
+    // output exposure and response of the programs, the output response is
+    // the response of the first image like in the stitcher.
+    double programs_exposure;
+    std::vector<float> programs_EMoR_params;
+    std::vector<double> programs_dest_lut;
 };
 
 #endif
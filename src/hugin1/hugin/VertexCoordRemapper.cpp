@@ -110,18 +110,18 @@ VertexCoordRemapper::VertexCoordRemapper(HuginBase::Panorama *m_pano_in,
     
 }
 
-void VertexCoordRemapper::UpdateAndResetIndex()
+void VertexCoordRemapper::UpdateAndResetIndex(ViewPtr new_view)
 {
     DEBUG_DEBUG("mesh update update reset index");
-    // this sets scale, height, and width.
-    MeshRemapper::UpdateAndResetIndex();
+    // this sets view, scale, height, and width.
+    MeshRemapper::UpdateAndResetIndex(new_view);
     // we need to record the output projection for flipping around 180 degrees.
-    output_projection = visualization_state->GetOptions()->getProjection();
-    o_width = visualization_state->GetOptions()->getWidth();
-    o_height = visualization_state->GetOptions()->getHeight();
+    output_projection = view->options.getProjection();
+    o_width = view->options.getWidth();
+    o_height = view->options.getHeight();
     // we want to make a remapped mesh, get the transformation we need:
 //    HuginBase::SrcPanoImage *src = visualization_state->GetSrcImage(image_number);
-    transform.createInvTransform(*image, *(visualization_state->GetOptions()));
+    transform.createInvTransform(*image, view->options);
     // use the scale to determine edge lengths in pixels for subdivision
 //    DEBUG_INFO("updating mesh for image " << image_number << ", using scale "
 //              << scale << ".\n");
@@ -129,7 +129,7 @@ void VertexCoordRemapper::UpdateAndResetIndex()
     // {x|y}_add_360's are added to a value near the left/top boundary to get
     // the corresponding point over the right/bottom boundary.
     // other values are used to check where the boundary is.
-    OutputProjectionInfo *info = visualization_state->GetProjectionInfo();
+    const OutputProjectionInfo *info = &view->projection_info;
     x_add_360 = info->GetXAdd360();
     radius = info->GetRadius();
     y_add_360 = info->GetYAdd360();
@@ -291,10 +291,10 @@ void VertexCoordRemapper::DiscontinuityFlip(double vertex_c[2])
             if (vertex_c[0] < x_midpoint)
             {
                 vertex_c[0] +=
-                      visualization_state->GetProjectionInfo()->GetXAdd360(vertex_c[1]);
+                      view->projection_info.GetXAdd360(vertex_c[1]);
             } else {
                 vertex_c[0] -=
-                      visualization_state->GetProjectionInfo()->GetXAdd360(vertex_c[1]);
+                      view->projection_info.GetXAdd360(vertex_c[1]);
             }
             break;
         case HuginBase::PanoramaOptions::TRANSVERSE_MERCATOR:
@@ -559,7 +559,7 @@ void VertexCoordRemapper::TestSubdivide(unsigned int node_id)
         }
         // if the face is entirely off the screen, we should not subdivide it.
         // get the screen area
-        vigra::Rect2D viewport = visualization_state->GetVisibleArea();
+        vigra::Rect2D viewport = view->visible_area;
         // add a margin for safety, we don't want to clip too much stuff that
         // curls back on to the screen. We add 2 as we need some space around 
         // very small panoramas that have enlarged to fit the preview window, 
@@ -605,7 +605,7 @@ void VertexCoordRemapper::TestSubdivide(unsigned int node_id)
         // across the '0 degree' point, and true for faces that span the +/-180
         // degree split. It doesn't really matter what it is set to otherwise.
         bool noncontinuous = false;
-        OutputProjectionInfo *i = visualization_state->GetProjectionInfo();
+        const OutputProjectionInfo *i = &view->projection_info;
         switch (output_projection)
         {
             case HuginBase::PanoramaOptions::RECTILINEAR:
@@ -66,7 +66,7 @@ class VertexCoordRemapper : public MeshRemapper
 public:
     VertexCoordRemapper(HuginBase::Panorama *m_pano, HuginBase::SrcPanoImage * image,
                        VisualizationState *visualization_state);
-    virtual void UpdateAndResetIndex();
+    virtual void UpdateAndResetIndex(ViewPtr new_view);
     // get the texture and vertex coordinates for the next face. The coordinates
     //    are ordered [left / right][top / bottom][x coord / y coord].
     virtual bool GetNextFaceCoordinates(Coords *result);
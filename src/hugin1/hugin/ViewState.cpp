@@ -28,6 +28,8 @@
 
 #include "ViewState.h"
 #include "MeshManager.h"
+#include "GLViewer.h"
+#include <algorithm>
 
 
 
@@ -205,9 +207,13 @@ void ViewState::SetSrcImage(unsigned int image_nr, HuginBase::SrcPanoImage *new_
             || new_img->getHFOV() != img->getHFOV()
             || new_img->getProjection() != img->getProjection()
             || new_img->getShear() != img->getShear()
+            || new_img->getTranslationPlaneYaw() != img->getTranslationPlaneYaw()
+            || new_img->getTranslationPlanePitch() != img->getTranslationPlanePitch()
+            || new_img->getSize() != img->getSize()
             || new_img->getRadialDistortionCenterShift()
-                                       == img->getRadialDistortionCenterShift()
+                                       != img->getRadialDistortionCenterShift()
             || new_img->getRadialDistortion() != img->getRadialDistortion()
+            || new_img->getCropMode() != img->getCropMode()
             || new_img->getCropRect() != img->getCropRect()
            )
         {
@@ -343,6 +349,23 @@ void ViewState::DoUpdates()
     DEBUG_DEBUG("VIEW STATE END DO UPDATES");
 }
 
+double ViewState::GetVisibleFraction(unsigned int image_nr, double margin)
+{
+    double fraction = 0.0;
+    bool found = false;
+    for (std::map<VisualizationState*,bool>::iterator it = vis_states.begin() ; it != vis_states.end() ; ++it)
+    {
+        // only count the views which are shown at the moment.
+        if (!(it->second)) continue;
+        GLViewer *viewer = it->first->GetViewer();
+        if (!viewer->IsActive() || viewer->m_visualization_state != it->first) continue;
+        found = true;
+        fraction = std::max(fraction, it->first->GetVisibleFraction(image_nr, margin));
+    }
+    // without a view we don't know, so treat all images as visible.
+    return found ? fraction : 1.0;
+}
+
 void ViewState::Redraw()
 {
 
@@ -454,10 +477,33 @@ void VisualizationState::FinishedDraw()
 void VisualizationState::DoUpdates()
 {
     DEBUG_DEBUG("BEGIN UPDATES");
-    m_view_state->DoUpdates();
-    DEBUG_DEBUG("END UPDATES");
+    // the meshes first, the texture sizes depend on which images are visible.
     m_mesh_manager->CheckUpdate();
     DEBUG_DEBUG("END UPDATES");
+    m_view_state->DoUpdates();
+    DEBUG_DEBUG("END UPDATES");
+}
+
+double VisualizationState::GetVisibleFraction(unsigned int image_nr, double margin)
+{
+    vigra::Rect2D box;
+    if (!m_mesh_manager->GetBoundingBox(image_nr, box) || visible_area.isEmpty())
+    {
+        return 1.0;
+    }
+    if (box.isEmpty())
+    {
+        return 0.0;
+    }
+    vigra::Rect2D area(visible_area);
+    area.addBorder(int(margin * visible_area.width()), int(margin * visible_area.height()));
+    const double box_area = double(box.width()) * double(box.height());
+    box &= area;
+    if (box.isEmpty())
+    {
+        return 0.0;
+    }
+    return double(box.width()) * double(box.height()) / box_area;
 }
 
 unsigned int VisualizationState::GetMeshDisplayList(unsigned int image_number)
@@ -114,6 +114,10 @@ public:
     bool RequireRecalculateMasks(unsigned int image_nr);
     // return true if images have been removed
     bool ImagesRemoved();
+    // return the fraction of the remapped image which is on screen in any of
+    // the active views. The visible areas are enlarged by margin times their
+    // size, to find images which are just off screen.
+    double GetVisibleFraction(unsigned int image_nr, double margin = 0.0);
     
     // this is called when a draw has been performed, so we can assume the
     // drawing state (textures, meshes) are now all up to date.
@@ -224,6 +228,10 @@ public:
 
     ViewState* getViewState() {return m_view_state;}
 
+    // return the fraction of the bounding box of the remapped image inside
+    // the visible area enlarged by margin times its size, 1 if unknown.
+    virtual double GetVisibleFraction(unsigned int image_nr, double margin = 0.0);
+
     // redraw the preview, but only if something has changed.
     void Redraw();
 
@@ -276,6 +284,9 @@ public:
     OverviewVisualizationState(HuginBase::Panorama* pano, ViewState* view_state, GLViewer * viewer, void(*RefreshFunction)(void*), void *arg, M* classArg)
         : VisualizationState(pano, view_state, viewer, RefreshFunction, arg, (M*) classArg) {}
 
+    // the overviews show all images
+    virtual double GetVisibleFraction(unsigned int image_nr, double margin = 0.0) {return 1.0;}
+
 };
 
 class PanosphereOverviewVisualizationState : public OverviewVisualizationState
@@ -57,6 +57,8 @@
 
 // Image cache defaults
 #define HUGIN_IMGCACHE_UPPERBOUND             268435456
+// size of the disk cache for the small images in MB, 0 disables the cache
+#define HUGIN_IMGCACHE_DISK_UPPERBOUND        512l
 #define HUGIN_IMGCACHE_MAPPING_INTEGER        0l
 #define HUGIN_IMGCACHE_MAPPING_FLOAT          1l
 
@@ -188,4 +190,7 @@
 //photometric optimizer
 #define HUGIN_PHOTOMETRIC_OPTIMIZER_NRPOINTS 200l
 
+//geometric optimizer
+#define HUGIN_OPTIMIZER_INCREMENTAL_HOPS 1l
+
 #endif // _CONFIG_DEFAULTS_H
@@ -134,10 +134,11 @@ UIntSet getImagesinROI(const PanoramaData& pano, const UIntSet activeImages, vig
     UIntSet images;
     PanoramaOptions opts = pano.getOptions();
     opts.setROI(panoROI);
-    for (UIntSet::const_iterator it = activeImages.begin(); it != activeImages.end(); ++it)
+    const std::vector<vigra::Rect2D> rois = estimateOutputROIs(pano, opts, activeImages);
+    std::vector<vigra::Rect2D>::const_iterator roi = rois.begin();
+    for (UIntSet::const_iterator it = activeImages.begin(); it != activeImages.end(); ++it, ++roi)
     {
-        vigra::Rect2D roi = estimateOutputROI(pano, opts, *it);
-        if (!(roi.isEmpty()))
+        if (!(roi->isEmpty()))
         {
             images.insert(*it);
         }
@@ -26,7 +26,7 @@
 #include "ComputeImageROI.h"
 
 #include <algorithm>
-#include <nona/RemappedPanoImage.h>
+#include <cmath>
 #include <nona/RemappedPanoImage.h>
 
 
@@ -229,6 +229,171 @@ void estimateImageRect(const SrcPanoImage & src, const PanoramaOptions & dest,
     estimateImageAlpha(src, dest, transf, imgRect, img, scale);
 }
 
+namespace
+{
+
+/** parametrisation of the border of the crop area of an image.
+ *
+ *  The parameter t runs from 0 to 4, each unit covers one side of the crop
+ *  rectangle or one quadrant of the crop circle.
+ */
+class CropOutline
+{
+public:
+    explicit CropOutline(const SrcPanoImage& src)
+    {
+        const vigra::Rect2D crop = src.getCropRect();
+        // outer border of the pixels
+        m_ul = hugin_utils::FDiff2D(crop.left() - 0.5, crop.top() - 0.5);
+        m_lr = hugin_utils::FDiff2D(crop.right() - 0.5, crop.bottom() - 0.5);
+        m_circle = src.getCropMode() == SrcPanoImage::CROP_CIRCLE;
+        m_center = (m_ul + m_lr) / 2.0;
+        m_radius = std::min(crop.width(), crop.height()) / 2.0;
+    };
+
+    hugin_utils::FDiff2D operator()(double t) const
+    {
+        if (m_circle)
+        {
+            const double phi = t * M_PI / 2.0;
+            return hugin_utils::FDiff2D(m_center.x + m_radius * cos(phi), m_center.y + m_radius * sin(phi));
+        };
+        const int side = std::min(static_cast<int>(t), 3);
+        const double f = t - side;
+        switch (side)
+        {
+            case 0:
+                return hugin_utils::FDiff2D(m_ul.x + f * (m_lr.x - m_ul.x), m_ul.y);
+            case 1:
+                return hugin_utils::FDiff2D(m_lr.x, m_ul.y + f * (m_lr.y - m_ul.y));
+            case 2:
+                return hugin_utils::FDiff2D(m_lr.x - f * (m_lr.x - m_ul.x), m_lr.y);
+            default:
+                return hugin_utils::FDiff2D(m_ul.x, m_lr.y - f * (m_lr.y - m_ul.y));
+        };
+    };
+
+private:
+    hugin_utils::FDiff2D m_ul;
+    hugin_utils::FDiff2D m_lr;
+    hugin_utils::FDiff2D m_center;
+    double m_radius;
+    bool m_circle;
+};
+
+/** traces the outline of an image in the panorama with an adaptive sampling.
+ *
+ *  A segment of the outline is only subdivided when the projected midpoint
+ *  deviates from the chord, so straight parts of the outline need only a few
+ *  transformations, but strongly bent parts are still followed exactly.
+ */
+class OutlineTracer
+{
+public:
+    OutlineTracer(const CropOutline& outline, const PTools::Transform& invTransf, const double maxJump)
+        : m_outline(outline), m_transf(invTransf), m_maxJump2(maxJump * maxJump),
+          m_ul(DBL_MAX, DBL_MAX), m_lr(-DBL_MAX, -DBL_MAX)
+    {};
+
+    /** traces the whole outline
+     *  @return false if the outline could not be traced reliably, e.g. because
+     *          a point could not be transformed or the outline jumps over the
+     *          border of a 360 deg panorama */
+    bool trace()
+    {
+        // start with some segments per side, so that symmetric bends are not missed
+        const int initialSegments = 32;
+        double t0 = 0;
+        hugin_utils::FDiff2D p0;
+        if (!transform(t0, p0))
+        {
+            return false;
+        };
+        for (int i = 1; i <= initialSegments; ++i)
+        {
+            const double t1 = 4.0 * i / initialSegments;
+            hugin_utils::FDiff2D p1;
+            if (!transform(t1, p1) || !traceSegment(t0, p0, t1, p1, 0))
+            {
+                return false;
+            };
+            t0 = t1;
+            p0 = p1;
+        };
+        return true;
+    };
+
+    /** returns the bounding box of the traced outline */
+    vigra::Rect2D getBoundingBox() const
+    {
+        // the outline deviates up to the tolerance from the samples
+        return vigra::Rect2D(hugin_utils::floori(m_ul.x - 1), hugin_utils::floori(m_ul.y - 1),
+                             hugin_utils::ceili(m_lr.x + 1) + 1, hugin_utils::ceili(m_lr.y + 1) + 1);
+    };
+
+private:
+    bool transform(double t, hugin_utils::FDiff2D& p)
+    {
+        const hugin_utils::FDiff2D srcPoint = m_outline(t);
+        if (!m_transf.transformImgCoord(p.x, p.y, srcPoint.x, srcPoint.y) || !std::isfinite(p.x) || !std::isfinite(p.y))
+        {
+            return false;
+        };
+        m_ul.x = std::min(m_ul.x, p.x);
+        m_ul.y = std::min(m_ul.y, p.y);
+        m_lr.x = std::max(m_lr.x, p.x);
+        m_lr.y = std::max(m_lr.y, p.y);
+        return true;
+    };
+
+    bool traceSegment(double t0, const hugin_utils::FDiff2D& p0, double t1, const hugin_utils::FDiff2D& p1, int depth)
+    {
+        const double tolerance = 0.5;
+        const int maxDepth = 20;
+        const hugin_utils::FDiff2D chord = p1 - p0;
+        const double chordLength2 = chord.squareLength();
+        if (chordLength2 > m_maxJump2)
+        {
+            return false;
+        };
+        if (depth >= maxDepth)
+        {
+            return true;
+        };
+        const double tm = (t0 + t1) / 2.0;
+        hugin_utils::FDiff2D pm;
+        if (!transform(tm, pm))
+        {
+            return false;
+        };
+        // distance of the midpoint from the chord
+        const hugin_utils::FDiff2D d = pm - p0;
+        double deviation2;
+        if (chordLength2 > 0)
+        {
+            const double cross = chord.x * d.y - chord.y * d.x;
+            deviation2 = cross * cross / chordLength2;
+        }
+        else
+        {
+            deviation2 = d.squareLength();
+        };
+        if (deviation2 <= tolerance * tolerance)
+        {
+            return true;
+        };
+        return traceSegment(t0, p0, tm, pm, depth + 1) && traceSegment(tm, pm, t1, p1, depth + 1);
+    };
+
+    const CropOutline& m_outline;
+    const PTools::Transform& m_transf;
+    const double m_maxJump2;
+    hugin_utils::FDiff2D m_ul;
+    hugin_utils::FDiff2D m_lr;
+};
+
+} // namespace
+
     vigra::Rect2D estimateOutputROI(const PanoramaData & pano, const PanoramaOptions & opts, unsigned i)
     {
         vigra::Rect2D imageRect;
@@ -236,20 +401,49 @@ void estimateImageRect(const SrcPanoImage & src, const PanoramaOptions & dest,
         PTools::Transform transf;
         transf.createTransform(srcImg, opts);
         estimateImageRect(srcImg, opts, transf, imageRect);
+        if (imageRect.isEmpty())
+        {
+            return imageRect;
+        };
+        // the coarse estimate above is robust, but only accurate up to a few pixels
+        // of the miniature panorama. If the image does not touch the border of the
+        // output, its outline encloses the remapped image, so the tighter bounding
+        // box of the outline can be used.
+        const vigra::Rect2D& roi = opts.getROI();
+        if (imageRect.left() <= roi.left() || imageRect.top() <= roi.top() ||
+            imageRect.right() >= roi.right() || imageRect.bottom() >= roi.bottom())
+        {
+            return imageRect;
+        };
+        PTools::Transform invTransf;
+        invTransf.createInvTransform(srcImg, opts);
+        CropOutline outline(srcImg);
+        OutlineTracer tracer(outline, invTransf, opts.getWidth() / 2.0);
+        if (tracer.trace())
+        {
+            imageRect &= tracer.getBoundingBox();
+        };
         return imageRect;
     }
 
-    std::vector<vigra::Rect2D> ComputeImageROI::computeROIS(const PanoramaData& panorama,
-                                                            const PanoramaOptions & opts,
-                                                            const UIntSet & images)
+    std::vector<vigra::Rect2D> estimateOutputROIs(const PanoramaData & pano, const PanoramaOptions & opts, const UIntSet & images)
     {
-        std::vector<vigra::Rect2D> res;
-        for (UIntSet::const_iterator it = images.begin(); 
-             it != images.end(); ++it)
+        const UIntVector imgs(images.begin(), images.end());
+        std::vector<vigra::Rect2D> res(imgs.size());
+        // the images are independent, so estimate their ROIs in parallel
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(imgs.size()); ++i)
         {
-            res.push_back(estimateOutputROI(panorama, panorama.getOptions(), *it));
+            res[i] = estimateOutputROI(pano, opts, imgs[i]);
         }
         return res;
     }
 
+    std::vector<vigra::Rect2D> ComputeImageROI::computeROIS(const PanoramaData& panorama,
+                                                            const PanoramaOptions & opts,
+                                                            const UIntSet & images)
+    {
+        return estimateOutputROIs(panorama, panorama.getOptions(), images);
+    }
+
 }
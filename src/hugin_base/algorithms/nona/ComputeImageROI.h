@@ -37,6 +37,9 @@
 namespace HuginBase {
 
 IMPEX vigra::Rect2D estimateOutputROI(const PanoramaData & pano, const PanoramaOptions & opts, unsigned i);
+/** estimates the ROIs of the given images for the output options opts in parallel,
+ *  the result is in the order of images */
+IMPEX std::vector<vigra::Rect2D> estimateOutputROIs(const PanoramaData & pano, const PanoramaOptions & opts, const UIntSet & images);
 
 class IMPEX ComputeImageROI : public PanoramaAlgorithm
 {
@@ -202,4 +202,43 @@ void ImageGraph::VisitAllImages(const size_t startImg, bool forceAllComponents,
     };
 };
 
+HuginBase::UIntSet ImageGraph::GetImagesInRange(const HuginBase::UIntSet& startImgs, const size_t maxHops) const
+{
+    HuginBase::UIntSet result;
+    if (m_graph.empty())
+    {
+        return result;
+    };
+    // breadth first search, limited to maxHops levels
+    std::vector<bool> visited(m_graph.size(), false);
+    HuginBase::UIntSet currentLevel;
+    for (HuginBase::UIntSet::const_iterator it = startImgs.begin(); it != startImgs.end(); ++it)
+    {
+        if (*it < m_graph.size())
+        {
+            visited[*it] = true;
+            currentLevel.insert(*it);
+        };
+    };
+    result = currentLevel;
+    for (size_t hop = 0; hop < maxHops && !currentLevel.empty(); ++hop)
+    {
+        HuginBase::UIntSet nextLevel;
+        for (HuginBase::UIntSet::const_iterator it = currentLevel.begin(); it != currentLevel.end(); ++it)
+        {
+            for (HuginBase::UIntSet::const_iterator it2 = m_graph[*it].begin(); it2 != m_graph[*it].end(); ++it2)
+            {
+                if (!visited[*it2])
+                {
+                    visited[*it2] = true;
+                    nextLevel.insert(*it2);
+                };
+            };
+        };
+        result.insert(nextLevel.begin(), nextLevel.end());
+        currentLevel.swap(nextLevel);
+    };
+    return result;
+};
+
 }  // namespace HuginGraph
@@ -69,6 +69,9 @@ public:
     *  @param forceAllComponents if true all images are visited, if false only the images
     *  connected with startImg are visited */
     void VisitAllImages(const size_t startImg, bool forceAllComponents, BreadthFirstSearchVisitor* visitor);
+    /** returns all images which can be reached from the given start images
+    *  with at most maxHops edges, the start images itself are included in the result */
+    HuginBase::UIntSet GetImagesInRange(const HuginBase::UIntSet& startImgs, const size_t maxHops) const;
 private:
     GraphList m_graph;
 }; // class ImageGraph
@@ -29,6 +29,7 @@
 
 #include "ImageGraph.h"
 #include "panodata/StandardImageVariableGroups.h"
+#include "panodata/ImageVariableTranslate.h"
 #include <panotools/PanoToolsOptimizerWrapper.h>
 #include <panotools/PanoToolsInterface.h>
 #include <algorithms/basic/CalculateCPStatistics.h>
@@ -36,6 +37,13 @@
 #include <algorithms/nona/CalculateFOV.h>
 #include <algorithms/basic/LayerStacks.h>
 #include <vigra_ext/ransac.h>
+#include <algorithm>
+#include <iterator>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+#include <hugin_utils/openmp_lock.h>
 
 #if DEBUG
 #include <fstream>
@@ -71,9 +79,29 @@ public:
     std::string m_name;
 };
 
-/** Estimator for RANSAC based adjustment of pairwise parameters */
+/** Estimator for RANSAC based adjustment of pairwise parameters.
+ *
+ *  The Ransac class calls the estimator from several threads, so each thread
+ *  works on its own copy of the two image panorama.
+ */
 class PTOptEstimator
 {
+    /** data used by a single thread */
+    struct ThreadData
+    {
+        ThreadData() : localPano(NULL), trafo_i1_to_pano(NULL), trafo_pano_to_i2(NULL) {};
+        ~ThreadData()
+        {
+            delete localPano;
+            delete trafo_i1_to_pano;
+            delete trafo_pano_to_i2;
+        };
+        PanoramaData * localPano;
+        /** parameters for which the transforms below have been created */
+        std::vector<double> trafoParams;
+        PTools::Transform * trafo_i1_to_pano;
+        PTools::Transform * trafo_pano_to_i2;
+    };
 
 public:
 
@@ -85,11 +113,20 @@ public:
 	UIntSet imgs;
 	imgs.insert(i1);
 	imgs.insert(i2);
-	m_localPano = (pano.getNewSubset(imgs)); // don't forget to delete
+#ifdef HAVE_OPENMP
+    m_threadData.resize(omp_get_max_threads());
+#else
+    m_threadData.resize(1);
+#endif
+    for (size_t i = 0; i < m_threadData.size(); ++i)
+    {
+        m_threadData[i] = new ThreadData;
+        m_threadData[i]->localPano = pano.getNewSubset(imgs);
+    }
 	m_li1 = (i1 < i2) ? 0 : 1;
 	m_li2 = (i1 < i2) ? 1 : 0;
 	// get control points
-	m_cps  = m_localPano->getCtrlPoints();
+	m_cps  = m_threadData[0]->localPano->getCtrlPoints();
 	// only use 2D control points
     for (size_t i = 0; i < m_cps.size();++i)
     {
@@ -134,7 +171,7 @@ public:
 	m_initParams.resize(m_optvars.size());
     for (size_t i = 0; i < m_optvars.size(); ++i)
     {
-        m_initParams[i] = m_optvars[i].get(*m_localPano);
+        m_initParams[i] = m_optvars[i].get(*m_threadData[0]->localPano);
         DEBUG_DEBUG("get init var: " << m_optvars[i].m_name << ", " << m_optvars[i].m_img << ": " << m_initParams[i]);
     }
 }
@@ -163,9 +200,9 @@ public:
 	    cpoints[i] = *points[i];
 	}
 
-	m_localPano->setCtrlPoints(cpoints);
+	PanoramaData * pano = getThreadData().localPano;
+	pano->setCtrlPoints(cpoints);
 
-	PanoramaData * pano = const_cast<PanoramaData *>(m_localPano);
 	// set parameters in pano object
     for (size_t i = 0; i < m_optvars.size(); ++i)
     {
@@ -173,24 +210,19 @@ public:
         DEBUG_DEBUG("Initial " << m_optvars[i].m_name << ": i1:" << pano->getImage(m_li1).getVar(m_optvars[i].m_name) << ", i2: " << pano->getImage(m_li2).getVar(m_optvars[i].m_name));
     }
 
-	m_localPano->setOptimizeVector(m_opt_first_pass);
-	// optimize parameters using panotools (or use a custom made optimizer here?)
-	UIntSet imgs;
-	imgs.insert(0);
-	imgs.insert(1);
-	//std::cout << "Optimizing without hfov:" << std::endl;
-	//pano->printPanoramaScript(std::cerr, m_localPano->getOptimizeVector(), pano->getOptions(), imgs, true );
-	PTools::optimize(*pano);
-	//std::cout << "result:" << std::endl;
-	//pano->printPanoramaScript(std::cerr, m_localPano->getOptimizeVector(), pano->getOptions(), imgs, true );
-
-	if (m_opt_second_pass.size() > 0) {
-	    m_localPano->setOptimizeVector(m_opt_second_pass);
-	    //std::cout << "Optimizing with hfov" << std::endl;
-	    //pano->printPanoramaScript(std::cerr, m_localPano->getOptimizeVector(), pano->getOptions(), imgs, true );
+	pano->setOptimizeVector(m_opt_first_pass);
+	{
+	    // the panotools optimizer uses global variables and is not reentrant,
+	    // the lock is shared by all estimators, so that several RANSAC runs
+	    // (e.g. the image pairs in cpfind) can also run in parallel
+	    hugin_omp::ScopedLock sl(m_optimizerLock);
+	    // optimize parameters using panotools (or use a custom made optimizer here?)
 	    PTools::optimize(*pano);
-	    //std::cout << "result:" << std::endl;
-	    //pano->printPanoramaScript(std::cerr, m_localPano->getOptimizeVector(), pano->getOptions(), imgs, true );
+
+	    if (m_opt_second_pass.size() > 0) {
+		pano->setOptimizeVector(m_opt_second_pass);
+		PTools::optimize(*pano);
+	    }
 	}
 
 	// get optimized parameters
@@ -205,18 +237,23 @@ public:
 
     bool agree(std::vector<double> &p, const ControlPoint & cp) const
     {
-	PanoramaData * pano = const_cast<PanoramaData *>(m_localPano);
-	// set parameters in pano object
-    for (size_t i = 0; i < m_optvars.size(); ++i)
-    {
-        m_optvars[i].set(*pano, p[i]);
-    }
-	// TODO: argh, this is slow, we should really construct this only once
-	// and reuse it for all calls...
-	PTools::Transform trafo_i1_to_pano;
-	trafo_i1_to_pano.createInvTransform(m_localPano->getImage(m_li1),m_localPano->getOptions());
-	PTools::Transform trafo_pano_to_i2;
-	trafo_pano_to_i2.createTransform(m_localPano->getImage(m_li2),m_localPano->getOptions());
+	ThreadData & data = getThreadData();
+	// the transformations are only created once for each tested parameter set
+	if (data.trafoParams != p || data.trafo_i1_to_pano == NULL)
+	{
+	    // set parameters in pano object
+	    for (size_t i = 0; i < m_optvars.size(); ++i)
+	    {
+		m_optvars[i].set(*data.localPano, p[i]);
+	    }
+	    delete data.trafo_i1_to_pano;
+	    delete data.trafo_pano_to_i2;
+	    data.trafo_i1_to_pano = new PTools::Transform;
+	    data.trafo_i1_to_pano->createInvTransform(data.localPano->getImage(m_li1), data.localPano->getOptions());
+	    data.trafo_pano_to_i2 = new PTools::Transform;
+	    data.trafo_pano_to_i2->createTransform(data.localPano->getImage(m_li2), data.localPano->getOptions());
+	    data.trafoParams = p;
+	}
 
 	double x1,y1,x2,y2,xt,yt,x2t,y2t;
 	if (cp.image1Nr == m_li1) {
@@ -230,8 +267,8 @@ public:
 	    x2 = cp.x1;
 	    y2 = cp.y1;
 	}   
-	trafo_i1_to_pano.transformImgCoord(xt, yt, x1, y1);
-	trafo_pano_to_i2.transformImgCoord(x2t, y2t, xt, yt);
+	data.trafo_i1_to_pano->transformImgCoord(xt, yt, x1, y1);
+	data.trafo_pano_to_i2->transformImgCoord(x2t, y2t, xt, yt);
 	DEBUG_DEBUG("Trafo i1 (0 " << x1 << " " << y1 << ") -> ("<< xt <<" "<< yt<<") -> i2 (1 "<<x2t<<", "<<y2t<<"), real ("<<x2<<", "<<y2<<")")
 	// compute error in pixels...
 	x2t -= x2;
@@ -243,7 +280,10 @@ public:
 
     ~PTOptEstimator()
     {
-	delete m_localPano;
+    for (size_t i = 0; i < m_threadData.size(); ++i)
+    {
+        delete m_threadData[i];
+    }
     }
 
     int numForEstimate() const
@@ -257,15 +297,28 @@ public:
     std::vector<OptVarSpec> m_optvars;
 
 private:
+    /** returns the data of the calling thread */
+    ThreadData & getThreadData() const
+    {
+#ifdef HAVE_OPENMP
+        return *m_threadData[omp_get_thread_num()];
+#else
+        return *m_threadData[0];
+#endif
+    }
+
     int m_li1, m_li2;
     double m_maxError;
-    PanoramaData * m_localPano;
+    std::vector<ThreadData *> m_threadData;
     CPVector m_cps;    
     std::vector<std::set<std::string> > m_opt_first_pass;
     std::vector<std::set<std::string> > m_opt_second_pass;
     int m_numForEstimate;
+    static hugin_omp::Lock m_optimizerLock;
 };
 
+hugin_omp::Lock PTOptEstimator::m_optimizerLock;
+
 
 std::vector<int> RANSACOptimizer::findInliers(PanoramaData & pano, int i1, int i2, double maxError, Mode rmode)
 {
@@ -383,6 +436,132 @@ void AutoOptimise::autoOptimise(PanoramaData& pano, bool optRoll)
     delete optPano;
 }
 
+/** check if the variable code of image imgNr is linked with an image outside of imgs */
+static bool IsLinkedOutside(const PanoramaData& pano, const unsigned int imgNr, const std::string& code, const UIntSet& imgs)
+{
+    const SrcPanoImage& img = pano.getImage(imgNr);
+#define image_variable( name, type, default_value ) \
+    if (PTOVariableConverterFor##name::checkApplicability(code)) \
+    {\
+        if (img.name##isLinked())\
+        {\
+            for (unsigned int i = 0; i < pano.getNrOfImages(); ++i)\
+            {\
+                if (!set_contains(imgs, i) && img.name##isLinkedWith(pano.getImage(i)))\
+                {\
+                    return true;\
+                }\
+            }\
+        }\
+        return false;\
+    }\
+    else
+#include "panodata/image_variables.h"
+#undef image_variable
+    {
+        DEBUG_ERROR("Unknown variable " << code);
+    }
+    return true;
+}
+
+UIntSet IncrementalOptimise::incrementalOptimise(PanoramaData& pano, const UIntSet& changedImages, unsigned int hops)
+{
+    HuginGraph::ImageGraph graph(pano);
+    const UIntSet freeImgs = graph.GetImagesInRange(changedImages, hops);
+    // the next ring of images is only used as fixed anchor
+    const UIntSet subsetImgs = graph.GetImagesInRange(changedImages, hops + 1);
+    if (freeImgs.empty())
+    {
+        return freeImgs;
+    };
+    if (subsetImgs.size() == pano.getNrOfImages())
+    {
+        // region covers the whole panorama, there is nothing to gain
+        PTools::optimize(pano);
+        UIntSet allImgs;
+        fill_set(allImgs, 0, pano.getNrOfImages() - 1);
+        return allImgs;
+    };
+
+    // build optimize vector for the subset, keep everything outside of the free region fixed
+    const OptimizeVector& fullOptVec = pano.getOptimizeVector();
+    OptimizeVector optVec;
+    UIntSet optimizedImgs;
+    bool hasOptVars = false;
+    for (UIntSet::const_iterator it = subsetImgs.begin(); it != subsetImgs.end(); ++it)
+    {
+        std::set<std::string> imgOpt;
+        if (set_contains(freeImgs, *it) && *it < fullOptVec.size())
+        {
+            for (std::set<std::string>::const_iterator varIt = fullOptVec[*it].begin(); varIt != fullOptVec[*it].end(); ++varIt)
+            {
+                if (!IsLinkedOutside(pano, *it, *varIt, freeImgs))
+                {
+                    imgOpt.insert(*varIt);
+                };
+            };
+        };
+        if (!imgOpt.empty())
+        {
+            hasOptVars = true;
+            optimizedImgs.insert(*it);
+        };
+        optVec.push_back(imgOpt);
+    };
+    if (!hasOptVars)
+    {
+        return optimizedImgs;
+    };
+
+    PanoramaData* localPano = pano.getNewSubset(subsetImgs); // don't forget to delete
+    localPano->setOptimizeVector(optVec);
+    // the panotools optimizer starts with the current values, so this is a warm start
+    PTools::optimize(*localPano);
+
+    // copy back the results
+    unsigned int localNr = 0;
+    for (UIntSet::const_iterator it = subsetImgs.begin(); it != subsetImgs.end(); ++it, ++localNr)
+    {
+        if (set_contains(optimizedImgs, *it))
+        {
+            pano.updateVariables(*it, localPano->getImageVariables(localNr));
+        };
+    };
+    pano.updateCtrlPointErrors(subsetImgs, localPano->getCtrlPoints());
+    delete localPano;
+    return optimizedImgs;
+}
+
+/** compares control points without the error */
+struct CPLess
+{
+    bool operator()(const ControlPoint& cp1, const ControlPoint& cp2) const
+    {
+        if (cp1.image1Nr != cp2.image1Nr) return cp1.image1Nr < cp2.image1Nr;
+        if (cp1.image2Nr != cp2.image2Nr) return cp1.image2Nr < cp2.image2Nr;
+        if (cp1.mode != cp2.mode) return cp1.mode < cp2.mode;
+        if (cp1.x1 != cp2.x1) return cp1.x1 < cp2.x1;
+        if (cp1.y1 != cp2.y1) return cp1.y1 < cp2.y1;
+        if (cp1.x2 != cp2.x2) return cp1.x2 < cp2.x2;
+        return cp1.y2 < cp2.y2;
+    };
+};
+
+UIntSet IncrementalOptimise::getImagesWithChangedCPs(const CPVector& oldCPs, const CPVector& newCPs)
+{
+    typedef std::multiset<ControlPoint, CPLess> CPSet;
+    const CPSet oldSet(oldCPs.begin(), oldCPs.end());
+    const CPSet newSet(newCPs.begin(), newCPs.end());
+    CPVector diff;
+    std::set_symmetric_difference(oldSet.begin(), oldSet.end(), newSet.begin(), newSet.end(), std::back_inserter(diff), CPLess());
+    UIntSet imgs;
+    for (CPVector::const_iterator it = diff.begin(); it != diff.end(); ++it)
+    {
+        imgs.insert(it->image1Nr);
+        imgs.insert(it->image2Nr);
+    };
+    return imgs;
+}
 
 void SmartOptimise::smartOptimize(PanoramaData& optPano)
 {
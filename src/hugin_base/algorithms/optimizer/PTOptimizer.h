@@ -127,6 +127,47 @@ namespace HuginBase {
 
     };
     
+    /** incremental optimisation after local changes of the control points
+     *
+     *  The optimisation starts from the current solution. Only the variables of the images
+     *  within hops edges (in the ImageGraph) of the changed images are optimized, the next ring
+     *  of images is included as fixed anchor, all other images and their control points are
+     *  ignored. Variables which are linked with images outside the optimized region are kept fixed.
+     */
+    class IMPEX IncrementalOptimise : public PTOptimizer
+    {
+
+        public:
+            ///
+            IncrementalOptimise(PanoramaData& panorama, const UIntSet& changedImages, unsigned int hops = 1)
+             : PTOptimizer(panorama), o_changedImages(changedImages), o_hops(hops)
+            {};
+
+            ///
+            virtual ~IncrementalOptimise()
+            {}
+
+        public:
+            /** optimizes the variables of the optimize vector of pano for the images near changedImages
+             *  @return the set of images, which were optimized */
+            static UIntSet incrementalOptimise(PanoramaData& pano, const UIntSet& changedImages, unsigned int hops = 1);
+            /** returns the images, which control points differ between oldCPs and newCPs
+             *  (added, removed or moved control points, the error is ignored) */
+            static UIntSet getImagesWithChangedCPs(const CPVector& oldCPs, const CPVector& newCPs);
+
+        public:
+            ///
+            virtual bool runAlgorithm()
+            {
+                incrementalOptimise(o_panorama, o_changedImages, o_hops);
+                return true; // let's hope so.
+            }
+
+        private:
+            UIntSet o_changedImages;
+            unsigned int o_hops;
+    };
+
     ///
     class IMPEX SmartOptimizerStub
     {
@@ -24,6 +24,7 @@
 #include "PhotometricOptimizer.h"
 
 #include <fstream>
+#include <algorithm>
 #include <foreign/levmar/levmar.h>
 #include <photometric/ResponseTransform.h>
 #include <algorithms/basic/LayerStacks.h>
@@ -46,6 +47,205 @@ inline double weightHuber(double x, double sigma)
 
 
 
+/** returns the PhotometricOptimizer::PhotometricVariable for the given variable name,
+ *  or -1 if there is no analytic derivative for this variable */
+static int GetPhotometricVariableIndex(const std::string& name)
+{
+    const char* names[] = { "Eev", "Er", "Eb", "Ra", "Rb", "Rc", "Rd", "Re",
+        "Va", "Vb", "Vc", "Vd", "Vx", "Vy" };
+    for (int i = 0; i < PhotometricOptimizer::PV_COUNT; ++i)
+    {
+        if (name == names[i])
+        {
+            return i;
+        };
+    };
+    return -1;
+}
+
+/** derivative of the response curve w.r.t. its input, the lut is linear interpolated
+ *  in the same way as vigra_ext::LUTFunctor::applyLutFloat does, an empty lut is a linear response */
+static double ResponseDerivative(const std::vector<double>& lut, const double v)
+{
+    if (lut.empty())
+    {
+        return 1.0;
+    };
+    if (v > 1 || v < 0 || lut.size() < 2)
+    {
+        return 0.0;
+    };
+    const size_t i = std::min<size_t>(static_cast<size_t>(v * (lut.size() - 1)), lut.size() - 2);
+    return (lut[i + 1] - lut[i]) * (lut.size() - 1);
+}
+
+/** linear interpolated value of the EMoR basis function k at v, this is the derivative
+ *  of the EMoR response curve w.r.t. the EMoR parameter k */
+static double EMoRBasis(const int k, const double v)
+{
+    if (v < 0)
+    {
+        return 0.0;
+    };
+    if (v >= 1)
+    {
+        return vigra_ext::EMoR::h[k][1023];
+    };
+    const double x = v * 1023;
+    const unsigned int i = static_cast<unsigned int>(x);
+    const double dx = x - i;
+    return (1 - dx) * vigra_ext::EMoR::h[k][i] + dx * vigra_ext::EMoR::h[k][i + 1];
+}
+
+/** calculates the factor vignetting*exposure*white balance for each channel at pos and
+ *  the derivatives of the logarithm of this factor w.r.t. the photometric variables */
+static void CalcFactorLogDerivatives(const PhotometricOptimizer::RespFunc& resp, const hugin_utils::FDiff2D& pos,
+                                     double factor[3], double dLogFactor[3][PhotometricOptimizer::PV_COUNT])
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        std::fill(dLogFactor[c], dLogFactor[c] + PhotometricOptimizer::PV_COUNT, 0.0);
+        // exposure is 1/2^Eev
+        dLogFactor[c][PhotometricOptimizer::PV_EEV] = -log(2.0);
+    };
+    const double vig = resp.calcVigFactor(pos);
+    const double common = vig * resp.m_srcExposure;
+    factor[0] = common * resp.m_WhiteBalanceRed;
+    factor[1] = common;
+    factor[2] = common * resp.m_WhiteBalanceBlue;
+    dLogFactor[0][PhotometricOptimizer::PV_ER] = 1.0 / resp.m_WhiteBalanceRed;
+    dLogFactor[2][PhotometricOptimizer::PV_EB] = 1.0 / resp.m_WhiteBalanceBlue;
+    if ((resp.m_VigCorrMode & SrcPanoImage::VIGCORR_RADIAL) && vig != 0)
+    {
+        // same calculation as in ResponseTransform::calcVigFactor
+        hugin_utils::FDiff2D d = pos - resp.m_RadialVigCorrCenter;
+        d *= resp.m_radiusScale;
+        const double r2 = d.x * d.x + d.y * d.y;
+        const std::vector<double>& coeff = resp.m_RadialVigCorrCoeff;
+        const double dVigdr2 = coeff[1] + r2 * (2 * coeff[2] + 3 * coeff[3] * r2);
+        double dVig[6];
+        dVig[0] = 1.0;
+        dVig[1] = r2;
+        dVig[2] = r2 * r2;
+        dVig[3] = r2 * r2 * r2;
+        // the center is the sum of the image center and the center shift Vx/Vy
+        dVig[4] = -2.0 * dVigdr2 * d.x * resp.m_radiusScale;
+        dVig[5] = -2.0 * dVigdr2 * d.y * resp.m_radiusScale;
+        for (int c = 0; c < 3; ++c)
+        {
+            for (int k = 0; k < 6; ++k)
+            {
+                dLogFactor[c][PhotometricOptimizer::PV_VA + k] = dVig[k] / vig;
+            };
+        };
+    };
+}
+
+/** calculates the error between the values of the target image and the values of the source image
+ *  transformed into the target image for all 3 channels and adds the derivatives of the (robust weighted)
+ *  errors to the 3 given rows of the Jacobian
+ *  @return sum of the squared (weighted) errors */
+static double AddErrorDerivatives(const std::vector<PhotometricOptimizer::RespFunc>& resp,
+                                  const std::vector<PhotometricOptimizer::InvRespFunc>& invResp,
+                                  const std::vector<std::vector<int> >& varColumns, const double huberSigma,
+                                  const unsigned int t, const vigra::RGBValue<float>& valT, const hugin_utils::FDiff2D& posT,
+                                  const unsigned int s, const vigra::RGBValue<float>& valS, const hugin_utils::FDiff2D& posS,
+                                  double* rows[3])
+{
+    double factorT[3];
+    double factorS[3];
+    double dLogFactorT[3][PhotometricOptimizer::PV_COUNT];
+    double dLogFactorS[3][PhotometricOptimizer::PV_COUNT];
+    CalcFactorLogDerivatives(resp[t], posT, factorT, dLogFactorT);
+    CalcFactorLogDerivatives(resp[s], posS, factorS, dLogFactorS);
+    const std::vector<int>& colT = varColumns[t];
+    const std::vector<int>& colS = varColumns[s];
+    const bool emorT = resp[t].m_src.getResponseType() == SrcPanoImage::RESPONSE_EMOR && resp[t].m_lutR.size() == 1024;
+    const bool emorS = resp[s].m_src.getResponseType() == SrcPanoImage::RESPONSE_EMOR && resp[s].m_lutR.size() == 1024;
+    // irradiance of the source pixel
+    const vigra::RGBValue<double> irradiance = invResp[s](valS, posS);
+    double sqError = 0;
+    for (int c = 0; c < 3; ++c)
+    {
+        const double u = irradiance[c] * factorT[c];
+        const double y = resp[t].m_lutR.empty() ? u : resp[t].m_lutRFunc(u);
+        const double e = valT[c] - y;
+        // derivative of the robust estimator
+        double h = e;
+        double w = 1.0;
+        if (huberSigma > 0)
+        {
+            const double a = fabs(e);
+            h = weightHuber(a, huberSigma);
+            w = (a > huberSigma) ? huberSigma / h : 1.0;
+            if (e < 0)
+            {
+                w = -w;
+            }
+            else if (e == 0)
+            {
+                w = 0;
+            };
+        };
+        sqError += h * h;
+        if (w == 0)
+        {
+            continue;
+        };
+        double* row = rows[c];
+        // e = valT - L_t(u), u = invL_s(valS) * factorT / factorS
+        const double dLdu = ResponseDerivative(resp[t].m_lutR, u);
+        const double fT = -w * dLdu * u;
+        const double fS = w * dLdu * u;
+        for (int v = PhotometricOptimizer::PV_EEV; v < PhotometricOptimizer::PV_COUNT; ++v)
+        {
+            if (v >= PhotometricOptimizer::PV_RA && v <= PhotometricOptimizer::PV_RE)
+            {
+                continue;
+            };
+            if (colT[v] >= 0)
+            {
+                row[colT[v]] += fT * dLogFactorT[c][v];
+            };
+            if (colS[v] >= 0)
+            {
+                row[colS[v]] += fS * dLogFactorS[c][v];
+            };
+        };
+        // response curve of the target image
+        if (emorT)
+        {
+            for (int k = 0; k < 5; ++k)
+            {
+                const int col = colT[PhotometricOptimizer::PV_RA + k];
+                if (col >= 0)
+                {
+                    row[col] -= w * EMoRBasis(k, u);
+                };
+            };
+        };
+        // inverse response curve of the source image: L_s(l) = valS => dl/dR_k = -h_k(l) / L_s'(l)
+        if (emorS && dLdu != 0 && valS[c] > resp[s].m_lutR.front() && valS[c] < resp[s].m_lutR.back())
+        {
+            const double l = irradiance[c] * factorS[c];
+            const double dLsdl = ResponseDerivative(resp[s].m_lutR, l);
+            if (dLsdl > 0)
+            {
+                const double f = w * dLdu * factorT[c] / factorS[c] / dLsdl;
+                for (int k = 0; k < 5; ++k)
+                {
+                    const int col = colS[PhotometricOptimizer::PV_RA + k];
+                    if (col >= 0)
+                    {
+                        row[col] += f * EMoRBasis(k, l);
+                    };
+                };
+            };
+        };
+    };
+    return sqError;
+}
+
 PhotometricOptimizer::OptimData::OptimData(const PanoramaData & pano, const OptimizeVector & optvars,
                                            const std::vector<vigra_ext::PointPairRGB> & data,
                                            double mEstimatorSigma, bool symmetric,
@@ -116,6 +316,30 @@ PhotometricOptimizer::OptimData::OptimData(const PanoramaData & pano, const Opti
             m_vars.push_back(var);
         }
     }
+
+    // remember which column of the Jacobian belongs to which variable of each image
+    m_iter = 0;
+    m_hasAnalyticJacobian = true;
+    m_varColumns.assign(pano.getNrOfImages(), std::vector<int>(PV_COUNT, -1));
+    for (size_t i = 0; i < m_vars.size(); i++)
+    {
+        const int varIndex = GetPhotometricVariableIndex(m_vars[i].type);
+        if (varIndex < 0)
+        {
+            m_hasAnalyticJacobian = false;
+            continue;
+        };
+        for (std::set<unsigned>::const_iterator it = m_vars[i].imgs.begin(); it != m_vars[i].imgs.end(); ++it)
+        {
+            m_varColumns[*it][varIndex] = static_cast<int>(i);
+        };
+    };
+
+    m_resp.resize(pano.getNrOfImages());
+    m_invResp.resize(pano.getNrOfImages());
+    m_monErr.assign(pano.getNrOfImages(), 0.0);
+    m_monErrDeriv.assign(pano.getNrOfImages(), std::vector<double>(5, 0.0));
+    m_cacheKeys.resize(pano.getNrOfImages());
 }
 
 void PhotometricOptimizer::OptimData::ToX(double * x)
@@ -149,14 +373,70 @@ void PhotometricOptimizer::OptimData::FromX(double * x)
 
 
 
+void PhotometricOptimizer::OptimData::UpdateResponseCache()
+{
+    const int nImg = m_imgs.size();
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nImg; ++i)
+    {
+        const SrcPanoImage& img = m_imgs[i];
+        // all parameters which are used by the response functions
+        std::vector<double> key;
+        key.push_back(img.getResponseType());
+        key.push_back(img.getGamma());
+        key.push_back(img.getExposureValue());
+        key.push_back(img.getWhiteBalanceRed());
+        key.push_back(img.getWhiteBalanceBlue());
+        key.push_back(img.getVigCorrMode());
+        key.push_back(img.getRadialVigCorrCenterShift().x);
+        key.push_back(img.getRadialVigCorrCenterShift().y);
+        key.push_back(img.getSize().width());
+        key.push_back(img.getSize().height());
+        const std::vector<float>& emor = img.getEMoRParams();
+        key.insert(key.end(), emor.begin(), emor.end());
+        const std::vector<double>& vig = img.getRadialVigCorrCoeff();
+        key.insert(key.end(), vig.begin(), vig.end());
+        if (key == m_cacheKeys[i])
+        {
+            continue;
+        };
+        m_cacheKeys[i].swap(key);
+        m_resp[i] = RespFunc(img);
+        m_invResp[i] = InvRespFunc(img);
+        // calculate the monotonicity error and its derivatives
+        m_monErr[i] = 0;
+        std::fill(m_monErrDeriv[i].begin(), m_monErrDeriv[i].end(), 0.0);
+        if (img.getResponseType() == SrcPanoImage::RESPONSE_EMOR)
+        {
+            const std::vector<double>& lut = m_resp[i].m_lutR;
+            const int lutsize = lut.size();
+            for (int j = 0; j < lutsize - 1; j++)
+            {
+                const double d = lut[j] - lut[j + 1];
+                if (d > 0)
+                {
+                    m_monErr[i] += d*d*lutsize;
+                    if (lutsize == 1024)
+                    {
+                        for (int k = 0; k < 5; ++k)
+                        {
+                            m_monErrDeriv[i][k] += 2 * d * lutsize * (vigra_ext::EMoR::h[k][j] - vigra_ext::EMoR::h[k][j + 1]);
+                        };
+                    };
+                }
+            }
+        }
+        // enforce a montonous response curves
+        m_resp[i].enforceMonotonicity();
+        m_invResp[i].enforceMonotonicity();
+    }
+}
+
 void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n, void * data)
 {
 #ifdef DEBUG_LOG_VIG
     static int iter = 0;
 #endif
-    typedef Photometric::ResponseTransform<vigra::RGBValue<double> > RespFunc;
-    typedef Photometric::InvResponseTransform<vigra::RGBValue<double>, vigra::RGBValue<double> > InvRespFunc;
-
     int xi = 0 ;
 
     OptimData * dat = static_cast<OptimData*>(data);
@@ -178,29 +458,13 @@ void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n,
     dat->m_pano.printPanoramaScript(script, optvars, dat->m_pano.getOptions(), imgs, false, "");
 #endif
 
-    size_t nImg = dat->m_imgs.size();
-    std::vector<RespFunc> resp(nImg);
-    std::vector<InvRespFunc> invResp(nImg);
+    // recreate only the response functions of images with changed parameters
+    dat->UpdateResponseCache();
+    const size_t nImg = dat->m_imgs.size();
+    const std::vector<RespFunc>& resp = dat->m_resp;
+    const std::vector<InvRespFunc>& invResp = dat->m_invResp;
     for (size_t i=0; i < nImg; i++) {
-        resp[i] = RespFunc(dat->m_imgs[i]);
-        invResp[i] = InvRespFunc(dat->m_imgs[i]);
-        // calculate the monotonicity error
-        double monErr = 0;
-        if (dat->m_imgs[i].getResponseType() == SrcPanoImage::RESPONSE_EMOR) {
-            // calculate monotonicity error
-            int lutsize = resp[i].m_lutR.size();
-            for (int j=0; j < lutsize-1; j++)
-            {
-                double d = resp[i].m_lutR[j] - resp[i].m_lutR[j+1];
-                if (d > 0) {
-                    monErr += d*d*lutsize;
-                }
-            }
-        }
-        x[xi++] = monErr;
-		// enforce a montonous response curves
-		resp[i].enforceMonotonicity();
-		invResp[i].enforceMonotonicity();
+        x[xi++] = dat->m_monErr[i];
     }
 
 #ifdef DEBUG
@@ -211,19 +475,25 @@ void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n,
     log << "VIGval = [ ";
 #endif
 
-    for (std::vector<vigra_ext::PointPairRGB>::const_iterator it = dat->m_data.begin();
-         it != dat->m_data.end(); ++it)
+    const int nPoints = dat->m_data.size();
+    // each point pair writes to its own 6 error values, so the points can be processed in parallel
+#if !defined DEBUG && !defined DEBUG_LOG_VIG
+#pragma omp parallel for schedule(dynamic, 100)
+#endif
+    for (int k = 0; k < nPoints; ++k)
     {
-        vigra::RGBValue<double> l2 = invResp[it->imgNr2](it->i2, it->p2);
-        vigra::RGBValue<double> i2ini1 = resp[it->imgNr1](l2, it->p1);
-        vigra::RGBValue<double> error = it->i1 - i2ini1;
+        const vigra_ext::PointPairRGB& pp = dat->m_data[k];
+        double* xk = x + xi + 6 * k;
+        vigra::RGBValue<double> l2 = invResp[pp.imgNr2](pp.i2, pp.p2);
+        vigra::RGBValue<double> i2ini1 = resp[pp.imgNr1](l2, pp.p1);
+        vigra::RGBValue<double> error = pp.i1 - i2ini1;
 
 
         // if requested, calcuate the error in image 2 as well.
         //TODO: weighting dependent on the pixel value? check if outside of i2 range?
-        vigra::RGBValue<double> l1 = invResp[it->imgNr1](it->i1, it->p1);
-        vigra::RGBValue<double> i1ini2 = resp[it->imgNr2](l1, it->p2);
-        vigra::RGBValue<double> error2 = it->i2 - i1ini2;
+        vigra::RGBValue<double> l1 = invResp[pp.imgNr1](pp.i1, pp.p1);
+        vigra::RGBValue<double> i1ini2 = resp[pp.imgNr2](l1, pp.p2);
+        vigra::RGBValue<double> error2 = pp.i2 - i1ini2;
 
 #ifdef DEBUG
         for (int i=0; i < 3; i++) {
@@ -235,21 +505,21 @@ void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n,
         // use huber robust estimator
         if (dat->huberSigma > 0) {
             for (int i=0; i < 3; i++) {
-                x[xi++] = weightHuber(fabs(error[i]), dat->huberSigma);
-                x[xi++] = weightHuber(fabs(error2[i]), dat->huberSigma);
+                xk[2*i] = weightHuber(fabs(error[i]), dat->huberSigma);
+                xk[2*i+1] = weightHuber(fabs(error2[i]), dat->huberSigma);
             }
         } else {
-            x[xi++] = error[0];
-            x[xi++] = error[1];
-            x[xi++] = error[2];
-            x[xi++] = error2[0];
-            x[xi++] = error2[1];
-            x[xi++] = error2[2];
+            xk[0] = error[0];
+            xk[1] = error[1];
+            xk[2] = error[2];
+            xk[3] = error2[0];
+            xk[4] = error2[1];
+            xk[5] = error2[2];
         }
 
 #ifdef DEBUG_LOG_VIG
-        log << it->i1.green()  << " "<< l1.green()  << " " << i1ini2.green() << "   " 
-             << it->i2.green()  << " "<< l2.green()  << " " << i2ini1.green() << ";  " << std::endl;
+        log << pp.i1.green()  << " "<< l1.green()  << " " << i1ini2.green() << "   " 
+             << pp.i2.green()  << " "<< l2.green()  << " " << i2ini1.green() << ";  " << std::endl;
 #endif
 
     }
@@ -265,6 +535,70 @@ void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n,
 #endif
 }
 
+void PhotometricOptimizer::photometricJacobian(double *p, double *jac, int m, int n, void * data)
+{
+    OptimData * dat = static_cast<OptimData*>(data);
+    dat->FromX(p);
+    dat->UpdateResponseCache();
+    const size_t nImg = dat->m_imgs.size();
+
+    double sqerror = 0;
+    // derivatives of the monotonicity errors, depend only on the response curve of the image itself
+    for (size_t i = 0; i < nImg; i++)
+    {
+        double* row = jac + i * m;
+        std::fill(row, row + m, 0.0);
+        for (int k = 0; k < 5; ++k)
+        {
+            const int col = dat->m_varColumns[i][PV_RA + k];
+            if (col >= 0)
+            {
+                row[col] += dat->m_monErrDeriv[i][k];
+            };
+        };
+        sqerror += dat->m_monErr[i] * dat->m_monErr[i];
+    };
+
+    const int nPoints = dat->m_data.size();
+    const bool useHuber = dat->huberSigma > 0;
+    // each point pair has its own 6 rows in the Jacobian, so the points can be processed in parallel
+#pragma omp parallel for schedule(dynamic, 100) reduction(+: sqerror)
+    for (int k = 0; k < nPoints; ++k)
+    {
+        const vigra_ext::PointPairRGB& pp = dat->m_data[k];
+        const size_t baseRow = nImg + 6 * k;
+        double* block = jac + baseRow * m;
+        std::fill(block, block + 6 * m, 0.0);
+        // same order of the error values as in photometricError
+        double* rows1[3];
+        double* rows2[3];
+        for (int c = 0; c < 3; ++c)
+        {
+            if (useHuber)
+            {
+                rows1[c] = block + (2 * c) * m;
+                rows2[c] = block + (2 * c + 1) * m;
+            }
+            else
+            {
+                rows1[c] = block + c * m;
+                rows2[c] = block + (3 + c) * m;
+            };
+        };
+        sqerror += AddErrorDerivatives(dat->m_resp, dat->m_invResp, dat->m_varColumns, dat->huberSigma,
+            pp.imgNr1, pp.i1, pp.p1, pp.imgNr2, pp.i2, pp.p2, rows1);
+        sqerror += AddErrorDerivatives(dat->m_resp, dat->m_invResp, dat->m_varColumns, dat->huberSigma,
+            pp.imgNr2, pp.i2, pp.p2, pp.imgNr1, pp.i1, pp.p1, rows2);
+    };
+
+    // the Jacobian is evaluated once per iteration, so use it for the progress display
+    if (photometricVis(p, NULL, m, n, dat->m_iter++, sqerror, data) == 0)
+    {
+        // cancelled by user: a zero Jacobian lets levmar stop with the current estimate
+        std::fill(jac, jac + static_cast<size_t>(n) * m, 0.0);
+    };
+}
+
 int PhotometricOptimizer::photometricVis(double *p, double *x, int m, int n, int iter, double sqerror, void * data)
 {
     OptimData * dat = static_cast<OptimData*>(data);
@@ -332,10 +666,17 @@ void PhotometricOptimizer::optimizePhotometric(PanoramaData & pano, const Optimi
     optimOpts[1] = 1e-5;   // ||J^T e||_inf
     optimOpts[2] = 1e-5;   // ||Dp||_2
     optimOpts[3] = 1e-1;   // ||e||_2
-    // difference mode
+    // difference mode, only used if no analytic Jacobian is available
     optimOpts[4] = LM_DIFF_DELTA;
     
-    dlevmar_dif(&photometricError, &photometricVis, &(p[0]), &(x[0]), m, n, nMaxIter, optimOpts, info, NULL,NULL, &data);  // no jacobian
+    if (data.m_hasAnalyticJacobian)
+    {
+        dlevmar_der(&photometricError, &photometricJacobian, &(p[0]), &(x[0]), m, n, nMaxIter, optimOpts, info, NULL, NULL, &data);
+    }
+    else
+    {
+        dlevmar_dif(&photometricError, &photometricVis, &(p[0]), &(x[0]), m, n, nMaxIter, optimOpts, info, NULL,NULL, &data);  // no jacobian
+    };
     // copy to source images (data.m_imgs)
     data.FromX(p.begin());
     // calculate error at solution
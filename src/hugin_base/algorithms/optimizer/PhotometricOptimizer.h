@@ -32,6 +32,7 @@
 #include <panodata/PanoramaData.h>
 #include <appbase/ProgressDisplay.h>
 #include <vigra_ext/VignettingCorrection.h>
+#include <photometric/ResponseTransform.h>
 
 namespace HuginBase
 {
@@ -62,6 +63,21 @@ namespace HuginBase
                                             AppBase::ProgressDisplay* progress,
                                             double& error);
         
+        public:
+            ///
+            typedef Photometric::ResponseTransform<vigra::RGBValue<double> > RespFunc;
+            ///
+            typedef Photometric::InvResponseTransform<vigra::RGBValue<double>, vigra::RGBValue<double> > InvRespFunc;
+
+            /// photometric variables of an image, for which the analytic derivatives are known
+            enum PhotometricVariable
+            {
+                PV_EEV = 0, PV_ER, PV_EB,
+                PV_RA, PV_RB, PV_RC, PV_RD, PV_RE,
+                PV_VA, PV_VB, PV_VC, PV_VD, PV_VX, PV_VY,
+                PV_COUNT
+            };
+
         protected:
             ///
             struct VarMapping
@@ -84,6 +100,22 @@ namespace HuginBase
                 int m_maxIter;
                 AppBase::ProgressDisplay* m_progress;
 
+                /** column in the Jacobian for each image and PhotometricVariable, -1 if not optimized */
+                std::vector<std::vector<int> > m_varColumns;
+                /** true, if all optimized variables have an analytic derivative */
+                bool m_hasAnalyticJacobian;
+                /// number of Jacobian evaluations, used for progress display
+                int m_iter;
+
+                /** cached response functions for each image, they are only
+                 *  recreated when the photometric parameters of the image change */
+                std::vector<RespFunc> m_resp;
+                std::vector<InvRespFunc> m_invResp;
+                /// monotonicity error of the response curve and its derivatives w.r.t. Ra..Re
+                std::vector<double> m_monErr;
+                std::vector<std::vector<double> > m_monErrDeriv;
+                /// parameters used to create the cached response functions
+                std::vector<std::vector<double> > m_cacheKeys;
 
                 ///
                 OptimData(const PanoramaData& pano, const OptimizeVector& optvars,
@@ -96,6 +128,9 @@ namespace HuginBase
 
                 /// copy new values from x to into this->m_imgs
                 void FromX(double * x);
+
+                /// recreate the response functions of all images whose parameters have changed
+                void UpdateResponseCache();
                 
             };
             
@@ -104,6 +139,9 @@ namespace HuginBase
             ///
             static void photometricError(double* p, double* x, int m, int n, void* data);
 
+            /// analytic Jacobian of photometricError, row major n x m matrix
+            static void photometricJacobian(double* p, double* jac, int m, int n, void* data);
+
 
         public:
             ///
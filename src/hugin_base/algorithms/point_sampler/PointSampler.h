@@ -33,6 +33,7 @@
 
 #include <random>
 #include <functional>
+#include <algorithm>
 #include <vigra_ext/utils.h>
 #include <appbase/ProgressDisplay.h>
 #include <panodata/PanoramaData.h>
@@ -192,11 +193,15 @@ namespace HuginBase
     class RandomPointSampler : public  PointSampler
     {
         public:
-            ///
+            /** constructor
+             *  @param seed seed for the random number generator, the same seed gives the
+             *              same points independent of the number of threads;
+             *              0 seeds from the current time
+             */
             RandomPointSampler(PanoramaData& panorama, AppBase::ProgressDisplay* progressDisplay,
                                std::vector<vigra::FRGBImage*> images,
-                               int nPoints)
-             : PointSampler(panorama, progressDisplay, images, nPoints)
+                               int nPoints, unsigned int seed = 0)
+             : PointSampler(panorama, progressDisplay, images, nPoints), o_seed(seed)
             {};
 
             ///
@@ -204,6 +209,12 @@ namespace HuginBase
             
             
         public:
+            /** sample random points inside the panorama and sort the point pairs into
+             *  the bins of radiusHist.
+             *  The samples are drawn in parallel in a fixed number of chunks, each with its
+             *  own random number stream derived from seed, and only image pairs which
+             *  overlap are tested, so the result is reproducible for a given seed (0 = current time)
+             */
             template <class Img, class VoteImg, class PP>
             static void sampleRandomPanoPoints(const std::vector<Img>& imgs,
                                                const std::vector<VoteImg *> &voteImgs,
@@ -213,7 +224,8 @@ namespace HuginBase
                                                float maxI,
                                                std::vector<std::multimap<double, PP > > & radiusHist,
                                                unsigned & nBadPoints,
-                                               AppBase::ProgressDisplay* progress);
+                                               AppBase::ProgressDisplay* progress,
+                                               unsigned int seed = 0);
             
         protected:
             ///
@@ -235,9 +247,11 @@ namespace HuginBase
                                         maxI,
                                         radiusHist,
                                         nBadPoints,
-                                        progress);
+                                        progress,
+                                        o_seed);
             }
-            
+
+            unsigned int o_seed;
     };
 
     
@@ -252,6 +266,7 @@ namespace HuginBase
 //  templated methods
 
 #include <panotools/PanoToolsInterface.h>
+#include <algorithms/basic/CalculateOverlap.h>
 
 namespace HuginBase {
 
@@ -434,12 +449,13 @@ void RandomPointSampler::sampleRandomPanoPoints(const std::vector<Img>& imgs,
                                                 int nPoints,
                                                 float minI,
                                                 float maxI,
-                                                //std::vector<PP> &points,
                                                 std::vector<std::multimap<double, PP > > & radiusHist,
                                                 unsigned & nBadPoints,
-                                                AppBase::ProgressDisplay* progress)
+                                                AppBase::ProgressDisplay* progress,
+                                                unsigned int seed)
 {
     typedef typename Img::PixelType PixelType;
+    typedef std::multimap<double, PP> PointPairMap;
 
     vigra_precondition(imgs.size() > 1, "sampleRandomPanoPoints: At least two images required");
     
@@ -449,126 +465,153 @@ void RandomPointSampler::sampleRandomPanoPoints(const std::vector<Img>& imgs,
     const unsigned pairsPerBin = nPoints / nBins;
 
     // create an array of transforms.
-    //std::vector<SpaceTransform> transf(imgs.size());
     std::vector<PTools::Transform *> transf(imgs.size());
     std::vector<double> maxr(imgs.size());
 
     // initialize transforms, and interpolating accessors
     for(unsigned i=0; i < nImg; i++) {
-        // same size is not needed?
-//        vigra_precondition(src[i].getSize() == srcSize, "images need to have the same size");
         transf[i] = new PTools::Transform;
         transf[i]->createTransform(pano.getImage(i), pano.getOptions());
         vigra::Size2D srcSize = pano.getImage(i).getSize();
         maxr[i] = sqrt(((double)srcSize.x)*srcSize.x + ((double)srcSize.y)*srcSize.y) / 2.0;
     }
-    // init random number generator
+    // build the overlap graph, for each sample only pairs of overlapping images are tested
+    std::vector<UIntVector> overlappingImages(nImg);
+    {
+        CalculateImageOverlap overlap(&pano);
+        overlap.calculate(20);
+        for (unsigned i = 0; i < nImg; i++)
+        {
+            for (unsigned j = i + 1; j < nImg; j++)
+            {
+                if (overlap.getOverlap(i, j) > 0 || overlap.getOverlap(j, i) > 0)
+                {
+                    overlappingImages[i].push_back(j);
+                };
+            };
+        };
+    }
+    if (seed == 0)
+    {
+        seed = static_cast<unsigned int>(std::time(0));
+    };
+    // the samples are drawn in a fixed number of chunks, each with its own random number
+    // stream, so that the result does not depend on the number of threads
+    const int nChunks = 64;
+    const unsigned pointsPerChunk = (nPoints + nChunks - 1) / nChunks;
+    std::vector<std::vector<PointPairMap> > chunkHist(nChunks, std::vector<PointPairMap>(nBins));
     const vigra::Rect2D roi = pano.getOptions().getROI();
-    std::mt19937 rng(static_cast<unsigned int>(std::time(0)));
-    std::uniform_int_distribution<unsigned int> distribx(roi.left(), roi.right()-1);
-    std::uniform_int_distribution<unsigned int> distriby(roi.top(), roi.bottom()-1);
-    auto randX = std::bind(distribx, std::ref(rng));
-    auto randY = std::bind(distriby, std::ref(rng));
-
-    for (unsigned maxTry = nPoints*5; nPoints > 0 && maxTry > 0; maxTry--) {
-        unsigned x = randX();
-        unsigned y = randY();
-        hugin_utils::FDiff2D panoPnt(x,y);
-        for (unsigned i=0; i< nImg-1; i++) {
-            // transform pixel
-            PixelType i1;
-            hugin_utils::FDiff2D p1;
-            if(!transf[i]->transformImgCoord(p1, panoPnt))
-                continue;
-            vigra::Point2D p1Int(p1.toDiff2D());
-            // check if pixel is valid
-            if (!pano.getImage(i).isInside(p1Int)) {
-                // point is outside image
-                continue;
-            }
-            vigra::UInt8 maskI;
-            if ( imgs[i](p1.x,p1.y, i1, maskI)){
-                float im1 = vigra_ext::getMaxComponent(i1);
-                if (minI > im1 || maxI < im1) {
-                    // ignore pixels that are too dark or bright
+#pragma omp parallel for schedule(dynamic)
+    for (int chunk = 0; chunk < nChunks; ++chunk)
+    {
+        std::seed_seq seedSeq{ seed, static_cast<unsigned int>(chunk) };
+        std::mt19937 rng(seedSeq);
+        std::uniform_int_distribution<unsigned int> distribx(roi.left(), roi.right()-1);
+        std::uniform_int_distribution<unsigned int> distriby(roi.top(), roi.bottom()-1);
+        std::vector<PointPairMap>& hist = chunkHist[chunk];
+        // cache of the image coordinates and values of the current sample
+        // state: 0 - not yet calculated, 1 - valid, -1 - outside or invalid
+        std::vector<hugin_utils::FDiff2D> imgPos(nImg);
+        std::vector<PixelType> imgValue(nImg);
+        std::vector<float> imgMax(nImg);
+        std::vector<int> imgState(nImg);
+        hugin_utils::FDiff2D panoPnt;
+        auto sampleImage = [&](unsigned imgNr) -> bool
+        {
+            if (imgState[imgNr] == 0)
+            {
+                imgState[imgNr] = -1;
+                hugin_utils::FDiff2D& p = imgPos[imgNr];
+                // check if pixel is valid
+                if (transf[imgNr]->transformImgCoord(p, panoPnt) && pano.getImage(imgNr).isInside(vigra::Point2D(p.toDiff2D())))
+                {
+                    vigra::UInt8 maskI;
+                    if (imgs[imgNr](p.x, p.y, imgValue[imgNr], maskI))
+                    {
+                        imgMax[imgNr] = vigra_ext::getMaxComponent(imgValue[imgNr]);
+                        // ignore pixels that are too dark or bright
+                        if (minI <= imgMax[imgNr] && imgMax[imgNr] <= maxI)
+                        {
+                            imgState[imgNr] = 1;
+                        };
+                    };
+                };
+            };
+            return imgState[imgNr] == 1;
+        };
+
+        unsigned remainingPoints = pointsPerChunk;
+        for (unsigned maxTry = pointsPerChunk*5; remainingPoints > 0 && maxTry > 0; maxTry--)
+        {
+            panoPnt.x = distribx(rng);
+            panoPnt.y = distriby(rng);
+            std::fill(imgState.begin(), imgState.end(), 0);
+            for (unsigned i = 0; i < nImg - 1 && remainingPoints > 0; i++)
+            {
+                if (overlappingImages[i].empty() || !sampleImage(i))
+                {
                     continue;
-                }
-                double r1 = hugin_utils::norm((p1 - pano.getImage(i).getRadialVigCorrCenter()) / maxr[i]);
-                for (unsigned j=i+1; j < nImg; j++) {
-                    PixelType i2;
-                    hugin_utils::FDiff2D p2;
-                    if(!transf[j]->transformImgCoord(p2, panoPnt))
-                        continue;
-                    // check if a pixel is inside the source image
-                    vigra::Point2D p2Int(p2.toDiff2D());
-                    if (!pano.getImage(j).isInside(p2Int)) {
-                        // point is outside image
+                };
+                const hugin_utils::FDiff2D& p1 = imgPos[i];
+                const double r1 = hugin_utils::norm((p1 - pano.getImage(i).getRadialVigCorrCenter()) / maxr[i]);
+                for (UIntVector::const_iterator itj = overlappingImages[i].begin(); itj != overlappingImages[i].end(); ++itj)
+                {
+                    const unsigned j = *itj;
+                    if (!sampleImage(j))
+                    {
                         continue;
+                    };
+                    // TODO: add check for gradient radius.
+                    const hugin_utils::FDiff2D& p2 = imgPos[j];
+                    const double r2 = hugin_utils::norm((p2 - pano.getImage(j).getRadialVigCorrCenter()) / maxr[j]);
+                    // add pixel
+                    const VoteImg & vimg1 =  *voteImgs[i];
+                    const VoteImg & vimg2 =  *voteImgs[j];
+                    double laplace = hugin_utils::sqr(vimg1[vigra::Point2D(p1.toDiff2D())]) + hugin_utils::sqr(vimg2[vigra::Point2D(p2.toDiff2D())]);
+                    size_t bin1 = (size_t)(r1*nBins);
+                    size_t bin2 = (size_t)(r2*nBins);
+                    // a center shift might lead to radi > 1.
+                    if (bin1+1 > nBins) bin1 = nBins-1;
+                    if (bin2+1 > nBins) bin2 = nBins-1;
+
+                    PP pp;
+                    if (imgMax[i] <= imgMax[j]) {
+                        // choose i1 to be smaller than i2
+                        pp = PP(i, imgValue[i], p1, r1,   j, imgValue[j], p2, r2);
+                    } else {
+                        pp = PP(j, imgValue[j], p2, r2,   i, imgValue[i], p1, r1);
                     }
-                    vigra::UInt8 maskI2;
-                    if (imgs[j](p2.x, p2.y, i2, maskI2)){
-                        float im2 = vigra_ext::getMaxComponent(i2);
-                        if (minI > im2 || maxI < im2) {
-                            // ignore pixels that are too dark or bright
-                            continue;
-                        }
-                        // TODO: add check for gradient radius.
-                        double r2 = hugin_utils::norm((p2 - pano.getImage(j).getRadialVigCorrCenter()) / maxr[j]);
-#if 0
-                        // add pixel
-                        if (im1 <= im2) {
-                            points.push_back(PP(i, i1, p1, r1,   j, i2, p2, r2) );
-                        } else {
-                            points.push_back(PP(j, i2, p2, r2,   i, i1, p1, r1) );
-                        }
-#else
-                            // add pixel
-                            const VoteImg & vimg1 =  *voteImgs[i];
-                            const VoteImg & vimg2 =  *voteImgs[j];
-                            double laplace = hugin_utils::sqr(vimg1[p1Int]) + hugin_utils::sqr(vimg2[p2Int]);
-                            size_t bin1 = (size_t)(r1*nBins);
-                            size_t bin2 = (size_t)(r2*nBins);
-                            // a center shift might lead to radi > 1.
-                            if (bin1+1 > nBins) bin1 = nBins-1;
-                            if (bin2+1 > nBins) bin2 = nBins-1;
 
-                            PP pp;
-                            if (im1 <= im2) {
-                                // choose i1 to be smaller than i2
-                                pp = PP(i, i1, p1, r1,   j, i2, p2, r2);
-                            } else {
-                                pp = PP(j, i2, p2, r2,   i, i1, p1, r1);
-                            }
-
-                            // decide which bin should be used.
-                            std::multimap<double, PP> * map1 = &radiusHist[bin1];
-                            std::multimap<double, PP> * map2 = &radiusHist[bin2];
-                            std::multimap<double, PP> * destMap;
-                            if (map1->empty()) {
-                                destMap = map1;
-                            } else if (map2->empty()) {
-                                destMap = map2;
-                            } else if (map1->size() < map2->size()) {
-                                destMap = map1;
-                            } else if (map1->size() > map2->size()) {
-                                destMap = map2;
-							} else if (map1->rbegin()->first > map2->rbegin()->first) {
-                                // heuristic: insert into bin with higher maximum laplacian filter response
-                                // (higher probablity of misregistration).
-                                destMap = map1;
-                            } else {
-                                destMap = map2;
-                            }
-                            // insert
-                            destMap->insert(std::make_pair(laplace,pp));
-                            // remove last element if too many elements have been gathered
-                            if (destMap->size() > pairsPerBin) {
-                                destMap->erase((--(destMap->end())));
-                            }
-//                            nGoodPoints++;
-#endif
-                        nPoints--;
+                    // decide which bin should be used.
+                    PointPairMap * map1 = &hist[bin1];
+                    PointPairMap * map2 = &hist[bin2];
+                    PointPairMap * destMap;
+                    if (map1->empty()) {
+                        destMap = map1;
+                    } else if (map2->empty()) {
+                        destMap = map2;
+                    } else if (map1->size() < map2->size()) {
+                        destMap = map1;
+                    } else if (map1->size() > map2->size()) {
+                        destMap = map2;
+                    } else if (map1->rbegin()->first > map2->rbegin()->first) {
+                        // heuristic: insert into bin with higher maximum laplacian filter response
+                        // (higher probablity of misregistration).
+                        destMap = map1;
+                    } else {
+                        destMap = map2;
+                    }
+                    // insert
+                    destMap->insert(std::make_pair(laplace,pp));
+                    // remove last element if too many elements have been gathered
+                    if (destMap->size() > pairsPerBin) {
+                        destMap->erase((--(destMap->end())));
                     }
+                    remainingPoints--;
+                    if (remainingPoints == 0)
+                    {
+                        break;
+                    };
                 }
             }
         }
@@ -576,7 +619,20 @@ void RandomPointSampler::sampleRandomPanoPoints(const std::vector<Img>& imgs,
     for(unsigned i=0; i < imgs.size(); i++) {
         delete transf[i];
     }
-   
+    // merge the bins of all chunks in a fixed order and keep only the
+    // pairsPerBin points with the lowest laplacian in each bin
+    for (unsigned bin = 0; bin < nBins; ++bin)
+    {
+        PointPairMap& destMap = radiusHist[bin];
+        for (int chunk = 0; chunk < nChunks; ++chunk)
+        {
+            destMap.insert(chunkHist[chunk][bin].begin(), chunkHist[chunk][bin].end());
+        };
+        while (destMap.size() > pairsPerBin)
+        {
+            destMap.erase(--destMap.end());
+        };
+    };
 }
 
 
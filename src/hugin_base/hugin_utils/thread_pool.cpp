@@ -0,0 +1,81 @@
+// -*- c-basic-offset: 4 -*-
+/** @file hugin_utils/thread_pool.cpp
+ *
+ *  a fixed number of background threads, which run jobs in the order
+ *  they are added
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "thread_pool.h"
+
+namespace hugin_utils
+{
+
+ThreadPool::ThreadPool(unsigned int threadCount) : m_stop(false)
+{
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    };
+    for (unsigned int i = 0; i < threadCount; ++i)
+    {
+        m_threads.push_back(std::thread(&ThreadPool::run, this));
+    };
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (size_t i = 0; i < m_threads.size(); ++i)
+    {
+        m_threads[i].join();
+    };
+}
+
+void ThreadPool::push(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_jobs.push(job);
+    }
+    m_condition.notify_one();
+}
+
+void ThreadPool::run()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+            if (m_stop)
+            {
+                return;
+            };
+            job = m_jobs.front();
+            m_jobs.pop();
+        }
+        job();
+    };
+}
+
+} // namespace hugin_utils
@@ -0,0 +1,65 @@
+// -*- c-basic-offset: 4 -*-
+/** @file hugin_utils/thread_pool.h
+ *
+ *  a fixed number of background threads, which run jobs in the order
+ *  they are added
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _HUGIN_UTILS_THREAD_POOL_H
+#define _HUGIN_UTILS_THREAD_POOL_H
+
+#include <hugin_shared.h>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <vector>
+
+namespace hugin_utils
+{
+
+/** a fixed number of threads, which run the jobs in the order they are added.
+ *  Jobs which are still waiting when the pool is destroyed are not run, the
+ *  destructor waits for the running jobs. */
+class IMPEX ThreadPool
+{
+public:
+    /** starts threadCount threads, at least one */
+    explicit ThreadPool(unsigned int threadCount);
+    /** stops and joins the threads */
+    ~ThreadPool();
+    /** returns the number of threads */
+    size_t size() const { return m_threads.size(); };
+    /** adds a job to the end of the queue */
+    void push(std::function<void()> job);
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+    void run();
+
+    std::vector<std::thread> m_threads;
+    std::queue<std::function<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+};
+
+} // namespace hugin_utils
+
+#endif // _HUGIN_UTILS_THREAD_POOL_H
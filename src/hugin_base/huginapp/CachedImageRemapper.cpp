@@ -33,6 +33,59 @@
 
 namespace HuginBase {
 
+/** returns true, if both images give the same remapped image. Only the
+ *  variables used by the remapping are compared, so e.g. changing the
+ *  exif data, the stack or the active state of an image keeps the cached
+ *  remapped image. */
+static bool SameRemapParameters(const SrcPanoImage & a, const SrcPanoImage & b)
+{
+    return a.getFilename() == b.getFilename()
+        && a.getSize() == b.getSize()
+        // geometry
+        && a.getProjection() == b.getProjection()
+        && a.getHFOV() == b.getHFOV()
+        && a.getRoll() == b.getRoll()
+        && a.getPitch() == b.getPitch()
+        && a.getYaw() == b.getYaw()
+        && a.getX() == b.getX()
+        && a.getY() == b.getY()
+        && a.getZ() == b.getZ()
+        && a.getTranslationPlaneYaw() == b.getTranslationPlaneYaw()
+        && a.getTranslationPlanePitch() == b.getTranslationPlanePitch()
+        && a.getRadialDistortion() == b.getRadialDistortion()
+        && a.getRadialDistortionRed() == b.getRadialDistortionRed()
+        && a.getRadialDistortionBlue() == b.getRadialDistortionBlue()
+        && a.getRadialDistortionCenterShift() == b.getRadialDistortionCenterShift()
+        && a.getShear() == b.getShear()
+        // cropping and masking
+        && a.getCropMode() == b.getCropMode()
+        && a.getCropRect() == b.getCropRect()
+        && a.getActiveMasks() == b.getActiveMasks()
+        // photometry
+        && a.getResponseType() == b.getResponseType()
+        && a.getEMoRParams() == b.getEMoRParams()
+        && a.getExposureValue() == b.getExposureValue()
+        && a.getGamma() == b.getGamma()
+        && a.getWhiteBalanceRed() == b.getWhiteBalanceRed()
+        && a.getWhiteBalanceBlue() == b.getWhiteBalanceBlue()
+        && a.getVigCorrMode() == b.getVigCorrMode()
+        && a.getFlatfieldFilename() == b.getFlatfieldFilename()
+        && a.getRadialVigCorrCoeff() == b.getRadialVigCorrCoeff()
+        && a.getRadialVigCorrCenterShift() == b.getRadialVigCorrCenterShift();
+}
+
+/** returns true, if the remapping into both outputs is the same. The
+ *  images are always remapped to HDR without output exposure, so the
+ *  output photometry is not compared. */
+static bool SameRemapOptions(const PanoramaOptions & a, const PanoramaOptions & b)
+{
+    return a.getHFOV() == b.getHFOV()
+        && a.getWidth() == b.getWidth()
+        && a.getHeight() == b.getHeight()
+        && a.getProjection() == b.getProjection()
+        && a.getProjectionParameters() == b.getProjectionParameters();
+}
+
 SmallRemappedImageCache::~SmallRemappedImageCache()
 {
     invalidate();
@@ -50,24 +103,22 @@ SmallRemappedImageCache::getRemapped(const PanoramaData& pano,
     opts.outputMode = PanoramaOptions::OUTPUT_HDR;
     opts.outputExposureValue = 0.0;
 
-    // return old image, if already in cache and if it has changed since the last rendering
-    if (set_contains(m_images, imgNr)) {
-        // return cached image if the parameters of the image have not changed
-        SrcPanoImage oldParam = m_imagesParam[imgNr];
-        if (oldParam == pano.getSrcImage(imgNr)
-                && m_panoOpts[imgNr].getHFOV() == opts.getHFOV()
-                && m_panoOpts[imgNr].getWidth() == opts.getWidth()
-                && m_panoOpts[imgNr].getHeight() == opts.getHeight()
-                && m_panoOpts[imgNr].getProjection() == opts.getProjection()
-                && m_panoOpts[imgNr].getProjectionParameters() == opts.getProjectionParameters()
-           )
-        {
-            DEBUG_DEBUG("using cached remapped image " << imgNr);
-            return m_images[imgNr];
-        }
+    // return old image, if already in cache and if the parameters of the
+    // image have not changed since the last rendering
+    if (isValid(pano, opts, imgNr)) {
+        DEBUG_DEBUG("using cached remapped image " << imgNr);
+        return m_images[imgNr];
+    }
+    invalidate(imgNr);
+
+    // the progress display can cancel the remapping of the remaining images
+    if (!progress->updateDisplay("remapping")) {
+        throw std::runtime_error("remapping cancelled");
     }
 
-    ImageCache::getInstance().softFlush();
+    if (m_sourceImages.empty()) {
+        ImageCache::getInstance().softFlush();
+    }
 
     // remap image
     DEBUG_DEBUG("remapping image " << imgNr);
@@ -75,8 +126,8 @@ SmallRemappedImageCache::getRemapped(const PanoramaData& pano,
     // load image
     const SrcPanoImage & img = pano.getImage(imgNr);
 
-    ImageCache::EntryPtr e = ImageCache::getInstance().getSmallImage(img.getFilename().c_str());
-    if ( (e->image8->width() == 0) && (e->image16->width() == 0) && (e->imageFloat->width() == 0) ) {
+    ImageCache::EntryPtr e = getSmallImage(img.getFilename());
+    if (!e || ((e->image8->width() == 0) && (e->image16->width() == 0) && (e->imageFloat->width() == 0)) ) {
         throw std::runtime_error("could not retrieve small source image for preview generation");
     }
     vigra::Size2D srcImgSize;
@@ -98,7 +149,7 @@ SmallRemappedImageCache::getRemapped(const PanoramaData& pano,
     vigra::BImage srcMask;
 
     if (img.getVigCorrMode() & SrcPanoImage::VIGCORR_FLATFIELD) {
-        ImageCache::EntryPtr e = ImageCache::getInstance().getSmallImage(img.getFlatfieldFilename().c_str());
+        ImageCache::EntryPtr e = getSmallImage(img.getFlatfieldFilename());
         if (!e) {
             delete remapped;
             throw std::runtime_error("could not retrieve flatfield image for preview generation");
@@ -120,8 +171,6 @@ SmallRemappedImageCache::getRemapped(const PanoramaData& pano,
                 vigra::destImage(srcFlat));
         }
     }
-    progress->setMessage("remapping");
-
     // compute the bounding output rectangle here!
     vigra::Rect2D outROI = estimateOutputROI(pano, opts, imgNr);
     DEBUG_DEBUG("srcPanoImg size: " << srcPanoImg.getSize() << " pano roi:" << outROI);
@@ -175,6 +224,7 @@ void SmallRemappedImageCache::invalidate()
     // remove all images
     m_images.clear();
     m_imagesParam.clear();
+    m_panoOpts.clear();
 }
 
 void SmallRemappedImageCache::invalidate(unsigned int imgNr)
@@ -184,7 +234,36 @@ void SmallRemappedImageCache::invalidate(unsigned int imgNr)
         delete (m_images[imgNr]);
         m_images.erase(imgNr);
         m_imagesParam.erase(imgNr);
+        m_panoOpts.erase(imgNr);
+    }
+}
+
+void SmallRemappedImageCache::invalidateFrom(unsigned int nrOfImages)
+{
+    while (!m_images.empty() && m_images.rbegin()->first >= nrOfImages) {
+        invalidate(m_images.rbegin()->first);
+    }
+}
+
+bool SmallRemappedImageCache::isValid(const PanoramaData & pano, const PanoramaOptions & opts, unsigned int imgNr) const
+{
+    if (!set_contains(m_images, imgNr) || imgNr >= pano.getNrOfImages()) {
+        return false;
+    }
+    return SameRemapParameters(m_imagesParam.find(imgNr)->second, pano.getSrcImage(imgNr))
+        && SameRemapOptions(m_panoOpts.find(imgNr)->second, opts);
+}
+
+ImageCache::EntryPtr SmallRemappedImageCache::getSmallImage(const std::string & filename) const
+{
+    if (m_sourceImages.empty()) {
+        return ImageCache::getInstance().getSmallImage(filename);
+    }
+    SourceImages::const_iterator it = m_sourceImages.find(filename);
+    if (it == m_sourceImages.end()) {
+        return ImageCache::EntryPtr();
     }
+    return it->second;
 }
 
 
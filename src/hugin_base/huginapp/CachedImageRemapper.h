@@ -28,6 +28,7 @@
 #include <nona/ImageRemapper.h>
 
 #include <map>
+#include <string>
 #include <huginapp/ImageCache.h>
 
 namespace HuginBase {
@@ -49,6 +50,9 @@ public:
     
     
 public:
+    /** the small source images by filename, see setSourceImages() */
+    typedef std::map<std::string, ImageCache::EntryPtr> SourceImages;
+
     ///
     virtual MRemappedImage* getRemapped(const PanoramaData & pano,
                                         const PanoramaOptions & opts,
@@ -68,14 +72,37 @@ public:
     /** invalidate a specific image */
     void invalidate(unsigned int imgNr);
 
+    /** invalidates the images with a number >= nrOfImages, e.g. after
+     *  images were removed from the panorama */
+    void invalidateFrom(unsigned int nrOfImages);
+
+    /** returns true, if the remapped image for imgNr is cached and
+     *  getRemapped would return it without remapping */
+    bool isValid(const PanoramaData & pano, const PanoramaOptions & opts, unsigned int imgNr) const;
+
+    /** sets the small images used as source for the remapping, including
+     *  the flatfield images. If set, getRemapped takes the images only from
+     *  this list and does not access the ImageCache, which is not thread
+     *  safe. So the remapping can be done in a worker thread.
+     */
+    void setSourceImages(const SourceImages & images)
+        { m_sourceImages = images; };
+
     
 protected:
+    /** returns the small image for filename, from the source images
+     *  if set, otherwise from the ImageCache */
+    ImageCache::EntryPtr getSmallImage(const std::string & filename) const;
+
+
     std::map<unsigned, MRemappedImage*> m_images;
     
     // descriptions of the remapped image. useful to determine
     // if it has to be updated or not
     std::map<unsigned, SrcPanoImage> m_imagesParam;
     std::map<unsigned, PanoramaOptions> m_panoOpts;
+
+    SourceImages m_sourceImages;
     
 };
 
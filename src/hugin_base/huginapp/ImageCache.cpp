@@ -25,10 +25,17 @@
  */
 
 #include "ImageCache.h"
+#include "ImageDiskCache.h"
 
 #include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <csetjmp>
 #include "hugin_config.h"
 #include <thread>
+#include <tiffio.h>
+#include <jpeglib.h>
 #include <vigra/inspectimage.hxx>
 #include <vigra/accessor.hxx>
 #include <vigra/functorexpression.hxx>
@@ -108,16 +115,46 @@ ImageCache::ImageCacheRGB8Ptr ImageCache::Entry::get8BitImage()
 {
     if (image8->width() > 0) {
         return image8;
-    } else if (image16->width() > 0) {
-        convertTo8Bit(*image16,
-                      origType,
-                      *image8);
-    } else if (imageFloat->width() > 0) {
-        convertTo8Bit(*imageFloat,
-                      origType,
-                      *image8);
     }
-    return image8;
+    if (!m_derived8) {
+        if (image16->width() > 0) {
+            m_derived8 = ImageCacheRGB8Ptr(new vigra::BRGBImage);
+            convertTo8Bit(*image16,
+                          origType,
+                          *m_derived8);
+        } else if (imageFloat->width() > 0) {
+            m_derived8 = ImageCacheRGB8Ptr(new vigra::BRGBImage);
+            convertTo8Bit(*imageFloat,
+                          origType,
+                          *m_derived8);
+        } else {
+            // empty entry
+            return image8;
+        }
+    }
+    // the 8 bit image is kept in a separate lru list of the cache
+    if (!m_cacheKey.empty()) {
+        ImageCache::getInstance().updateDerivedImage(m_cacheKey, this);
+    }
+    return m_derived8;
+}
+
+size_t ImageCache::Entry::getMemSize() const
+{
+    size_t memSize = 0;
+    if (image8) {
+        memSize += image8->width() * image8->height() * sizeof(vigra::BRGBImage::value_type);
+    }
+    if (image16) {
+        memSize += image16->width() * image16->height() * sizeof(vigra::UInt16RGBImage::value_type);
+    }
+    if (imageFloat) {
+        memSize += imageFloat->width() * imageFloat->height() * sizeof(vigra::FRGBImage::value_type);
+    }
+    if (mask) {
+        memSize += mask->width() * mask->height() * sizeof(vigra::BImage::value_type);
+    }
+    return memSize;
 }
 
 ImageCache * ImageCache::instance = NULL;
@@ -125,15 +162,15 @@ ImageCache * ImageCache::instance = NULL;
 
 void ImageCache::removeImage(const std::string & filename)
 {
-    std::map<std::string, EntryPtr>::iterator it = images.find(filename);
+    CacheMap::iterator it = images.find(filename);
     if (it != images.end()) {
-        images.erase(it);
+        eraseEntry(it);
     }
 
-    std::string sfilename = filename + std::string("_small");
+    std::string sfilename = filename + std::string(":small");
     it = images.find(sfilename);
     if (it != images.end()) {
-        images.erase(it);
+        eraseEntry(it);
     }
 
     int level = 0;
@@ -144,6 +181,7 @@ void ImageCache::removeImage(const std::string & filename)
         std::map<std::string, vigra::BImage*>::iterator it = pyrImages.find(key.toString());
         found = (it != pyrImages.end());
         if (found) {
+            m_usedMemory -= it->second->width() * it->second->height();
             delete it->second;
             pyrImages.erase(it);
         }
@@ -161,6 +199,10 @@ std::string ImageCache::PyramidKey::toString()
 void ImageCache::flush()
 {
     images.clear();
+    for (int i = 0; i < ENTRY_CLASS_COUNT; ++i)
+    {
+        m_lru[i].clear();
+    };
 
     for (std::map<std::string, vigra::BImage*>::iterator it = pyrImages.begin();
          it != pyrImages.end();
@@ -169,122 +211,150 @@ void ImageCache::flush()
         delete it->second;
     }
     pyrImages.clear();
+    m_usedMemory = 0;
 }
 
-void ImageCache::softFlush()
+ImageCache::EntryPtr ImageCache::findEntry(const std::string & key)
 {
-    if(upperBound==0l)
-        upperBound = 100 * 1024 * 1024l;
-    long purgeToSize = long(0.75 * upperBound);
-
-    // calculate used memory
-    long imgMem = 0;
-
-    std::map<std::string, EntryPtr>::iterator imgIt;
-    for(imgIt=images.begin(); imgIt != images.end(); ++imgIt) {
-#ifdef DEBUG
-        std::cout << "Image: " << imgIt->first << std::endl;
-        std::cout << "CacheEntry: " << imgIt->second.use_count() << "last access: " << imgIt->second->lastAccess;
-#endif
-        if (imgIt->second->image8) {
-            imgMem += imgIt->second->image8->width() * imgIt->second->image8->height() * 3;
-#ifdef DEBUG
-            std::cout << " 8bit: " << imgIt->second->image8.use_count();
-#endif
-        }
-        if (imgIt->second->image16) {
-            imgMem += imgIt->second->image16->width() * imgIt->second->image16->height() * 3*2;
-#ifdef DEBUG
-            std::cout << " 16bit: " << imgIt->second->image8.use_count();
-#endif
-        }
-        if (imgIt->second->imageFloat) {
-            imgMem += imgIt->second->imageFloat->width() * imgIt->second->imageFloat->height() * 3 * 4;
-#ifdef DEBUG
-            std::cout << " float: " << imgIt->second->imageFloat.use_count() ;
-#endif
-        }
-        if (imgIt->second->mask) {
-            imgMem += imgIt->second->mask->width() * imgIt->second->mask->height();
-#ifdef DEBUG
-            std::cout << " mask: " << imgIt->second->mask.use_count() << std::endl;
-#endif
-        }
+    CacheMap::iterator it = images.find(key);
+    if (it == images.end()) {
+        return EntryPtr();
     }
+    m_accessCounter++;
+    CacheItem & item = it->second;
+    item.entry->lastAccess = m_accessCounter;
+    // move to the front of the lru list
+    std::list<std::string> & lru = m_lru[item.entryClass];
+    lru.splice(lru.begin(), lru, item.lruPos);
+    return item.entry;
+}
 
-    long pyrMem = 0;
-    std::map<std::string, vigra::BImage*>::iterator pyrIt;
-    for(pyrIt=pyrImages.begin(); pyrIt != pyrImages.end(); ++pyrIt) {
-        pyrMem += pyrIt->second->width() * pyrIt->second->height();
+void ImageCache::storeEntry(const std::string & key, EntryPtr entry)
+{
+    CacheMap::iterator it = images.find(key);
+    if (it != images.end()) {
+        eraseEntry(it);
+    }
+    m_accessCounter++;
+    entry->lastAccess = m_accessCounter;
+    CacheItem item;
+    item.entry = entry;
+    item.memSize = entry->getMemSize();
+    // "_small" is only used internally
+    const bool isSmall = key.size() > 6 && key.compare(key.size() - 6, 6, ":small") == 0;
+    item.entryClass = isSmall ? ENTRY_SMALL : ENTRY_FULL;
+    std::list<std::string> & lru = m_lru[item.entryClass];
+    item.lruPos = lru.insert(lru.begin(), key);
+    item.derivedSize = 0;
+    item.hasDerived = false;
+    images[key] = item;
+    m_usedMemory += item.memSize;
+    entry->m_cacheKey = key;
+    if (entry->m_derived8) {
+        updateDerivedImage(key, entry.get());
     }
+}
 
-    long usedMem = imgMem + pyrMem;
+void ImageCache::eraseEntry(CacheMap::iterator it)
+{
+    releaseDerivedImage(it->second);
+    m_usedMemory -= it->second.memSize;
+    m_lru[it->second.entryClass].erase(it->second.lruPos);
+    it->second.entry->m_cacheKey.clear();
+    images.erase(it);
+}
 
-    DEBUG_DEBUG("total: " << (usedMem>>20) << " MB upper bound: " << (purgeToSize>>20) << " MB");
-    if (usedMem > upperBound) 
+void ImageCache::updateDerivedImage(const std::string & key, const Entry * entry)
+{
+    CacheMap::iterator it = images.find(key);
+    if (it == images.end() || it->second.entry.get() != entry) {
+        return;
+    }
+    CacheItem & item = it->second;
+    std::list<std::string> & lru = m_lru[ENTRY_DERIVED];
+    if (item.hasDerived) {
+        lru.splice(lru.begin(), lru, item.derivedLruPos);
+    } else if (entry->m_derived8) {
+        item.derivedLruPos = lru.insert(lru.begin(), key);
+        item.hasDerived = true;
+        item.derivedSize = entry->m_derived8->width() * entry->m_derived8->height() * sizeof(vigra::BRGBImage::value_type);
+        m_usedMemory += item.derivedSize;
+    }
+}
+
+void ImageCache::releaseDerivedImage(CacheItem & item)
+{
+    if (item.hasDerived) {
+        m_lru[ENTRY_DERIVED].erase(item.derivedLruPos);
+        m_usedMemory -= item.derivedSize;
+        item.entry->m_derived8.reset();
+        item.derivedSize = 0;
+        item.hasDerived = false;
+    }
+}
+
+void ImageCache::softFlush()
+{
+    if(upperBound==0l)
+        upperBound = 100 * 1024 * 1024l;
+    if (m_usedMemory <= static_cast<unsigned long long>(upperBound))
     {
-        // we need to remove images.
-        long purgeAmount = usedMem - purgeToSize;
-        long purgedMem = 0;
-        // remove images from cache, first the grey level image,
-        // then the full size images
+        return;
+    };
+    const unsigned long long purgeToSize = static_cast<unsigned long long>(0.75 * upperBound);
+    const unsigned long long usedMem = m_usedMemory;
+    DEBUG_DEBUG("total: " << (usedMem>>20) << " MB upper bound: " << (upperBound>>20) << " MB");
 
-        // use least recently uses strategy.
-        // sort images by their access time
-        std::map<int,std::string> accessMap;
-        for (std::map<std::string, EntryPtr>::iterator it = images.begin();
-             it != images.end();
-             ++it)
+    // we need to remove images.
+    // first the pyramid images
+    while (m_usedMemory > purgeToSize && !pyrImages.empty())
+    {
+        vigra::BImage * imgPtr = pyrImages.begin()->second;
+        m_usedMemory -= imgPtr->width() * imgPtr->height();
+        delete imgPtr;
+        pyrImages.erase(pyrImages.begin());
+    }
+    // then the generated 8 bit images, the full size images and at last
+    // the small images, use least recently used strategy
+    for (int entryClass = ENTRY_DERIVED; entryClass < ENTRY_CLASS_COUNT && m_usedMemory > purgeToSize; ++entryClass)
+    {
+        std::list<std::string> & lru = m_lru[entryClass];
+        std::list<std::string>::iterator lruIt = lru.end();
+        while (m_usedMemory > purgeToSize && lruIt != lru.begin())
         {
-            if (it->first.substr(it->first.size()-6) != ":small") {
-                // only consider full images that are not used elsewhere
-                if (it->second.unique()) {
-                    DEBUG_DEBUG("Considering " << it->first << " for deletion");
-                    accessMap.insert(make_pair(it->second->lastAccess, it->first));
-                } else {
-                    DEBUG_DEBUG(it->first << ", usecount: " << it->second.use_count());
-                }
+            --lruIt;
+            CacheMap::iterator it = images.find(*lruIt);
+            if (it == images.end()) {
+                DEBUG_ASSERT("internal error while purging cache");
+                break;
             }
-        }
-        while (purgeAmount > purgedMem) {
-            bool deleted = false;
-            if (!pyrImages.empty()) {
-                vigra::BImage * imgPtr = (*(pyrImages.begin())).second;
-                purgedMem += imgPtr->width() * imgPtr->height();
-                delete imgPtr;
-                pyrImages.erase(pyrImages.begin());
-                deleted = true;
-            } else if (!accessMap.empty()) {
-                std::map<int,std::string>::iterator accIt = accessMap.begin();
-                std::map<std::string, EntryPtr>::iterator it = images.find(accIt->second);
-                // check for uniqueness.
-                if (it != images.end()) {
-                    DEBUG_DEBUG("soft flush: removing image: " << it->first);
-                    if (it->second->image8) {
-                        purgedMem += it->second->image8->width() * it->second->image8->height() * 3;
-                    }
-                    if (it->second->image16) {
-                        purgedMem += it->second->image16->width() * it->second->image16->height() * 3 * 2;
-                    }
-                    if (it->second->imageFloat) {
-                        purgedMem += it->second->imageFloat->width() * it->second->imageFloat->height()*3*4;
-                    }
-                    if (it->second->mask) {
-                        purgedMem += it->second->mask->width() * it->second->mask->height();
-                    }
-                    images.erase(it);
-                    accessMap.erase(accIt);
-                    deleted = true;
-                } else {
-                    DEBUG_ASSERT("internal error while purging cache");
+            if (entryClass == ENTRY_DERIVED) {
+                // only release the 8 bit image, the entry itself stays in the cache
+                if (it->second.entry->m_derived8.unique()) {
+                    DEBUG_DEBUG("soft flush: releasing 8 bit image: " << it->first);
+                    std::list<std::string>::iterator nextIt = lruIt;
+                    ++nextIt;
+                    releaseDerivedImage(it->second);
+                    lruIt = nextIt;
                 }
-            }
-            if (!deleted) {
-                break;
+            } else if (it->second.entry.unique()) {
+                // only remove images that are not used elsewhere
+                DEBUG_DEBUG("soft flush: removing image: " << it->first);
+                // the list iterator becomes invalid, continue with the next newer entry
+                std::list<std::string>::iterator nextIt = lruIt;
+                ++nextIt;
+                eraseEntry(it);
+                lruIt = nextIt;
+            } else {
+                DEBUG_DEBUG(it->first << ", usecount: " << it->second.entry.use_count());
             }
         }
-        DEBUG_DEBUG("purged: " << (purgedMem>>20) << " MB, memory used for images: " << ((usedMem - purgedMem)>>20) << " MB");
-
+    }
+    DEBUG_DEBUG("purged: " << ((usedMem - m_usedMemory)>>20) << " MB, memory used for images: " << (m_usedMemory>>20) << " MB");
+    if (m_usedMemory > static_cast<unsigned long long>(upperBound) && memoryPressureSignal)
+    {
+        // the remaining images are all used elsewhere
+        memoryPressureSignal(m_usedMemory - upperBound);
     }
 }
 
@@ -295,10 +365,16 @@ ImageCache& ImageCache::getInstance()
     if (instance == NULL)
     {
         instance = new ImageCache();
+        instance->m_diskCache = std::make_shared<ImageDiskCache>();
     }
     return *instance;
 }
 
+void ImageCache::SetDiskCache(const std::string& directory, unsigned long long upperLimit)
+{
+    m_diskCache->SetDirectory(directory, upperLimit);
+}
+
 
 
 /*
@@ -418,12 +494,9 @@ void ImageCache::importAndConvertAlphaImage(const vigra::ImageImportInfo & info,
 ImageCache::EntryPtr ImageCache::getImage(const std::string & filename)
 {
 //    softFlush();
-    m_accessCounter++;
-    std::map<std::string, EntryPtr>::iterator it;
-    it = images.find(filename);
-    if (it != images.end()) {
-        it->second->lastAccess = m_accessCounter;
-        return it->second;
+    EntryPtr cached = findEntry(filename);
+    if (cached.get()) {
+        return cached;
     } else {
         if (m_progress) {
             m_progress->setMessage("Loading image:", hugin_utils::stripPath(filename));
@@ -441,8 +514,7 @@ ImageCache::EntryPtr ImageCache::getImage(const std::string & filename)
             throw std::exception();
         }
         
-        images[filename] = e;
-        e->lastAccess = m_accessCounter;
+        storeEntry(filename, e);
         return e;
     }
 }
@@ -623,39 +695,45 @@ ImageCache::EntryPtr ImageCache::loadImageSafely(const std::string & filename)
 
 ImageCache::EntryPtr ImageCache::getImageIfAvailable(const std::string & filename)
 {
-    std::map<std::string, EntryPtr>::iterator it;
-    it = images.find(filename);
-    if (it != images.end()) {
-        m_accessCounter++;
-        it->second->lastAccess = m_accessCounter;
-        return it->second;
-    } else {
-        // not found, return 0 pointer.
-        return EntryPtr();
-    }
+    // returns a 0 pointer, if not found
+    return findEntry(filename);
 }
 
 ImageCache::EntryPtr ImageCache::getSmallImage(const std::string & filename)
 {
-    m_accessCounter++;
     softFlush();
-    std::map<std::string, EntryPtr>::iterator it;
     // "_small" is only used internally
     std::string name = filename + std::string(":small");
-    it = images.find(name);
-    if (it != images.end()) {
-        return it->second;
+    EntryPtr cached = findEntry(name);
+    if (cached.get()) {
+        return cached;
     } else {
         if (m_progress)
         {
             m_progress->setMessage("Scaling image:", hugin_utils::stripPath(filename));
         }
         DEBUG_DEBUG("creating small image " << name );
-        EntryPtr entry = getImage(filename);
-        
-        EntryPtr small_entry = loadSmallImageSafely(entry);
-        small_entry->lastAccess = m_accessCounter;
-        images[name] = small_entry;
+        EntryPtr small_entry;
+        EntryPtr entry = getImageIfAvailable(filename);
+        if (entry.get())
+        {
+            small_entry = loadSmallImageSafely(entry);
+            m_diskCache->StoreSmallImage(filename, small_entry);
+        }
+        else
+        {
+            // don't decode the full size image only for the small image
+            small_entry = loadSmallImageCached(filename);
+            if (!small_entry.get())
+            {
+                if (m_progress) {
+                    m_progress->taskFinished();
+                }
+                // could not access image.
+                throw std::exception();
+            };
+        };
+        storeEntry(name, small_entry);
         DEBUG_INFO ( "created small image: " << name);
         if (m_progress) {
             m_progress->taskFinished();
@@ -664,33 +742,27 @@ ImageCache::EntryPtr ImageCache::getSmallImage(const std::string & filename)
     }
 }
 
-ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
-{
-    // && entry->image8
-    size_t w=0;
-    size_t h=0;
-    if (entry->image8->width() > 0) {
-        w = entry->image8->width();
-        h = entry->image8->height();
-    } else if (entry->image16->width() > 0) {
-        w = entry->image16->width();
-        h = entry->image16->height();
-    } else if (entry->imageFloat->width() > 0) {
-        w = entry->imageFloat->width();
-        h = entry->imageFloat->height();
-    } else {
-        vigra_fail("Could not load image");
-    }
+/** maximal number of pixels of the small images */
+static const size_t smallImageSize = 800 * 800l;
 
+/** returns the number of pyramid levels needed to reduce an image of the given
+ *  size to at most maxPixels pixels */
+static int GetReduceLevels(size_t w, size_t h, size_t maxPixels)
+{
     size_t sz = w*h;
-    size_t smallImageSize = 800 * 800l;
-
-    int nLevel=0;
-    while(sz > smallImageSize) {
-        sz /=4;
+    int nLevel = 0;
+    while (sz > maxPixels)
+    {
+        sz /= 4;
         nLevel++;
-    }
-    EntryPtr e(new Entry);
+    };
+    return nLevel;
+}
+
+/** reduces the given image by nLevel pyramid levels */
+static ImageCache::EntryPtr ReduceEntry(ImageCache::EntryPtr entry, int nLevel)
+{
+    ImageCache::EntryPtr e(new ImageCache::Entry);
     e->origType = entry->origType;
     // also copy icc profile
     if (!entry->iccProfile->empty())
@@ -700,7 +772,7 @@ ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
     // TODO: fix bug with mask reduction
     vigra::BImage fullsizeMask = *(entry->mask);
     if (entry->imageFloat->width() != 0 ) {
-        e->imageFloat = ImageCacheRGBFloatPtr(new vigra::FRGBImage);
+        e->imageFloat = ImageCache::ImageCacheRGBFloatPtr(new vigra::FRGBImage);
         if (entry->mask->width() != 0) {
             vigra_ext::reduceNTimes(*(entry->imageFloat), fullsizeMask, *(e->imageFloat), *(e->mask), nLevel);
         } else {
@@ -708,7 +780,7 @@ ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
         }
     }
     if (entry->image16->width() != 0 ) {
-        e->image16 = ImageCacheRGB16Ptr(new vigra::UInt16RGBImage);
+        e->image16 = ImageCache::ImageCacheRGB16Ptr(new vigra::UInt16RGBImage);
         if (entry->mask->width() != 0) {
             vigra_ext::reduceNTimes(*(entry->image16), fullsizeMask, *(e->image16), *(e->mask), nLevel);
         } else {
@@ -716,7 +788,7 @@ ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
         }
     }
     if (entry->image8->width() != 0) {
-        e->image8 = ImageCacheRGB8Ptr(new vigra::BRGBImage);
+        e->image8 = ImageCache::ImageCacheRGB8Ptr(new vigra::BRGBImage);
         if (entry->mask->width() != 0) {
             vigra_ext::reduceNTimes(*(entry->image8), fullsizeMask, *(e->image8), *(e->mask), nLevel);
         } else {
@@ -726,56 +798,325 @@ ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
     return e;
 }
 
+/** error manager for libjpeg, which returns to the caller instead of calling exit() */
+struct JPEGErrorManager
+{
+    jpeg_error_mgr pub;
+    jmp_buf setjmpBuffer;
+};
+
+static void JPEGErrorExit(j_common_ptr cinfo)
+{
+    longjmp(reinterpret_cast<JPEGErrorManager*>(cinfo->err)->setjmpBuffer, 1);
+}
+
+static void JPEGOutputMessage(j_common_ptr cinfo)
+{
+    // don't print warnings, the image is loaded again with vigra if it fails
+}
+
+/** decodes a jpeg file with DCT scaling by 1/scaleDenom.
+ *  Only 8 bit grayscale and color images are handled, all other return false. */
+static bool ReadScaledJPEG(const std::string& filename, unsigned int scaleDenom, vigra::BRGBImage& image)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        return false;
+    };
+    jpeg_decompress_struct cinfo;
+    JPEGErrorManager jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = JPEGErrorExit;
+    jerr.pub.output_message = JPEGOutputMessage;
+    // no C++ objects are created below, so leaving with longjmp is safe
+    if (setjmp(jerr.setjmpBuffer))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return false;
+    };
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.jpeg_color_space != JCS_GRAYSCALE && cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_RGB)
+    {
+        // CMYK and YCCK images are left to vigra
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return false;
+    };
+    cinfo.out_color_space = (cinfo.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scaleDenom;
+    // the reduced image is reduced further, so prefer speed
+    cinfo.dct_method = JDCT_IFAST;
+    jpeg_calc_output_dimensions(&cinfo);
+    image.resize(cinfo.output_width, cinfo.output_height);
+    jpeg_start_decompress(&cinfo);
+    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+        cinfo.output_width * cinfo.output_components, 1);
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        vigra::BRGBImage::traverser::row_iterator it = (image.upperLeft() + vigra::Diff2D(0, cinfo.output_scanline)).rowIterator();
+        jpeg_read_scanlines(&cinfo, buffer, 1);
+        const JSAMPLE* scanline = buffer[0];
+        if (cinfo.output_components == 1)
+        {
+            for (unsigned int x = 0; x < cinfo.output_width; ++x, ++it, ++scanline)
+            {
+                *it = vigra::RGBValue<vigra::UInt8>(*scanline, *scanline, *scanline);
+            };
+        }
+        else
+        {
+            for (unsigned int x = 0; x < cinfo.output_width; ++x, ++it, scanline += 3)
+            {
+                *it = vigra::RGBValue<vigra::UInt8>(scanline[0], scanline[1], scanline[2]);
+            };
+        };
+    };
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    return true;
+}
+
+/** reads the smallest reduced resolution image of a tiff file, which is at
+ *  least minWidth x minHeight pixels. Reduced resolution images are searched in
+ *  the SubIFDs of the first directory and in the following directories marked
+ *  as FILETYPE_REDUCEDIMAGE. Only 8 bit images are handled. */
+static bool ReadReducedTIFF(const std::string& filename, const vigra::Size2D& fullSize,
+    const vigra::Size2D& minSize, vigra::BRGBImage& image, vigra::BImage& mask)
+{
+    TIFFErrorHandler oldWarningHandler = TIFFSetWarningHandler(NULL);
+    TIFF* tiff = TIFFOpen(filename.c_str(), "r");
+    TIFFSetWarningHandler(oldWarningHandler);
+    if (tiff == NULL)
+    {
+        return false;
+    };
+    // collect all reduced images
+    std::vector<toff_t> candidates;
+    uint16 subIFDCount = 0;
+    toff_t* subIFDs = NULL;
+    if (TIFFGetField(tiff, TIFFTAG_SUBIFD, &subIFDCount, &subIFDs))
+    {
+        candidates.assign(subIFDs, subIFDs + subIFDCount);
+    };
+    while (TIFFReadDirectory(tiff))
+    {
+        uint32 subFileType = 0;
+        if (TIFFGetField(tiff, TIFFTAG_SUBFILETYPE, &subFileType) && (subFileType & FILETYPE_REDUCEDIMAGE))
+        {
+            candidates.push_back(TIFFCurrentDirOffset(tiff));
+        };
+    };
+    // find the smallest suitable image
+    toff_t best = 0;
+    vigra::Size2D bestSize(fullSize);
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (!TIFFSetSubDirectory(tiff, candidates[i]))
+        {
+            continue;
+        };
+        uint32 width = 0;
+        uint32 height = 0;
+        uint16 bitsPerSample = 0;
+        uint16 orientation = ORIENTATION_TOPLEFT;
+        TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+        TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation);
+        // vigra ignores the orientation tag, so only accept images which need no rotation,
+        // also skip thumbnails with a different aspect ratio
+        if (bitsPerSample == 8 && orientation == ORIENTATION_TOPLEFT &&
+            width >= static_cast<uint32>(minSize.width()) && height >= static_cast<uint32>(minSize.height()) &&
+            width < static_cast<uint32>(bestSize.width()) && height < static_cast<uint32>(bestSize.height()) &&
+            std::abs(static_cast<double>(width) * fullSize.height() - static_cast<double>(height) * fullSize.width()) <= std::max(fullSize.width(), fullSize.height()))
+        {
+            best = candidates[i];
+            bestSize = vigra::Size2D(width, height);
+        };
+    };
+    bool success = false;
+    if (best != 0 && TIFFSetSubDirectory(tiff, best))
+    {
+        uint16 extraSamplesCount = 0;
+        uint16* extraSamples = NULL;
+        const bool hasAlpha = TIFFGetField(tiff, TIFFTAG_EXTRASAMPLES, &extraSamplesCount, &extraSamples) && extraSamplesCount > 0;
+        std::vector<uint32> raster(bestSize.area());
+        if (TIFFReadRGBAImageOriented(tiff, bestSize.width(), bestSize.height(), raster.data(), ORIENTATION_TOPLEFT, 0))
+        {
+            image.resize(bestSize);
+            if (hasAlpha)
+            {
+                mask.resize(bestSize);
+            };
+            std::vector<uint32>::const_iterator pixel = raster.begin();
+            for (int y = 0; y < bestSize.height(); ++y)
+            {
+                for (int x = 0; x < bestSize.width(); ++x, ++pixel)
+                {
+                    image(x, y) = vigra::RGBValue<vigra::UInt8>(TIFFGetR(*pixel), TIFFGetG(*pixel), TIFFGetB(*pixel));
+                    if (hasAlpha)
+                    {
+                        mask(x, y) = TIFFGetA(*pixel);
+                    };
+                };
+            };
+            success = true;
+        };
+    };
+    TIFFClose(tiff);
+    return success;
+}
+
+ImageCache::EntryPtr ImageCache::loadImageAtScale(const std::string & filename, size_t maxPixels)
+{
+    EntryPtr reduced;
+    try
+    {
+        const vigra::ImageImportInfo info(filename.c_str());
+        const int nLevel = GetReduceLevels(info.width(), info.height(), maxPixels);
+        const std::string fileType(info.getFileType());
+        if (nLevel > 0 && std::string(info.getPixelType()) == "UINT8")
+        {
+            ImageCacheRGB8Ptr img8(new vigra::BRGBImage);
+            ImageCache8Ptr mask(new vigra::BImage);
+            bool success = false;
+            if (fileType == "JPEG" && (info.numBands() == 1 || info.numBands() == 3))
+            {
+                // libjpeg supports scaling by 1/2, 1/4 and 1/8
+                success = ReadScaledJPEG(filename, 1 << std::min(nLevel, 3), *img8);
+            }
+            else if (fileType == "TIFF")
+            {
+                // the size after reducing by nLevel pyramid levels
+                const vigra::Size2D minSize((info.width() + (1 << nLevel) - 1) >> nLevel,
+                                            (info.height() + (1 << nLevel) - 1) >> nLevel);
+                success = ReadReducedTIFF(filename, info.size(), minSize, *img8, *mask);
+            };
+            if (success)
+            {
+                ImageCacheRGB16Ptr img16(new vigra::UInt16RGBImage);
+                ImageCacheRGBFloatPtr imgFloat(new vigra::FRGBImage);
+                ImageCacheICCProfile iccProfile(new vigra::ImageImportInfo::ICCProfile);
+                if (!info.getICCProfile().empty())
+                {
+                    *iccProfile = info.getICCProfile();
+                };
+                reduced = EntryPtr(new Entry(img8, img16, imgFloat, mask, iccProfile, info.getPixelType()));
+                DEBUG_DEBUG("decoded " << filename << " at reduced size " << img8->width() << "x" << img8->height());
+            };
+        };
+    }
+    catch (std::exception & e)
+    {
+        // could not read header, let loadImageSafely report the error
+        DEBUG_DEBUG("Could not decode reduced image: " << e.what());
+    };
+    if (!reduced.get())
+    {
+        // fall back to loading the full size image
+        reduced = loadImageSafely(filename);
+        if (!reduced.get())
+        {
+            return EntryPtr();
+        };
+    };
+    vigra::Size2D size;
+    if (reduced->image8->width() > 0)
+    {
+        size = reduced->image8->size();
+    }
+    else if (reduced->image16->width() > 0)
+    {
+        size = reduced->image16->size();
+    }
+    else
+    {
+        size = reduced->imageFloat->size();
+    };
+    return ReduceEntry(reduced, GetReduceLevels(size.width(), size.height(), maxPixels));
+}
+
+ImageCache::EntryPtr ImageCache::loadSmallImageSafely(EntryPtr entry)
+{
+    // && entry->image8
+    size_t w=0;
+    size_t h=0;
+    if (entry->image8->width() > 0) {
+        w = entry->image8->width();
+        h = entry->image8->height();
+    } else if (entry->image16->width() > 0) {
+        w = entry->image16->width();
+        h = entry->image16->height();
+    } else if (entry->imageFloat->width() > 0) {
+        w = entry->imageFloat->width();
+        h = entry->imageFloat->height();
+    } else {
+        vigra_fail("Could not load image");
+    }
+
+    return ReduceEntry(entry, GetReduceLevels(w, h, smallImageSize));
+}
+
+ImageCache::EntryPtr ImageCache::loadSmallImageCached(const std::string & filename)
+{
+    ImageDiskCache& diskCache = *(getInstance().m_diskCache);
+    EntryPtr small_entry = diskCache.LoadSmallImage(filename);
+    if (small_entry.get())
+    {
+        return small_entry;
+    };
+    small_entry = loadImageAtScale(filename, smallImageSize);
+    if (small_entry.get())
+    {
+        diskCache.StoreSmallImage(filename, small_entry);
+    };
+    return small_entry;
+}
+
 ImageCache::EntryPtr ImageCache::getSmallImageIfAvailable(const std::string & filename)
 {
-    m_accessCounter++;
     softFlush();
-    std::map<std::string, EntryPtr>::iterator it;
     // "_small" is only used internally
-    std::string name = filename + std::string(":small");
-    it = images.find(name);
-    if (it != images.end()) {
-        return it->second;
-    } else {
-        // not found, return 0 pointer.
-        return EntryPtr();
-    }
+    // returns a 0 pointer, if not found
+    return findEntry(filename + std::string(":small"));
 }
 
-ImageCache::RequestPtr ImageCache::requestAsyncImage(const std::string & filename)
+ImageCache::RequestPtr ImageCache::requestAsyncImage(const std::string & filename, RequestPriority priority)
 {
     // see if we have a request already
     std::map<std::string, RequestPtr>::iterator it = m_requests.find(filename);
     if (it != m_requests.end()) {
         // return a copy of the existing request.
+        it->second->raisePriority(priority);
         return it->second;
     } else {
-        bool need_thread = m_requests.empty() && m_smallRequests.empty();
         // Make a new request.
-        RequestPtr request = RequestPtr(new Request(filename, false));
+        RequestPtr request = RequestPtr(new Request(filename, false, priority));
         m_requests[filename] = request;
-        if (need_thread) {
-            spawnAsyncThread();
-        }
+        startAsyncLoads();
         return request;
     }
 }
 
-ImageCache::RequestPtr ImageCache::requestAsyncSmallImage(const std::string & filename)
+ImageCache::RequestPtr ImageCache::requestAsyncSmallImage(const std::string & filename, RequestPriority priority)
 {
     // see if we have a request already
     std::map<std::string, RequestPtr>::iterator it = m_smallRequests.find(filename);
     if (it != m_smallRequests.end()) {
         // return a copy of the existing request.
+        it->second->raisePriority(priority);
         return it->second;
     } else {
         // Make a new request.
-        bool need_thread = m_requests.empty() && m_smallRequests.empty();
-        RequestPtr request = RequestPtr(new Request(filename, true));
+        RequestPtr request = RequestPtr(new Request(filename, true, priority));
         m_smallRequests[filename] = request;
-        if (need_thread) {
-            spawnAsyncThread();
-        }
+        startAsyncLoads();
         return request;
     }
 }
@@ -786,14 +1127,30 @@ void ImageCache::postEvent(RequestPtr request, EntryPtr entry)
     // the background loading thread, which will close itself now.
     bool is_small_request = request->getIsSmall();
     const std::string & filename = request->getFilename();
-    // Put the loaded image in the cache.
-    if (is_small_request) {
-        std::string name = filename+std::string(":small");
-        images[name] = entry;
-    } else {
-        images[filename] = entry;
+    const std::string name = is_small_request ? filename + std::string(":small") : filename;
+    m_loading.erase(name);
+    if (entry.get())
+    {
+        // Put the loaded image in the cache.
+        storeEntry(name, entry);
     }
-    entry->lastAccess = m_accessCounter;
+    else
+    {
+        // The image could not be loaded, trying again won't help.
+        DEBUG_ERROR("Could not load image " << filename);
+        std::map<std::string, RequestPtr>& requests = is_small_request ? m_smallRequests : m_requests;
+        std::map<std::string, RequestPtr>::iterator it = requests.find(filename);
+        if (it != requests.end() && it->second == request)
+        {
+            requests.erase(it);
+        };
+        // signal to anything waiting, that the image won't come
+        while (!request->failed.empty())
+        {
+            request->failed.front()(filename, is_small_request);
+            request->failed.erase(request->failed.begin());
+        };
+    };
     // Remove all the completed and no longer wanted requests from the queues.
     // We need to check everything, as images can be loaded synchronously after
     // an asynchronous request for it was made, and also something could have
@@ -845,48 +1202,81 @@ void ImageCache::postEvent(RequestPtr request, EntryPtr entry)
         }
         it = next_it;
     }
-    // If there are more images to load, start the thread again.
-    if (!(m_requests.empty() && m_smallRequests.empty())) {
-        // Start a background thread to load another image.
-        spawnAsyncThread();
-    }
+    // Load the next images, if there are any waiting.
+    startAsyncLoads();
 }
 
-void ImageCache::spawnAsyncThread()
+void ImageCache::startAsyncLoads()
 {
-    // Pick an image to load.
-    // Try the small images first.
-    std::map<std::string, RequestPtr>::iterator it = m_smallRequests.begin();
-    if (it == m_smallRequests.end()) {
-        it = m_requests.begin();
-        if (it == m_requests.end())
+    if (m_requests.empty() && m_smallRequests.empty())
+    {
+        DEBUG_DEBUG("Not loading an image, since no images are wanted.");
+        return;
+    };
+    if (!m_loaderThreads)
+    {
+        // decoding is partly limited by the disk, so don't use too many threads
+        const unsigned int threadCount = std::max(2u, std::min(std::thread::hardware_concurrency(), 4u));
+        m_loaderThreads = std::make_shared<hugin_utils::ThreadPool>(threadCount);
+    };
+    while (m_loading.size() < m_loaderThreads->size())
+    {
+        // Pick the waiting request with the highest priority, small images
+        // first if the priority is the same, because they load faster.
+        // Forget about requests nobody holds anymore.
+        RequestPtr best;
+        for (std::map<std::string, RequestPtr>::iterator it = m_smallRequests.begin();
+             it != m_smallRequests.end();)
         {
-            DEBUG_DEBUG("Not staring a thread to load an image, since no images are wanted.");
-        } else {
-            std::thread thread(loadSafely, it->second, EntryPtr());
-            thread.detach();
+            std::map<std::string, RequestPtr>::iterator next_it = it;
+            ++next_it;
+            if (it->second.unique()) {
+                m_smallRequests.erase(it);
+            } else if (m_loading.find(it->first + std::string(":small")) == m_loading.end() &&
+                       m_loading.find(it->first) == m_loading.end() &&
+                       (!best || it->second->getPriority() > best->getPriority())) {
+                // when the full size image is loading, the small image is generated from it later
+                best = it->second;
+            }
+            it = next_it;
         }
-    } else {
-        // got a small image request, check if its larger version has loaded.
-        const std::string & filename = it->second->getFilename();
-        EntryPtr large = getImageIfAvailable(filename);
-        if (large.get() == 0)
+        for (std::map<std::string, RequestPtr>::iterator it = m_requests.begin();
+             it != m_requests.end();)
         {
-            // the larger one is needed to generate it.
-            RequestPtr request(new Request(filename, false));
-            std::thread thread(loadSafely, request, EntryPtr());
-            thread.detach();
-        } else {
-            // we have the large image.
-            std::thread thread(loadSafely, it->second, large);
-            thread.detach();
+            std::map<std::string, RequestPtr>::iterator next_it = it;
+            ++next_it;
+            if (it->second.unique()) {
+                m_requests.erase(it);
+            } else if (m_loading.find(it->first) == m_loading.end() &&
+                       (!best || it->second->getPriority() > best->getPriority())) {
+                best = it->second;
+            }
+            it = next_it;
         }
-    }
-    // thread should be processing the image asynchronously now.
-    // Only one image is done at a time, so very little can go wrong between the
-    // threads. The loading thread does not need to alter the ImageCache, and
-    // there is a time when we can safely pick Requests which haven't started
-    // loading, without giving images and lists mutexes.
+        if (!best)
+        {
+            // everything wanted is already loading
+            break;
+        };
+        const std::string & filename = best->getFilename();
+        EntryPtr large;
+        if (best->getIsSmall())
+        {
+            m_loading.insert(filename + std::string(":small"));
+            // check if its larger version has loaded, the small image can be
+            // generated from it, otherwise the small image is read from the
+            // disk cache or decoded at reduced resolution
+            large = getImageIfAvailable(filename);
+        }
+        else
+        {
+            m_loading.insert(filename);
+        };
+        m_loaderThreads->push(std::bind(&ImageCache::loadSafely, best, large));
+    };
+    // The loading threads do not need to alter the ImageCache, they only pass
+    // the loaded image back to postEvent in the main thread. So the requests
+    // and the images need no mutexes.
 }
 
 void ImageCache::loadSafely(ImageCache::RequestPtr request, EntryPtr large)
@@ -896,6 +1286,9 @@ void ImageCache::loadSafely(ImageCache::RequestPtr request, EntryPtr large)
     if (large.get())
     {
         new_entry = loadSmallImageSafely(large);
+        getInstance().m_diskCache->StoreSmallImage(request->getFilename(), new_entry);
+    } else if (request->getIsSmall()) {
+        new_entry = loadSmallImageCached(request->getFilename());
     } else {
         new_entry = loadImageSafely(request->getFilename());
     }
@@ -27,12 +27,16 @@
 #include <hugin_shared.h>
 #include "hugin_config.h"
 #include <map>
+#include <set>
+#include <list>
 #include <vector>
 #include <memory>
 #include <functional>
+#include <algorithm>
 #include <vigra/stdimage.hxx>
 #include <vigra/imageinfo.hxx>
 #include <hugin_utils/utils.h>
+#include <hugin_utils/thread_pool.h>
 #include <appbase/ProgressDisplay.h>
 
 #define HUGIN_IMGCACHE_MAPPING_INTEGER        0l
@@ -40,6 +44,8 @@
 
 
 namespace HuginBase {
+
+class ImageDiskCache;
     
 /** This is a cache for all the images we use.
  *
@@ -60,7 +66,11 @@ class IMPEX ImageCache
         typedef std::shared_ptr<vigra::BImage> ImageCache8Ptr;
         typedef std::shared_ptr<vigra::ImageImportInfo::ICCProfile> ImageCacheICCProfile;
 
-        /** information about an image inside the cache */
+        /** information about an image inside the cache
+         *
+         *  Only one of image8, image16 and imageFloat contains the image,
+         *  depending on the pixel type of the file, the others are empty.
+         */
         struct IMPEX Entry
         {
             ImageCacheRGB8Ptr image8;
@@ -104,21 +114,49 @@ class IMPEX ImageCache
                     DEBUG_TRACE("Deleting ImageCacheEntry");
                 };
 
-                ///
+                /** returns the image as 8 bit image.
+                 *
+                 *  For 16 bit and float images the 8 bit version is generated
+                 *  on demand. It is kept as long as it is used, or until the
+                 *  ImageCache needs the memory, so hold the returned pointer
+                 *  as long as the 8 bit image is needed.
+                 */
                 ImageCacheRGB8Ptr get8BitImage();
+                /** returns the memory used by the image buffers of the entry
+                 *  in bytes, without the generated 8 bit image */
+                size_t getMemSize() const;
+
+            private:
+                friend class ImageCache;
+                /// 8 bit version of image16 or imageFloat, generated by get8BitImage
+                ImageCacheRGB8Ptr m_derived8;
+                /// key of the entry in the ImageCache, empty if not in the cache
+                std::string m_cacheKey;
         };
 
         /** a shared pointer to the entry */
         typedef std::shared_ptr<Entry> EntryPtr;
         
+        /** priority of an asynchronous request, requests with higher
+         *  priority are loaded first */
+        enum RequestPriority
+        {
+            /// e.g. thumbnails in lists
+            PRIORITY_LOW = 0,
+            /// e.g. textures for the previews
+            PRIORITY_NORMAL,
+            /// e.g. the image currently shown in the control point editor
+            PRIORITY_HIGH
+        };
+
         /** Request for an image to load
          *  Connect to the ready signal so when the image loads you can respond.
          */
         class Request
         {
             public:
-                Request(std::string filename, bool request_small)
-                    :m_filename(filename), m_isSmall(request_small)
+                Request(std::string filename, bool request_small, RequestPriority priority = PRIORITY_NORMAL)
+                    :m_filename(filename), m_isSmall(request_small), m_priority(priority)
                     {};
                 /** Signal that fires when the image is loaded.
                  *  Function must return void and have three arguments: EntryPtr
@@ -129,13 +167,25 @@ class IMPEX ImageCache
                  *  the EntryPtr prevents this.
                  */
                 std::vector <std::function<void(EntryPtr, std::string, bool)>> ready;
+                /** Signal that fires when the image could not be loaded.
+                 *  Function must return void and have two arguments:
+                 *  std::string for the filename, and a bool that is true iff
+                 *  this is a small image. The ready signal does not fire then.
+                 */
+                std::vector <std::function<void(std::string, bool)>> failed;
                 bool getIsSmall() const
                     {return m_isSmall;};
                 const std::string & getFilename() const
                     {return m_filename;};
+                RequestPriority getPriority() const
+                    {return m_priority;};
+                /** raises the priority of the request, a lower priority is ignored */
+                void raisePriority(RequestPriority priority)
+                    {m_priority = std::max(m_priority, priority);};
             protected:
                 std::string m_filename;
                 bool m_isSmall;
+                RequestPriority m_priority;
         };
         
         /** Reference counted request for an image to load.
@@ -154,7 +204,7 @@ class IMPEX ImageCache
         // ctor. private, nobody execpt us can create an instance.
         ImageCache()
             : asyncLoadCompleteSignal(0), upperBound(100*1024*1024l),
-              m_progress(NULL), m_accessCounter(0)
+              m_usedMemory(0), m_progress(NULL), m_accessCounter(0)
         {};
         
     public:
@@ -220,11 +270,14 @@ class IMPEX ImageCache
          
         /** Request an image be loaded.
          * This function returns quickly even when the image is not cached.
+         * Several images are loaded in parallel, the requests with the highest
+         * priority first. Requesting an image again returns the existing
+         * request, with its priority raised to @p priority if necessary.
          *
          * @return Object to keep while you want the image. Connect to its
          * ready signal to be notified when the image is ready.
          */
-        RequestPtr requestAsyncImage(const std::string & filename);
+        RequestPtr requestAsyncImage(const std::string & filename, RequestPriority priority = PRIORITY_NORMAL);
         
         /** Request a small image be loaded.
          * This function returns quickly even when the image is not cached.
@@ -232,7 +285,7 @@ class IMPEX ImageCache
          * @return Object to keep while you want the image. Connect to its
          * ready signal to be notified when it is ready.
          */
-        RequestPtr requestAsyncSmallImage(const std::string & filename);
+        RequestPtr requestAsyncSmallImage(const std::string & filename, RequestPriority priority = PRIORITY_LOW);
 
         /** remove a specific image (and dependant images)
          * from the cache 
@@ -248,12 +301,26 @@ class IMPEX ImageCache
 
         /** a soft version of flush.
          *
-         *  Releases some images if they go over a certain threshold
+         *  Releases some images if they go over a certain threshold.
+         *  The least recently used images are released first, pyramid images
+         *  before full size images before small images. Images which are
+         *  still used elsewhere are kept.
          */
         void softFlush();
+        /** returns the memory used by the images in the cache in bytes */
+        unsigned long long getUsedMemory() const { return m_usedMemory; };
 		/** sets the upper limit, which is used by softFlush() 
 		 */
 		void SetUpperLimit(long newUpperLimit) { upperBound=newUpperLimit; };
+        /** enables the persistent cache for small images.
+         *
+         *  The small images are stored in @p directory, so they are available
+         *  without decoding the original images in the next session.
+         *  @param directory directory for the cached files, an empty string
+         *                   disables the disk cache
+         *  @param upperLimit maximal size of the disk cache in bytes
+         */
+        void SetDiskCache(const std::string& directory, unsigned long long upperLimit);
         
         /** Signal for when a asynchronous load completes.
          *  If you use the requestAsync functions, ensure there is something
@@ -266,6 +333,15 @@ class IMPEX ImageCache
          *  later.
          */
         void (*asyncLoadCompleteSignal)(RequestPtr, EntryPtr);
+
+        /** Signal for memory pressure.
+         *  It is called by softFlush, when the images in the cache still use
+         *  more memory than the upper limit after releasing all images which
+         *  are not used elsewhere. The argument is the number of bytes over the
+         *  limit. The handler can release EntryPtrs it does not really need,
+         *  they are released from the cache at the next softFlush.
+         */
+        std::function<void(unsigned long long)> memoryPressureSignal;
         
         /** Pass on a loaded event for any images loaded asynchronously.
          *  Call from the main GUI thread when an ImageLoadedEvent occurs.
@@ -279,6 +355,9 @@ class IMPEX ImageCache
     private:
         long upperBound;
 
+        /// persistent cache of the small images
+        std::shared_ptr<ImageDiskCache> m_diskCache;
+
         template <class SrcPixelType,
                   class DestIterator, class DestAccessor>
         static void importAndConvertImage(const vigra::ImageImportInfo& info,
@@ -317,7 +396,52 @@ class IMPEX ImageCache
         
         
     private:
-        std::map<std::string, EntryPtr> images;
+        /** size classes of the cached entries, released in this order */
+        enum EntryClass
+        {
+            /// 8 bit versions generated by Entry::get8BitImage
+            ENTRY_DERIVED = 0,
+            ENTRY_FULL,
+            ENTRY_SMALL,
+            ENTRY_CLASS_COUNT
+        };
+
+        /** an entry in the cache with the information needed for the memory accounting */
+        struct CacheItem
+        {
+            EntryPtr entry;
+            /// memory accounted for this entry in m_usedMemory
+            size_t memSize;
+            EntryClass entryClass;
+            /// position in m_lru[entryClass]
+            std::list<std::string>::iterator lruPos;
+            /// memory accounted for the generated 8 bit image of the entry
+            size_t derivedSize;
+            /// true, if the key is in m_lru[ENTRY_DERIVED]
+            bool hasDerived;
+            /// position in m_lru[ENTRY_DERIVED]
+            std::list<std::string>::iterator derivedLruPos;
+        };
+        typedef std::map<std::string, CacheItem> CacheMap;
+
+        CacheMap images;
+        /// keys of the cached entries for each size class, the most recently used first
+        std::list<std::string> m_lru[ENTRY_CLASS_COUNT];
+        /// memory used by all entries and pyramid images in bytes
+        unsigned long long m_usedMemory;
+
+        /** returns the cached entry for key and marks it as recently used,
+         *  or a 0 pointer if it is not in the cache */
+        EntryPtr findEntry(const std::string & key);
+        /** adds an entry to the cache, replacing an existing entry for key */
+        void storeEntry(const std::string & key, EntryPtr entry);
+        /** removes an entry from the cache */
+        void eraseEntry(CacheMap::iterator it);
+        /** accounts the generated 8 bit image of the entry stored under key
+         *  and marks it as recently used, called by Entry::get8BitImage */
+        void updateDerivedImage(const std::string & key, const Entry * entry);
+        /** releases the generated 8 bit image of a cached entry */
+        void releaseDerivedImage(CacheItem & item);
 
         // our progress display
         AppBase::ProgressDisplay* m_progress;
@@ -330,8 +454,18 @@ class IMPEX ImageCache
         // Requests for small images that need generating.
         std::map<std::string, RequestPtr> m_smallRequests;
         
-        /// Start a background thread to load an image.
-        void spawnAsyncThread();
+        /// the threads for loading the requested images
+        std::shared_ptr<hugin_utils::ThreadPool> m_loaderThreads;
+
+        /** Keys (filename or filename:small) of the requests which are
+         *  currently loaded by the loader threads. */
+        std::set<std::string> m_loading;
+
+        /** Pass the waiting requests with the highest priority to the loader
+         *  threads, until all threads are busy. Requests which nobody holds
+         *  anymore are cancelled. Must be called from the main thread.
+         */
+        void startAsyncLoads();
         
         /** Load a requested image in a way that will work in parallel.
          *  When done, it sends an event with the newly created EntryPtr and
@@ -353,6 +487,23 @@ class IMPEX ImageCache
          * @param entry Large image to scale down.
          */
         static EntryPtr loadSmallImageSafely(EntryPtr entry);
+
+        /** Load an image, reduced so that it has at most @p maxPixels pixels.
+         *
+         *  If the codec can decode a reduced resolution directly (JPEG DCT
+         *  scaling, reduced resolution images in TIFF files), the largest
+         *  reduced resolution which is not smaller than the requested size is
+         *  decoded and then reduced further. Otherwise the full size image is
+         *  loaded and reduced. Works in parallel like loadImageSafely.
+         *  If the image cannot be loaded, the pointer returned is 0.
+         */
+        static EntryPtr loadImageAtScale(const std::string & filename, size_t maxPixels);
+
+        /** Get a small image from the disk cache or load it at reduced
+         *  resolution, in a way that will work in parallel.
+         *  If the image cannot be loaded, the pointer returned is 0.
+         */
+        static EntryPtr loadSmallImageCached(const std::string & filename);
         
     public:
         /** get a pyramid image.
@@ -386,6 +537,7 @@ class IMPEX ImageCache
                 std::string toString();
         };
         
+        /// the memory of the pyramid images is included in m_usedMemory
         std::map<std::string, vigra::BImage *> pyrImages;
 };
 
@@ -0,0 +1,579 @@
+// -*- c-basic-offset: 4 -*-
+
+/** @file ImageDiskCache.cpp
+ *
+ *  @brief implementation of ImageDiskCache Class
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ImageDiskCache.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <chrono>
+#include <thread>
+#include "hugin_config.h"
+#ifdef HAVE_STD_FILESYSTEM
+#include <filesystem>
+namespace fs = std::tr2::sys;
+#else
+#define BOOST_FILESYSTEM_VERSION 3
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+#endif
+#include <vigra/impex.hxx>
+#include <vigra_ext/impexalpha.hxx>
+
+namespace HuginBase {
+
+/** name of the index file inside the cache directory */
+static const char* indexFilename = "index.txt";
+/** name of the lock file, which protects the index file */
+static const char* lockFilename = "index.lock";
+/** temporary files and files which are not in the index are only removed when
+ *  they are older than this (in seconds), newer files can belong to another
+ *  running instance */
+static const long long staleFileAge = 3600;
+/** a lock file older than this (in seconds) is left over from a crashed instance */
+static const long long staleLockAge = 60;
+
+/** returns true, if the file was modified more than @p age seconds ago */
+static bool IsOlderThan(const fs::path& path, const long long age)
+{
+#ifdef HAVE_STD_FILESYSTEM
+    return fs::file_time_type::clock::now() - fs::last_write_time(path) > std::chrono::seconds(age);
+#else
+    return std::time(NULL) - fs::last_write_time(path) > age;
+#endif
+}
+
+/** lock file in the cache directory, which serializes the access to the index
+ *  file of several running instances */
+class IndexLock
+{
+public:
+    explicit IndexLock(const std::string& directory)
+        : m_path(fs::path(directory) / lockFilename), m_locked(false)
+    {
+        for (int attempt = 0; attempt < 100 && !m_locked; ++attempt)
+        {
+            // mode x fails if the file already exists
+            FILE* file = std::fopen(m_path.string().c_str(), "wx");
+            if (file != NULL)
+            {
+                std::fclose(file);
+                m_locked = true;
+                break;
+            };
+            try
+            {
+                if (fs::exists(m_path) && IsOlderThan(m_path, staleLockAge))
+                {
+                    fs::remove(m_path);
+                    continue;
+                };
+            }
+            catch (const fs::filesystem_error&)
+            {
+            };
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        };
+    }
+    ~IndexLock()
+    {
+        if (m_locked)
+        {
+            try
+            {
+                fs::remove(m_path);
+            }
+            catch (const fs::filesystem_error& e)
+            {
+                DEBUG_ERROR("Could not remove lock file of image cache: " << e.what());
+            };
+        };
+    }
+    bool IsLocked() const
+    {
+        return m_locked;
+    }
+private:
+    IndexLock(const IndexLock&);
+    IndexLock& operator=(const IndexLock&);
+    fs::path m_path;
+    bool m_locked;
+};
+
+/** 64 bit FNV-1a hash, used instead of std::hash because the key needs to
+ *  be stable between different builds */
+static unsigned long long HashString(const std::string& s)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        hash ^= static_cast<unsigned char>(s[i]);
+        hash *= 1099511628211ULL;
+    };
+    return hash;
+}
+
+template <class ImageType>
+static void ImportCachedImage(const vigra::ImageImportInfo& info, ImageType& image, vigra::BImage& mask)
+{
+    image.resize(info.size());
+    if (info.numExtraBands() > 0)
+    {
+        mask.resize(info.size());
+        vigra::importImageAlpha(info, vigra::destImage(image), vigra::destImage(mask));
+    }
+    else
+    {
+        vigra::importImage(info, vigra::destImage(image));
+    };
+}
+
+template <class ImageType>
+static void ExportCachedImage(const ImageType& image, const vigra::BImage& mask, vigra::ImageExportInfo& exportInfo)
+{
+    if (mask.width() > 0)
+    {
+        vigra::exportImageAlpha(vigra::srcImageRange(image), vigra::srcImage(mask), exportInfo);
+    }
+    else
+    {
+        vigra::exportImage(vigra::srcImageRange(image), exportInfo);
+    };
+}
+
+ImageDiskCache::ImageDiskCache()
+    : m_upperLimit(0), m_totalSize(0), m_accessCounter(0), m_indexChanged(false),
+      m_tempNameGenerator(std::random_device()())
+{
+}
+
+ImageDiskCache::~ImageDiskCache()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_indexChanged)
+    {
+        WriteIndex();
+    };
+}
+
+void ImageDiskCache::SetDirectory(const std::string& directory, unsigned long long upperLimit)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (directory != m_directory)
+    {
+        if (m_indexChanged)
+        {
+            WriteIndex();
+        };
+        m_index.clear();
+        m_totalSize = 0;
+        m_accessCounter = 0;
+        m_indexChanged = false;
+        m_directory = directory;
+        if (!m_directory.empty())
+        {
+            try
+            {
+                const fs::path path(m_directory);
+                if (!fs::exists(path))
+                {
+                    fs::create_directories(path);
+                };
+            }
+            catch (const fs::filesystem_error& e)
+            {
+                DEBUG_ERROR("Could not create image cache directory: " << e.what());
+                m_directory.clear();
+                return;
+            };
+            ReadIndex();
+        };
+    };
+    m_upperLimit = upperLimit;
+    if (!m_directory.empty())
+    {
+        Trim();
+        if (m_indexChanged)
+        {
+            WriteIndex();
+        };
+    };
+}
+
+bool ImageDiskCache::IsEnabled()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_directory.empty() && m_upperLimit > 0;
+}
+
+std::string ImageDiskCache::GetKey(const std::string& filename)
+{
+    std::ostringstream key;
+    try
+    {
+        const fs::path path = fs::absolute(fs::path(filename));
+        key << path.string() << "|" << fs::file_size(path) << "|";
+#ifdef HAVE_STD_FILESYSTEM
+        key << fs::last_write_time(path).time_since_epoch().count();
+#else
+        key << fs::last_write_time(path);
+#endif
+    }
+    catch (const fs::filesystem_error&)
+    {
+        return std::string();
+    };
+    std::ostringstream hash;
+    hash << std::hex << std::setfill('0') << std::setw(16) << HashString(key.str());
+    return hash.str();
+}
+
+std::string ImageDiskCache::GetCacheFilename(const std::string& key) const
+{
+    return (fs::path(m_directory) / (key + ".tif")).string();
+}
+
+std::string ImageDiskCache::GetTempFilename(const std::string& cacheFilename)
+{
+    std::ostringstream tempFilename;
+    tempFilename << cacheFilename.substr(0, cacheFilename.size() - 4) << "." << std::hex << std::setfill('0')
+        << std::setw(16) << m_tempNameGenerator() << ".tmp.tif";
+    return tempFilename.str();
+}
+
+ImageCache::EntryPtr ImageDiskCache::LoadSmallImage(const std::string& filename)
+{
+    const std::string key = GetKey(filename);
+    if (key.empty())
+    {
+        return ImageCache::EntryPtr();
+    };
+    std::string cacheFilename;
+    std::string origType;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_directory.empty() || m_upperLimit == 0)
+        {
+            return ImageCache::EntryPtr();
+        };
+        std::map<std::string, IndexEntry>::iterator it = m_index.find(key);
+        if (it == m_index.end())
+        {
+            return ImageCache::EntryPtr();
+        };
+        it->second.lastAccess = ++m_accessCounter;
+        m_indexChanged = true;
+        origType = it->second.origType;
+        cacheFilename = GetCacheFilename(key);
+    }
+    ImageCache::EntryPtr entry(new ImageCache::Entry);
+    entry->origType = origType;
+    try
+    {
+        vigra::ImageImportInfo info(cacheFilename.c_str());
+        if (!info.getICCProfile().empty())
+        {
+            *(entry->iccProfile) = info.getICCProfile();
+        };
+        const std::string pixelType(info.getPixelType());
+        if (pixelType == "UINT8")
+        {
+            ImportCachedImage(info, *(entry->image8), *(entry->mask));
+        }
+        else if (pixelType == "UINT16")
+        {
+            ImportCachedImage(info, *(entry->image16), *(entry->mask));
+        }
+        else
+        {
+            ImportCachedImage(info, *(entry->imageFloat), *(entry->mask));
+        };
+    }
+    catch (std::exception& e)
+    {
+        // broken or deleted file, remove it from the index
+        DEBUG_ERROR("Could not read cached image " << cacheFilename << ": " << e.what());
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<std::string, IndexEntry>::iterator it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            RemoveEntry(it);
+        };
+        return ImageCache::EntryPtr();
+    };
+    return entry;
+}
+
+void ImageDiskCache::StoreSmallImage(const std::string& filename, ImageCache::EntryPtr entry)
+{
+    if (!entry.get() || entry->origType.empty())
+    {
+        return;
+    };
+    const std::string key = GetKey(filename);
+    if (key.empty())
+    {
+        return;
+    };
+    std::string cacheFilename;
+    std::string tempFilename;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_directory.empty() || m_upperLimit == 0 || m_index.find(key) != m_index.end() ||
+            m_pending.find(key) != m_pending.end())
+        {
+            return;
+        };
+        // reserve the key, so that no other thread writes the same image
+        m_pending.insert(key);
+        cacheFilename = GetCacheFilename(key);
+        // write to a temporary file first, so that no other thread or other running
+        // instance reads a partial file
+        tempFilename = GetTempFilename(cacheFilename);
+    }
+    unsigned long long fileSize = 0;
+    try
+    {
+        vigra::ImageExportInfo exportInfo(tempFilename.c_str());
+        exportInfo.setCompression("LZW");
+        if (!entry->iccProfile->empty())
+        {
+            exportInfo.setICCProfile(*(entry->iccProfile));
+        };
+        // store the image in its original pixel type
+        if (entry->imageFloat->width() > 0)
+        {
+            exportInfo.setPixelType("FLOAT");
+            ExportCachedImage(*(entry->imageFloat), *(entry->mask), exportInfo);
+        }
+        else if (entry->image16->width() > 0)
+        {
+            exportInfo.setPixelType("UINT16");
+            ExportCachedImage(*(entry->image16), *(entry->mask), exportInfo);
+        }
+        else if (entry->image8->width() > 0)
+        {
+            exportInfo.setPixelType("UINT8");
+            ExportCachedImage(*(entry->image8), *(entry->mask), exportInfo);
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.erase(key);
+            return;
+        };
+        if (fs::exists(fs::path(cacheFilename)))
+        {
+            // another running instance has stored the same image in the meantime
+            fs::remove(fs::path(tempFilename));
+        }
+        else
+        {
+            fs::rename(fs::path(tempFilename), fs::path(cacheFilename));
+        };
+        fileSize = fs::file_size(fs::path(cacheFilename));
+    }
+    catch (std::exception& e)
+    {
+        DEBUG_ERROR("Could not write cached image " << cacheFilename << ": " << e.what());
+        try
+        {
+            fs::remove(fs::path(tempFilename));
+        }
+        catch (const fs::filesystem_error&)
+        {
+        };
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.erase(key);
+        return;
+    };
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.erase(key);
+    if (m_directory.empty() || GetCacheFilename(key) != cacheFilename || m_index.find(key) != m_index.end())
+    {
+        // the cache directory was changed while writing or the entry is already known
+        return;
+    };
+    IndexEntry indexEntry;
+    indexEntry.origType = entry->origType;
+    indexEntry.fileSize = fileSize;
+    indexEntry.lastAccess = ++m_accessCounter;
+    m_index[key] = indexEntry;
+    m_totalSize += fileSize;
+    Trim();
+    WriteIndex();
+}
+
+void ImageDiskCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while (!m_index.empty())
+    {
+        RemoveEntry(m_index.begin());
+    };
+    if (!m_directory.empty())
+    {
+        WriteIndex();
+    };
+}
+
+void ImageDiskCache::ReadIndexFile(std::map<std::string, IndexEntry>& index) const
+{
+    std::ifstream indexFile((fs::path(m_directory) / indexFilename).string().c_str());
+    std::string line;
+    while (indexFile.good() && std::getline(indexFile, line))
+    {
+        std::istringstream lineStream(line);
+        std::string key;
+        IndexEntry entry;
+        if (lineStream >> key >> entry.origType >> entry.fileSize >> entry.lastAccess)
+        {
+            index[key] = entry;
+        };
+    };
+}
+
+void ImageDiskCache::ReadIndex()
+{
+    std::map<std::string, IndexEntry> index;
+    ReadIndexFile(index);
+    for (std::map<std::string, IndexEntry>::const_iterator it = index.begin(); it != index.end(); ++it)
+    {
+        if (!fs::exists(fs::path(GetCacheFilename(it->first))))
+        {
+            m_indexChanged = true;
+            continue;
+        };
+        m_index[it->first] = it->second;
+        m_totalSize += it->second.fileSize;
+        m_accessCounter = std::max(m_accessCounter, it->second.lastAccess);
+    };
+    // remove temporary files and files which are not in the index, e.g. after a crash,
+    // recent files are kept because they could be written by another running instance
+    try
+    {
+        for (fs::directory_iterator it(m_directory); it != fs::directory_iterator(); ++it)
+        {
+            const fs::path file = it->path();
+            if (file.extension().string() == ".tif" && m_index.find(file.stem().string()) == m_index.end() &&
+                IsOlderThan(file, staleFileAge))
+            {
+                fs::remove(file);
+            };
+        };
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        DEBUG_ERROR("Could not clean image cache directory: " << e.what());
+    };
+}
+
+void ImageDiskCache::WriteIndex()
+{
+    IndexLock lock(m_directory);
+    if (!lock.IsLocked())
+    {
+        DEBUG_ERROR("Could not lock index of image cache in " << m_directory);
+        return;
+    };
+    // merge the entries which were added by other running instances, entries
+    // removed by any instance are skipped because their file is missing
+    std::map<std::string, IndexEntry> index;
+    ReadIndexFile(index);
+    for (std::map<std::string, IndexEntry>::const_iterator it = index.begin(); it != index.end(); ++it)
+    {
+        std::map<std::string, IndexEntry>::iterator known = m_index.find(it->first);
+        if (known != m_index.end())
+        {
+            known->second.lastAccess = std::max(known->second.lastAccess, it->second.lastAccess);
+        }
+        else
+        {
+            if (m_pending.find(it->first) == m_pending.end() && fs::exists(fs::path(GetCacheFilename(it->first))))
+            {
+                m_index[it->first] = it->second;
+                m_totalSize += it->second.fileSize;
+            }
+            else
+            {
+                continue;
+            };
+        };
+        m_accessCounter = std::max(m_accessCounter, it->second.lastAccess);
+    };
+    // write to a temporary file and replace the index, so that it is never read partially
+    const fs::path indexPath = fs::path(m_directory) / indexFilename;
+    const fs::path tempPath = fs::path(m_directory) / (std::string(indexFilename) + ".tmp");
+    {
+        std::ofstream indexFile(tempPath.string().c_str());
+        for (std::map<std::string, IndexEntry>::const_iterator it = m_index.begin(); it != m_index.end(); ++it)
+        {
+            indexFile << it->first << " " << it->second.origType << " " << it->second.fileSize << " " << it->second.lastAccess << std::endl;
+        };
+    }
+    try
+    {
+        fs::rename(tempPath, indexPath);
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        DEBUG_ERROR("Could not write index of image cache: " << e.what());
+        return;
+    };
+    m_indexChanged = false;
+}
+
+void ImageDiskCache::Trim()
+{
+    while (m_totalSize > m_upperLimit && !m_index.empty())
+    {
+        std::map<std::string, IndexEntry>::iterator oldest = m_index.begin();
+        for (std::map<std::string, IndexEntry>::iterator it = m_index.begin(); it != m_index.end(); ++it)
+        {
+            if (it->second.lastAccess < oldest->second.lastAccess)
+            {
+                oldest = it;
+            };
+        };
+        RemoveEntry(oldest);
+    };
+}
+
+void ImageDiskCache::RemoveEntry(std::map<std::string, IndexEntry>::iterator it)
+{
+    try
+    {
+        fs::remove(fs::path(GetCacheFilename(it->first)));
+    }
+    catch (const fs::filesystem_error& e)
+    {
+        DEBUG_ERROR("Could not remove cached image: " << e.what());
+    };
+    m_totalSize -= std::min(m_totalSize, it->second.fileSize);
+    m_index.erase(it);
+    m_indexChanged = true;
+}
+
+} //namespace
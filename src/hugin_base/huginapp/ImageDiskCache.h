@@ -0,0 +1,122 @@
+// -*- c-basic-offset: 4 -*-
+/** @file ImageDiskCache.h
+ *
+ *  @brief persistent cache for the small images of the ImageCache
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _HUGINAPP_IMAGEDISKCACHE_H
+#define _HUGINAPP_IMAGEDISKCACHE_H
+
+#include <hugin_shared.h>
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <random>
+#include <huginapp/ImageCache.h>
+
+namespace HuginBase {
+
+/** stores the small images of the ImageCache on disk, so that they are
+ *  available in the next session without decoding the original images again.
+ *
+ *  The cached files are addressed by the absolute filename, the modification
+ *  time and the size of the original image, so a changed image is not found
+ *  anymore and its old version is evicted eventually. The images are stored
+ *  in their original pixel type (8 bit, 16 bit or float) together with the mask
+ *  and the icc profile. When the cache grows over the upper limit the least
+ *  recently used images are removed.
+ *
+ *  All functions are thread safe, so the cache can be used from the
+ *  background loading threads of the ImageCache. Several running instances
+ *  can share the same directory, the index file is protected by a lock file
+ *  and the entries of the other instances are merged when it is written.
+ */
+class IMPEX ImageDiskCache
+{
+    public:
+        ImageDiskCache();
+        ~ImageDiskCache();
+
+        /** sets the directory for the cache, an empty string disables the cache
+         *  @param directory directory of the cache, it is created if necessary
+         *  @param upperLimit maximal size of all cached files in bytes
+         */
+        void SetDirectory(const std::string& directory, unsigned long long upperLimit);
+        /** returns true, if the cache is enabled */
+        bool IsEnabled();
+        /** loads the small image of @p filename from the cache
+         *  @return the cached small image or a 0 pointer if it is not in the cache
+         */
+        ImageCache::EntryPtr LoadSmallImage(const std::string& filename);
+        /** stores the small image @p entry of @p filename in the cache */
+        void StoreSmallImage(const std::string& filename, ImageCache::EntryPtr entry);
+        /** removes all files from the cache */
+        void Clear();
+
+    private:
+        // no copies
+        ImageDiskCache(const ImageDiskCache&);
+        ImageDiskCache& operator=(const ImageDiskCache&);
+
+        /** information about a cached file */
+        struct IndexEntry
+        {
+            std::string origType;
+            unsigned long long fileSize;
+            unsigned long long lastAccess;
+        };
+
+        /** returns the key for the given image file, or an empty string if
+         *  the file could not be accessed */
+        static std::string GetKey(const std::string& filename);
+        /** returns the filename of the cached image for @p key */
+        std::string GetCacheFilename(const std::string& key) const;
+        /** returns a new unique name for a temporary file for @p cacheFilename,
+         *  m_mutex must be locked */
+        std::string GetTempFilename(const std::string& cacheFilename);
+        /** reads the entries of the index file into @p index */
+        void ReadIndexFile(std::map<std::string, IndexEntry>& index) const;
+        /** reads the index file and removes old files which are not in the index,
+         *  m_mutex must be locked */
+        void ReadIndex();
+        /** merges the entries of other running instances from the index file and
+         *  writes the index file, m_mutex must be locked */
+        void WriteIndex();
+        /** removes the least recently used files until the cache is below the
+         *  upper limit, m_mutex must be locked */
+        void Trim();
+        /** removes the given file from the cache, m_mutex must be locked */
+        void RemoveEntry(std::map<std::string, IndexEntry>::iterator it);
+
+        std::mutex m_mutex;
+        std::string m_directory;
+        unsigned long long m_upperLimit;
+        unsigned long long m_totalSize;
+        unsigned long long m_accessCounter;
+        bool m_indexChanged;
+        std::map<std::string, IndexEntry> m_index;
+        /** keys of the images which are currently written by a thread */
+        std::set<std::string> m_pending;
+        /** creates the names of the temporary files, so that they are unique
+         *  for all threads and all running instances */
+        std::mt19937_64 m_tempNameGenerator;
+};
+
+} //namespace
+#endif // _HUGINAPP_IMAGEDISKCACHE_H
@@ -178,17 +178,33 @@ RemappedPanoImage<ImageType, AlphaType>*
         if (r != 0) width += 8 - r;
     }
 
-    ImageType srcImg(width, height);
     m_remapped->m_ICCProfile = info.getICCProfile();
-    
-    if (info.numExtraBands() > 0) {
-        srcAlpha.resize(width, height);
-    }
     //int nb = info.numBands() - info.numExtraBands();
     bool alpha = info.numExtraBands() > 0;
     std::string type = info.getPixelType();
     
     SrcPanoImage src = pano.getSrcImage(imgNr);
+
+    // remap huge images in bands, without loading the whole image
+    const int bandHeight = static_cast<int>(GetAdvancedOption(SingleImageRemapper<ImageType, AlphaType>::m_advancedOptions, "remapBandHeight", 0.0f));
+    if (bandHeight > 0 && !opts.remapUsingGPU && !(img.getVigCorrMode() & SrcPanoImage::VIGCORR_FLATFIELD))
+    {
+        vigra_ext::ScanlineImporter<ImageType, AlphaType> importer(info);
+        // scale integer images to 0 .. 1, if loaded into a float image
+        const double maxv = vigra_ext::getMaxValForPixelType(info.getPixelType());
+        if (maxv != vigra_ext::LUTTraits<PixelType>::max()) {
+            importer.setScale(((double)vigra_ext::LUTTraits<PixelType>::max()) / maxv);
+        }
+        m_remapped->setAdvancedOptions(SingleImageRemapper<ImageType, AlphaType>::m_advancedOptions);
+        m_remapped->setPanoImage(src, opts, outputROI);
+        m_remapped->remapImageStreaming(importer, opts.interpolator, bandHeight, progress);
+        return m_remapped;
+    };
+
+    ImageType srcImg(width, height);
+    if (info.numExtraBands() > 0) {
+        srcAlpha.resize(width, height);
+    }
     
     // import the image
     progress->setMessage("loading", hugin_utils::stripPath(img.getFilename()));
@@ -32,6 +32,7 @@
 #include <vigra/copyimage.hxx>
 #include <vigra/flatmorphology.hxx>
 #include <vigra_ext/ROIImage.h>
+#include <vigra_ext/ScanlineImport.h>
 
 #include <appbase/ProgressDisplay.h>
 #include <nona/StitcherOptions.h>
@@ -149,6 +150,17 @@ class RemappedPanoImage : public vigra_ext::ROIImage<RemapImage, AlphaImage>
                         std::pair<AlphaIter, AlphaAccessor> alphaImg,
                         vigra_ext::Interpolator interp,
                         AppBase::ProgressDisplay* progress, bool singleThreaded = false);
+
+        /** remap a image, which is read row by row from @p importer.
+         *
+         *  The remapped image is calculated in bands of @p bandHeight rows, only
+         *  the source rows needed by the current band are kept in memory.
+         *  GPU remapping is not supported.
+         */
+        void remapImageStreaming(vigra_ext::ScanlineImporter<RemapImage, AlphaImage> & importer,
+                                 vigra_ext::Interpolator interp,
+                                 int bandHeight,
+                                 AppBase::ProgressDisplay* progress);
         
         
     public:
@@ -189,6 +201,7 @@ void remapImage(SrcImgType & srcImg,
 
 #include <photometric/ResponseTransform.h>
 #include <vigra_ext/ImageTransforms.h>
+#include <vigra_ext/ImageTransformsFixedPoint.h>
 #include <vigra_ext/ImageTransformsGPU.h>
 
 // #define DEBUG_REMAP 1
@@ -463,11 +476,15 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
     } else {
         invResponse.setHDROutput(true,1.0/pow(2.0,m_destImg.outputExposureValue));
     }
+    // 8 and 16 bit images with a photometric transform, which is only a lookup table,
+    // are remapped with fixed point interpolation
+    const bool useFixedPoint = invResponse.hasOutputLUT() && vigra_ext::isFixedPointInterpolator(interpol);
 
     if ((m_srcImg.hasActiveMasks()) || (m_srcImg.getCropMode() != SrcPanoImage::NO_CROP) || Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposure", false))
     {
         // need to create and additional alpha image for the crop mask...
         // not very efficient during the remapping phase, but works.
+        vigra_ext::RemapStageClock maskClock(vigra_ext::GetRemapStageTimes());
         vigra::BImage alpha(srcImgSize.x, srcImgSize.y);
 
         switch (m_srcImg.getCropMode()) {
@@ -526,6 +543,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
             const float upperCutoff = Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposureUpperCutoff", NONA_DEFAULT_EXPOSURE_UPPER_CUTOFF);
             vigra_ext::applyExposureClipMask(srcImg, vigra::destImageRange(alpha), lowerCutoff, upperCutoff);
         };
+        maskClock.lap(vigra_ext::REMAP_STAGE_MASK);
         if (useGPU) {
             transformImageAlphaGPU(srcImg,
                                    vigra::srcImage(alpha),
@@ -538,17 +556,31 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                                    interpol,
                                    progress);
         } else {
-            transformImageAlpha(srcImg,
-                                vigra::srcImage(alpha),
-                                destImageRange(Base::m_image),
-                                destImage(Base::m_mask),
-                                Base::boundingBox().upperLeft(),
-                                m_transf,
-                                invResponse,
-                                m_srcImg.horizontalWarpNeeded(),
-                                interpol,
-                                progress,
-                                singleThreaded);
+            if (useFixedPoint) {
+                vigra_ext::transformImageAlphaFixedPoint(srcImg,
+                                                         vigra::srcImage(alpha),
+                                                         destImageRange(Base::m_image),
+                                                         destImage(Base::m_mask),
+                                                         Base::boundingBox().upperLeft(),
+                                                         m_transf,
+                                                         invResponse,
+                                                         m_srcImg.horizontalWarpNeeded(),
+                                                         interpol,
+                                                         progress,
+                                                         singleThreaded);
+            } else {
+                transformImageAlpha(srcImg,
+                                    vigra::srcImage(alpha),
+                                    destImageRange(Base::m_image),
+                                    destImage(Base::m_mask),
+                                    Base::boundingBox().upperLeft(),
+                                    m_transf,
+                                    invResponse,
+                                    m_srcImg.horizontalWarpNeeded(),
+                                    interpol,
+                                    progress,
+                                    singleThreaded);
+            }
         }
     } else {
         if (useGPU) {
@@ -583,16 +615,29 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                                   progress);
             }
         } else {
-            transformImage(srcImg,
-                           destImageRange(Base::m_image),
-                           destImage(Base::m_mask),
-                           Base::boundingBox().upperLeft(),
-                           m_transf,
-                           invResponse,
-                           m_srcImg.horizontalWarpNeeded(),
-                           interpol,
-                           progress,
-                           singleThreaded);
+            if (useFixedPoint) {
+                vigra_ext::transformImageFixedPoint(srcImg,
+                                                    destImageRange(Base::m_image),
+                                                    destImage(Base::m_mask),
+                                                    Base::boundingBox().upperLeft(),
+                                                    m_transf,
+                                                    invResponse,
+                                                    m_srcImg.horizontalWarpNeeded(),
+                                                    interpol,
+                                                    progress,
+                                                    singleThreaded);
+            } else {
+                transformImage(srcImg,
+                               destImageRange(Base::m_image),
+                               destImage(Base::m_mask),
+                               Base::boundingBox().upperLeft(),
+                               m_transf,
+                               invResponse,
+                               m_srcImg.horizontalWarpNeeded(),
+                               interpol,
+                               progress,
+                               singleThreaded);
+            }
         }
     }
 }
@@ -648,8 +693,12 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
     } else {
         invResponse.setHDROutput(true,1.0/pow(2.0,m_destImg.outputExposureValue));
     }
+    // 8 and 16 bit images with a photometric transform, which is only a lookup table,
+    // are remapped with fixed point interpolation
+    const bool useFixedPoint = invResponse.hasOutputLUT() && vigra_ext::isFixedPointInterpolator(interp);
 
     if ((m_srcImg.hasActiveMasks()) || (m_srcImg.getCropMode() != SrcPanoImage::NO_CROP) || Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposure", false)) {
+        vigra_ext::RemapStageClock maskClock(vigra_ext::GetRemapStageTimes());
         vigra::BImage alpha(srcImgSize);
         vigra::Rect2D cR = m_srcImg.getCropRect();
         switch (m_srcImg.getCropMode()) {
@@ -700,6 +749,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
             const float upperCutoff = Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposureUpperCutoff", NONA_DEFAULT_EXPOSURE_UPPER_CUTOFF);
             vigra_ext::applyExposureClipMask(srcImg, vigra::destImageRange(alpha), lowerCutoff, upperCutoff);
         };
+        maskClock.lap(vigra_ext::REMAP_STAGE_MASK);
         if (useGPU) {
             vigra_ext::transformImageAlphaGPU(srcImg,
                                               vigra::srcImage(alpha),
@@ -712,17 +762,31 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                                               interp,
                                               progress);
         } else {
-            vigra_ext::transformImageAlpha(srcImg,
-                                           vigra::srcImage(alpha),
-                                           destImageRange(Base::m_image),
-                                           destImage(Base::m_mask),
-                                           Base::boundingBox().upperLeft(),
-                                           m_transf,
-                                           invResponse,
-                                           m_srcImg.horizontalWarpNeeded(),
-                                           interp,
-                                           progress,
-                                           singleThreaded);
+            if (useFixedPoint) {
+                vigra_ext::transformImageAlphaFixedPoint(srcImg,
+                                                         vigra::srcImage(alpha),
+                                                         destImageRange(Base::m_image),
+                                                         destImage(Base::m_mask),
+                                                         Base::boundingBox().upperLeft(),
+                                                         m_transf,
+                                                         invResponse,
+                                                         m_srcImg.horizontalWarpNeeded(),
+                                                         interp,
+                                                         progress,
+                                                         singleThreaded);
+            } else {
+                vigra_ext::transformImageAlpha(srcImg,
+                                               vigra::srcImage(alpha),
+                                               destImageRange(Base::m_image),
+                                               destImage(Base::m_mask),
+                                               Base::boundingBox().upperLeft(),
+                                               m_transf,
+                                               invResponse,
+                                               m_srcImg.horizontalWarpNeeded(),
+                                               interp,
+                                               progress,
+                                               singleThreaded);
+            }
         }
     } else {
         if (useGPU) {
@@ -738,21 +802,378 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                                               interp,
                                               progress);
         } else {
-            vigra_ext::transformImageAlpha(srcImg,
-                                           alphaImg,
-                                           destImageRange(Base::m_image),
-                                           destImage(Base::m_mask),
-                                           Base::boundingBox().upperLeft(),
-                                           m_transf,
-                                           invResponse,
-                                           m_srcImg.horizontalWarpNeeded(),
-                                           interp,
-                                           progress,
-                                           singleThreaded);
+            if (useFixedPoint) {
+                vigra_ext::transformImageAlphaFixedPoint(srcImg,
+                                                         alphaImg,
+                                                         destImageRange(Base::m_image),
+                                                         destImage(Base::m_mask),
+                                                         Base::boundingBox().upperLeft(),
+                                                         m_transf,
+                                                         invResponse,
+                                                         m_srcImg.horizontalWarpNeeded(),
+                                                         interp,
+                                                         progress,
+                                                         singleThreaded);
+            } else {
+                vigra_ext::transformImageAlpha(srcImg,
+                                               alphaImg,
+                                               destImageRange(Base::m_image),
+                                               destImage(Base::m_mask),
+                                               Base::boundingBox().upperLeft(),
+                                               m_transf,
+                                               invResponse,
+                                               m_srcImg.horizontalWarpNeeded(),
+                                               interp,
+                                               progress,
+                                               singleThreaded);
+            }
+        }
+    }
+}
+
+
+
+
+/** transformation into a window of the source image, which starts at row @p rowOffset */
+template <class TRANSFORM>
+class SrcWindowTransform
+{
+public:
+    SrcWindowTransform(const TRANSFORM & transf, const int rowOffset) : m_transf(transf), m_rowOffset(rowOffset) {};
+
+    bool transformImgCoord(double & x_dest, double & y_dest, double x_src, double y_src) const
+    {
+        const bool result = m_transf.transformImgCoord(x_dest, y_dest, x_src, y_src);
+        y_dest -= m_rowOffset;
+        return result;
+    };
+
+private:
+    const TRANSFORM & m_transf;
+    const int m_rowOffset;
+};
+
+/** photometric transformation of pixels from a window of the source image, which starts at row @p rowOffset.
+ *  The position is shifted back to the full image for the vignetting correction */
+template <class PixelTransform>
+class SrcWindowPixelTransform
+{
+public:
+    SrcWindowPixelTransform(const PixelTransform & transform, const int rowOffset) : m_transform(transform), m_rowOffset(rowOffset) {};
+
+    template <class T>
+    typename vigra::NumericTraits<T>::RealPromote operator()(T v, const hugin_utils::FDiff2D & pos) const
+    {
+        return m_transform(v, hugin_utils::FDiff2D(pos.x, pos.y + m_rowOffset));
+    };
+
+    template <class T, class A>
+    A hdrWeight(T v, A a) const
+    {
+        return m_transform.hdrWeight(v, a);
+    };
+
+private:
+    const PixelTransform & m_transform;
+    const int m_rowOffset;
+};
+
+/** remap the rows @p top to @p bottom of @p dest from the window @p src of the source image.
+ *  @p alpha is the alpha channel of the window or NULL, if the window has no alpha channel */
+template <class SrcImage, class SrcAlphaImage, class DestImage, class MaskImage, class TRANSFORM, class PixelTransform>
+void transformImageBand(SrcImage & src, SrcAlphaImage * alpha, DestImage & dest, MaskImage & mask,
+                        const int top, const int bottom, const vigra::Diff2D destUL,
+                        const TRANSFORM & transf, const PixelTransform & pixelTransf,
+                        const bool warparound, const bool useFixedPoint,
+                        vigra_ext::Interpolator interp, AppBase::ProgressDisplay* progress)
+{
+    const auto destRange = vigra::destIterRange(dest.upperLeft() + vigra::Diff2D(0, top),
+                                                dest.upperLeft() + vigra::Diff2D(dest.width(), bottom),
+                                                dest.accessor());
+    const auto destMask = vigra::destIter(mask.upperLeft() + vigra::Diff2D(0, top), mask.accessor());
+    if (alpha)
+    {
+        if (useFixedPoint)
+        {
+            vigra_ext::transformImageAlphaFixedPoint(vigra::srcImageRange(src), vigra::srcImage(*alpha), destRange, destMask,
+                                                     destUL, transf, pixelTransf, warparound, interp, progress);
         }
+        else
+        {
+            vigra_ext::transformImageAlpha(vigra::srcImageRange(src), vigra::srcImage(*alpha), destRange, destMask,
+                                           destUL, transf, pixelTransf, warparound, interp, progress);
+        };
     }
+    else
+    {
+        if (useFixedPoint)
+        {
+            vigra_ext::transformImageFixedPoint(vigra::srcImageRange(src), destRange, destMask,
+                                                destUL, transf, pixelTransf, warparound, interp, progress);
+        }
+        else
+        {
+            vigra_ext::transformImage(vigra::srcImageRange(src), destRange, destMask,
+                                      destUL, transf, pixelTransf, warparound, interp, progress);
+        };
+    };
 }
 
+/** remap a image, which is read row by row */
+template<class RemapImage, class AlphaImage>
+void RemappedPanoImage<RemapImage,AlphaImage>::remapImageStreaming(vigra_ext::ScanlineImporter<RemapImage, AlphaImage> & importer,
+                                                                   vigra_ext::Interpolator interp,
+                                                                   int bandHeight,
+                                                                   AppBase::ProgressDisplay* progress)
+{
+    typedef typename RemapImage::value_type input_value_type;
+    typedef typename vigra_ext::ValueTypeTraits<input_value_type>::value_type input_component_type;
+    typedef Photometric::InvResponseTransform<input_component_type, double> InvResponse;
+
+    if (Base::boundingBox().isEmpty())
+        return;
+
+    vigra_precondition(!m_destImg.remapUsingGPU,
+                       "RemappedPanoImage<RemapImage,AlphaImage>::remapImageStreaming(): GPU remapping is not supported");
+    const vigra::Size2D srcSize = m_srcImg.getSize();
+    vigra_precondition(importer.width() == srcSize.x && importer.height() == srcSize.y,
+                       "RemappedPanoImage<RemapImage,AlphaImage>::remapImageStreaming(): image sizes not consistent");
+
+    progress->setMessage("remapping", hugin_utils::stripPath(m_srcImg.getFilename()));
+
+    // setup photometric transform for this image type
+    InvResponse invResponse(m_srcImg);
+    invResponse.enforceMonotonicity();
+    if (m_destImg.outputMode == PanoramaOptions::OUTPUT_LDR) {
+        // select exposure and response curve for LDR output
+        std::vector<double> outLut;
+        double maxVal = vigra_ext::LUTTraits<input_value_type>::max();
+        if (m_destImg.outputPixelType.size() > 0) {
+            maxVal = vigra_ext::getMaxValForPixelType(m_destImg.outputPixelType);
+        }
+        vigra_ext::EMoR::createEMoRLUT(m_destImg.outputEMoRParams, outLut);
+        vigra_ext::enforceMonotonicity(outLut);
+        invResponse.setOutput(1.0/pow(2.0,m_destImg.outputExposureValue), outLut,
+                              maxVal);
+    } else {
+        invResponse.setHDROutput(true,1.0/pow(2.0,m_destImg.outputExposureValue));
+    }
+    const bool useFixedPoint = invResponse.hasOutputLUT() && vigra_ext::isFixedPointInterpolator(interp);
+    const bool warparound = m_srcImg.horizontalWarpNeeded();
+    const bool needsAlpha = m_srcImg.hasActiveMasks() || (m_srcImg.getCropMode() != SrcPanoImage::NO_CROP) ||
+        Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposure", false);
+
+    // find the source rows needed by the remapped image. Like estimateImageAlpha the
+    // transformation is only sampled on a sparse grid of output pixels. Samples next to
+    // a sample inside the image are also used, so that the rows between the last sample
+    // inside and the image border are included.
+    // The largest interpolator (sinc 1024) uses 16 rows above and below the position.
+    const vigra::Rect2D bb = Base::boundingBox();
+    const int border = 17;
+    const int gridStep = 8;
+    const int gridWidth = (bb.width() - 1) / gridStep + 2;
+    const int gridHeight = (bb.height() - 1) / gridStep + 2;
+    // source row of each sample, clamped to the image border
+    vigra::DImage gridRow(gridWidth, gridHeight);
+    // 255 if the transformation of the sample succeeded
+    vigra::BImage gridValid(gridWidth, gridHeight, vigra::UInt8(0));
+    // 255 if the sample is inside the source image
+    vigra::BImage gridInside(gridWidth, gridHeight, vigra::UInt8(0));
+#pragma omp parallel for
+    for (int gy = 0; gy < gridHeight; ++gy)
+    {
+        const int y = bb.top() + std::min(gy * gridStep, bb.height() - 1);
+        for (int gx = 0; gx < gridWidth; ++gx)
+        {
+            const int x = bb.left() + std::min(gx * gridStep, bb.width() - 1);
+            double sx, sy;
+            if (m_transf.transformImgCoord(sx, sy, x, y))
+            {
+                gridValid(gx, gy) = 255;
+                gridRow(gx, gy) = std::min(std::max(sy, -1.0 * border), 1.0 * srcSize.y + border);
+                if (sy > -border && sy < srcSize.y + border &&
+                    (warparound || (sx > -border && sx < srcSize.x + border)))
+                {
+                    gridInside(gx, gy) = 255;
+                };
+            };
+        };
+    };
+    // cover the neighbouring samples of the samples inside the image
+    vigra::BImage gridUsed(gridWidth, gridHeight);
+    vigra::discDilation(vigra::srcImageRange(gridInside), vigra::destImage(gridUsed), 1);
+    // range of the source rows for each row of the grid, the largest difference between
+    // neighbouring samples is added as margin for the curvature between the samples
+    std::vector<double> gridRowStart(gridHeight, srcSize.y);
+    std::vector<double> gridRowEnd(gridHeight, 0);
+    std::vector<double> gridRowMargin(gridHeight, 0);
+    for (int gy = 0; gy < gridHeight; ++gy)
+    {
+        for (int gx = 0; gx < gridWidth; ++gx)
+        {
+            if (!gridUsed(gx, gy) || !gridValid(gx, gy))
+            {
+                continue;
+            };
+            gridRowStart[gy] = std::min(gridRowStart[gy], gridRow(gx, gy));
+            gridRowEnd[gy] = std::max(gridRowEnd[gy], gridRow(gx, gy));
+            if (gx + 1 < gridWidth && gridValid(gx + 1, gy))
+            {
+                gridRowMargin[gy] = std::max(gridRowMargin[gy], std::abs(gridRow(gx + 1, gy) - gridRow(gx, gy)));
+            };
+            if (gy + 1 < gridHeight && gridValid(gx, gy + 1))
+            {
+                gridRowMargin[gy] = std::max(gridRowMargin[gy], std::abs(gridRow(gx, gy + 1) - gridRow(gx, gy)));
+            };
+        };
+    };
+
+    struct RemapBand
+    {
+        int top;
+        int bottom;
+        int srcStart;
+        int srcEnd;
+    };
+    std::vector<RemapBand> bands;
+    for (int top = 0; top < bb.height(); top += bandHeight)
+    {
+        RemapBand band;
+        band.top = top;
+        band.bottom = std::min(top + bandHeight, bb.height());
+        band.srcStart = srcSize.y;
+        band.srcEnd = 0;
+        // grid rows enclosing the band
+        const int gridLast = std::min((band.bottom - 1 + gridStep - 1) / gridStep, gridHeight - 1);
+        for (int gy = band.top / gridStep; gy <= gridLast; ++gy)
+        {
+            if (gridRowStart[gy] <= gridRowEnd[gy])
+            {
+                band.srcStart = std::min(band.srcStart, static_cast<int>(floor(gridRowStart[gy] - gridRowMargin[gy])) - border);
+                band.srcEnd = std::max(band.srcEnd, static_cast<int>(ceil(gridRowEnd[gy] + gridRowMargin[gy])) + border + 1);
+            };
+        };
+        band.srcStart = std::max(band.srcStart, 0);
+        band.srcEnd = std::min(band.srcEnd, srcSize.y);
+        // bands without source rows stay transparent
+        if (band.srcStart < band.srcEnd)
+        {
+            bands.push_back(band);
+        };
+    };
+    // the rows can only be read in order, so process the bands sorted by their first source row
+    std::stable_sort(bands.begin(), bands.end(),
+        [](const RemapBand& a, const RemapBand& b)
+        {
+            return a.srcStart < b.srcStart;
+        });
+
+    RemapImage window;
+    AlphaImage windowAlpha;
+    int windowStart = 0;
+    int windowEnd = 0;
+    for (size_t i = 0; i < bands.size(); ++i)
+    {
+        const RemapBand& band = bands[i];
+        // move the window to the source rows of the current band, rows before
+        // the band are no longer needed by the remaining bands
+        const int newStart = band.srcStart;
+        const int newEnd = std::max(windowEnd, band.srcEnd);
+        if (newStart != windowStart || newEnd != windowEnd)
+        {
+            RemapImage newWindow(srcSize.x, newEnd - newStart);
+            AlphaImage newWindowAlpha;
+            if (importer.hasAlpha())
+            {
+                newWindowAlpha.resize(srcSize.x, newEnd - newStart);
+            };
+            if (windowEnd > newStart)
+            {
+                // keep the rows which were already read
+                vigra::copyImage(window.upperLeft() + vigra::Diff2D(0, newStart - windowStart), window.lowerRight(), window.accessor(),
+                                 newWindow.upperLeft(), newWindow.accessor());
+                if (importer.hasAlpha())
+                {
+                    vigra::copyImage(windowAlpha.upperLeft() + vigra::Diff2D(0, newStart - windowStart), windowAlpha.lowerRight(), windowAlpha.accessor(),
+                                     newWindowAlpha.upperLeft(), newWindowAlpha.accessor());
+                };
+            };
+            const int readStart = std::max(windowEnd, newStart);
+            importer.skipRows(readStart - importer.nextRow());
+            importer.readRows(newWindow, newWindowAlpha, readStart - newStart, newEnd - readStart);
+            window.swap(newWindow);
+            windowAlpha.swap(newWindowAlpha);
+            windowStart = newStart;
+            windowEnd = newEnd;
+        };
+
+        const int windowHeight = windowEnd - windowStart;
+        const vigra::Diff2D destUL = bb.upperLeft() + vigra::Diff2D(0, band.top);
+        SrcWindowTransform<PTools::Transform> windowTransf(m_transf, windowStart);
+        SrcWindowPixelTransform<InvResponse> windowResponse(invResponse, windowStart);
+        if (needsAlpha)
+        {
+            // create the alpha channel with crop and masks for the rows in the window
+            vigra::BImage alpha(srcSize.x, windowHeight);
+            if (importer.hasAlpha())
+            {
+                vigra::copyImage(vigra::srcImageRange(windowAlpha), vigra::destImage(alpha));
+            }
+            else
+            {
+                initImage(vigra::destImageRange(alpha), 255);
+            };
+            switch (m_srcImg.getCropMode())
+            {
+                case SrcPanoImage::CROP_CIRCLE:
+                    {
+                        vigra::Rect2D cR = m_srcImg.getCropRect();
+                        hugin_utils::FDiff2D m( (cR.left() + cR.width()/2.0),
+                                (cR.top() + cR.height()/2.0 - windowStart) );
+                        double radius = std::min(cR.width(), cR.height())/2.0;
+                        vigra_ext::circularCrop(vigra::destImageRange(alpha), m, radius);
+                        break;
+                    }
+                case SrcPanoImage::CROP_RECTANGLE:
+                    {
+                        vigra::Rect2D cR = m_srcImg.getCropRect();
+                        cR &= vigra::Rect2D(0, 0, srcSize.x, srcSize.y);
+                        cR.moveBy(0, -windowStart);
+                        cR &= vigra::Rect2D(0, 0, srcSize.x, windowHeight);
+                        // only the area inside the crop rectangle stays opaque
+                        vigra::BImage croppedAlpha(srcSize.x, windowHeight, vigra::UInt8(0));
+                        if (!cR.isEmpty())
+                        {
+                            vigra::copyImage(alpha.upperLeft() + cR.upperLeft(),
+                                             alpha.upperLeft() + cR.lowerRight(),
+                                             alpha.accessor(),
+                                             croppedAlpha.upperLeft() + cR.upperLeft(), croppedAlpha.accessor());
+                        };
+                        alpha.swap(croppedAlpha);
+                        break;
+                    }
+                default:
+                    break;
+            }
+            if (m_srcImg.hasActiveMasks())
+                vigra_ext::applyMask(vigra::destImageRange(alpha), m_srcImg.getActiveMasks(), vigra::Diff2D(0, windowStart));
+            if (Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposure", false))
+            {
+                const float lowerCutoff = Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposureLowerCutoff", NONA_DEFAULT_EXPOSURE_LOWER_CUTOFF);
+                const float upperCutoff = Nona::GetAdvancedOption(m_advancedOptions, "maskClipExposureUpperCutoff", NONA_DEFAULT_EXPOSURE_UPPER_CUTOFF);
+                vigra_ext::applyExposureClipMask(vigra::srcImageRange(window), vigra::destImageRange(alpha), lowerCutoff, upperCutoff);
+            };
+            transformImageBand(window, &alpha, Base::m_image, Base::m_mask, band.top, band.bottom, destUL,
+                               windowTransf, windowResponse, warparound, useFixedPoint, interp, progress);
+        } else if (importer.hasAlpha()) {
+            transformImageBand(window, &windowAlpha, Base::m_image, Base::m_mask, band.top, band.bottom, destUL,
+                               windowTransf, windowResponse, warparound, useFixedPoint, interp, progress);
+        } else {
+            transformImageBand(window, static_cast<AlphaImage*>(NULL), Base::m_image, Base::m_mask, band.top, band.bottom, destUL,
+                               windowTransf, windowResponse, warparound, useFixedPoint, interp, progress);
+        }
+    }
+}
 
 
 
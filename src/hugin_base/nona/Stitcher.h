@@ -124,7 +124,8 @@ namespace detail
         unsigned int imgNr, unsigned int nImg,
         const PanoramaOptions & opts,
         const std::string& basename,
-        AppBase::ProgressDisplay* progress)
+        AppBase::ProgressDisplay* progress,
+        const bool tiledTiff = false)
     {
         ImageType * final_img = 0;
         AlphaType * alpha_img = 0;
@@ -249,6 +250,15 @@ namespace detail
             };
         }
 
+        if (tiledTiff && ext == "tif" && opts.outputPixelType.empty())
+        {
+            // tiled tiff, compressed in parallel
+            vigra_ext::exportTiledAlphaTiff(subImage.area() > 0 ? srcImageRange(*final_img, subImage) : srcImageRange(*final_img),
+                srcImage(*alpha_img), filename.str(), opts.tiffCompression,
+                opts.tiff_saveROI ? remapped.boundingBox().upperLeft() : opts.getROI().upperLeft(),
+                vigra::Size2D(opts.getWidth(), opts.getHeight()), remapped.m_ICCProfile);
+            return;
+        };
         if (subImage.area() > 0)
         {
             if (supportsAlpha)
@@ -284,7 +294,7 @@ public:
 
     MultiImageRemapper(const PanoramaData & pano,
                        AppBase::ProgressDisplay* progress)
-    : Stitcher<ImageType,AlphaType>(pano, progress)
+    : Stitcher<ImageType,AlphaType>(pano, progress), m_tiledTiff(false)
     {
     }
 
@@ -306,6 +316,7 @@ public:
                      || opts.outputFormat == PanoramaOptions::EXR_m);
 
         m_basename = basename;
+        m_tiledTiff = GetAdvancedOption(advOptions, "tiledTiff", false);
 
         // setup the output.
         prepareOutputFile(opts);
@@ -350,7 +361,7 @@ public:
                               unsigned int imgNr, unsigned int nImg,
                               const PanoramaOptions & opts)
     {
-        detail::saveRemapped(remapped, imgNr, nImg, opts, m_basename, Base::m_progress);
+        detail::saveRemapped(remapped, imgNr, nImg, opts, m_basename, Base::m_progress, m_tiledTiff);
 
         if (opts.saveCoordImgs) {
             vigra::UInt16Image xImg;
@@ -412,6 +423,8 @@ public:
 
 protected:
     std::string m_basename;
+    /// save the remapped images as tiled tiff files
+    bool m_tiledTiff;
 };
 
 
@@ -540,7 +553,8 @@ public:
                 {
                     finalFilename.append(suffix);
                 };
-                detail::saveRemapped(*remapped, *it, nImg, modOptions, finalFilename, Base::m_progress);
+                detail::saveRemapped(*remapped, *it, nImg, modOptions, finalFilename, Base::m_progress,
+                                     GetAdvancedOption(advOptions, "tiledTiff", false));
             }
             Base::m_progress->setMessage("blending", hugin_utils::stripPath(Base::m_pano.getImage(*it).getFilename()));
             // add image to pano and panoalpha, adjusts panoROI as well.
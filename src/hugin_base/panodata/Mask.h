@@ -156,8 +156,11 @@ IMPEX void SaveMaskToStream(std::ostream& stream, vigra::Size2D imageSize, MaskP
 namespace vigra_ext 
 {
 
+/** sets all pixels inside the masks to 0, @p offset is the position of the
+ *  upper left corner of @p img in the image the masks refer to */
 template <class SrcImageIterator, class SrcAccessor>
-void applyMask(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> img, HuginBase::MaskPolygonVector masks)
+void applyMask(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> img, HuginBase::MaskPolygonVector masks,
+               const vigra::Diff2D offset = vigra::Diff2D(0, 0))
 {
     const vigra::Diff2D imgSize = img.second - img.first;
 
@@ -172,7 +175,7 @@ void applyMask(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> im
         xd.y += y;
         for(int x=0; x < imgSize.x; ++x, ++xd.x)
         {
-            hugin_utils::FDiff2D newPoint(x,y);
+            hugin_utils::FDiff2D newPoint(x + offset.x, y + offset.y);
             bool insideMasks=false;
             unsigned int i=0;
             while(!insideMasks && (i<masks.size()))
@@ -25,9 +25,11 @@
 #define _PHOTOMETRIC_VIGNETTING_CORRECTION_H
 
 #include <vector>
+#include <algorithm>
 #include <functional>
+#include <type_traits>
+#include <stdint.h>
 #include "hugin_config.h"
-#include <random>
 
 #include <vigra/stdimage.hxx>
 #include <vigra/numerictraits.hxx>
@@ -176,6 +178,7 @@ class InvResponseTransform : public ResponseTransform<VTIn>
 				vigra_ext::enforceMonotonicity(Base::m_lutR);
 		        // todo: invert lut, instead of using this functor?
 		        m_lutRInvFunc = vigra_ext::InvLUTFunctor<VT1, LUT>(Base::m_lutR);
+		        initLookupTables();
 			}
 		}
 
@@ -184,8 +187,20 @@ class InvResponseTransform : public ResponseTransform<VTIn>
          * This prevents the occurence of cleanly-bordered regions in the output where
          * the pixel values suddenly change from N to N+1.
          * Such regions are especially objectionable in the green channel of 8-bit images.
+         *
+         * The random threshold is a hash of the source position and the channel, so
+         * the result is deterministic and the function can be called from several threads.
          */
-        double dither(const double &v) const;
+        double dither(const double &v, const hugin_utils::FDiff2D & pos, unsigned int channel) const;
+
+        /** returns true if the transform does not depend on the position in the image,
+         *  this is the case if no vignetting correction is active */
+        bool isPositionIndependent() const;
+
+        /** returns true if the transform of the input values (without dithering) is
+         *  tabulated, this is the case for 8 and 16 bit input, LDR output and no
+         *  vignetting correction */
+        bool hasOutputLUT() const { return !m_outLut.empty(); };
         
         /** function for gray values (ignores white balance :-) */
         typename vigra::NumericTraits<dest_type>::RealPromote
@@ -223,7 +238,25 @@ class InvResponseTransform : public ResponseTransform<VTIn>
             }
         }
         
-        void emitGLSL(std::ostringstream& oss, std::vector<double>& invLut, std::vector<double>& destLut) const;
+        /** emits GLSL code, which applies the transform to the pixel p, and the lookup tables
+         *  for the textures InvLutTexture and DestLutTexture.
+         *  @param srcPos GLSL expression for the position of the pixel in the source image,
+         *                used for the vignetting correction
+         */
+        void emitGLSL(std::ostringstream& oss, std::vector<double>& invLut, std::vector<double>& destLut,
+                      const std::string& srcPos = "texture2DRect(CoordTexture, gl_TexCoord[0].st).sq") const;
+
+    protected:
+        /** creates the lookup tables for the inverse response and the inverse vignetting.
+         *  They are only used for 8 and 16 bit input, float input and the photometric
+         *  optimizer use the exact functions. */
+        void initLookupTables();
+        /** inverse response for value v, scaled to 0..1 */
+        double invResponse(VT1 v) const;
+        /** returns destExposure/(vignetting*srcExposure) at pos */
+        double invVigExposureFactor(const hugin_utils::FDiff2D & pos) const;
+        /** creates the per channel output lut, if the transform does not depend on the position */
+        void initOutputLUT();
 
     protected: // needs be public?
         //LUT m_lutRInv;
@@ -233,9 +266,15 @@ class InvResponseTransform : public ResponseTransform<VTIn>
         double m_destExposure;
         bool m_hdrMode;
         double m_intScale;
-        
-    private:
-        std::mt19937 Twister;
+        /// inverse response, indexed directly with the integer input value
+        std::vector<float> m_invLut;
+        /// 1/vignetting, linear interpolated over the squared radius
+        std::vector<float> m_invVigLut;
+        double m_invVigLutScale;
+        double m_invWhiteBalanceRed;
+        double m_invWhiteBalanceBlue;
+        /// complete transform of red, green and blue channel (one lut after the other), without dithering
+        std::vector<float> m_outLut;
 };
 
 
@@ -406,6 +445,9 @@ InvResponseTransform<VTIn,VTOut>::InvResponseTransform()
     m_destExposure = 1.0;
     m_hdrMode = false;
     m_intScale = 1;
+    m_invVigLutScale = 0;
+    m_invWhiteBalanceRed = 1.0;
+    m_invWhiteBalanceBlue = 1.0;
 }
 
 template <class VTIn, class VTOut>
@@ -418,6 +460,88 @@ InvResponseTransform<VTIn,VTOut>::InvResponseTransform(const HuginBase::SrcPanoI
         // todo: invert lut, instead of using this functor?
         m_lutRInvFunc = vigra_ext::InvLUTFunctor<VT1, LUT>(Base::m_lutR);
     }
+    m_invWhiteBalanceRed = 1.0 / Base::m_WhiteBalanceRed;
+    m_invWhiteBalanceBlue = 1.0 / Base::m_WhiteBalanceBlue;
+    initLookupTables();
+}
+
+template <class VTIn, class VTOut>
+void InvResponseTransform<VTIn,VTOut>::initLookupTables()
+{
+    m_invLut.clear();
+    m_invVigLut.clear();
+    m_outLut.clear();
+    m_invVigLutScale = 0;
+    const double maxVal = vigra_ext::LUTTraits<VT1>::max();
+    if (!std::is_integral<VT1>::value || !std::is_unsigned<VT1>::value || maxVal > 65535)
+    {
+        return;
+    };
+    // one entry for each possible input value, so no interpolation is needed
+    m_invLut.resize(static_cast<size_t>(maxVal) + 1);
+    for (size_t i = 0; i < m_invLut.size(); ++i)
+    {
+        if (Base::m_lutR.size())
+        {
+            m_invLut[i] = m_lutRInvFunc.applyLutFloat(i / maxVal);
+        }
+        else
+        {
+            m_invLut[i] = i / maxVal;
+        };
+    };
+    if ((Base::m_VigCorrMode & HuginBase::SrcPanoImage::VIGCORR_RADIAL) && Base::m_radiusScale > 0)
+    {
+        // largest squared radius, with a margin of one pixel for the interpolator
+        const vigra::Size2D size = Base::m_src.getSize();
+        double r2max = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            hugin_utils::FDiff2D d((i & 1) ? size.x + 1.0 : -1.0, (i & 2) ? size.y + 1.0 : -1.0);
+            d = (d - Base::m_RadialVigCorrCenter) * Base::m_radiusScale;
+            r2max = std::max(r2max, d.x * d.x + d.y * d.y);
+        };
+        m_invVigLut.resize(1025);
+        m_invVigLutScale = (m_invVigLut.size() - 1) / r2max;
+        for (size_t i = 0; i < m_invVigLut.size(); ++i)
+        {
+            const double r = sqrt(i / m_invVigLutScale) / Base::m_radiusScale;
+            m_invVigLut[i] = 1.0 / Base::calcVigFactor(Base::m_RadialVigCorrCenter + hugin_utils::FDiff2D(r, 0));
+        };
+    };
+    initOutputLUT();
+}
+
+template <class VTIn, class VTOut>
+inline double InvResponseTransform<VTIn,VTOut>::invResponse(VT1 v) const
+{
+    if (!m_invLut.empty())
+    {
+        return m_invLut[static_cast<size_t>(v)];
+    };
+    if (Base::m_lutR.size())
+    {
+        return m_lutRInvFunc(v);
+    };
+    return v / vigra_ext::LUTTraits<VT1>::max();
+}
+
+template <class VTIn, class VTOut>
+inline double InvResponseTransform<VTIn,VTOut>::invVigExposureFactor(const hugin_utils::FDiff2D & pos) const
+{
+    const double exposureFactor = m_destExposure / Base::m_srcExposure;
+    if (!m_invVigLut.empty())
+    {
+        const hugin_utils::FDiff2D d = (pos - Base::m_RadialVigCorrCenter) * Base::m_radiusScale;
+        const double x = (d.x * d.x + d.y * d.y) * m_invVigLutScale;
+        const size_t index = static_cast<size_t>(x);
+        if (index + 1 < m_invVigLut.size())
+        {
+            const double f = x - index;
+            return exposureFactor * (m_invVigLut[index] + f * (m_invVigLut[index + 1] - m_invVigLut[index]));
+        };
+    };
+    return exposureFactor / Base::calcVigFactor(pos);
 }
 
 template <class VTIn, class VTOut>
@@ -439,6 +563,7 @@ void InvResponseTransform<VTIn,VTOut>::setHDROutput(bool hdrMode, double destExp
     m_intScale = 1;
     m_destExposure = destExposure;
     m_destLut.clear();
+    m_outLut.clear();
 }
 
 template <class VTIn, class VTOut>
@@ -451,18 +576,64 @@ void InvResponseTransform<VTIn,VTOut>::setOutput(double destExposure, const LUTD
     }
     m_destExposure = destExposure;
     m_intScale = scale;
+    initOutputLUT();
+}
+
+template <class VTIn, class VTOut>
+bool InvResponseTransform<VTIn,VTOut>::isPositionIndependent() const
+{
+    if (Base::m_VigCorrMode & HuginBase::SrcPanoImage::VIGCORR_RADIAL)
+    {
+        const std::vector<double>& coeff = Base::m_RadialVigCorrCoeff;
+        return coeff[0] == 1.0 && coeff[1] == 0.0 && coeff[2] == 0.0 && coeff[3] == 0.0;
+    };
+    return (Base::m_VigCorrMode & HuginBase::SrcPanoImage::VIGCORR_FLATFIELD) == 0;
+}
+
+template <class VTIn, class VTOut>
+void InvResponseTransform<VTIn,VTOut>::initOutputLUT()
+{
+    m_outLut.clear();
+    // only worth for integer output, where the table is used for every pixel
+    if (m_invLut.empty() || m_hdrMode || m_intScale <= 1 || !isPositionIndependent())
+    {
+        return;
+    };
+    const size_t n = m_invLut.size();
+    const double exposureFactor = m_destExposure / Base::m_srcExposure;
+    const double channelFactor[3] = { exposureFactor * m_invWhiteBalanceRed, exposureFactor, exposureFactor * m_invWhiteBalanceBlue };
+    m_outLut.resize(3 * n);
+    for (size_t c = 0; c < 3; ++c)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            VTInCompReal v = m_invLut[i] * channelFactor[c];
+            if (m_destLut.size() > 0)
+            {
+                v = m_destLutFunc(v);
+            };
+            m_outLut[c * n + i] = v * m_intScale;
+        };
+    };
 }
 
 
 template <class VTIn, class VTOut>
-double InvResponseTransform<VTIn,VTOut>::dither(const double &v) const
+double InvResponseTransform<VTIn,VTOut>::dither(const double &v, const hugin_utils::FDiff2D & pos, unsigned int channel) const
 {
-    std::mt19937 &mt = const_cast<std::mt19937 &>(Twister);
     double vFraction = v - floor(v);
     // Only dither values within a certain range of the rounding cutoff point.
     if (vFraction > 0.25 && vFraction <= 0.75) {
-        // Generate a random number between 0 and 0.5.
-        double random = 0.5 * (double)mt() / UINT_MAX;
+        // Generate a random number between 0 and 0.5 from the position
+        // (1/256 pixel resolution) and the channel, murmur3 finalizer as hash
+        uint32_t h = static_cast<uint32_t>(static_cast<int64_t>(floor(pos.x * 256.0))) * 0x9E3779B1u;
+        h ^= static_cast<uint32_t>(static_cast<int64_t>(floor(pos.y * 256.0))) * 0x85EBCA77u + channel * 0xC2B2AE3Du;
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        double random = 0.5 * (double)h / UINT_MAX;
         if ((vFraction - 0.25) >= random) {
             return ceil(v);
         } else {
@@ -478,22 +649,20 @@ template <class VTIn, class VTOut>
 typename vigra::NumericTraits<typename InvResponseTransform<VTIn,VTOut>::dest_type>::RealPromote
 InvResponseTransform<VTIn,VTOut>::apply(VT1 v, const hugin_utils::FDiff2D & pos, vigra::VigraTrueType) const
 {
-    // inverse response
-    typename vigra::NumericTraits<VT1>::RealPromote ret(v);
-    if (Base::m_lutR.size()) {
-        ret = m_lutRInvFunc(v);
-    } else {
-        ret /= vigra_ext::LUTTraits<VT1>::max();
-    }
-    // inverse vignetting and exposure
-    ret *= m_destExposure / (Base::calcVigFactor(pos) * Base::m_srcExposure);
+    if (!m_outLut.empty())
+    {
+        // gray values ignore white balance, use table of green channel
+        return dither(m_outLut[m_invLut.size() + static_cast<size_t>(v)], pos, 0);
+    };
+    // inverse response, inverse vignetting and exposure
+    typename vigra::NumericTraits<VT1>::RealPromote ret = invResponse(v) * invVigExposureFactor(pos);
     // apply output transform if required
     if (m_destLut.size() > 0) {
         ret = m_destLutFunc(ret);
     }
     // dither all integer images
     if ( m_intScale > 1) {
-        return dither(ret * m_intScale);
+        return dither(ret * m_intScale, pos, 0);
     }
     return ret;
 }
@@ -503,17 +672,21 @@ template <class VTIn, class VTOut>
 typename vigra::NumericTraits<vigra::RGBValue<typename InvResponseTransform<VTIn,VTOut>::VT1> >::RealPromote
 InvResponseTransform<VTIn,VTOut>::apply(vigra::RGBValue<VT1> v, const hugin_utils::FDiff2D & pos, vigra::VigraFalseType) const
 {
-    typename vigra::NumericTraits<vigra::RGBValue<VT1> >::RealPromote ret(v);
-    if (Base::m_lutR.size()) {
-        ret = m_lutRInvFunc(v);
-    } else {
-        ret /= vigra_ext::LUTTraits<VT1>::max();
-    }
-
-    // inverse vignetting and exposure
-    ret *= m_destExposure/(Base::calcVigFactor(pos)*Base::m_srcExposure);
-    ret.red() /= Base::m_WhiteBalanceRed;
-    ret.blue() /= Base::m_WhiteBalanceBlue;
+    if (!m_outLut.empty())
+    {
+        const size_t n = m_invLut.size();
+        typename vigra::NumericTraits<vigra::RGBValue<VT1> >::RealPromote ret;
+        ret.red() = dither(m_outLut[static_cast<size_t>(v.red())], pos, 0);
+        ret.green() = dither(m_outLut[n + static_cast<size_t>(v.green())], pos, 1);
+        ret.blue() = dither(m_outLut[2 * n + static_cast<size_t>(v.blue())], pos, 2);
+        return ret;
+    };
+    // inverse vignetting, exposure and white balance are combined into one factor per channel
+    const double factor = invVigExposureFactor(pos);
+    typename vigra::NumericTraits<vigra::RGBValue<VT1> >::RealPromote ret;
+    ret.red() = invResponse(v.red()) * factor * m_invWhiteBalanceRed;
+    ret.green() = invResponse(v.green()) * factor;
+    ret.blue() = invResponse(v.blue()) * factor * m_invWhiteBalanceBlue;
     // apply output transform if required
     if (m_destLut.size() > 0) {
         ret = m_destLutFunc(ret);
@@ -521,7 +694,7 @@ InvResponseTransform<VTIn,VTOut>::apply(vigra::RGBValue<VT1> v, const hugin_util
     // dither 8 bit images.
     if (m_intScale > 1) {
         for (size_t i=0; i < 3; i++) {
-            ret[i] = dither(ret[i] * m_intScale);
+            ret[i] = dither(ret[i] * m_intScale, pos, i);
         }
     }
     return ret;
@@ -546,7 +719,8 @@ InvResponseTransform<VTIn,VTOut>::apply(vigra::RGBValue<VT1> v, const hugin_util
 
 template <class VTIn, class VTOut>
 void
-InvResponseTransform<VTIn,VTOut>::emitGLSL(std::ostringstream& oss, std::vector<double>& invLut, std::vector<double>& destLut) const
+InvResponseTransform<VTIn,VTOut>::emitGLSL(std::ostringstream& oss, std::vector<double>& invLut, std::vector<double>& destLut,
+                                           const std::string& srcPos) const
 {
     invLut.clear();
     invLut.reserve(Base::m_lutR.size());
@@ -599,7 +773,7 @@ InvResponseTransform<VTIn,VTOut>::emitGLSL(std::ostringstream& oss, std::vector<
             << "        float radialVigCorrCoeff1 = " << Base::m_src.getRadialVigCorrCoeff()[1] << ";" << endl
             << "        float radialVigCorrCoeff2 = " << Base::m_src.getRadialVigCorrCoeff()[2] << ";" << endl
             << "        float radialVigCorrCoeff3 = " << Base::m_src.getRadialVigCorrCoeff()[3] << ";" << endl
-            << "        vec2 src = texture2DRect(CoordTexture, gl_TexCoord[0].st).sq;" << endl
+            << "        vec2 src = " << srcPos << ";" << endl
             << "        vec2 d = src - vigCorrCenter;" << endl
             << "        d *= radiusScale;" << endl
             << "        vig = radialVigCorrCoeff0;" << endl
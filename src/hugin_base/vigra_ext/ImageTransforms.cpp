@@ -0,0 +1,116 @@
+// -*- c-basic-offset: 4 -*-
+/** @file ImageTransforms.cpp
+ *
+ *  Support functions for the remapping of images.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "ImageTransforms.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace vigra_ext
+{
+
+/** tile size used by transformImage, 0 means full rows */
+static int remapTileSize = 64;
+
+void SetRemapTileSize(const int tileSize)
+{
+    remapTileSize = std::max(tileSize, 0);
+};
+
+int GetRemapTileSize()
+{
+    return remapTileSize;
+};
+
+/** returns the position of (x,y) on the hilbert curve covering a n x n grid, n must be a power of 2 */
+static unsigned long long HilbertIndex(unsigned int n, unsigned int x, unsigned int y)
+{
+    unsigned long long d = 0;
+    for (unsigned int s = n / 2; s > 0; s /= 2)
+    {
+        const unsigned int rx = (x & s) > 0;
+        const unsigned int ry = (y & s) > 0;
+        d += static_cast<unsigned long long>(s) * s * ((3 * rx) ^ ry);
+        // rotate quadrant
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            };
+            std::swap(x, y);
+        };
+    };
+    return d;
+};
+
+void GetRemapTiles(const vigra::Size2D& size, std::vector<vigra::Rect2D>& tiles)
+{
+    tiles.clear();
+    if (size.x <= 0 || size.y <= 0)
+    {
+        return;
+    };
+    const int tileSize = remapTileSize;
+    if (tileSize == 0)
+    {
+        // old behaviour: process full rows
+        tiles.reserve(size.y);
+        for (int y = 0; y < size.y; ++y)
+        {
+            tiles.push_back(vigra::Rect2D(0, y, size.x, y + 1));
+        };
+        return;
+    };
+    const unsigned int nx = (size.x + tileSize - 1) / tileSize;
+    const unsigned int ny = (size.y + tileSize - 1) / tileSize;
+    unsigned int n = 1;
+    while (n < std::max(nx, ny))
+    {
+        n *= 2;
+    };
+    // order the tiles along a hilbert curve, so that consecutive tiles (which are
+    // processed at the same time by different threads) access nearby source pixels
+    std::vector<std::pair<unsigned long long, vigra::Rect2D> > sortedTiles;
+    sortedTiles.reserve(nx * ny);
+    for (unsigned int ty = 0; ty < ny; ++ty)
+    {
+        for (unsigned int tx = 0; tx < nx; ++tx)
+        {
+            vigra::Rect2D tile(tx * tileSize, ty * tileSize,
+                std::min<int>((tx + 1) * tileSize, size.x), std::min<int>((ty + 1) * tileSize, size.y));
+            sortedTiles.push_back(std::make_pair(HilbertIndex(n, tx, ty), tile));
+        };
+    };
+    std::sort(sortedTiles.begin(), sortedTiles.end(),
+        [](const std::pair<unsigned long long, vigra::Rect2D>& a, const std::pair<unsigned long long, vigra::Rect2D>& b)
+        {
+            return a.first < b.first;
+        });
+    tiles.reserve(sortedTiles.size());
+    for (size_t i = 0; i < sortedTiles.size(); ++i)
+    {
+        tiles.push_back(sortedTiles[i].second);
+    };
+};
+
+} // namespace vigra_ext
@@ -28,10 +28,13 @@
 #define _VIGRA_EXT_IMAGETRANSFORMS_H
 
 #include <fstream>
+#include <vector>
 
+#include <hugin_shared.h>
 #include <vigra/basicimage.hxx>
 #include <vigra_ext/ROIImage.h>
 #include <vigra_ext/Interpolators.h>
+#include <vigra_ext/RemapStageTimes.h>
 
 #include <hugin_math/hugin_math.h>
 #include <hugin_utils/utils.h>
@@ -62,6 +65,99 @@ vigra::RGBValue<T> zeroNegative(vigra::RGBValue<T> p)
 }
 
 
+/** set the size of the square output tiles used by transformImage.
+ *
+ *  The output is processed tile by tile, the tiles are ordered along a
+ *  hilbert curve. For rotated or strongly distorted images consecutive
+ *  pixels of an output row map to source pixels far apart, processing
+ *  tiles keeps the accessed source region small.
+ *  A tile size of 0 processes the output row by row.
+ */
+IMPEX void SetRemapTileSize(const int tileSize);
+/** returns the current tile size of transformImage */
+IMPEX int GetRemapTileSize();
+/** splits an output image of the given size into the tiles used by transformImage */
+IMPEX void GetRemapTiles(const vigra::Size2D& size, std::vector<vigra::Rect2D>& tiles);
+
+/** remap the output image tile by tile using the interpolator @p interpol.
+ *
+ *  @p interpol is either a ImageInterpolator or a ImageMaskInterpolator (or a class
+ *  with the same interface), for images without alpha channel ImageInterpolator
+ *  returns a dummy alpha value.
+ *  The time of the single stages is recorded, when SetRemapStageTimes() was called.
+ */
+template <class INTERPOLATOR,
+          class DestImageIterator, class DestAccessor,
+          class TRANSFORM,
+          class PixelTransform,
+          class AlphaImageIterator, class AlphaAccessor>
+void transformImageWithInterpolator(const INTERPOLATOR & interpol,
+                                    vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                    std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                    TRANSFORM & transform,
+                                    PixelTransform & pixelTransform,
+                                    vigra::Diff2D destUL,
+                                    bool singleThreaded)
+{
+    const vigra::Diff2D destSize = dest.second - dest.first;
+
+    const int xstart = destUL.x;
+    const int ystart = destUL.y;
+
+    std::vector<vigra::Rect2D> tiles;
+    GetRemapTiles(vigra::Size2D(destSize), tiles);
+    RemapStageTimes* stageTimes = GetRemapStageTimes();
+
+    // loop over the image tile by tile and transform
+#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i)
+    {
+        const vigra::Rect2D& tile = tiles[i];
+        const int width = tile.width();
+        // each row of the tile is processed in stages, the coordinate transform,
+        // the interpolation and the pixel transform, so that the stages can be timed
+        std::vector<hugin_utils::FDiff2D> srcPos(width);
+        std::vector<char> valid(width);
+        std::vector<typename INTERPOLATOR::PixelType> values(width);
+        std::vector<typename INTERPOLATOR::MaskType> alphaValues(width);
+        RemapStageClock clock(stageTimes);
+        for (int ty = tile.top(); ty < tile.bottom(); ++ty)
+        {
+            const int y = ystart + ty;
+            for (int tx = 0; tx < width; ++tx)
+            {
+                double sx, sy;
+                valid[tx] = transform.transformImgCoord(sx, sy, xstart + tile.left() + tx, y);
+                srcPos[tx] = hugin_utils::FDiff2D(sx, sy);
+            }
+            clock.lap(REMAP_STAGE_TRANSFORM);
+            for (int tx = 0; tx < width; ++tx)
+            {
+                // try to interpolate, fails for points outside of image or mask
+                if (valid[tx])
+                {
+                    valid[tx] = interpol(srcPos[tx].x, srcPos[tx].y, values[tx], alphaValues[tx]);
+                };
+            }
+            clock.lap(REMAP_STAGE_INTERPOLATE);
+            // create x iterators
+            DestImageIterator xd(dest.first + vigra::Diff2D(tile.left(), ty));
+            AlphaImageIterator xdist(alpha.first + vigra::Diff2D(tile.left(), ty));
+            for (int tx = 0; tx < width; ++tx, ++xd.x, ++xdist.x)
+            {
+                if (valid[tx]) {
+                    // apply pixel transform and write to output
+                    dest.third.set(zeroNegative(pixelTransform(values[tx], srcPos[tx])), xd);
+                    alpha.second.set(pixelTransform.hdrWeight(values[tx], alphaValues[tx]), xdist);
+                } else {
+                    alpha.second.set(0, xdist);
+                }
+            }
+            clock.lap(REMAP_STAGE_PHOTOMETRIC);
+        }
+    }
+}
+
 /** Transform an image into the panorama
  *
  *  It can be used for partial transformations as well, if the bounding
@@ -104,44 +200,9 @@ void transformImageIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcA
                           AppBase::ProgressDisplay* progress,
                           bool singleThreaded)
 {
-    const vigra::Diff2D destSize = dest.second - dest.first;
-
-    const int xstart = destUL.x;
-    const int xend = destUL.x + destSize.x;
-    const int ystart = destUL.y;
-    const int yend = destUL.y + destSize.y;
-
     vigra_ext::ImageInterpolator<SrcImageIterator, SrcAccessor, Interpolator>
         interpol(src, interp, warparound);
-
-    // loop over the image and transform
-#pragma omp parallel for if(!singleThreaded) schedule(dynamic) 
-    for (int y = ystart; y < yend; ++y)
-    {
-        // create x iterators
-        DestImageIterator xd(dest.first);
-        xd.y += y - ystart;
-        AlphaImageIterator xdm(alpha.first);
-        xdm.y += y - ystart;
-        typename SrcAccessor::value_type tempval;
-        for (int x = xstart; x < xend; ++x, ++xd.x, ++xdm.x)
-        {
-            double sx, sy;
-            if (transform.transformImgCoord(sx, sy, x, y)) {
-                if (interpol.operator()(sx, sy, tempval)){
-                    // apply pixel transform and write to output
-                    dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
-                    alpha.second.set(pixelTransform.hdrWeight(tempval, vigra::UInt8(255)), xdm);
-                }
-                else {
-                    alpha.second.set(0, xdm);
-                }
-            }
-            else {
-                alpha.second.set(0, xdm);
-            }
-        }
-    }
+    transformImageWithInterpolator(interpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
 }
 
 /** transform input images with alpha channel */
@@ -164,45 +225,10 @@ void transformImageAlphaIntern(vigra::triple<SrcImageIterator, SrcImageIterator,
                                AppBase::ProgressDisplay* progress,
                                bool singleThreaded)
 {
-    const vigra::Diff2D destSize = dest.second - dest.first;
-
-    const int xstart = destUL.x;
-    const int xend   = destUL.x + destSize.x;
-    const int ystart = destUL.y;
-    const int yend   = destUL.y + destSize.y;
-
     vigra_ext::ImageMaskInterpolator<SrcImageIterator, SrcAccessor, SrcAlphaIterator,
                                      SrcAlphaAccessor, Interpolator>
                                     interpol (src, srcAlpha, interp, warparound);
-
-    // loop over the image and transform
-#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
-    for(int y=ystart; y < yend; ++y)
-    {
-        // create x iterators
-        DestImageIterator xd(dest.first);
-        xd.y += y - ystart;
-        AlphaImageIterator xdist(alpha.first);
-        xdist.y += y - ystart;
-        typename SrcAccessor::value_type tempval;
-        typename SrcAlphaAccessor::value_type alphaval;
-        for (int x = xstart; x < xend; ++x, ++xd.x, ++xdist.x)
-        {
-            double sx,sy;
-            if (transform.transformImgCoord(sx,sy,x,y)) {
-                // try to interpolate.
-                if (interpol(sx, sy, tempval, alphaval)) {
-                    dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
-                    alpha.second.set(pixelTransform.hdrWeight(tempval, alphaval), xdist);
-                } else {
-                    // point outside of image or mask
-                    alpha.second.set(0, xdist);
-                }
-            } else {
-                alpha.second.set(0, xdist);
-            }
-        }
-    }
+    transformImageWithInterpolator(interpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
 };
 
 /** Transform an image into the panorama
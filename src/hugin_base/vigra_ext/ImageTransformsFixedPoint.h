@@ -0,0 +1,494 @@
+// -*- c-basic-offset: 4 -*-
+/** @file ImageTransformsFixedPoint.h
+ *
+ *  Remapping of 8 and 16 bit images with fixed point interpolation.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_IMAGETRANSFORMSFIXEDPOINT_H
+#define _VIGRA_EXT_IMAGETRANSFORMSFIXEDPOINT_H
+
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+
+#include <vigra_ext/ImageTransforms.h>
+#include <vigra_ext/utils.h>
+
+namespace vigra_ext
+{
+
+/** access to the channels of gray and RGB pixels for the fixed point interpolators */
+template <class T>
+struct FixedPointPixel
+{
+    static const int channels = 1;
+    static int get(const T & p, int c) { return p; };
+    static void set(T & p, int c, int v) { p = static_cast<T>(v); };
+};
+
+template <class T>
+struct FixedPointPixel<vigra::RGBValue<T> >
+{
+    static const int channels = 3;
+    static int get(const vigra::RGBValue<T> & p, int c) { return p[c]; };
+    static void set(vigra::RGBValue<T> & p, int c, int v) { p[c] = static_cast<T>(v); };
+};
+
+/** true for the pixel component types which can be interpolated with fixed point arithmetic */
+template <class T>
+struct FixedPointSupported : public std::false_type {};
+
+template <>
+struct FixedPointSupported<vigra::UInt8> : public std::true_type {};
+
+template <>
+struct FixedPointSupported<vigra::UInt16> : public std::true_type {};
+
+/** integer weights of an interpolation kernel.
+ *
+ *  The positions are rounded to 1/256 pixel, the weights are scaled to 12 bit
+ *  and corrected so that they sum up to exactly 1<<12 for each phase.
+ */
+template <class INTERPOLATOR>
+class FixedPointWeightTable
+{
+public:
+    static const int size = INTERPOLATOR::size;
+    static const int phaseBits = 8;
+    static const int phases = 1 << phaseBits;
+    static const int weightBits = 12;
+    static const int one = 1 << weightBits;
+
+    /** returns the table for this kernel, it is created on first use */
+    static const FixedPointWeightTable & instance()
+    {
+        static const FixedPointWeightTable table;
+        return table;
+    }
+
+    /** returns the size weights for the given phase */
+    const int * weights(int phase) const
+    {
+        return &m_weights[phase * size];
+    }
+
+private:
+    FixedPointWeightTable() : m_weights(phases * size)
+    {
+        INTERPOLATOR inter;
+        float w[size];
+        for (int phase = 0; phase < phases; ++phase)
+        {
+            InterpolatorWeights<INTERPOLATOR>::calc_coeff(inter, double(phase) / phases, w);
+            int sum = 0;
+            int maxIndex = 0;
+            for (int k = 0; k < size; ++k)
+            {
+                m_weights[phase * size + k] = static_cast<int>(floor(w[k] * one + 0.5));
+                sum += m_weights[phase * size + k];
+                if (w[k] > w[maxIndex])
+                {
+                    maxIndex = k;
+                };
+            }
+            // correct rounding errors at the largest weight
+            m_weights[phase * size + maxIndex] += one - sum;
+        }
+    }
+
+    std::vector<int> m_weights;
+};
+
+/** converts a position to fixed point.
+ *
+ *  @return true if the whole kernel of the given size is inside the image
+ */
+template <int SIZE>
+inline bool fixedPointPosition(double x, double y, int w, int h, int & srcx, int & srcy, int & phasex, int & phasey)
+{
+    if (x < 0 || y < 0 || x >= w || y >= h)
+    {
+        return false;
+    };
+    // positions are positive here, so the cast truncates like floor
+    const int fx = static_cast<int>(x * (1 << 8) + 0.5);
+    const int fy = static_cast<int>(y * (1 << 8) + 0.5);
+    srcx = fx >> 8;
+    srcy = fy >> 8;
+    phasex = fx & 0xFF;
+    phasey = fy & 0xFF;
+    return srcx > SIZE / 2 && srcx < w - SIZE / 2 && srcy > SIZE / 2 && srcy < h - SIZE / 2;
+}
+
+/** separable fixed point interpolation at the position (srcx, srcy), no boundary checks */
+template <typename SrcImageIterator, typename SrcAccessor, typename INTERPOLATOR>
+inline void interpolateFixedPoint(SrcImageIterator sIter, const SrcAccessor & sAcc,
+                                  int srcx, int srcy, int phasex, int phasey,
+                                  typename SrcAccessor::value_type & result)
+{
+    typedef typename SrcAccessor::value_type PixelType;
+    typedef FixedPointPixel<PixelType> Pixel;
+    typedef FixedPointWeightTable<INTERPOLATOR> Weights;
+    typedef typename ValueTypeTraits<PixelType>::value_type ComponentType;
+    const int size = INTERPOLATOR::size;
+    // the result of the x pass keeps the full precision, so it is rounded only once after the y pass
+    const int64_t half = int64_t(1) << (2 * Weights::weightBits - 1);
+    const int maxVal = vigra::NumericTraits<ComponentType>::max();
+    const Weights & table = Weights::instance();
+    const int * wx = table.weights(phasex);
+    const int * wy = table.weights(phasey);
+
+    // first pass of separable filter, x pass
+    // 16 bit * 12 bit weights * size taps fits into 32 bit
+    int resX[size][Pixel::channels];
+    SrcImageIterator ys(sIter + vigra::Diff2D(srcx - size / 2 + 1, srcy - size / 2 + 1));
+    for (int ky = 0; ky < size; ++ky, ++(ys.y))
+    {
+        int acc[Pixel::channels];
+        for (int c = 0; c < Pixel::channels; ++c)
+        {
+            acc[c] = 0;
+        }
+        typename SrcImageIterator::row_iterator xs(ys.rowIterator());
+        for (int kx = 0; kx < size; ++kx, ++xs)
+        {
+            const PixelType p = sAcc(xs);
+            for (int c = 0; c < Pixel::channels; ++c)
+            {
+                acc[c] += wx[kx] * Pixel::get(p, c);
+            }
+        }
+        for (int c = 0; c < Pixel::channels; ++c)
+        {
+            resX[ky][c] = acc[c];
+        }
+    }
+    // y pass, the 24 bit weight product needs 64 bit
+    for (int c = 0; c < Pixel::channels; ++c)
+    {
+        int64_t acc = 0;
+        for (int ky = 0; ky < size; ++ky)
+        {
+            acc += static_cast<int64_t>(wy[ky]) * resX[ky][c];
+        }
+        acc = (acc + half) >> (2 * Weights::weightBits);
+        Pixel::set(result, c, static_cast<int>(std::min<int64_t>(std::max<int64_t>(acc, 0), maxVal)));
+    }
+}
+
+/** fixed point interpolation of 8 and 16 bit images without mask.
+ *
+ *  Positions where the kernel is completely inside the image are interpolated with
+ *  integer arithmetic, all others are passed to ImageInterpolator.
+ */
+template <typename SrcImageIterator, typename SrcAccessor, typename INTERPOLATOR>
+class FixedPointImageInterpolator
+{
+public:
+    typedef typename SrcAccessor::value_type PixelType;
+    typedef typename vigra::UInt8 MaskType;
+
+    FixedPointImageInterpolator(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> const & src,
+                                INTERPOLATOR & inter,
+                                bool warparound)
+    : m_interpol(src, inter, warparound),
+      m_sIter(src.first),
+      m_sAcc(src.third),
+      m_w(src.second.x - src.first.x),
+      m_h(src.second.y - src.first.y)
+    {
+        // create table before the parallel section
+        FixedPointWeightTable<INTERPOLATOR>::instance();
+    }
+
+    bool operator()(double x, double y, PixelType & result, MaskType & mask) const
+    {
+        int srcx, srcy, phasex, phasey;
+        if (fixedPointPosition<INTERPOLATOR::size>(x, y, m_w, m_h, srcx, srcy, phasex, phasey))
+        {
+            interpolateFixedPoint<SrcImageIterator, SrcAccessor, INTERPOLATOR>(m_sIter, m_sAcc, srcx, srcy, phasex, phasey, result);
+            mask = 255;
+            return true;
+        };
+        return m_interpol(x, y, result, mask);
+    }
+
+private:
+    ImageInterpolator<SrcImageIterator, SrcAccessor, INTERPOLATOR> m_interpol;
+    SrcImageIterator m_sIter;
+    SrcAccessor m_sAcc;
+    int m_w;
+    int m_h;
+};
+
+/** fixed point interpolation of 8 and 16 bit images with mask.
+ *
+ *  Only positions where the kernel is inside the image and all pixels under the
+ *  kernel are fully opaque are interpolated with integer arithmetic, all others
+ *  (borders, partially transparent) are passed to ImageMaskInterpolator.
+ */
+template <typename SrcImageIterator, typename SrcAccessor,
+          typename MaskIterator, typename MaskAccessor,
+          typename INTERPOLATOR>
+class FixedPointImageMaskInterpolator
+{
+public:
+    typedef typename SrcAccessor::value_type PixelType;
+    typedef typename MaskAccessor::value_type MaskType;
+
+    FixedPointImageMaskInterpolator(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> const & src,
+                                    std::pair<MaskIterator, MaskAccessor> mask,
+                                    INTERPOLATOR & inter,
+                                    bool warparound)
+    : m_interpol(src, mask, inter, warparound),
+      m_sIter(src.first),
+      m_sAcc(src.third),
+      m_mIter(mask.first),
+      m_mAcc(mask.second),
+      m_w(src.second.x - src.first.x),
+      m_h(src.second.y - src.first.y)
+    {
+        // create table before the parallel section
+        FixedPointWeightTable<INTERPOLATOR>::instance();
+    }
+
+    bool operator()(double x, double y, PixelType & result, MaskType & mask) const
+    {
+        int srcx, srcy, phasex, phasey;
+        if (fixedPointPosition<INTERPOLATOR::size>(x, y, m_w, m_h, srcx, srcy, phasex, phasey) &&
+            isOpaque(srcx, srcy))
+        {
+            interpolateFixedPoint<SrcImageIterator, SrcAccessor, INTERPOLATOR>(m_sIter, m_sAcc, srcx, srcy, phasex, phasey, result);
+            mask = vigra::NumericTraits<MaskType>::max();
+            return true;
+        };
+        return m_interpol(x, y, result, mask);
+    }
+
+private:
+    /** returns true, if all mask pixels under the kernel are fully opaque */
+    bool isOpaque(int srcx, int srcy) const
+    {
+        const MaskType opaque = vigra::NumericTraits<MaskType>::max();
+        MaskIterator ys(m_mIter + vigra::Diff2D(srcx - INTERPOLATOR::size / 2 + 1, srcy - INTERPOLATOR::size / 2 + 1));
+        for (int ky = 0; ky < INTERPOLATOR::size; ++ky, ++(ys.y))
+        {
+            typename MaskIterator::row_iterator xs(ys.rowIterator());
+            for (int kx = 0; kx < INTERPOLATOR::size; ++kx, ++xs)
+            {
+                if (m_mAcc(xs) != opaque)
+                {
+                    return false;
+                };
+            }
+        }
+        return true;
+    }
+
+    ImageMaskInterpolator<SrcImageIterator, SrcAccessor, MaskIterator, MaskAccessor, INTERPOLATOR> m_interpol;
+    SrcImageIterator m_sIter;
+    SrcAccessor m_sAcc;
+    MaskIterator m_mIter;
+    MaskAccessor m_mAcc;
+    int m_w;
+    int m_h;
+};
+
+/** returns true if the interpolator is supported by transformImageFixedPoint */
+inline bool isFixedPointInterpolator(Interpolator interpol)
+{
+    return interpol == INTERP_BILINEAR || interpol == INTERP_CUBIC;
+}
+
+/** unsupported pixel type, use floating point remapping */
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageFixedPointIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                    vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                    std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                    vigra::Diff2D destUL,
+                                    TRANSFORM & transform,
+                                    PixelTransform & pixelTransform,
+                                    bool warparound,
+                                    Interpolator interpol,
+                                    AppBase::ProgressDisplay* progress, bool singleThreaded,
+                                    std::false_type)
+{
+    transformImage(src, dest, alpha, destUL, transform, pixelTransform, warparound, interpol, progress, singleThreaded);
+}
+
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageFixedPointIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                    vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                    std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                    vigra::Diff2D destUL,
+                                    TRANSFORM & transform,
+                                    PixelTransform & pixelTransform,
+                                    bool warparound,
+                                    Interpolator interpol,
+                                    AppBase::ProgressDisplay* progress, bool singleThreaded,
+                                    std::true_type)
+{
+    switch (interpol) {
+    case INTERP_CUBIC:
+        {
+            vigra_ext::interp_cubic inter;
+            FixedPointImageInterpolator<SrcImageIterator, SrcAccessor, vigra_ext::interp_cubic> fixedInterpol(src, inter, warparound);
+            transformImageWithInterpolator(fixedInterpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
+        }
+        break;
+    case INTERP_BILINEAR:
+        {
+            vigra_ext::interp_bilin inter;
+            FixedPointImageInterpolator<SrcImageIterator, SrcAccessor, vigra_ext::interp_bilin> fixedInterpol(src, inter, warparound);
+            transformImageWithInterpolator(fixedInterpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
+        }
+        break;
+    default:
+        transformImage(src, dest, alpha, destUL, transform, pixelTransform, warparound, interpol, progress, singleThreaded);
+        break;
+    }
+}
+
+/** Transform an 8 or 16 bit image into the panorama using fixed point interpolation.
+ *
+ *  Same interface as transformImage. Bilinear and bicubic interpolation of 8 and
+ *  16 bit images are done with integer weights, all other interpolators and pixel
+ *  types fall back to transformImage.
+ *
+ *  The pixel transform is still called for each pixel, it should be cheap (e.g. a
+ *  lookup table, see Photometric::InvResponseTransform::hasOutputLUT()),
+ *  otherwise the gain of the integer interpolation is small.
+ */
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageFixedPoint(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                              vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                              std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                              vigra::Diff2D destUL,
+                              TRANSFORM & transform,
+                              PixelTransform & pixelTransform,
+                              bool warparound,
+                              Interpolator interpol,
+                              AppBase::ProgressDisplay* progress, bool singleThreaded = false)
+{
+    typedef typename ValueTypeTraits<typename SrcAccessor::value_type>::value_type ComponentType;
+    transformImageFixedPointIntern(src, dest, alpha, destUL, transform, pixelTransform, warparound, interpol,
+                                   progress, singleThreaded, FixedPointSupported<ComponentType>());
+}
+
+/** unsupported pixel type, use floating point remapping */
+template <class SrcImageIterator, class SrcAccessor,
+          class SrcAlphaIterator, class SrcAlphaAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageAlphaFixedPointIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                         std::pair<SrcAlphaIterator, SrcAlphaAccessor> srcAlpha,
+                                         vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                         std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                         vigra::Diff2D destUL,
+                                         TRANSFORM & transform,
+                                         PixelTransform & pixelTransform,
+                                         bool warparound,
+                                         Interpolator interpol,
+                                         AppBase::ProgressDisplay* progress, bool singleThreaded,
+                                         std::false_type)
+{
+    transformImageAlpha(src, srcAlpha, dest, alpha, destUL, transform, pixelTransform, warparound, interpol, progress, singleThreaded);
+}
+
+template <class SrcImageIterator, class SrcAccessor,
+          class SrcAlphaIterator, class SrcAlphaAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageAlphaFixedPointIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                         std::pair<SrcAlphaIterator, SrcAlphaAccessor> srcAlpha,
+                                         vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                         std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                         vigra::Diff2D destUL,
+                                         TRANSFORM & transform,
+                                         PixelTransform & pixelTransform,
+                                         bool warparound,
+                                         Interpolator interpol,
+                                         AppBase::ProgressDisplay* progress, bool singleThreaded,
+                                         std::true_type)
+{
+    switch (interpol) {
+    case INTERP_CUBIC:
+        {
+            vigra_ext::interp_cubic inter;
+            FixedPointImageMaskInterpolator<SrcImageIterator, SrcAccessor, SrcAlphaIterator, SrcAlphaAccessor,
+                                            vigra_ext::interp_cubic> fixedInterpol(src, srcAlpha, inter, warparound);
+            transformImageWithInterpolator(fixedInterpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
+        }
+        break;
+    case INTERP_BILINEAR:
+        {
+            vigra_ext::interp_bilin inter;
+            FixedPointImageMaskInterpolator<SrcImageIterator, SrcAccessor, SrcAlphaIterator, SrcAlphaAccessor,
+                                            vigra_ext::interp_bilin> fixedInterpol(src, srcAlpha, inter, warparound);
+            transformImageWithInterpolator(fixedInterpol, dest, alpha, transform, pixelTransform, destUL, singleThreaded);
+        }
+        break;
+    default:
+        transformImageAlpha(src, srcAlpha, dest, alpha, destUL, transform, pixelTransform, warparound, interpol, progress, singleThreaded);
+        break;
+    }
+}
+
+/** Transform an 8 or 16 bit image with alpha channel into the panorama using
+ *  fixed point interpolation, see transformImageFixedPoint */
+template <class SrcImageIterator, class SrcAccessor,
+          class SrcAlphaIterator, class SrcAlphaAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageAlphaFixedPoint(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                   std::pair<SrcAlphaIterator, SrcAlphaAccessor> srcAlpha,
+                                   vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                   std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                   vigra::Diff2D destUL,
+                                   TRANSFORM & transform,
+                                   PixelTransform & pixelTransform,
+                                   bool warparound,
+                                   Interpolator interpol,
+                                   AppBase::ProgressDisplay* progress, bool singleThreaded = false)
+{
+    typedef typename ValueTypeTraits<typename SrcAccessor::value_type>::value_type ComponentType;
+    transformImageAlphaFixedPointIntern(src, srcAlpha, dest, alpha, destUL, transform, pixelTransform, warparound, interpol,
+                                        progress, singleThreaded, FixedPointSupported<ComponentType>());
+}
+
+}; // namespace
+
+#endif // _VIGRA_EXT_IMAGETRANSFORMSFIXEDPOINT_H
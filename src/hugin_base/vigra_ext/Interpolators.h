@@ -33,9 +33,11 @@
 #include <math.h>
 #include <hugin_math/hugin_math.h>
 #include <algorithm>
+#include <vector>
 
 #include <vigra/accessor.hxx>
 #include <vigra/diff2d.hxx>
+#include <vigra/rgbvalue.hxx>
 
 using std::endl;
 
@@ -281,6 +283,134 @@ struct interp_sinc
 };
 
 
+/** precalculated weights of an interpolation kernel.
+ *
+ *  Evaluating the kernels for every remapped pixel is expensive, especially
+ *  sinc which calls sin() twice per tap. The weights are tabulated once per
+ *  kernel with 1/256 pixel resolution and linear interpolated between the
+ *  phases.
+ */
+template <class INTERPOLATOR>
+class KernelWeightTable
+{
+public:
+    static const int size = INTERPOLATOR::size;
+    static const int phases = 256;
+
+    /** returns the table for this kernel, it is created on first use */
+    static const KernelWeightTable & instance()
+    {
+        static const KernelWeightTable table;
+        return table;
+    }
+
+    /** calculate weights for given offset @p x (0 <= x < 1) */
+    void calc_coeff(double x, float * w) const
+    {
+        const double pos = x * phases;
+        int i = std::min(std::max(int(pos), 0), phases - 1);
+        const float f = static_cast<float>(pos - i);
+        const float * w0 = &m_weights[i * size];
+        const float * w1 = w0 + size;
+        for (int k = 0; k < size; ++k)
+        {
+            w[k] = w0[k] + f * (w1[k] - w0[k]);
+        }
+    }
+
+private:
+    KernelWeightTable() : m_weights((phases + 1) * size)
+    {
+        INTERPOLATOR inter;
+        std::vector<double> w(size);
+        for (int i = 0; i <= phases; ++i)
+        {
+            inter.calc_coeff(double(i) / phases, &w[0]);
+            for (int k = 0; k < size; ++k)
+            {
+                m_weights[i * size + k] = static_cast<float>(w[k]);
+            }
+        }
+    }
+
+    std::vector<float> m_weights;
+};
+
+/** interpolation weights as used by ImageInterpolator and ImageMaskInterpolator,
+ *  tabulated for all kernels with more than 2 taps */
+template <class INTERPOLATOR>
+struct InterpolatorWeights
+{
+    static void calc_coeff(const INTERPOLATOR & inter, double x, float * w)
+    {
+        KernelWeightTable<INTERPOLATOR>::instance().calc_coeff(x, w);
+    }
+};
+
+/** nearest neighbour can't be interpolated between phases */
+template <>
+struct InterpolatorWeights<interp_nearest>
+{
+    static void calc_coeff(const interp_nearest & inter, double x, float * w)
+    {
+        w[1] = (x >= 0.5) ? 1.0f : 0.0f;
+        w[0] = (x < 0.5) ? 1.0f : 0.0f;
+    }
+};
+
+/** bilinear is cheaper to calculate than to lookup */
+template <>
+struct InterpolatorWeights<interp_bilin>
+{
+    static void calc_coeff(const interp_bilin & inter, double x, float * w)
+    {
+        w[1] = static_cast<float>(x);
+        w[0] = static_cast<float>(1.0 - x);
+    }
+};
+
+/** type used to accumulate the weighted pixels.
+ *
+ *  8 and 16 bit and float images are accumulated in single precision, the
+ *  precision is sufficient for these types and the loops vectorize better.
+ *  All other types use the vigra RealPromote.
+ */
+template <class T>
+struct InterpolationRealType
+{
+    typedef typename vigra::NumericTraits<T>::RealPromote type;
+};
+
+template <>
+struct InterpolationRealType<vigra::UInt8>
+{
+    typedef float type;
+};
+
+template <>
+struct InterpolationRealType<vigra::Int16>
+{
+    typedef float type;
+};
+
+template <>
+struct InterpolationRealType<vigra::UInt16>
+{
+    typedef float type;
+};
+
+template <>
+struct InterpolationRealType<float>
+{
+    typedef float type;
+};
+
+template <class T>
+struct InterpolationRealType<vigra::RGBValue<T> >
+{
+    typedef vigra::RGBValue<typename InterpolationRealType<T>::type> type;
+};
+
 /** "wrapper" for efficient interpolation access to an image
  *
  *  Tailored for panorama remapping. Supports warparound boundary condition of left and right
@@ -294,7 +424,8 @@ public:
     // dummy mask type to be compatible to algorithms expecting a ImageMaskInterpolator object
     typedef typename vigra::UInt8 MaskType;
 private:
-    typedef typename vigra::NumericTraits<PixelType>::RealPromote RealPixelType;
+    typedef typename InterpolationRealType<PixelType>::type RealPixelType;
+    typedef InterpolatorWeights<INTERPOLATOR> Weights;
 
     SrcImageIterator m_sIter;
     SrcAccessor m_sAcc;
@@ -365,12 +496,12 @@ public:
             return interpolateNoMaskInside(srcx, srcy, dx, dy, result);
         }
 
-        double wx[INTERPOLATOR::size];
-        double wy[INTERPOLATOR::size];
+        float wx[INTERPOLATOR::size];
+        float wy[INTERPOLATOR::size];
 
         // calculate x interpolation coefficients
-        m_inter.calc_coeff(dx, wx);
-        m_inter.calc_coeff(dy, wy);
+        Weights::calc_coeff(m_inter, dx, wx);
+        Weights::calc_coeff(m_inter, dy, wy);
 
         RealPixelType p(vigra::NumericTraits<RealPixelType>::zero());
         double weightsum = 0.0;
@@ -403,8 +534,8 @@ public:
                 }
 
                 // check mask
-                double f = wx[kx]*wy[ky];
-                p += f * m_sAcc(m_sIter, vigra::Diff2D(bounded_kx, bounded_ky));
+                float f = wx[kx]*wy[ky];
+                p += f * RealPixelType(m_sAcc(m_sIter, vigra::Diff2D(bounded_kx, bounded_ky)));
                 weightsum += f;
             }
         }
@@ -423,11 +554,11 @@ public:
     bool interpolateNoMaskInside(int srcx, int srcy, double dx, double dy,
                                     PixelType & result) const
     {
-        double w[INTERPOLATOR::size];
+        float w[INTERPOLATOR::size];
         RealPixelType resX[INTERPOLATOR::size];
 
         // calculate x interpolation coefficients
-        m_inter.calc_coeff(dx, w);
+        Weights::calc_coeff(m_inter, dx, w);
 
         RealPixelType p;
 
@@ -440,13 +571,13 @@ public:
             typename SrcImageIterator::row_iterator xs(ys.rowIterator());
             //SrcImageIterator xs(ys);
             for (int kx = 0; kx < INTERPOLATOR::size; kx++, ++xs) {
-                p += w[kx] * m_sAcc(xs);
+                p += w[kx] * RealPixelType(m_sAcc(xs));
             }
             resX[ky] = p;
         }
 
         // y pass.
-        m_inter.calc_coeff(dy, w);
+        Weights::calc_coeff(m_inter, dy, w);
         p = vigra::NumericTraits<RealPixelType>::zero();
         for (int ky = 0; ky < INTERPOLATOR::size; ky++) {
             p += w[ky] * resX[ky];
@@ -477,7 +608,8 @@ public:
     typedef typename SrcAccessor::value_type PixelType;
     typedef typename MaskAccessor::value_type MaskType;
 private:
-    typedef typename vigra::NumericTraits<PixelType>::RealPromote RealPixelType;
+    typedef typename InterpolationRealType<PixelType>::type RealPixelType;
+    typedef InterpolatorWeights<INTERPOLATOR> Weights;
 
     SrcImageIterator m_sIter;
     SrcAccessor m_sAcc;
@@ -679,12 +811,12 @@ public:
             return interpolateInside(srcx, srcy, dx, dy, result, mask);
         }
 
-        double wx[INTERPOLATOR::size];
-        double wy[INTERPOLATOR::size];
+        float wx[INTERPOLATOR::size];
+        float wy[INTERPOLATOR::size];
 
         // calculate x interpolation coefficients
-        m_inter.calc_coeff(dx, wx);
-        m_inter.calc_coeff(dy, wy);
+        Weights::calc_coeff(m_inter, dx, wx);
+        Weights::calc_coeff(m_inter, dy, wy);
 
         // first pass of separable filter
 
@@ -722,10 +854,10 @@ public:
                 MaskType cmask = m_mIter(bounded_kx, bounded_ky);
                 if (cmask) {
                     // check mask
-                    double f = wx[kx]*wy[ky];
+                    float f = wx[kx]*wy[ky];
                     // TODO: check if this is good, influences the HDR stitching masks
                     m += f * cmask;
-                    p += f * m_sAcc(m_sIter, vigra::Diff2D(bounded_kx, bounded_ky));
+                    p += f * RealPixelType(m_sAcc(m_sIter, vigra::Diff2D(bounded_kx, bounded_ky)));
                     weightsum += f;
                 }
             }
@@ -750,12 +882,12 @@ public:
                                     PixelType & result, MaskType & mask) const
     {
 
-        double wx[INTERPOLATOR::size];
-        double wy[INTERPOLATOR::size];
+        float wx[INTERPOLATOR::size];
+        float wy[INTERPOLATOR::size];
 
         // calculate x interpolation coefficients
-        m_inter.calc_coeff(dx, wx);
-        m_inter.calc_coeff(dy, wy);
+        Weights::calc_coeff(m_inter, dx, wx);
+        Weights::calc_coeff(m_inter, dy, wy);
 
         RealPixelType p(vigra::NumericTraits<RealPixelType>::zero());
         double weightsum = 0.0;
@@ -774,10 +906,10 @@ public:
                 MaskType cmask = *xms;
                 if (cmask) {
                     // check mask
-                    double f = wx[kx]*wy[ky];
+                    float f = wx[kx]*wy[ky];
                     // TODO: check if this is good, influences the HDR stitching masks
                     m += f * cmask;
-                    p += f * m_sAcc(xs);
+                    p += f * RealPixelType(m_sAcc(xs));
                     weightsum += f;
                 }
             }
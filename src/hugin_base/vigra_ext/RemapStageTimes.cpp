@@ -0,0 +1,89 @@
+// -*- c-basic-offset: 4 -*-
+/** @file RemapStageTimes.cpp
+ *
+ *  Optional timing of the stages of the remapping.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "RemapStageTimes.h"
+
+namespace vigra_ext
+{
+
+/** receives the times of the stages, NULL disables the measurement */
+static RemapStageTimes* remapStageTimes = NULL;
+
+RemapStageTimes::RemapStageTimes()
+{
+    reset();
+};
+
+void RemapStageTimes::reset()
+{
+    hugin_omp::ScopedLock sl(m_lock);
+    for (int i = 0; i < REMAP_STAGE_COUNT; ++i)
+    {
+        m_times[i] = 0;
+    };
+};
+
+void RemapStageTimes::add(const double* times)
+{
+    hugin_omp::ScopedLock sl(m_lock);
+    for (int i = 0; i < REMAP_STAGE_COUNT; ++i)
+    {
+        m_times[i] += times[i];
+    };
+};
+
+double RemapStageTimes::get(const RemapStage stage) const
+{
+    return m_times[stage];
+};
+
+const char* RemapStageTimes::getName(const RemapStage stage)
+{
+    switch (stage)
+    {
+        case REMAP_STAGE_MASK:
+            return "mask";
+        case REMAP_STAGE_TRANSFORM:
+            return "transform";
+        case REMAP_STAGE_INTERPOLATE:
+            return "interpolate";
+        case REMAP_STAGE_PHOTOMETRIC:
+            return "photometric";
+        case REMAP_STAGE_ENCODE:
+            return "encode";
+        case REMAP_STAGE_WRITE:
+            return "write";
+        default:
+            return "unknown";
+    };
+};
+
+void SetRemapStageTimes(RemapStageTimes* times)
+{
+    remapStageTimes = times;
+};
+
+RemapStageTimes* GetRemapStageTimes()
+{
+    return remapStageTimes;
+};
+
+} // namespace vigra_ext
@@ -0,0 +1,120 @@
+// -*- c-basic-offset: 4 -*-
+/** @file RemapStageTimes.h
+ *
+ *  Optional timing of the stages of the remapping and of writing the
+ *  remapped images, used by bench_remap.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_REMAPSTAGETIMES_H
+#define _VIGRA_EXT_REMAPSTAGETIMES_H
+
+#include <chrono>
+
+#include <hugin_shared.h>
+#include <hugin_utils/openmp_lock.h>
+
+namespace vigra_ext
+{
+
+/** the measured stages */
+enum RemapStage
+{
+    /** creating the source alpha channel from crop and masks */
+    REMAP_STAGE_MASK = 0,
+    /** transforming the output coordinates into source coordinates */
+    REMAP_STAGE_TRANSFORM,
+    /** interpolating the source image */
+    REMAP_STAGE_INTERPOLATE,
+    /** photometric transform and writing pixel and alpha value */
+    REMAP_STAGE_PHOTOMETRIC,
+    /** filling and compressing the tiles of a tiff file */
+    REMAP_STAGE_ENCODE,
+    /** writing the tiles to the tiff file */
+    REMAP_STAGE_WRITE,
+    REMAP_STAGE_COUNT
+};
+
+/** accumulates the time spent in the stages, summed over all threads */
+class IMPEX RemapStageTimes
+{
+public:
+    RemapStageTimes();
+    /** sets all times to 0 */
+    void reset();
+    /** adds the times (in seconds) of all stages, can be called from several threads */
+    void add(const double* times);
+    /** returns the summed time of the given stage in seconds */
+    double get(const RemapStage stage) const;
+    /** returns the name of the stage */
+    static const char* getName(const RemapStage stage);
+private:
+    double m_times[REMAP_STAGE_COUNT];
+    hugin_omp::Lock m_lock;
+};
+
+/** sets the object which receives the times of the stages,
+ *  NULL (the default) disables the time measurement */
+IMPEX void SetRemapStageTimes(RemapStageTimes* times);
+/** returns the current object for the times of the stages or NULL */
+IMPEX RemapStageTimes* GetRemapStageTimes();
+
+/** measures the time between calls of lap() for a single thread,
+ *  the times are added to the RemapStageTimes when the clock is destroyed.
+ *  Does nothing when no RemapStageTimes are set. */
+class RemapStageClock
+{
+public:
+    explicit RemapStageClock(RemapStageTimes* times) : m_times(times)
+    {
+        if (m_times)
+        {
+            for (int i = 0; i < REMAP_STAGE_COUNT; ++i)
+            {
+                m_elapsed[i] = 0;
+            };
+            m_last = std::chrono::steady_clock::now();
+        };
+    };
+    ~RemapStageClock()
+    {
+        if (m_times)
+        {
+            m_times->add(m_elapsed);
+        };
+    };
+    /** adds the time since the last call (or the construction) to the given stage */
+    void lap(const RemapStage stage)
+    {
+        if (m_times)
+        {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            m_elapsed[stage] += std::chrono::duration<double>(now - m_last).count();
+            m_last = now;
+        };
+    };
+private:
+    RemapStageClock(const RemapStageClock&);
+    RemapStageClock& operator=(const RemapStageClock&);
+    RemapStageTimes* m_times;
+    double m_elapsed[REMAP_STAGE_COUNT];
+    std::chrono::steady_clock::time_point m_last;
+};
+
+} // namespace vigra_ext
+
+#endif // _VIGRA_EXT_REMAPSTAGETIMES_H
@@ -0,0 +1,202 @@
+// -*- c-basic-offset: 4 -*-
+/** @file ScanlineImport.h
+ *
+ *  Import of images row by row, without decoding the whole image at once.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_SCANLINEIMPORT_H
+#define _VIGRA_EXT_SCANLINEIMPORT_H
+
+#include <vigra/imageinfo.hxx>
+#include <vigra/impex.hxx>
+#include <vigra/impexbase.hxx>
+#include <vigra/codec.hxx>
+#include <vigra/transformimage.hxx>
+#include <vigra/functorexpression.hxx>
+
+#include <vigra_ext/utils.h>
+
+namespace vigra_ext
+{
+
+/** reads an image file row by row.
+ *
+ *  The rows can only be read in order, rows which are not needed can be skipped.
+ *  Memory usage depends on the codec: tiff and jpeg files are decoded scanline
+ *  by scanline, other formats may decode the whole file at the first access.
+ *
+ *  Like vigra::importImageAlpha, the alpha channel is scaled from the range
+ *  of the image type to the range of the alpha type.
+ */
+template <class ImageType, class AlphaType>
+class ScanlineImporter
+{
+public:
+    typedef typename ImageType::value_type PixelType;
+    typedef typename ValueTypeTraits<PixelType>::value_type ComponentType;
+    typedef typename AlphaType::value_type AlphaValueType;
+
+    explicit ScanlineImporter(const vigra::ImageImportInfo& info) :
+        m_decoder(vigra::decoder(info)), m_nextRow(0), m_scale(1.0),
+        m_alphaScaler(vigra::detail::range_t(LUTTraits<ComponentType>::min(), LUTTraits<ComponentType>::max()),
+                      vigra::detail::range_t(LUTTraits<AlphaValueType>::min(), LUTTraits<AlphaValueType>::max()))
+    {
+        m_width = m_decoder->getWidth();
+        m_height = m_decoder->getHeight();
+        m_hasAlpha = m_decoder->getNumExtraBands() > 0;
+        m_imageBands = m_decoder->getNumBands() - m_decoder->getNumExtraBands();
+        vigra_precondition(m_imageBands == numBands(typename vigra::NumericTraits<PixelType>::isScalar()),
+            "vigra_ext::ScanlineImporter: number of channels and image type do not match");
+        switch (vigra::detail::pixel_t_of_string(m_decoder->getPixelType()))
+        {
+            case vigra::detail::UNSIGNED_INT_8:
+                m_readScanline = &ScanlineImporter::readScanline<vigra::UInt8>;
+                break;
+            case vigra::detail::UNSIGNED_INT_16:
+                m_readScanline = &ScanlineImporter::readScanline<vigra::UInt16>;
+                break;
+            case vigra::detail::UNSIGNED_INT_32:
+                m_readScanline = &ScanlineImporter::readScanline<vigra::UInt32>;
+                break;
+            case vigra::detail::SIGNED_INT_16:
+                m_readScanline = &ScanlineImporter::readScanline<vigra::Int16>;
+                break;
+            case vigra::detail::SIGNED_INT_32:
+                m_readScanline = &ScanlineImporter::readScanline<vigra::Int32>;
+                break;
+            case vigra::detail::IEEE_FLOAT_32:
+                m_readScanline = &ScanlineImporter::readScanline<float>;
+                break;
+            case vigra::detail::IEEE_FLOAT_64:
+                m_readScanline = &ScanlineImporter::readScanline<double>;
+                break;
+            default:
+                vigra_fail("vigra_ext::ScanlineImporter: unsupported pixel type");
+        }
+    };
+
+    ~ScanlineImporter()
+    {
+        if (m_nextRow == m_height)
+        {
+            m_decoder->close();
+        }
+        else
+        {
+            m_decoder->abort();
+        };
+    };
+
+    int width() const { return m_width; };
+    int height() const { return m_height; };
+    /** returns true, if the file contains an alpha channel */
+    bool hasAlpha() const { return m_hasAlpha; };
+    /** returns the number of the next row, which will be read */
+    int nextRow() const { return m_nextRow; };
+    /** all pixel values are multiplied by scale after reading */
+    void setScale(const double scale) { m_scale = scale; };
+
+    /** skips the next @p count rows */
+    void skipRows(int count)
+    {
+        vigra_precondition(m_nextRow + count <= m_height, "vigra_ext::ScanlineImporter: reading past the end of the image");
+        for (int i = 0; i < count; ++i)
+        {
+            m_decoder->nextScanline();
+        };
+        m_nextRow += count;
+    };
+
+    /** reads the next @p count rows into the rows starting at @p destRow of @p image,
+     *  @p alpha is only written if the file contains an alpha channel */
+    void readRows(ImageType& image, AlphaType& alpha, int destRow, int count)
+    {
+        vigra_precondition(m_nextRow + count <= m_height, "vigra_ext::ScanlineImporter: reading past the end of the image");
+        vigra_precondition(image.width() == m_width && destRow + count <= image.height(),
+            "vigra_ext::ScanlineImporter: image too small");
+        vigra_precondition(!m_hasAlpha || (alpha.width() == m_width && destRow + count <= alpha.height()),
+            "vigra_ext::ScanlineImporter: alpha image too small");
+        for (int i = 0; i < count; ++i)
+        {
+            m_decoder->nextScanline();
+            (this->*m_readScanline)(image, alpha, destRow + i);
+        };
+        m_nextRow += count;
+        if (m_scale != 1.0)
+        {
+            vigra::transformImage(image.upperLeft() + vigra::Diff2D(0, destRow),
+                image.upperLeft() + vigra::Diff2D(m_width, destRow + count), image.accessor(),
+                image.upperLeft() + vigra::Diff2D(0, destRow), image.accessor(),
+                vigra::functor::Arg1()*vigra::functor::Param(m_scale));
+        };
+    };
+
+private:
+    // no copies
+    ScanlineImporter(const ScanlineImporter&);
+    ScanlineImporter& operator=(const ScanlineImporter&);
+
+    static unsigned int numBands(vigra::VigraTrueType) { return 1; };
+    static unsigned int numBands(vigra::VigraFalseType) { return PixelType::static_size; };
+
+    template <class Iterator, class Accessor, class T>
+    static void setBand(Accessor& acc, Iterator& it, unsigned int band, T v, vigra::VigraTrueType) { acc.set(v, it); };
+    template <class Iterator, class Accessor, class T>
+    static void setBand(Accessor& acc, Iterator& it, unsigned int band, T v, vigra::VigraFalseType) { acc.setComponent(v, it, band); };
+
+    /** copies the current scanline of the decoder into row @p y */
+    template <class FileType>
+    void readScanline(ImageType& image, AlphaType& alpha, int y)
+    {
+        const unsigned int offset = m_decoder->getOffset();
+        typename ImageType::Accessor acc = image.accessor();
+        for (unsigned int band = 0; band < m_imageBands; ++band)
+        {
+            const FileType* scanline = static_cast<const FileType*>(m_decoder->currentScanlineOfBand(band));
+            typename ImageType::traverser::row_iterator it = (image.upperLeft() + vigra::Diff2D(0, y)).rowIterator();
+            for (int x = 0; x < m_width; ++x, ++it, scanline += offset)
+            {
+                setBand(acc, it, band, *scanline, typename vigra::NumericTraits<PixelType>::isScalar());
+            };
+        };
+        if (m_hasAlpha)
+        {
+            const FileType* scanline = static_cast<const FileType*>(m_decoder->currentScanlineOfBand(m_imageBands));
+            typename AlphaType::Accessor alphaAcc = alpha.accessor();
+            typename AlphaType::traverser::row_iterator it = (alpha.upperLeft() + vigra::Diff2D(0, y)).rowIterator();
+            for (int x = 0; x < m_width; ++x, ++it, scanline += offset)
+            {
+                alphaAcc.set(m_alphaScaler(*scanline), it);
+            };
+        };
+    };
+
+    VIGRA_UNIQUE_PTR<vigra::Decoder> m_decoder;
+    void (ScanlineImporter::*m_readScanline)(ImageType&, AlphaType&, int);
+    int m_width;
+    int m_height;
+    bool m_hasAlpha;
+    unsigned int m_imageBands;
+    int m_nextRow;
+    double m_scale;
+    vigra::detail::linear_transform m_alphaScaler;
+};
+
+} // namespace
+
+#endif // _VIGRA_EXT_SCANLINEIMPORT_H
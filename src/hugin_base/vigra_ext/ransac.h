@@ -38,6 +38,8 @@
 #include "hugin_config.h"
 #include <random>
 #include <functional>
+#include <algorithm>
+#include <atomic>
 
 //#include "ParameterEsitmator.h"
 
@@ -71,6 +73,11 @@
  *
  * Small modifications by Pablo d'Angelo:
  *  * allow arbitrary parameters, not just vector<S>
+ *
+ * The hypotheses of the probabilistic variant are evaluated in parallel, so the
+ * estimate and agree functions of the Estimator must be callable from several threads
+ * at once. Each hypothesis is first scored on a random subset of the data
+ * and discarded early if it can not compete with the best model found so far.
  */
 class Ransac {
 
@@ -129,6 +136,11 @@ public:
 	
 private:
 
+    /** draw numTries unique random subsets of size numForEstimate out of numDataObjects */
+    template<class RNG>
+    static void drawSubSets(std::vector<std::vector<int> > & subSets, int numTries,
+                            unsigned int numDataObjects, unsigned int numForEstimate, RNG & rng);
+
     /**
      * Compute n choose m  [ n!/(m!*(n-m)!)]
      */
@@ -149,23 +161,6 @@ private:
                          short *bestVotes, short *curVotes,
                          int &numVotesForBest, int *arr);
 
-    class SubSetIndexComparator 
-    {
-    private:
-        int m_length;
-        public:
-            SubSetIndexComparator(int arrayLength) : m_length(arrayLength)
-            {}
-
-        bool operator()(const int *arr1, const int *arr2) const 
-        {
-            for(int i=0; i<m_length; i++)
-                if(arr1[i] < arr2[i])
-                    return true;
-                return false;			
-        }
-    };
-
 };
 
 
@@ -186,129 +181,110 @@ std::vector<const T *> Ransac::compute(S &parameters,
     if(numDataObjects < numForEstimate || maximalOutlierPercentage>=1.0) 
         return std::vector<const T*>();
 
-    std::vector<const T *> exactEstimateData;
     std::vector<const T *> leastSquaresEstimateData;
-    S exactEstimateParameters;
-    int i, j, k, l, numVotesForBest, numVotesForCur, maxIndex, numTries;
-    short *bestVotes = new short[numDataObjects]; //one if data[i] agrees with the best model, otherwise zero
-    short *curVotes = new short[numDataObjects];  //one if data[i] agrees with the current model, otherwise zero
-    short *notChosen = new short[numDataObjects]; //not zero if data[i] is NOT chosen for computing the exact fit, otherwise zero
-    SubSetIndexComparator subSetIndexComparator(numForEstimate);
-    std::set<int *, SubSetIndexComparator > chosenSubSets(subSetIndexComparator);
-    int *curSubSetIndexes;
-    // double outlierPercentage = maximalOutlierPercentage;
     double numerator = log(1.0-desiredProbabilityForNoOutliers);
     double denominator = log(1- pow((double)(1.0-maximalOutlierPercentage), (double)(numForEstimate)));
     int allTries = choose(numDataObjects,numForEstimate);
 
-    //parameters.clear();
-
-
-    numVotesForBest = 0; //initalize with 0 so that the first computation which gives any type of fit will be set to best
-    
     // intialize random generator
-    maxIndex = numDataObjects - 1;
     std::mt19937 rng(static_cast<unsigned int>(std::time(0)));
-    std::uniform_int_distribution<> distribIndex(0, maxIndex);
-    auto randIndex=std::bind(distribIndex, rng);
-
-//    srand((unsigned)time(NULL)); //seed random number generator
-    numTries = (int)(numerator/denominator + 0.5);
 
+    int numTries = (int)(numerator/denominator + 0.5);
     //there are cases when the probablistic number of tries is greater than all possible sub-sets
     numTries = numTries<allTries ? numTries : allTries;
 
-    for(i=0; i<numTries; i++) {
-        //randomly select data for exact model fit ('numForEstimate' objects).
-        memset(notChosen,'1',numDataObjects*sizeof(short));
-        curSubSetIndexes = new int[numForEstimate];
+    // draw all sub sets up front, so that the hypotheses can be evaluated in parallel
+    std::vector<std::vector<int> > subSets;
+    drawSubSets(subSets, numTries, numDataObjects, numForEstimate, rng);
+
+    // the data is scored in a random order, the first numPreemptive objects are used
+    // for the preemptive test of each hypothesis
+    std::vector<int> evalOrder(numDataObjects);
+    for (unsigned int j = 0; j < numDataObjects; ++j)
+    {
+        evalOrder[j] = j;
+    };
+    std::shuffle(evalOrder.begin(), evalOrder.end(), rng);
+    const unsigned int numPreemptive = std::min<unsigned int>(numDataObjects, std::max<unsigned int>(20, numDataObjects / 10));
 
-        exactEstimateData.clear();
+    std::vector<short> bestVotes(numDataObjects, 0); //one if data[i] agrees with the best model, otherwise zero
+    //initalize with 0 so that the first computation which gives any type of fit will be set to best
+    std::atomic<int> numVotesForBest(0);
+    int bestSubSet = -1;
 
-        maxIndex = numDataObjects-1; 
-        for(l=0; l<(int)numForEstimate; l++) {
-            //selectedIndex is in [0,maxIndex]
-            unsigned int selectedIndex = randIndex();
-//            unsigned int selectedIndex = (unsigned int)(((float)rand()/(float)RAND_MAX)*maxIndex + 0.5);
-            for(j=-1,k=0; k<(int)numDataObjects && j<(int)selectedIndex; k++) {
-                if(notChosen[k])
-                    j++;
-            }
-            k--;
-            exactEstimateData.push_back(&(data[k]));
-            notChosen[k] = 0;
-            maxIndex--;
-        }
-        //get the indexes of the chosen objects so we can check that this sub-set hasn't been
-        //chosen already
-        for(l=0, j=0; j<(int)numDataObjects; j++) {
-            if(!notChosen[j]) {
-                curSubSetIndexes[l] = j+1;
-                l++;
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int)subSets.size(); i++)
+    {
+        std::vector<const T *> exactEstimateData;
+        for (size_t l = 0; l < subSets[i].size(); ++l)
+        {
+            exactEstimateData.push_back(&(data[subSets[i][l]]));
+        };
+        //use the selected data for an exact model parameter fit
+        S exactEstimateParameters;
+        if (!paramEstimator.estimate(exactEstimateData,exactEstimateParameters))
+            //selected data is a singular configuration (e.g. three colinear points for 
+            //a circle fit)
+            continue;
+        //see how many agree on this estimate
+        std::vector<short> curVotes(numDataObjects, 0); //one if data[i] agrees with the current model, otherwise zero
+        int numVotesForCur = 0;
+        bool discarded = false;
+        for (unsigned int j = 0; j < numDataObjects; j++)
+        {
+            const int index = evalOrder[j];
+            if (paramEstimator.agree(exactEstimateParameters, data[index]))
+            {
+                curVotes[index] = 1;
+                numVotesForCur++;
             }
+            const int best = numVotesForBest.load();
+            // preemptive test: discard hypotheses whose extrapolated inlier count
+            // is less than half of the best model
+            if (j + 1 == numPreemptive && 2.0 * numVotesForCur * numDataObjects < (double)best * numPreemptive)
+            {
+                discarded = true;
+                break;
+            };
+            // even if all remaining objects agree we can not beat the best model
+            if (numVotesForCur + (int)(numDataObjects - j - 1) < best)
+            {
+                discarded = true;
+                break;
+            };
         }
-
-        //check that the sub set just chosen is unique
-        std::pair< std::set<int *, SubSetIndexComparator >::iterator, bool > res = chosenSubSets.insert(curSubSetIndexes);
-
-        if(res.second == true) { //first time we chose this sub set
-		                 //use the selected data for an exact model parameter fit
-            if (!paramEstimator.estimate(exactEstimateData,exactEstimateParameters))
-                //selected data is a singular configuration (e.g. three colinear points for 
-                //a circle fit)
-                continue;
-            //see how many agree on this estimate
-            numVotesForCur = 0;
-            memset(curVotes,'\0',numDataObjects*sizeof(short));
-            for(j=0; j<(int)numDataObjects; j++) {
-                if(paramEstimator.agree(exactEstimateParameters, data[j])) {
-                    curVotes[j] = 1;
-                    numVotesForCur++;
-                }
-            }
+        if (discarded)
+        {
+            continue;
+        };
 	    // debug output
 	    #ifdef DEBUG_RANSAC
+#pragma omp critical (ransac_debug)
+        {
 	    std::cerr << "RANSAC iter " << i << ": inliers: " << numVotesForCur << " parameters:";
 	    for (int jj=0; jj < exactEstimateParameters.size(); jj++)
 		std::cerr << " " << exactEstimateParameters[jj];
 	    std::cerr << std::endl;
+        }
 	    #endif
 
-            if(numVotesForCur > numVotesForBest) {
+#pragma omp critical (ransac_best)
+        {
+            // on equal votes prefer the earlier sub set, so the result does not depend
+            // on the order in which the threads finish
+            if (numVotesForCur > numVotesForBest || (numVotesForCur == numVotesForBest && i < bestSubSet))
+            {
                 numVotesForBest = numVotesForCur;
-                memcpy(bestVotes,curVotes, numDataObjects*sizeof(short));
-		parameters = exactEstimateParameters;
+                bestSubSet = i;
+                bestVotes.swap(curVotes);
+                parameters = exactEstimateParameters;
             }
-	    /*
-            //update the estimate of outliers and the number of iterations we need
-            outlierPercentage = 1 - (double)numVotesForCur/(double)numDataObjects;
-            if(outlierPercentage < maximalOutlierPercentage) {
-                maximalOutlierPercentage = outlierPercentage;
-                denominator = log(1- pow((double)(1.0-maximalOutlierPercentage), (double)(numForEstimate)));
-                numTries = (int)(numerator/denominator + 0.5);
-                //there are cases when the probablistic number of tries is greater than all possible sub-sets
-                numTries = numTries<allTries ? numTries : allTries;
-            }
-	    */
-        }
-        else {  //this sub set already appeared, don't count this iteration
-            delete [] curSubSetIndexes;
-            i--;
         }
     }
 
-    //release the memory
-    std::set<int *, SubSetIndexComparator >::iterator it = chosenSubSets.begin();
-    std::set<int *, SubSetIndexComparator >::iterator chosenSubSetsEnd = chosenSubSets.end();
-    while(it!=chosenSubSetsEnd) {
-	delete [] (*it);
-        it++;
-    }
-    chosenSubSets.clear();
-
     //compute the least squares estimate using the largest sub set
     if(numVotesForBest > 0) {
-        for(j=0; j<(int)numDataObjects; j++) {
+        for(unsigned int j=0; j<numDataObjects; j++) {
             if(bestVotes[j]) {
                 leastSquaresEstimateData.push_back(&(data[j]));
 		inliers.push_back(j);
@@ -316,9 +292,6 @@ std::vector<const T *> Ransac::compute(S &parameters,
         }
         paramEstimator.leastSquaresEstimate(leastSquaresEstimateData,parameters);
     }
-    delete [] bestVotes;
-    delete [] curVotes;
-    delete [] notChosen;
 
     return leastSquaresEstimateData;
 }
@@ -417,6 +390,49 @@ void Ransac::estimate(const Estimator & paramEstimator, const std::vector<T> &da
 	}
 }
 /*****************************************************************************/
+template<class RNG>
+void Ransac::drawSubSets(std::vector<std::vector<int> > & subSets, int numTries,
+                         unsigned int numDataObjects, unsigned int numForEstimate, RNG & rng)
+{
+    std::set<std::vector<int> > chosenSubSets;
+    std::vector<short> notChosen(numDataObjects); //not zero if data[i] is NOT chosen for computing the exact fit, otherwise zero
+    while ((int)subSets.size() < numTries)
+    {
+        //randomly select data for exact model fit ('numForEstimate' objects).
+        std::fill(notChosen.begin(), notChosen.end(), 1);
+        int maxIndex = numDataObjects-1;
+        for (unsigned int l = 0; l < numForEstimate; l++)
+        {
+            //selectedIndex is in [0,maxIndex]
+            std::uniform_int_distribution<> distribIndex(0, maxIndex);
+            const int selectedIndex = distribIndex(rng);
+            int j, k;
+            for(j=-1,k=0; k<(int)numDataObjects && j<selectedIndex; k++) {
+                if(notChosen[k])
+                    j++;
+            }
+            k--;
+            notChosen[k] = 0;
+            maxIndex--;
+        }
+        //get the indexes of the chosen objects so we can check that this sub-set hasn't been
+        //chosen already
+        std::vector<int> curSubSetIndexes;
+        for (unsigned int j = 0; j < numDataObjects; j++)
+        {
+            if (!notChosen[j])
+            {
+                curSubSetIndexes.push_back(j);
+            }
+        }
+        //check that the sub set just chosen is unique, otherwise don't count this iteration
+        if (chosenSubSets.insert(curSubSetIndexes).second)
+        {
+            subSets.push_back(curSubSetIndexes);
+        }
+    }
+}
+/*****************************************************************************/
 inline unsigned int Ransac::choose(unsigned int n, unsigned int m)
 {
 	unsigned int denominatorEnd, numeratorStart, numerator,denominator; 
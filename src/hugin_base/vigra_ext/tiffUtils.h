@@ -26,15 +26,26 @@
 #ifndef _TIFFUTILS_H
 #define _TIFFUTILS_H
 
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
 #include <vigra/tiff.hxx>
 #include <vigra/imageinfo.hxx>
 #include <vigra/transformimage.hxx>
 #include <vigra/functorexpression.hxx>
 
 #include <vigra_ext/FunctorAccessor.h>
+#include <vigra_ext/RemapStageTimes.h>
+#include <vigra_ext/utils.h>
 #include <hugin_utils/utils.h>
 
 #include <tiffio.h>
+#include <zlib.h>
+#include "hugin_config.h"
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 // add this to the vigra_ext namespace
 namespace vigra_ext {
@@ -124,6 +135,149 @@ inline void createTiffDirectory(vigra::TiffImage * tiff, const std::string & pag
 }
 
 
+/** size of the tiles in the tiff files written by createAlphaTiffImage */
+#define HUGIN_TIFF_TILESIZE 256
+
+/** encodes one row with PackBits, as used by the tiff PACKBITS compression */
+inline void packBitsEncodeRow(const unsigned char * data, const size_t length, std::vector<unsigned char> & out)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t run = 1;
+        while (i + run < length && run < 128 && data[i + run] == data[i])
+        {
+            ++run;
+        }
+        if (run > 1)
+        {
+            // repeated byte
+            out.push_back(static_cast<unsigned char>(257 - run));
+            out.push_back(data[i]);
+            i += run;
+        }
+        else
+        {
+            // literal bytes up to the next run of 3 equal bytes
+            const size_t start = i;
+            while (i < length && i - start < 128)
+            {
+                if (i + 2 < length && data[i] == data[i + 1] && data[i] == data[i + 2])
+                {
+                    break;
+                }
+                ++i;
+            }
+            out.push_back(static_cast<unsigned char>(i - start - 1));
+            out.insert(out.end(), data + start, data + i);
+        }
+    }
+}
+
+/** compresses a tile with the given tiff compression, returns false if the
+ *  compression is not supported, in this case libtiff has to encode the tile */
+inline bool compressTiffTile(const uint16 compression, const std::vector<unsigned char> & tile,
+                             const size_t rowBytes, std::vector<unsigned char> & out)
+{
+    switch (compression)
+    {
+        case COMPRESSION_ADOBE_DEFLATE:
+        case COMPRESSION_DEFLATE:
+            {
+                uLongf size = compressBound(tile.size());
+                out.resize(size);
+                if (compress2(&out[0], &size, &tile[0], tile.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+                {
+                    return false;
+                }
+                out.resize(size);
+                return true;
+            }
+        case COMPRESSION_PACKBITS:
+            // each row is packed separately
+            out.clear();
+            for (size_t offset = 0; offset < tile.size(); offset += rowBytes)
+            {
+                packBitsEncodeRow(&tile[offset], std::min(rowBytes, tile.size() - offset), out);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** writes the current tiff directory as tiled image.
+ *
+ *  @p fillTile(buffer, x, y, width, height) has to copy the interleaved pixels
+ *  of the tile at (x, y) into buffer (with a row length of HUGIN_TIFF_TILESIZE pixels).
+ *  Several tiles are filled and compressed in parallel and then written in
+ *  order, compressions not handled by compressTiffTile are encoded by libtiff.
+ */
+template <class FillTile>
+void writeTiffTiles(vigra::TiffImage * tiff, const int w, const int h, FillTile fillTile)
+{
+    TIFFSetField(tiff, TIFFTAG_TILEWIDTH, HUGIN_TIFF_TILESIZE);
+    TIFFSetField(tiff, TIFFTAG_TILELENGTH, HUGIN_TIFF_TILESIZE);
+    uint16 compression = COMPRESSION_NONE;
+    TIFFGetField(tiff, TIFFTAG_COMPRESSION, &compression);
+
+    const size_t tileBytes = TIFFTileSize(tiff);
+    const size_t rowBytes = TIFFTileRowSize(tiff);
+    const int tilesX = (w + HUGIN_TIFF_TILESIZE - 1) / HUGIN_TIFF_TILESIZE;
+    const int tilesY = (h + HUGIN_TIFF_TILESIZE - 1) / HUGIN_TIFF_TILESIZE;
+    const int nrTiles = tilesX * tilesY;
+    // a fixed number of tiles per thread is kept in memory, independent of the image width
+#ifdef HAVE_OPENMP
+    const int batchSize = std::min(nrTiles, 4 * omp_get_max_threads());
+#else
+    const int batchSize = std::min(nrTiles, 4);
+#endif
+    std::vector<std::vector<unsigned char> > tiles(batchSize);
+    std::vector<std::vector<unsigned char> > compressed(batchSize);
+    std::vector<char> isCompressed(batchSize);
+    RemapStageTimes* stageTimes = GetRemapStageTimes();
+
+    for (int firstTile = 0; firstTile < nrTiles; firstTile += batchSize)
+    {
+        const int n = std::min(batchSize, nrTiles - firstTile);
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < n; ++i)
+        {
+            RemapStageClock clock(stageTimes);
+            const int x = ((firstTile + i) % tilesX) * HUGIN_TIFF_TILESIZE;
+            const int y = ((firstTile + i) / tilesX) * HUGIN_TIFF_TILESIZE;
+            // border tiles are padded with 0
+            tiles[i].assign(tileBytes, 0);
+            fillTile(&tiles[i][0], x, y, std::min(HUGIN_TIFF_TILESIZE, w - x), std::min(HUGIN_TIFF_TILESIZE, h - y));
+            isCompressed[i] = compression != COMPRESSION_NONE && compressTiffTile(compression, tiles[i], rowBytes, compressed[i]);
+            clock.lap(REMAP_STAGE_ENCODE);
+        }
+        RemapStageClock writeClock(stageTimes);
+        for (int i = 0; i < n; ++i)
+        {
+            const uint32 x = ((firstTile + i) % tilesX) * HUGIN_TIFF_TILESIZE;
+            const uint32 y = ((firstTile + i) / tilesX) * HUGIN_TIFF_TILESIZE;
+            const uint32 tileIndex = TIFFComputeTile(tiff, x, y, 0, 0);
+            if (isCompressed[i])
+            {
+                TIFFWriteRawTile(tiff, tileIndex, &compressed[i][0], compressed[i].size());
+            }
+            else
+            {
+                if (compression == COMPRESSION_NONE)
+                {
+                    TIFFWriteRawTile(tiff, tileIndex, &tiles[i][0], tileBytes);
+                }
+                else
+                {
+                    TIFFWriteEncodedTile(tiff, tileIndex, &tiles[i][0], tileBytes);
+                }
+            }
+        }
+        writeClock.lap(REMAP_STAGE_WRITE);
+    }
+}
+
 /** internal function to create a scalar tiff image with alpha channel */
 template <class ImageIterator, class ImageAccessor,
           class AlphaIterator, class AlphaAccessor>
@@ -145,7 +299,6 @@ createScalarATiffImage(ImageIterator upperleft, ImageIterator lowerright,
     TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
     TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleformat);
     TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, 1);
 
     // for alpha stuff, do not uses premultilied data
     // We do not want to throw away data by premultiplying
@@ -153,36 +306,23 @@ createScalarATiffImage(ImageIterator upperleft, ImageIterator lowerright,
     uint16 extra_samples = EXTRASAMPLE_UNASSALPHA;
     TIFFSetField (tiff, TIFFTAG_EXTRASAMPLES, nextra_samples, &extra_samples);
 
-    int bufsize = TIFFScanlineSize(tiff);
-    tdata_t * buf = new tdata_t[bufsize];
-
-    ImageIterator ys(upperleft);
-    AlphaIterator ya(alphaUpperleft);
-
-    try
+    writeTiffTiles(tiff, w, h, [&](unsigned char * buf, int tileX, int tileY, int tileWidth, int tileHeight)
     {
-        for(int y=0; y<h; ++y, ++ys.y, ++ya.y)
+        for (int y = 0; y < tileHeight; ++y)
         {
-            PixelType * pg = (PixelType *)buf;
-            PixelType * alpha = pg+1;
+            PixelType * pg = reinterpret_cast<PixelType *>(buf) + 2 * y * HUGIN_TIFF_TILESIZE;
+            PixelType * alpha = pg + 1;
 
-            ImageIterator xs(ys);
-            AlphaIterator xa(ya);
+            ImageIterator xs(upperleft + vigra::Diff2D(tileX, tileY + y));
+            AlphaIterator xa(alphaUpperleft + vigra::Diff2D(tileX, tileY + y));
 
-            for(int x=0; x<w; ++x, ++xs.x, pg+=2, alpha+=2, ++xa.x)
+            for (int x = 0; x < tileWidth; ++x, ++xs.x, pg += 2, alpha += 2, ++xa.x)
             {
                 *pg = a(xs);
                 *alpha = alphaA(xa);
             }
-            TIFFWriteScanline(tiff, buf, y);
         }
-    }
-    catch(...)
-    {
-        delete[] buf;
-        throw;
-    }
-    delete[] buf;
+    });
 }
 
 /** internal function to create a RGB tiff image with alpha channel */
@@ -207,7 +347,6 @@ createRGBATiffImage(ImageIterator upperleft, ImageIterator lowerright,
     TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
     TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleformat);
     TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
-    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, 1);
 		
     // for alpha stuff, do not uses premultilied data
     // We do not want to throw away data & accuracy by premultiplying
@@ -215,40 +354,27 @@ createRGBATiffImage(ImageIterator upperleft, ImageIterator lowerright,
     uint16 extra_samples = EXTRASAMPLE_UNASSALPHA;
     TIFFSetField (tiff, TIFFTAG_EXTRASAMPLES, nextra_samples, &extra_samples);
 
-    int bufsize = TIFFScanlineSize(tiff);
-    tdata_t * buf = new tdata_t[bufsize];
-
-    ImageIterator ys(upperleft);
-    AlphaIterator ya(alphaUpperleft);
-
-    try
+    writeTiffTiles(tiff, w, h, [&](unsigned char * buf, int tileX, int tileY, int tileWidth, int tileHeight)
     {
-        for(int y=0; y<h; ++y, ++ys.y, ++ya.y)
+        for (int y = 0; y < tileHeight; ++y)
         {
-            PixelType * pr = (PixelType *)buf;
+            PixelType * pr = reinterpret_cast<PixelType *>(buf) + 4 * y * HUGIN_TIFF_TILESIZE;
             PixelType * pg = pr+1;
             PixelType * pb = pg+1;
             PixelType * alpha = pb+1;
 
-            ImageIterator xs(ys);
-            AlphaIterator xa(ya);
+            ImageIterator xs(upperleft + vigra::Diff2D(tileX, tileY + y));
+            AlphaIterator xa(alphaUpperleft + vigra::Diff2D(tileX, tileY + y));
 
-            for(int x=0; x<w; ++x, ++xs.x, pr+=4, pg+=4, pb+=4, alpha+=4, ++xa.x)
+            for (int x = 0; x < tileWidth; ++x, ++xs.x, pr += 4, pg += 4, pb += 4, alpha += 4, ++xa.x)
             {
                 *pr = a.red(xs);
                 *pg = a.green(xs);
                 *pb = a.blue(xs);
                 *alpha = alphaA(xa);
             }
-            TIFFWriteScanline(tiff, buf, y);
         }
-    }
-    catch(...)
-    {
-        delete[] buf;
-        throw;
-    }
-    delete[] buf;
+    });
 }
 
 // try to add stuff the vigra way
@@ -550,6 +676,58 @@ createAlphaTiffImage(vigra::triple<ImageIterator, ImageIterator, ImageAccessor>
                          alpha.first, alpha.second, tiff);
 }
 
+/** scalar images for exportTiledAlphaTiff */
+template <class ImageIterator, class ImageAccessor,
+          class AlphaIterator, class AlphaAccessor>
+inline void exportTiledAlphaTiffIntern(ImageIterator upperleft, ImageIterator lowerright, ImageAccessor a,
+                                       AlphaIterator alphaUpperleft, AlphaAccessor alphaA,
+                                       vigra::TiffImage * tiff, int sampleformat, vigra::VigraTrueType)
+{
+    createScalarATiffImage(upperleft, lowerright, a, alphaUpperleft, alphaA, tiff, sampleformat);
+}
+
+/** RGB images for exportTiledAlphaTiff */
+template <class ImageIterator, class ImageAccessor,
+          class AlphaIterator, class AlphaAccessor>
+inline void exportTiledAlphaTiffIntern(ImageIterator upperleft, ImageIterator lowerright, ImageAccessor a,
+                                       AlphaIterator alphaUpperleft, AlphaAccessor alphaA,
+                                       vigra::TiffImage * tiff, int sampleformat, vigra::VigraFalseType)
+{
+    createRGBATiffImage(upperleft, lowerright, a, alphaUpperleft, alphaA, tiff, sampleformat);
+}
+
+/** save an image with an 8 bit alpha channel as tiled tiff file.
+ *
+ *  The tiles are compressed in parallel. Like vigra::exportImageAlpha, the
+ *  alpha channel is scaled to the range of the image type.
+ *
+ *  @param position   position of the image in the canvas (must be positive)
+ *  @param canvasSize size of the full image
+ */
+template <class ImageIterator, class ImageAccessor,
+          class AlphaIterator, class AlphaAccessor>
+void exportTiledAlphaTiff(vigra::triple<ImageIterator, ImageIterator, ImageAccessor> src,
+                          vigra::pair<AlphaIterator, AlphaAccessor> alpha,
+                          const std::string & filename,
+                          const std::string & compression,
+                          vigra::Diff2D position,
+                          vigra::Size2D canvasSize,
+                          const vigra::ImageExportInfo::ICCProfile & icc)
+{
+    typedef typename ValueTypeTraits<typename ImageAccessor::value_type>::value_type ComponentType;
+    vigra::TiffImage * tiff = TIFFOpen(filename.c_str(), "w");
+    vigra_precondition(tiff != NULL, "exportTiledAlphaTiff(): could not open output file");
+    const std::string name = hugin_utils::stripPath(filename);
+    createTiffDirectory(tiff, name, name, compression, 1, 1, position, canvasSize, icc);
+    vigra_ext::ReadFunctorAccessor<vigra::ScalarIntensityTransform<ComponentType>, AlphaAccessor>
+        mA(vigra::ScalarIntensityTransform<ComponentType>(LUTTraits<ComponentType>::max() / 255.0), alpha.second);
+    const int sampleformat = std::is_integral<ComponentType>::value ?
+        (std::is_signed<ComponentType>::value ? SAMPLEFORMAT_INT : SAMPLEFORMAT_UINT) : SAMPLEFORMAT_IEEEFP;
+    exportTiledAlphaTiffIntern(src.first, src.second, src.third, alpha.first, mA, tiff, sampleformat,
+                               typename vigra::NumericTraits<typename ImageAccessor::value_type>::isScalar());
+    TIFFClose(tiff);
+}
+
 
 
 //***************************************************************************
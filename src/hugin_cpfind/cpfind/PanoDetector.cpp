@@ -422,6 +422,17 @@ void RunQueue(std::vector<Runnable*>& queue)
     };
 };
 
+/** run a queue of MatchDataRunnable. The RANSAC step calls the panotools optimizer
+ *  from several threads, so the panotools progress functions are set once for the whole queue */
+void RunMatchQueue(std::vector<Runnable*>& queue)
+{
+    PT_setProgressFcn(ptProgress);
+    PT_setInfoDlgFcn(ptinfoDlg);
+    RunQueue(queue);
+    PT_setProgressFcn(NULL);
+    PT_setInfoDlgFcn(NULL);
+};
+
 void PanoDetector::run()
 {
     // init the random time generator
@@ -720,7 +731,7 @@ bool PanoDetector::match(std::vector<HuginBase::UIntSet> &checkedPairs)
     {
         queue.push_back(new MatchDataRunnable(matchesData[i], *this));
     };
-    RunQueue(queue);
+    RunMatchQueue(queue);
 
     // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
@@ -991,7 +1002,7 @@ bool PanoDetector::matchMultiRow()
     {
         queue.push_back(new MatchDataRunnable(matchesData[i], *this));
     };
-    RunQueue(queue);
+    RunMatchQueue(queue);
 
     // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
@@ -1059,7 +1070,7 @@ bool PanoDetector::matchMultiRow()
         {
             queue.push_back(new MatchDataRunnable(matchesData[i], *this));
         };
-        RunQueue(queue);
+        RunMatchQueue(queue);
 
         for (size_t i = 0; i < matchesData.size(); ++i)
         {
@@ -1213,7 +1224,7 @@ bool PanoDetector::matchPrealigned(HuginBase::Panorama* pano, std::vector<HuginB
     {
         queue.push_back(new MatchDataRunnable(matchesData[i], *this));
     };
-    RunQueue(queue);
+    RunMatchQueue(queue);
 
     // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
@@ -1006,9 +1006,9 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
     }
 
     // perform ransac matching.
-    // ARGH the panotools optimizer uses global variables is not reentrant
+    // the panotools optimizer uses global variables and is not reentrant, the
+    // RANSAC estimator serialises its calls, so the image pairs can be processed in parallel
     std::vector<int> inliers;
-#pragma omp critical
     {
         HuginBase::PanoramaData* panoSubset = iPanoDetector._panoramaInfo->getNewSubset(imgs);
 
@@ -1022,10 +1022,6 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
         }
         panoSubset->setCtrlPoints(controlPoints);
 
-
-        PT_setProgressFcn(ptProgress);
-        PT_setInfoDlgFcn(ptinfoDlg);
-
         HuginBase::RANSACOptimizer::Mode rmode = iPanoDetector._ransacMode;
         if (rmode == HuginBase::RANSACOptimizer::AUTO)
         {
@@ -1033,8 +1029,6 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
         }
         inliers = HuginBase::RANSACOptimizer::findInliers(*panoSubset, pano_local_i1, pano_local_i2,
                   iPanoDetector.getRansacDistanceThreshold(), rmode);
-        PT_setProgressFcn(NULL);
-        PT_setInfoDlgFcn(NULL);
         delete panoSubset;
     }
 
@@ -105,7 +105,8 @@ std::vector<ImageType *> loadImagesPyr(std::vector<std::string> files, int pyrLe
 
 
 // needs 2.0 progress steps
-void loadImgsAndExtractPoints(HuginBase::Panorama pano, int nPoints, int pyrLevel, bool randomPoints, AppBase::ProgressDisplay& progress, std::vector<vigra_ext::PointPairRGB> & points, int verbose)
+// seed is only used for random points, 0 seeds from the current time
+void loadImgsAndExtractPoints(HuginBase::Panorama pano, int nPoints, int pyrLevel, bool randomPoints, AppBase::ProgressDisplay& progress, std::vector<vigra_ext::PointPairRGB> & points, int verbose, unsigned int seed = 0)
 {
     // extract file names
     std::vector<std::string> files;
@@ -119,7 +120,7 @@ void loadImgsAndExtractPoints(HuginBase::Panorama pano, int nPoints, int pyrLeve
     
     progress.setMessage("Sampling points");
     if(randomPoints)
-        points = HuginBase::RandomPointSampler(pano, &progress, images, nPoints).execute().getResultPoints();
+        points = HuginBase::RandomPointSampler(pano, &progress, images, nPoints, seed).execute().getResultPoints();
     else
         points = HuginBase::AllPointSampler(pano, &progress, images, nPoints).execute().getResultPoints();
     progress.taskFinished();
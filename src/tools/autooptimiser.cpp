@@ -67,6 +67,11 @@ static void usage(const char* name)
          << "              first image" << std::endl
          << "     -m       Optimise photometric parameters" << std::endl
          << "     -n       Optimize parameters specified in script file (like PTOptimizer)" << std::endl
+         << "     -i prev.pto  incremental optimisation (only with -n): starts from the" << std::endl
+         << "              current values and only optimises the images near images whose" << std::endl
+         << "              control points differ from the previously optimised project prev.pto" << std::endl
+         << "     -k hops  number of image graph hops around changed images, which are" << std::endl
+         << "              optimised in incremental mode (default: 1)" << std::endl
          << std::endl
          << "    Postprocessing options:" << std::endl
          << "     -l       level horizon (works best for horizontal panos)" << std::endl
@@ -85,7 +90,7 @@ static void usage(const char* name)
 int main(int argc, char* argv[])
 {
     // parse arguments
-    const char* optstring = "alho:npqsv:m";
+    const char* optstring = "alho:npqsv:mi:k:";
     int c;
     std::string output;
     bool doPairwise = false;
@@ -96,6 +101,8 @@ int main(int argc, char* argv[])
     bool quiet = false;
     bool doPhotometric = false;
     double hfov = 0.0;
+    std::string incrementalPrev;
+    int incrementalHops = 1;
     while ((c = getopt (argc, argv, optstring)) != -1)
     {
         switch (c)
@@ -130,6 +137,17 @@ int main(int argc, char* argv[])
             case 'm':
                 doPhotometric = true;
                 break;
+            case 'i':
+                incrementalPrev = optarg;
+                break;
+            case 'k':
+                incrementalHops = atoi(optarg);
+                if (incrementalHops < 0)
+                {
+                    std::cerr << "Invalid number of hops given, using 1" << std::endl;
+                    incrementalHops = 1;
+                };
+                break;
             default:
                 abort ();
         }
@@ -232,11 +250,35 @@ int main(int argc, char* argv[])
     }
     else if (doNormalOpt)
     {
-        if (!quiet)
+        bool incrementalDone = false;
+        if (!incrementalPrev.empty())
         {
-            std::cerr << "*** Optimising parameters specified in PTO file" << std::endl;
-        }
-        HuginBase::PTools::optimize(pano);
+            HuginBase::Panorama prevPano;
+            std::ifstream prevFile(incrementalPrev.c_str());
+            if (prevFile.good() && prevPano.readData(prevFile) == AppBase::DocumentData::SUCCESSFUL &&
+                prevPano.getNrOfImages() == pano.getNrOfImages())
+            {
+                const HuginBase::UIntSet changedImgs = HuginBase::IncrementalOptimise::getImagesWithChangedCPs(prevPano.getCtrlPoints(), pano.getCtrlPoints());
+                if (!quiet)
+                {
+                    std::cerr << "*** Incremental optimisation of parameters specified in PTO file (" << changedImgs.size() << " images with changed control points)" << std::endl;
+                }
+                HuginBase::IncrementalOptimise::incrementalOptimise(pano, changedImgs, incrementalHops);
+                incrementalDone = true;
+            }
+            else
+            {
+                std::cerr << "Could not use " << incrementalPrev << " for incremental optimisation, doing full optimisation" << std::endl;
+            };
+        };
+        if (!incrementalDone)
+        {
+            if (!quiet)
+            {
+                std::cerr << "*** Optimising parameters specified in PTO file" << std::endl;
+            }
+            HuginBase::PTools::optimize(pano);
+        };
     }
     else
     {
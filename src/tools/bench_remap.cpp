@@ -0,0 +1,602 @@
+// -*- c-basic-offset: 4 -*-
+
+/** @file bench_remap.cpp
+ *
+ *  @brief benchmark for the remapping of images
+ *
+ *  Creates a synthetic source image, remaps it with RemappedPanoImage::remapImage
+ *  and writes it with vigra_ext::exportTiledAlphaTiff for several thread counts.
+ *  The times of the single stages (mask creation, coordinate transform,
+ *  interpolation, photometric transform, encoding and writing of the tiles)
+ *  are measured inside these functions. The results are written as JSON.
+ *
+ */
+
+/*  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+#include <getopt.h>
+
+#include <hugin_config.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include <vigra/stdimage.hxx>
+#include <panodata/Panorama.h>
+#include <panodata/Mask.h>
+#include <nona/RemappedPanoImage.h>
+#include <vigra_ext/ImageTransforms.h>
+#include <vigra_ext/RemapStageTimes.h>
+#include <vigra_ext/tiffUtils.h>
+#include <vigra_ext/utils.h>
+#include <algorithms/nona/ComputeImageROI.h>
+#include <algorithms/nona/FitPanorama.h>
+#include <algorithms/basic/CalculateOptimalScale.h>
+#include <hugin_utils/utils.h>
+#include <hugin_utils/stl_utils.h>
+
+static void usage(const char* name)
+{
+    std::cout << name << ": benchmark the remapping of images" << std::endl
+        << name << " version " << hugin_utils::GetHuginVersion() << std::endl
+        << std::endl
+        << "Usage:  " << name << " [options]" << std::endl
+        << std::endl
+        << "Creates a synthetic source image, remaps it in the same way as nona" << std::endl
+        << "(stage remap) and saves it as tiled tiff file (stage write). Inside these" << std::endl
+        << "functions the time of the single stages is measured: creation of the mask," << std::endl
+        << "coordinate transform, interpolation, photometric transform, encoding and" << std::endl
+        << "writing of the tiles. The times of the single stages are summed over all" << std::endl
+        << "threads. The results are written as JSON." << std::endl
+        << std::endl
+        << "  Options:" << std::endl
+        << "     --projection=SRC,DEST  Projection of source image and panorama as" << std::endl
+        << "                            numbers like in pto files (default: 0,2)" << std::endl
+        << "     --hfov=FLOAT           Horizontal field of view of source image" << std::endl
+        << "                            (default: 50)" << std::endl
+        << "     --distortion=A,B,C     Lens distortion parameters (default: 0,-0.01,0)" << std::endl
+        << "     --size=WxH             Size of source image (default: 4000x3000)" << std::endl
+        << "     --pixel-type=TYPE      Pixel type of source image, UINT8, UINT16" << std::endl
+        << "                            or FLOAT (default: UINT8)" << std::endl
+        << "     --interpolator=NAME    Interpolator: nearest, bilinear, cubic, spline16," << std::endl
+        << "                            spline36, spline64, sinc256 or sinc1024" << std::endl
+        << "                            (default: cubic)" << std::endl
+        << "     --crop                 Use a circular crop for the source image" << std::endl
+        << "     --mask                 Add a negative mask to the source image" << std::endl
+        << "     --threads=LIST         Comma separated list of thread counts" << std::endl
+        << "                            (default: 1 and number of processors)" << std::endl
+        << "     --tile-size=INT        Size of tiles for remapping, 0 remaps full rows" << std::endl
+        << "     --compression=NAME     Compression of written tiff file (default: LZW)" << std::endl
+        << "     --repeat=INT           Number of runs of each stage (default: 3)" << std::endl
+        << "     -o, --output=FILE      Write JSON to file instead of stdout" << std::endl
+        << "     -h, --help             Shows this help" << std::endl
+        << std::endl;
+}
+
+/** settings of the benchmark */
+struct RemapSettings
+{
+    RemapSettings() : srcProjection(0), destProjection(2), hfov(50.0), size(4000, 3000),
+        pixelType("UINT8"), interpolator(vigra_ext::INTERP_CUBIC), interpolatorName("cubic"),
+        crop(false), mask(false), tileSize(-1), compression("LZW"), repeat(3)
+    {
+        distortion.push_back(0.0);
+        distortion.push_back(-0.01);
+        distortion.push_back(0.0);
+    };
+    int srcProjection;
+    int destProjection;
+    double hfov;
+    std::vector<double> distortion;
+    vigra::Size2D size;
+    std::string pixelType;
+    vigra_ext::Interpolator interpolator;
+    std::string interpolatorName;
+    bool crop;
+    bool mask;
+    std::vector<int> threads;
+    int tileSize;
+    std::string compression;
+    int repeat;
+};
+
+/** result of one stage for one thread count */
+struct StageResult
+{
+    StageResult() : threads(1), bestTime(0), meanTime(0), threadTime(0), mpix(0) {};
+    std::string name;
+    /** for the single stages the name of the measured function, empty otherwise */
+    std::string parent;
+    int threads;
+    /** wall time of the whole function */
+    double bestTime;
+    double meanTime;
+    /** mean time of a single stage per run, summed over all threads */
+    double threadTime;
+    /** number of processed pixels in Mpix */
+    double mpix;
+};
+
+/** runs func settings.repeat times and records the wall time of func and the time
+ *  of the given stages, as measured inside the remapping and saving code */
+template <class Func>
+static void TimeStages(const std::string& name, const std::vector<vigra_ext::RemapStage>& stages,
+    const RemapSettings& settings, const int threads, const double mpix, Func func, std::vector<StageResult>& results)
+{
+    StageResult result;
+    result.name = name;
+    result.threads = threads;
+    result.mpix = mpix;
+    vigra_ext::RemapStageTimes stageTimes;
+    vigra_ext::SetRemapStageTimes(&stageTimes);
+    double sumTime = 0;
+    for (int run = 0; run < settings.repeat; ++run)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        func();
+        const double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        sumTime += time;
+        if (run == 0 || time < result.bestTime)
+        {
+            result.bestTime = time;
+        };
+    };
+    vigra_ext::SetRemapStageTimes(NULL);
+    result.meanTime = sumTime / settings.repeat;
+    results.push_back(result);
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        StageResult stage;
+        stage.name = vigra_ext::RemapStageTimes::getName(stages[i]);
+        stage.parent = name;
+        stage.threads = threads;
+        stage.mpix = mpix;
+        stage.threadTime = stageTimes.get(stages[i]) * 1000.0 / settings.repeat;
+        results.push_back(stage);
+    };
+}
+
+/** creates the source image description from the settings */
+static HuginBase::SrcPanoImage CreateSrcImage(const RemapSettings& settings)
+{
+    HuginBase::SrcPanoImage img;
+    img.setFilename("synthetic.tif");
+    img.setSize(settings.size);
+    img.setProjection(static_cast<HuginBase::SrcPanoImage::Projection>(settings.srcProjection));
+    img.setHFOV(settings.hfov);
+    std::vector<double> dist(4, 0.0);
+    dist[0] = settings.distortion[0];
+    dist[1] = settings.distortion[1];
+    dist[2] = settings.distortion[2];
+    dist[3] = 1.0 - dist[0] - dist[1] - dist[2];
+    img.setRadialDistortion(dist);
+    std::vector<double> vig(4, 0.0);
+    vig[0] = 1.0;
+    vig[1] = -0.3;
+    vig[2] = 0.1;
+    img.setRadialVigCorrCoeff(vig);
+    img.setExposureValue(0.5);
+    if (settings.crop)
+    {
+        const int radius = std::min(settings.size.x, settings.size.y) * 9 / 20;
+        img.setCropMode(HuginBase::SrcPanoImage::CROP_CIRCLE);
+        img.setCropRect(vigra::Rect2D(settings.size.x / 2 - radius, settings.size.y / 2 - radius,
+            settings.size.x / 2 + radius, settings.size.y / 2 + radius));
+    };
+    if (settings.mask)
+    {
+        // a triangle in the lower left corner
+        HuginBase::MaskPolygon mask;
+        mask.setMaskType(HuginBase::MaskPolygon::Mask_negative);
+        mask.addPoint(hugin_utils::FDiff2D(0, settings.size.y * 0.5));
+        mask.addPoint(hugin_utils::FDiff2D(settings.size.x * 0.3, settings.size.y));
+        mask.addPoint(hugin_utils::FDiff2D(0, settings.size.y));
+        img.addActiveMask(mask);
+    };
+    return img;
+}
+
+/** fills the image with a smooth pattern and sharp edges, so that the interpolators
+ *  can not take any shortcuts */
+template <class ImageType>
+static void FillSyntheticImage(ImageType& image)
+{
+    typedef typename ImageType::value_type PixelType;
+    typedef typename vigra_ext::ValueTypeTraits<PixelType>::value_type ComponentType;
+    const double maxVal = vigra_ext::LUTTraits<ComponentType>::max();
+#pragma omp parallel for
+    for (int y = 0; y < image.height(); ++y)
+    {
+        for (int x = 0; x < image.width(); ++x)
+        {
+            const double checker = ((x / 64 + y / 64) % 2) * 0.2;
+            const double r = 0.4 + 0.3 * sin(x * 0.05) * cos(y * 0.07) + checker;
+            const double g = 0.3 + 0.3 * x / image.width() + checker;
+            const double b = 0.3 + 0.3 * y / image.height() + checker;
+            image(x, y) = PixelType(r * maxVal, g * maxVal, b * maxVal);
+        };
+    };
+}
+
+/** runs all stages for the given pixel type and all thread counts */
+template <class ImageType>
+static void RunRemapBenchmark(const RemapSettings& settings, vigra::Rect2D& roi, std::vector<StageResult>& results)
+{
+    HuginBase::Panorama pano;
+    const HuginBase::SrcPanoImage srcImg = CreateSrcImage(settings);
+    pano.addImage(srcImg);
+    HuginBase::PanoramaOptions opts = pano.getOptions();
+    opts.setProjection(static_cast<HuginBase::PanoramaOptions::ProjectionFormat>(settings.destProjection));
+    opts.outputMode = HuginBase::PanoramaOptions::OUTPUT_LDR;
+    pano.setOptions(opts);
+    // fit the panorama to the image and select the size, so that the scale is similar
+    HuginBase::CalculateFitPanorama fitPano(pano);
+    fitPano.run();
+    opts.setHFOV(fitPano.getResultHorizontalFOV());
+    opts.setHeight(hugin_utils::roundi(fitPano.getResultHeight()));
+    pano.setOptions(opts);
+    opts.setWidth(hugin_utils::roundi(opts.getWidth() * HuginBase::CalculateOptimalScale::calcOptimalScale(pano)), true);
+    pano.setOptions(opts);
+    roi = HuginBase::estimateOutputROI(pano, opts, 0);
+    if (roi.isEmpty())
+    {
+        std::cerr << "Remapped image is empty" << std::endl;
+        return;
+    };
+    const double mpix = static_cast<double>(roi.area()) / 1e6;
+
+    ImageType image(settings.size);
+    FillSyntheticImage(image);
+    HuginBase::Nona::RemappedPanoImage<ImageType, vigra::BImage> remapped;
+    const std::string tempFile("bench_remap_temp.tif");
+
+    std::vector<vigra_ext::RemapStage> remapStages;
+    remapStages.push_back(vigra_ext::REMAP_STAGE_MASK);
+    remapStages.push_back(vigra_ext::REMAP_STAGE_TRANSFORM);
+    remapStages.push_back(vigra_ext::REMAP_STAGE_INTERPOLATE);
+    remapStages.push_back(vigra_ext::REMAP_STAGE_PHOTOMETRIC);
+    std::vector<vigra_ext::RemapStage> writeStages;
+    writeStages.push_back(vigra_ext::REMAP_STAGE_ENCODE);
+    writeStages.push_back(vigra_ext::REMAP_STAGE_WRITE);
+
+    std::vector<int> threads(settings.threads);
+    if (threads.empty())
+    {
+        threads.push_back(1);
+#ifdef HAVE_OPENMP
+        if (omp_get_num_procs() > 1)
+        {
+            threads.push_back(omp_get_num_procs());
+        };
+#endif
+    };
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+#ifdef HAVE_OPENMP
+        omp_set_num_threads(threads[i]);
+#else
+        if (threads[i] != 1)
+        {
+            std::cerr << "Compiled without OpenMP support, using a single thread" << std::endl;
+            threads[i] = 1;
+        };
+#endif
+        TimeStages("remap", remapStages, settings, threads[i], mpix, [&]()
+        {
+            remapped.setPanoImage(srcImg, opts, roi);
+            AppBase::DummyProgressDisplay progress;
+            remapped.remapImage(vigra::srcImageRange(image), settings.interpolator, &progress);
+        }, results);
+        TimeStages("write", writeStages, settings, threads[i], mpix, [&]()
+        {
+            vigra_ext::exportTiledAlphaTiff(vigra::srcImageRange(remapped.m_image), vigra::srcImage(remapped.m_mask),
+                tempFile, settings.compression, roi.upperLeft(), vigra::Size2D(opts.getWidth(), opts.getHeight()),
+                remapped.m_ICCProfile);
+        }, results);
+    };
+    std::remove(tempFile.c_str());
+}
+
+static void WriteJSON(std::ostream& out, const RemapSettings& settings, const vigra::Rect2D& roi, const std::vector<StageResult>& results)
+{
+    out << std::setprecision(6);
+    out << "{" << std::endl
+        << "  \"version\": \"" << hugin_utils::GetHuginVersion() << "\"," << std::endl
+        << "  \"settings\": {" << std::endl
+        << "    \"src_projection\": " << settings.srcProjection << "," << std::endl
+        << "    \"dest_projection\": " << settings.destProjection << "," << std::endl
+        << "    \"hfov\": " << settings.hfov << "," << std::endl
+        << "    \"distortion\": [" << settings.distortion[0] << ", " << settings.distortion[1] << ", " << settings.distortion[2] << "]," << std::endl
+        << "    \"src_width\": " << settings.size.x << "," << std::endl
+        << "    \"src_height\": " << settings.size.y << "," << std::endl
+        << "    \"dest_width\": " << roi.width() << "," << std::endl
+        << "    \"dest_height\": " << roi.height() << "," << std::endl
+        << "    \"pixel_type\": \"" << settings.pixelType << "\"," << std::endl
+        << "    \"interpolator\": \"" << settings.interpolatorName << "\"," << std::endl
+        << "    \"crop\": " << (settings.crop ? "true" : "false") << "," << std::endl
+        << "    \"mask\": " << (settings.mask ? "true" : "false") << "," << std::endl
+        << "    \"tile_size\": " << vigra_ext::GetRemapTileSize() << "," << std::endl
+        << "    \"compression\": \"" << settings.compression << "\"," << std::endl
+        << "    \"repeat\": " << settings.repeat << std::endl
+        << "  }," << std::endl
+        << "  \"stages\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const StageResult& r = results[i];
+        out << "    {" << std::endl
+            << "      \"name\": \"" << r.name << "\"," << std::endl;
+        if (r.parent.empty())
+        {
+            out << "      \"threads\": " << r.threads << "," << std::endl
+                << "      \"wall_time_ms\": " << r.bestTime << "," << std::endl
+                << "      \"wall_time_ms_mean\": " << r.meanTime << "," << std::endl
+                << "      \"mpix_per_s\": " << (r.bestTime > 0 ? r.mpix / r.bestTime * 1000.0 : 0.0) << std::endl;
+        }
+        else
+        {
+            out << "      \"stage_of\": \"" << r.parent << "\"," << std::endl
+                << "      \"threads\": " << r.threads << "," << std::endl
+                << "      \"thread_time_ms\": " << r.threadTime << "," << std::endl
+                << "      \"mpix_per_thread_s\": " << (r.threadTime > 0 ? r.mpix / r.threadTime * 1000.0 : 0.0) << std::endl;
+        };
+        out << "    }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    };
+    out << "  ]" << std::endl
+        << "}" << std::endl;
+}
+
+/** parses a comma separated list of numbers */
+static bool ParseDoubleList(const std::string& s, std::vector<double>& values)
+{
+    values.clear();
+    std::vector<std::string> parts = hugin_utils::SplitString(s, ",");
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+        double val;
+        if (!hugin_utils::stringToDouble(parts[i], val))
+        {
+            return false;
+        };
+        values.push_back(val);
+    };
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // parse arguments
+    const char* optstring = "o:h";
+    enum
+    {
+        PROJECTION = 1000,
+        HFOV,
+        DISTORTION,
+        SIZE,
+        PIXELTYPE,
+        INTERPOLATOR,
+        CROP,
+        MASK,
+        THREADS,
+        TILESIZE,
+        COMPRESSION,
+        REPEAT
+    };
+    static struct option longOptions[] =
+    {
+        { "output", required_argument, NULL, 'o' },
+        { "projection", required_argument, NULL, PROJECTION },
+        { "hfov", required_argument, NULL, HFOV },
+        { "distortion", required_argument, NULL, DISTORTION },
+        { "size", required_argument, NULL, SIZE },
+        { "pixel-type", required_argument, NULL, PIXELTYPE },
+        { "interpolator", required_argument, NULL, INTERPOLATOR },
+        { "crop", no_argument, NULL, CROP },
+        { "mask", no_argument, NULL, MASK },
+        { "threads", required_argument, NULL, THREADS },
+        { "tile-size", required_argument, NULL, TILESIZE },
+        { "compression", required_argument, NULL, COMPRESSION },
+        { "repeat", required_argument, NULL, REPEAT },
+        { "help", no_argument, NULL, 'h' },
+        0
+    };
+    RemapSettings settings;
+    std::string output;
+    std::vector<double> values;
+    int c;
+    int optionIndex = 0;
+    while ((c = getopt_long(argc, argv, optstring, longOptions, &optionIndex)) != -1)
+    {
+        switch (c)
+        {
+            case 'o':
+                output = optarg;
+                break;
+            case 'h':
+                usage(hugin_utils::stripPath(argv[0]).c_str());
+                return 0;
+            case PROJECTION:
+                if (!ParseDoubleList(optarg, values) || values.size() != 2)
+                {
+                    std::cerr << "Invalid projections: " << optarg << std::endl;
+                    return 1;
+                };
+                settings.srcProjection = hugin_utils::roundi(values[0]);
+                settings.destProjection = hugin_utils::roundi(values[1]);
+                break;
+            case HFOV:
+                settings.hfov = atof(optarg);
+                break;
+            case DISTORTION:
+                if (!ParseDoubleList(optarg, values) || values.size() != 3)
+                {
+                    std::cerr << "Invalid distortion parameters: " << optarg << std::endl;
+                    return 1;
+                };
+                settings.distortion = values;
+                break;
+            case SIZE:
+                {
+                    int width, height;
+                    if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 1 || height < 1)
+                    {
+                        std::cerr << "Invalid image size: " << optarg << std::endl;
+                        return 1;
+                    };
+                    settings.size = vigra::Size2D(width, height);
+                };
+                break;
+            case PIXELTYPE:
+                settings.pixelType = hugin_utils::toupper(optarg);
+                break;
+            case INTERPOLATOR:
+                {
+                    const std::string name = hugin_utils::tolower(optarg);
+                    settings.interpolatorName = name;
+                    if (name == "nearest")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_NEAREST_NEIGHBOUR;
+                    }
+                    else if (name == "bilinear")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_BILINEAR;
+                    }
+                    else if (name == "cubic")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_CUBIC;
+                    }
+                    else if (name == "spline16")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_SPLINE_16;
+                    }
+                    else if (name == "spline36")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_SPLINE_36;
+                    }
+                    else if (name == "spline64")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_SPLINE_64;
+                    }
+                    else if (name == "sinc256")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_SINC_256;
+                    }
+                    else if (name == "sinc1024")
+                    {
+                        settings.interpolator = vigra_ext::INTERP_SINC_1024;
+                    }
+                    else
+                    {
+                        std::cerr << "Unknown interpolator: " << optarg << std::endl;
+                        return 1;
+                    };
+                };
+                break;
+            case CROP:
+                settings.crop = true;
+                break;
+            case MASK:
+                settings.mask = true;
+                break;
+            case THREADS:
+                if (!ParseDoubleList(optarg, values) || values.empty())
+                {
+                    std::cerr << "Invalid thread counts: " << optarg << std::endl;
+                    return 1;
+                };
+                settings.threads.clear();
+                for (size_t i = 0; i < values.size(); ++i)
+                {
+                    settings.threads.push_back(std::max(1, hugin_utils::roundi(values[i])));
+                };
+                break;
+            case TILESIZE:
+                settings.tileSize = atoi(optarg);
+                break;
+            case COMPRESSION:
+                settings.compression = hugin_utils::toupper(optarg);
+                break;
+            case REPEAT:
+                settings.repeat = atoi(optarg);
+                break;
+            case '?':
+                break;
+            default:
+                abort();
+        }
+    }
+    if (settings.hfov <= 0 || settings.repeat < 1)
+    {
+        std::cerr << "Invalid parameter" << std::endl;
+        usage(hugin_utils::stripPath(argv[0]).c_str());
+        return 1;
+    };
+    if (settings.tileSize >= 0)
+    {
+        vigra_ext::SetRemapTileSize(settings.tileSize);
+    };
+    vigra::Rect2D roi;
+    std::vector<StageResult> results;
+    try
+    {
+        if (settings.pixelType == "UINT8")
+        {
+            RunRemapBenchmark<vigra::BRGBImage>(settings, roi, results);
+        }
+        else if (settings.pixelType == "UINT16")
+        {
+            RunRemapBenchmark<vigra::UInt16RGBImage>(settings, roi, results);
+        }
+        else if (settings.pixelType == "FLOAT")
+        {
+            RunRemapBenchmark<vigra::FRGBImage>(settings, roi, results);
+        }
+        else
+        {
+            std::cerr << "Unsupported pixel type: " << settings.pixelType << std::endl;
+            return 1;
+        };
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << "caught exception: " << e.what() << std::endl;
+        return 1;
+    };
+    if (results.empty())
+    {
+        return 1;
+    };
+    if (output.empty())
+    {
+        WriteJSON(std::cout, settings, roi, results);
+    }
+    else
+    {
+        std::ofstream of(output.c_str());
+        if (!of.good())
+        {
+            std::cerr << "Could not write to " << output << std::endl;
+            return 1;
+        };
+        WriteJSON(of, settings, roi, results);
+    };
+    return 0;
+}
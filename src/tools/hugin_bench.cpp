@@ -0,0 +1,752 @@
+// -*- c-basic-offset: 4 -*-
+
+/** @file hugin_bench.cpp
+ *
+ *  @brief benchmark for the geometric and photometric optimizers
+ *
+ *  Creates synthetic panoramas with known orientation and lens parameters,
+ *  runs the optimizers and control point cleaning on them and reports
+ *  timing and accuracy as JSON. No image files are needed.
+ *
+ */
+
+/*  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <set>
+#include <getopt.h>
+
+#include <panodata/Panorama.h>
+#include <panodata/StandardImageVariableGroups.h>
+#include <panodata/OptimizerSwitches.h>
+#include <panotools/PanoToolsInterface.h>
+#include <panotools/PanoToolsOptimizerWrapper.h>
+#include <algorithms/optimizer/PTOptimizer.h>
+#include <algorithms/optimizer/PhotometricOptimizer.h>
+#include <algorithms/basic/CalculateCPStatistics.h>
+#include <algorithms/control_points/CleanCP.h>
+#include <vigra_ext/utils.h>
+
+static void usage(const char* name)
+{
+    std::cout << name << ": benchmark optimizers on synthetic panoramas" << std::endl
+        << name << " version " << hugin_utils::GetHuginVersion() << std::endl
+        << std::endl
+        << "Usage:  " << name << " [options]" << std::endl
+        << std::endl
+        << "Creates a grid of images with known orientation and lens parameters" << std::endl
+        << "and control points between overlapping images, disturbs the parameters" << std::endl
+        << "and measures the optimizers. The results are written as JSON." << std::endl
+        << std::endl
+        << "  Options:" << std::endl
+        << "     --rows=INT          Number of image rows (default: 3)" << std::endl
+        << "     --cols=INT          Number of images per row (default: 8)" << std::endl
+        << "     --cps=INT           Control points per overlapping image pair (default: 25)" << std::endl
+        << "     --noise=FLOAT       Standard deviation of control point noise in pixel" << std::endl
+        << "                         (default: 0.5)" << std::endl
+        << "     --outliers=FLOAT    Ratio of wrong control points (default: 0.1)" << std::endl
+        << "     --points=INT        Number of point pairs for photometric optimizer" << std::endl
+        << "                         (default: 2000)" << std::endl
+        << "     --seed=INT          Seed for the random number generator (default: 42)" << std::endl
+        << "     --repeat=INT        Number of runs of each benchmark (default: 3)" << std::endl
+        << "     --benchmark=NAME    Run only given benchmark, can be repeated. Valid names" << std::endl
+        << "                         are optimize, smartoptimise, autooptimise," << std::endl
+        << "                         photometric, cpclean_pair and cpclean" << std::endl
+        << "     -o, --output=FILE   Write JSON to file instead of stdout" << std::endl
+        << "     -h, --help          Shows this help" << std::endl
+        << std::endl;
+}
+
+// counts the iterations reported by the panotools optimizer
+static int ptIterations = 0;
+
+static int ptProgress(int command, char* argument)
+{
+    return 1;
+}
+
+static int ptinfoDlg(int command, char* argument)
+{
+    if (argument != NULL && strstr(argument, "iteration") != NULL)
+    {
+        ++ptIterations;
+    };
+    return 1;
+}
+
+/** progress display which counts the iterations reported by the photometric optimizer */
+class IterationCounter : public AppBase::ProgressDisplay
+{
+public:
+    IterationCounter() : ProgressDisplay(), m_iterations(0) {};
+    int getIterations() const { return m_iterations; };
+protected:
+    virtual void updateProgressDisplay()
+    {
+        if (m_message.compare(0, 10, "Iteration:") == 0)
+        {
+            ++m_iterations;
+        };
+    };
+private:
+    int m_iterations;
+};
+
+/** settings of the synthetic panorama */
+struct BenchSettings
+{
+    BenchSettings() : rows(3), cols(8), cpsPerPair(25), noise(0.5), outliers(0.1),
+        nrPoints(2000), seed(42), repeat(3) {};
+    int rows;
+    int cols;
+    int cpsPerPair;
+    double noise;
+    double outliers;
+    int nrPoints;
+    unsigned int seed;
+    int repeat;
+};
+
+/** a synthetic panorama with its ground truth */
+struct SyntheticPano
+{
+    HuginBase::Panorama truth;
+    HuginBase::Panorama start;
+    /** true for all control points, which were created as outliers */
+    std::vector<bool> isOutlier;
+    /** overlapping image pairs */
+    std::vector<std::pair<unsigned int, unsigned int> > pairs;
+};
+
+/** result of one benchmark */
+struct BenchResult
+{
+    BenchResult() : bestTime(0), meanTime(0), iterations(0), cpErrorMean(0), cpErrorMax(0),
+        orientationError(-1), hfovError(-1), photometricError(-1), exposureError(-1),
+        removedCPs(-1), removedOutliers(-1) {};
+    std::string name;
+    double bestTime;
+    double meanTime;
+    int iterations;
+    double cpErrorMean;
+    double cpErrorMax;
+    double orientationError;
+    double hfovError;
+    double photometricError;
+    double exposureError;
+    int removedCPs;
+    int removedOutliers;
+};
+
+/** creates a grid of images with control points between all overlapping images */
+static void CreateSyntheticPano(const BenchSettings& settings, std::mt19937& rng, SyntheticPano& synth)
+{
+    const vigra::Size2D imgSize(3000, 2000);
+    const double hfov = 50.0;
+    const double vfov = hfov * imgSize.y / imgSize.x;
+    // 30 % overlap between neighbouring images
+    const double yawStep = hfov * 0.7;
+    const double pitchStep = vfov * 0.7;
+    std::normal_distribution<double> rollDistrib(0.0, 1.0);
+    std::uniform_real_distribution<double> evDistrib(-1.0, 1.0);
+
+    HuginBase::Panorama& pano = synth.truth;
+    for (int row = 0; row < settings.rows; ++row)
+    {
+        for (int col = 0; col < settings.cols; ++col)
+        {
+            HuginBase::SrcPanoImage img;
+            std::ostringstream filename;
+            filename << "synthetic_" << std::setfill('0') << std::setw(4) << pano.getNrOfImages() << ".tif";
+            img.setFilename(filename.str());
+            img.setSize(imgSize);
+            img.setProjection(HuginBase::SrcPanoImage::RECTILINEAR);
+            img.setHFOV(hfov);
+            std::vector<double> dist(4, 0.0);
+            dist[1] = -0.01;
+            dist[3] = 1.01;
+            img.setRadialDistortion(dist);
+            std::vector<double> vig(4, 0.0);
+            vig[0] = 1.0;
+            vig[1] = -0.3;
+            vig[2] = 0.1;
+            img.setRadialVigCorrCoeff(vig);
+            double yaw = col * yawStep;
+            if (yaw > 180.0)
+            {
+                yaw -= 360.0;
+            };
+            img.setYaw(yaw);
+            img.setPitch((row - (settings.rows - 1) / 2.0) * pitchStep);
+            img.setRoll(rollDistrib(rng));
+            img.setExposureValue(pano.getNrOfImages() == 0 ? 0.0 : evDistrib(rng));
+            pano.addImage(img);
+        };
+    };
+    // all images are taken with the same lens
+    HuginBase::StandardImageVariableGroups variable_groups(pano);
+    HuginBase::ImageVariableGroup& lenses = variable_groups.getLenses();
+    for (size_t i = 1; i < pano.getNrOfImages(); ++i)
+    {
+        HuginBase::SrcPanoImage img = pano.getSrcImage(i);
+        lenses.switchParts(i, lenses.getPartNumber(0));
+        lenses.unlinkVariableImage(HuginBase::ImageVariableGroup::IVE_ExposureValue, i);
+        lenses.unlinkVariableImage(HuginBase::ImageVariableGroup::IVE_WhiteBalanceRed, i);
+        lenses.unlinkVariableImage(HuginBase::ImageVariableGroup::IVE_WhiteBalanceBlue, i);
+        pano.setSrcImage(i, img);
+    };
+
+    HuginBase::PanoramaOptions opts = pano.getOptions();
+    opts.setProjection(HuginBase::PanoramaOptions::EQUIRECTANGULAR);
+    opts.setHFOV(360.0);
+    opts.setWidth(3600);
+    opts.setHeight(1800);
+    pano.setOptions(opts);
+    pano.setOptimizerSwitch(HuginBase::OPT_POSITION);
+
+    // now create the control points
+    const unsigned int nrImg = pano.getNrOfImages();
+    std::vector<HuginBase::PTools::Transform*> toPano(nrImg);
+    std::vector<HuginBase::PTools::Transform*> toImg(nrImg);
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        toPano[i] = new HuginBase::PTools::Transform;
+        toPano[i]->createInvTransform(pano.getImage(i), opts);
+        toImg[i] = new HuginBase::PTools::Transform;
+        toImg[i]->createTransform(pano.getImage(i), opts);
+    };
+    std::uniform_real_distribution<double> xDistrib(0, imgSize.x - 1);
+    std::uniform_real_distribution<double> yDistrib(0, imgSize.y - 1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, settings.noise);
+    HuginBase::CPVector cps;
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        for (unsigned int j = i + 1; j < nrImg; ++j)
+        {
+            HuginBase::CPVector pairCps;
+            std::vector<bool> pairOutliers;
+            for (int tries = 0; tries < 20 * settings.cpsPerPair && pairCps.size() < static_cast<size_t>(settings.cpsPerPair); ++tries)
+            {
+                const double x1 = xDistrib(rng);
+                const double y1 = yDistrib(rng);
+                double xp, yp, x2, y2;
+                if (!toPano[i]->transformImgCoord(xp, yp, x1, y1) || !toImg[j]->transformImgCoord(x2, y2, xp, yp))
+                {
+                    continue;
+                };
+                if (!pano.getImage(j).isInside(vigra::Point2D(hugin_utils::roundi(x2), hugin_utils::roundi(y2))))
+                {
+                    continue;
+                };
+                const bool outlier = uniform(rng) < settings.outliers;
+                if (outlier)
+                {
+                    x2 = xDistrib(rng);
+                    y2 = yDistrib(rng);
+                }
+                else
+                {
+                    x2 += noise(rng);
+                    y2 += noise(rng);
+                };
+                pairCps.push_back(HuginBase::ControlPoint(i, x1, y1, j, x2, y2));
+                pairOutliers.push_back(outlier);
+            };
+            // ignore pairs with only a small overlap
+            if (pairCps.size() >= 3)
+            {
+                cps.insert(cps.end(), pairCps.begin(), pairCps.end());
+                synth.isOutlier.insert(synth.isOutlier.end(), pairOutliers.begin(), pairOutliers.end());
+                synth.pairs.push_back(std::make_pair(i, j));
+            };
+        };
+    };
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        delete toPano[i];
+        delete toImg[i];
+    };
+    pano.setCtrlPoints(cps);
+
+    // disturb the parameters for the start values, image 0 is the anchor
+    synth.start = pano.duplicate();
+    std::normal_distribution<double> angleNoise(0.0, 2.0);
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        HuginBase::SrcPanoImage img = synth.start.getSrcImage(i);
+        if (i > 0)
+        {
+            img.setYaw(img.getYaw() + angleNoise(rng));
+            img.setPitch(img.getPitch() + angleNoise(rng));
+            img.setRoll(img.getRoll() + angleNoise(rng));
+        };
+        img.setExposureValue(0.0);
+        synth.start.setSrcImage(i, img);
+    };
+    // lens parameters are linked, so setting them for image 0 is sufficient
+    HuginBase::SrcPanoImage img = synth.start.getSrcImage(0);
+    img.setHFOV(hfov * 1.05);
+    std::vector<double> dist(4, 0.0);
+    dist[3] = 1.0;
+    img.setRadialDistortion(dist);
+    std::vector<double> vig(4, 0.0);
+    vig[0] = 1.0;
+    img.setRadialVigCorrCoeff(vig);
+    synth.start.setSrcImage(0, img);
+}
+
+/** creates point pairs for the photometric optimizer from the ground truth */
+static void CreatePhotometricPoints(const BenchSettings& settings, std::mt19937& rng, const SyntheticPano& synth,
+    std::vector<vigra_ext::PointPairRGB>& points)
+{
+    const HuginBase::Panorama& pano = synth.truth;
+    const HuginBase::PanoramaOptions& opts = pano.getOptions();
+    const unsigned int nrImg = pano.getNrOfImages();
+    std::vector<HuginBase::PTools::Transform*> toPano(nrImg);
+    std::vector<HuginBase::PTools::Transform*> toImg(nrImg);
+    std::vector<HuginBase::PhotometricOptimizer::RespFunc*> resp(nrImg);
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        toPano[i] = new HuginBase::PTools::Transform;
+        toPano[i]->createInvTransform(pano.getImage(i), opts);
+        toImg[i] = new HuginBase::PTools::Transform;
+        toImg[i]->createTransform(pano.getImage(i), opts);
+        resp[i] = new HuginBase::PhotometricOptimizer::RespFunc(pano.getImage(i));
+    };
+    const vigra::Size2D imgSize = pano.getImage(0).getSize();
+    const double maxr = sqrt(((double)imgSize.x)*imgSize.x + ((double)imgSize.y)*imgSize.y) / 2.0;
+    std::uniform_int_distribution<size_t> pairDistrib(0, synth.pairs.size() - 1);
+    std::uniform_real_distribution<double> xDistrib(0, imgSize.x - 1);
+    std::uniform_real_distribution<double> yDistrib(0, imgSize.y - 1);
+    std::uniform_real_distribution<double> radianceDistrib(0.05, 0.6);
+    std::normal_distribution<double> noise(0.0, 1.0 / 255.0);
+    for (int tries = 0; tries < 20 * settings.nrPoints && points.size() < static_cast<size_t>(settings.nrPoints); ++tries)
+    {
+        const std::pair<unsigned int, unsigned int>& imgPair = synth.pairs[pairDistrib(rng)];
+        const unsigned int i = imgPair.first;
+        const unsigned int j = imgPair.second;
+        hugin_utils::FDiff2D p1(xDistrib(rng), yDistrib(rng));
+        hugin_utils::FDiff2D p2;
+        double xp, yp;
+        if (!toPano[i]->transformImgCoord(xp, yp, p1.x, p1.y) || !toImg[j]->transformImgCoord(p2.x, p2.y, xp, yp))
+        {
+            continue;
+        };
+        if (!pano.getImage(j).isInside(vigra::Point2D(p2.toDiff2D())))
+        {
+            continue;
+        };
+        const vigra::RGBValue<double> radiance(radianceDistrib(rng), radianceDistrib(rng), radianceDistrib(rng));
+        vigra::RGBValue<double> v1 = (*resp[i])(radiance, p1);
+        vigra::RGBValue<double> v2 = (*resp[j])(radiance, p2);
+        for (size_t c = 0; c < 3; ++c)
+        {
+            v1[c] += noise(rng);
+            v2[c] += noise(rng);
+        };
+        // ignore under- and over-exposed pixels like the point sampler
+        const double max1 = vigra_ext::getMaxComponent(v1);
+        const double max2 = vigra_ext::getMaxComponent(v2);
+        if (max1 > 250 / 255.0 || max2 > 250 / 255.0 || max1 < 1 / 255.0 || max2 < 1 / 255.0)
+        {
+            continue;
+        };
+        const double r1 = hugin_utils::norm((p1 - pano.getImage(i).getRadialVigCorrCenter()) / maxr);
+        const double r2 = hugin_utils::norm((p2 - pano.getImage(j).getRadialVigCorrCenter()) / maxr);
+        points.push_back(vigra_ext::PointPairRGB(i, vigra::RGBValue<float>(v1), p1, r1, j, vigra::RGBValue<float>(v2), p2, r2));
+    };
+    for (unsigned int i = 0; i < nrImg; ++i)
+    {
+        delete toPano[i];
+        delete toImg[i];
+        delete resp[i];
+    };
+}
+
+/** returns the direction of the optical axis for the given image */
+static void GetImageDirection(const HuginBase::SrcPanoImage& img, double* dir)
+{
+    const double yaw = DEG_TO_RAD(img.getYaw());
+    const double pitch = DEG_TO_RAD(img.getPitch());
+    dir[0] = cos(pitch) * sin(yaw);
+    dir[1] = sin(pitch);
+    dir[2] = cos(pitch) * cos(yaw);
+}
+
+/** calculates the error of the geometric parameters against the ground truth */
+static void CalcGeometricError(const HuginBase::Panorama& truth, const HuginBase::Panorama& pano, BenchResult& result)
+{
+    double sumSqr = 0;
+    for (unsigned int i = 0; i < truth.getNrOfImages(); ++i)
+    {
+        double d1[3], d2[3];
+        GetImageDirection(truth.getImage(i), d1);
+        GetImageDirection(pano.getImage(i), d2);
+        const double dot = std::max(-1.0, std::min(1.0, d1[0] * d2[0] + d1[1] * d2[1] + d1[2] * d2[2]));
+        sumSqr += hugin_utils::sqr(RAD_TO_DEG(acos(dot)));
+    };
+    result.orientationError = sqrt(sumSqr / truth.getNrOfImages());
+    result.hfovError = fabs(truth.getImage(0).getHFOV() - pano.getImage(0).getHFOV());
+    double var;
+    double min;
+    HuginBase::CalculateCPStatisticsError::calcCtrlPntsErrorStats(pano, min, result.cpErrorMax, result.cpErrorMean, var);
+}
+
+/** calculates the error of the photometric parameters against the ground truth */
+static void CalcExposureError(const HuginBase::Panorama& truth, const HuginBase::Panorama& pano, BenchResult& result)
+{
+    double sumSqr = 0;
+    for (unsigned int i = 0; i < truth.getNrOfImages(); ++i)
+    {
+        sumSqr += hugin_utils::sqr(truth.getImage(i).getExposureValue() - pano.getImage(i).getExposureValue());
+    };
+    result.exposureError = sqrt(sumSqr / truth.getNrOfImages());
+}
+
+/** counts how many of the removed control points were outliers */
+static void CountRemovedOutliers(const SyntheticPano& synth, const HuginBase::UIntSet& removed, BenchResult& result)
+{
+    result.removedCPs = removed.size();
+    result.removedOutliers = 0;
+    for (HuginBase::UIntSet::const_iterator it = removed.begin(); it != removed.end(); ++it)
+    {
+        if (synth.isOutlier[*it])
+        {
+            ++result.removedOutliers;
+        };
+    };
+}
+
+/** returns the optimizer variables for optimising the position of all images except the anchor */
+static HuginBase::OptimizeVector GetPositionOptVector(const HuginBase::Panorama& pano)
+{
+    HuginBase::OptimizeVector optvec(pano.getNrOfImages());
+    for (size_t i = 1; i < optvec.size(); ++i)
+    {
+        optvec[i].insert("y");
+        optvec[i].insert("p");
+        optvec[i].insert("r");
+    };
+    return optvec;
+}
+
+/** runs the given benchmark settings.repeat times and records the timing */
+template <class Func>
+static BenchResult RunBenchmark(const std::string& name, const BenchSettings& settings, const SyntheticPano& synth, Func func)
+{
+    BenchResult result;
+    result.name = name;
+    double sumTime = 0;
+    for (int run = 0; run < settings.repeat; ++run)
+    {
+        HuginBase::Panorama pano = synth.start.duplicate();
+        BenchResult runResult;
+        ptIterations = 0;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        func(pano, runResult);
+        const double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        sumTime += time;
+        if (run == 0 || time < result.bestTime)
+        {
+            result.bestTime = time;
+        };
+        if (run == settings.repeat - 1)
+        {
+            // keep the accuracy of the last run
+            const double bestTime = result.bestTime;
+            result = runResult;
+            result.name = name;
+            result.bestTime = bestTime;
+            if (result.iterations == 0)
+            {
+                result.iterations = ptIterations;
+            };
+        };
+    };
+    result.meanTime = sumTime / settings.repeat;
+    return result;
+}
+
+/** writes a value to json, negative values mark not available values */
+static void WriteJSONValue(std::ostream& out, const char* key, double value, bool last = false)
+{
+    out << "      \"" << key << "\": ";
+    if (value < 0)
+    {
+        out << "null";
+    }
+    else
+    {
+        out << value;
+    };
+    out << (last ? "" : ",") << std::endl;
+}
+
+static void WriteJSON(std::ostream& out, const BenchSettings& settings, const SyntheticPano& synth, const std::vector<BenchResult>& results)
+{
+    out << std::setprecision(6);
+    out << "{" << std::endl
+        << "  \"version\": \"" << hugin_utils::GetHuginVersion() << "\"," << std::endl
+        << "  \"settings\": {" << std::endl
+        << "    \"images\": " << synth.truth.getNrOfImages() << "," << std::endl
+        << "    \"rows\": " << settings.rows << "," << std::endl
+        << "    \"cols\": " << settings.cols << "," << std::endl
+        << "    \"control_points\": " << synth.truth.getNrOfCtrlPoints() << "," << std::endl
+        << "    \"noise\": " << settings.noise << "," << std::endl
+        << "    \"outliers\": " << settings.outliers << "," << std::endl
+        << "    \"seed\": " << settings.seed << "," << std::endl
+        << "    \"repeat\": " << settings.repeat << std::endl
+        << "  }," << std::endl
+        << "  \"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult& r = results[i];
+        out << "    {" << std::endl
+            << "      \"name\": \"" << r.name << "\"," << std::endl;
+        WriteJSONValue(out, "wall_time_ms", r.bestTime);
+        WriteJSONValue(out, "wall_time_ms_mean", r.meanTime);
+        WriteJSONValue(out, "iterations", r.iterations);
+        WriteJSONValue(out, "cp_error_mean", r.cpErrorMean);
+        WriteJSONValue(out, "cp_error_max", r.cpErrorMax);
+        WriteJSONValue(out, "orientation_error_rms_deg", r.orientationError);
+        WriteJSONValue(out, "hfov_error_deg", r.hfovError);
+        WriteJSONValue(out, "photometric_error", r.photometricError);
+        WriteJSONValue(out, "exposure_error_rms_ev", r.exposureError);
+        WriteJSONValue(out, "removed_cps", r.removedCPs);
+        WriteJSONValue(out, "removed_outliers", r.removedOutliers, true);
+        out << "    }" << (i + 1 < results.size() ? "," : "") << std::endl;
+    };
+    out << "  ]" << std::endl
+        << "}" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    // parse arguments
+    const char* optstring = "o:h";
+    enum
+    {
+        ROWS = 1000,
+        COLS,
+        CPS,
+        NOISE,
+        OUTLIERS,
+        POINTS,
+        SEED,
+        REPEAT,
+        BENCHMARK
+    };
+    static struct option longOptions[] =
+    {
+        { "output", required_argument, NULL, 'o' },
+        { "rows", required_argument, NULL, ROWS },
+        { "cols", required_argument, NULL, COLS },
+        { "cps", required_argument, NULL, CPS },
+        { "noise", required_argument, NULL, NOISE },
+        { "outliers", required_argument, NULL, OUTLIERS },
+        { "points", required_argument, NULL, POINTS },
+        { "seed", required_argument, NULL, SEED },
+        { "repeat", required_argument, NULL, REPEAT },
+        { "benchmark", required_argument, NULL, BENCHMARK },
+        { "help", no_argument, NULL, 'h' },
+        0
+    };
+    BenchSettings settings;
+    std::set<std::string> benchmarks;
+    std::string output;
+    int c;
+    int optionIndex = 0;
+    while ((c = getopt_long(argc, argv, optstring, longOptions, &optionIndex)) != -1)
+    {
+        switch (c)
+        {
+            case 'o':
+                output = optarg;
+                break;
+            case 'h':
+                usage(hugin_utils::stripPath(argv[0]).c_str());
+                return 0;
+            case ROWS:
+                settings.rows = atoi(optarg);
+                break;
+            case COLS:
+                settings.cols = atoi(optarg);
+                break;
+            case CPS:
+                settings.cpsPerPair = atoi(optarg);
+                break;
+            case NOISE:
+                settings.noise = atof(optarg);
+                break;
+            case OUTLIERS:
+                settings.outliers = atof(optarg);
+                break;
+            case POINTS:
+                settings.nrPoints = atoi(optarg);
+                break;
+            case SEED:
+                settings.seed = atoi(optarg);
+                break;
+            case REPEAT:
+                settings.repeat = atoi(optarg);
+                break;
+            case BENCHMARK:
+                {
+                    const std::string name(optarg);
+                    if (name != "optimize" && name != "smartoptimise" && name != "autooptimise" &&
+                        name != "photometric" && name != "cpclean_pair" && name != "cpclean")
+                    {
+                        std::cerr << hugin_utils::stripPath(argv[0]) << ": Unknown benchmark \"" << name << "\"" << std::endl;
+                        return 1;
+                    };
+                    benchmarks.insert(name);
+                };
+                break;
+            case '?':
+                break;
+            default:
+                abort();
+        }
+    }
+
+    if (settings.rows < 1 || settings.cols < 1 || settings.rows * settings.cols < 2)
+    {
+        std::cerr << "Synthetic panorama should consist of at least two images" << std::endl;
+        return 1;
+    };
+    if (settings.cpsPerPair < 3 || settings.noise < 0 || settings.outliers < 0 || settings.outliers >= 1 ||
+        settings.nrPoints < 1 || settings.repeat < 1)
+    {
+        std::cerr << "Invalid parameter" << std::endl;
+        usage(hugin_utils::stripPath(argv[0]).c_str());
+        return 1;
+    };
+
+    PT_setProgressFcn(ptProgress);
+    PT_setInfoDlgFcn(ptinfoDlg);
+
+    std::mt19937 rng(settings.seed);
+    SyntheticPano synth;
+    CreateSyntheticPano(settings, rng, synth);
+    if (synth.pairs.empty())
+    {
+        std::cerr << "Synthetic panorama contains no overlapping images" << std::endl;
+        return 1;
+    };
+    std::vector<vigra_ext::PointPairRGB> points;
+    CreatePhotometricPoints(settings, rng, synth, points);
+
+    std::vector<BenchResult> results;
+    if (benchmarks.empty() || benchmarks.count("optimize"))
+    {
+        results.push_back(RunBenchmark("optimize", settings, synth,
+            [&synth](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                pano.setOptimizeVector(GetPositionOptVector(pano));
+                HuginBase::PTools::optimize(pano);
+                CalcGeometricError(synth.truth, pano, result);
+            }));
+    };
+    if (benchmarks.empty() || benchmarks.count("smartoptimise"))
+    {
+        results.push_back(RunBenchmark("smartoptimise", settings, synth,
+            [&synth](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                HuginBase::SmartOptimise::smartOptimize(pano);
+                CalcGeometricError(synth.truth, pano, result);
+            }));
+    };
+    if (benchmarks.empty() || benchmarks.count("autooptimise"))
+    {
+        results.push_back(RunBenchmark("autooptimise", settings, synth,
+            [&synth](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                HuginBase::AutoOptimise::autoOptimise(pano);
+                CalcGeometricError(synth.truth, pano, result);
+            }));
+    };
+    if ((benchmarks.empty() || benchmarks.count("photometric")) && !points.empty())
+    {
+        results.push_back(RunBenchmark("photometric", settings, synth,
+            [&synth, &points](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                // photometric optimizer works on the correct geometry
+                for (unsigned int i = 0; i < pano.getNrOfImages(); ++i)
+                {
+                    HuginBase::SrcPanoImage img = synth.truth.getSrcImage(i);
+                    img.setExposureValue(0.0);
+                    std::vector<double> vig(4, 0.0);
+                    vig[0] = 1.0;
+                    img.setRadialVigCorrCoeff(vig);
+                    pano.setSrcImage(i, img);
+                };
+                HuginBase::OptimizeVector optvec(pano.getNrOfImages());
+                optvec[0].insert("Vb");
+                optvec[0].insert("Vc");
+                optvec[0].insert("Vd");
+                for (size_t i = 1; i < optvec.size(); ++i)
+                {
+                    optvec[i].insert("Eev");
+                };
+                IterationCounter progress;
+                double error = 0;
+                HuginBase::PhotometricOptimizer::optimizePhotometric(pano, optvec, points, &progress, error);
+                result.photometricError = error;
+                result.iterations = progress.getIterations();
+                CalcExposureError(synth.truth, pano, result);
+            }));
+    };
+    if (benchmarks.empty() || benchmarks.count("cpclean_pair"))
+    {
+        results.push_back(RunBenchmark("cpclean_pair", settings, synth,
+            [&synth](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                AppBase::DummyProgressDisplay dummy;
+                CountRemovedOutliers(synth, HuginBase::getCPoutsideLimit_pair(pano, dummy, 2.0), result);
+            }));
+    };
+    if (benchmarks.empty() || benchmarks.count("cpclean"))
+    {
+        results.push_back(RunBenchmark("cpclean", settings, synth,
+            [&synth](HuginBase::Panorama& pano, BenchResult& result)
+            {
+                CountRemovedOutliers(synth, HuginBase::getCPoutsideLimit(pano, 2.0), result);
+            }));
+    };
+
+    if (output.empty())
+    {
+        WriteJSON(std::cout, settings, synth, results);
+    }
+    else
+    {
+        std::ofstream of(output.c_str());
+        if (!of.good())
+        {
+            std::cerr << "Could not write to " << output << std::endl;
+            return 1;
+        };
+        WriteJSON(of, settings, synth, results);
+    };
+    return 0;
+}
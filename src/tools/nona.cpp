@@ -42,6 +42,7 @@
 #include "hugin_base/algorithms/basic/LayerStacks.h"
 #include <hugin_utils/platform.h>
 #include <algorithms/nona/NonaFileStitcher.h>
+#include <vigra_ext/ImageTransforms.h>
 #include <vigra_ext/ImageTransformsGPU.h>
 #include "hugin_utils/stl_utils.h"
 #include "nona/StitcherOptions.h"
@@ -108,6 +109,16 @@ static void usage(const char* name)
          << "                   lower and upper cutoff (specify in range 0...1," << std::endl
          << "                   relative the full range)" << std::endl
          << "      --seam=hard|blend   select the blend mode for the seam" << std::endl
+         << "      --tile-size=num  size of the tiles used for remapping (default 64)" << std::endl
+         << "                   0 remaps the images row by row" << std::endl
+         << "      --band-height=num  remap the images in bands of num rows, only" << std::endl
+         << "                   the source rows needed for the current band are" << std::endl
+         << "                   loaded (default 0, load the whole images)" << std::endl
+         << "                   This does not save memory for rotated images" << std::endl
+         << "                   (e.g. portrait images with roll 90), where each" << std::endl
+         << "                   band needs all rows of the source image." << std::endl
+         << "      --tiled-tiff  write tiled tiff files, the tiles are compressed" << std::endl
+         << "                   in parallel (multilayer tiff files are always tiled)" << std::endl
          << std::endl;
 }
 
@@ -142,7 +153,10 @@ int main(int argc, char* argv[])
         INTERMEDIATESUFFIX,
         EXPOSURELAYERS,
         MASKCLIPEXPOSURE,
-        SEAMMODE
+        SEAMMODE,
+        TILESIZE,
+        BANDHEIGHT,
+        TILEDTIFF
     };
     static struct option longOptions[] =
     {
@@ -153,6 +167,9 @@ int main(int argc, char* argv[])
         { "create-exposure-layers", no_argument, NULL, EXPOSURELAYERS },
         { "clip-exposure", optional_argument, NULL, MASKCLIPEXPOSURE },
         { "seam", required_argument, NULL, SEAMMODE},
+        { "tile-size", required_argument, NULL, TILESIZE },
+        { "band-height", required_argument, NULL, BANDHEIGHT },
+        { "tiled-tiff", no_argument, NULL, TILEDTIFF },
         0
     };
     
@@ -282,6 +299,39 @@ int main(int argc, char* argv[])
                     };
                 };
                 break;
+            case TILESIZE:
+                {
+                    int tileSize;
+                    if (hugin_utils::stringToInt(std::string(optarg), tileSize) && tileSize >= 0)
+                    {
+                        vigra_ext::SetRemapTileSize(tileSize);
+                    }
+                    else
+                    {
+                        std::cerr << "nona: Argument \"" << optarg << "\" is not a valid tile size." << std::endl
+                            << "      Aborting." << std::endl;
+                        return 1;
+                    };
+                };
+                break;
+            case BANDHEIGHT:
+                {
+                    int bandHeight;
+                    if (hugin_utils::stringToInt(std::string(optarg), bandHeight) && bandHeight >= 0)
+                    {
+                        HuginBase::Nona::SetAdvancedOption(advOptions, "remapBandHeight", static_cast<float>(bandHeight));
+                    }
+                    else
+                    {
+                        std::cerr << "nona: Argument \"" << optarg << "\" is not a valid band height." << std::endl
+                            << "      Aborting." << std::endl;
+                        return 1;
+                    };
+                };
+                break;
+            case TILEDTIFF:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "tiledTiff", true);
+                break;
             case '?':
             case 'h':
                 usage(hugin_utils::stripPath(argv[0]).c_str());
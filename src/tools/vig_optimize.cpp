@@ -53,6 +53,7 @@ static void usage(const char* name)
          << "  -v        Verbose, print progress messages" << std::endl
          << "  -p n      Number of points to extract" << std::endl
          << "  -s level  Work on downscaled images, every step halves width and height" << std::endl
+         << "  -d n      Seed for the random point sampling, same seed gives same points" << std::endl
          << "  -h        Display help (this text)" << std::endl
          << std::endl
          << " Expert and debugging options:" << std::endl
@@ -153,7 +154,7 @@ int main(int argc, char* argv[])
     AppBase::StreamProgressDisplay progressDisplay(std::cout);
 
     // parse arguments
-    const char* optstring = "hi:o:p:s:vw:";
+    const char* optstring = "d:hi:o:p:s:vw:";
     int c;
 
     opterr = 0;
@@ -161,12 +162,16 @@ int main(int argc, char* argv[])
     int pyrLevel=3;
     int verbose = 0;
     int nPoints = 200;
+    unsigned int seed = 0;
     std::string outputFile;
     std::string outputPointsFile;
     std::string inputPointsFile;
     while ((c = getopt (argc, argv, optstring)) != -1)
         switch (c)
         {
+            case 'd':
+                seed = atoi(optarg);
+                break;
             case 'i':
                 inputPointsFile = optarg;
                 break;
@@ -250,7 +255,7 @@ int main(int argc, char* argv[])
         }
         else
         {
-            loadImgsAndExtractPoints(pano, nPoints, pyrLevel, true, progressDisplay, points, verbose);
+            loadImgsAndExtractPoints(pano, nPoints, pyrLevel, true, progressDisplay, points, verbose, seed);
         }
         if (verbose)
         {